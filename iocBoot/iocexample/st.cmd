@@ -25,7 +25,8 @@ cd ${TOP}/iocBoot/${IOC}
 ## and a different username + password for remote host if that is required 
 ##
 ## the "options" argument is a combination of the following flags (as per the #lvDCOMOptions enum in lvDCOMInterface.h)
-##    viWarnIfIdle=1, viStartIfIdle=2, viStopOnExitIfStarted=4, viAlwaysStopOnExit=8
+##    viWarnIfIdle=1, viStartIfIdle=2, viStopOnExitIfStarted=4, viAlwaysStopOnExit=8, lvNoStart=16
+## with lvNoStart, reads and writes fail (disconnected) while LabVIEW is not running rather than waiting for it to start
 lvDCOMConfigure("lvfp", "frontpanel", "$(TOP)/exampleApp/src/lvinput.xml", "", 6)
 #lvDCOMConfigure("lvfp", "frontpanel", "$(TOP)/exampleApp/src/lvinput.xml", "", 6, "LvDCOMex.Application")
 #lvDCOMConfigure("lvfp", "frontpanel", "$(TOP)/exampleApp/src/lvinput.xml", "ndxtestfaa", 6, "", "username", "password")
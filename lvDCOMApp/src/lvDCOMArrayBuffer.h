@@ -0,0 +1,76 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMArrayBuffer.h header for #lvDCOMArrayBuffer class.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#ifndef LV_DCOM_ARRAY_BUFFER_H
+#define LV_DCOM_ARRAY_BUFFER_H
+
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+/// Double buffered driver side copy of a LabVIEW array. The poller fills the back buffer from LabVIEW without
+/// holding any lock, it then takes the asyn port lock and calls swap() before posting callbacks from front().
+/// Readers also hold the port lock, so will always see a complete array.
+template <typename T>
+class lvDCOMArrayBuffer
+{
+public:
+	lvDCOMArrayBuffer() : m_front(0) { }
+	/// buffer for the poller to fill with the next value, not visible to readers
+	std::vector<T>& back() { return m_buffers[1 - m_front]; }
+	/// most recent complete value, call with asyn port lock held
+	std::vector<T>& front() { return m_buffers[m_front]; }
+	/// make the back buffer visible to readers, call with asyn port lock held
+	void swap() { m_front = 1 - m_front; }
+	/// true if the back buffer differs from the front buffer in size, or in any element by more than \a deadband.
+	/// With no deadband this is a plain memcmp(), which the C runtime vectorises
+	bool changed(double deadband) const
+	{
+		const std::vector<T>& next = m_buffers[1 - m_front];
+		const std::vector<T>& current = m_buffers[m_front];
+		if (next.size() != current.size())
+		{
+			return true;
+		}
+		if (next.size() == 0)
+		{
+			return false;
+		}
+		if (deadband <= 0.0)
+		{
+			return (memcmp(&(next[0]), &(current[0]), next.size() * sizeof(T)) != 0);
+		}
+		for(size_t i = 0; i < next.size(); ++i)
+		{
+			// written so a NaN on either side counts as a change
+			if ( !(fabs(static_cast<double>(next[i]) - static_cast<double>(current[i])) <= deadband) )
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+	/// copy at most \a nElements of the current value to \a value, call with asyn port lock held
+	size_t read(T* value, size_t nElements)
+	{
+		const std::vector<T>& current = front();
+		size_t n = (current.size() > nElements ? nElements : current.size());
+		if (n > 0)
+		{
+			memcpy(value, &(current[0]), n * sizeof(T));
+		}
+		return n;
+	}
+private:
+	std::vector<T> m_buffers[2];
+	int m_front;   ///< index into m_buffers of the buffer readers use
+};
+
+#endif /* LV_DCOM_ARRAY_BUFFER_H */
@@ -0,0 +1,74 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMAuthIdentity.h header for #lvDCOMAuthIdentity class.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#ifndef LV_DCOM_AUTH_IDENTITY_H
+#define LV_DCOM_AUTH_IDENTITY_H
+
+#include <windows.h>
+
+#include <string>
+
+/// Owns the COAUTHIDENTITY and COAUTHINFO used to reach LabVIEW on a remote host as a given user.
+/// CoSetProxyBlanket() keeps a pointer to the identity rather than copying it, so this is created once per
+/// #lvDCOMInterface and the same identity is used for every (re)connection and VI reference made by it.
+class lvDCOMAuthIdentity
+{
+public:
+	lvDCOMAuthIdentity()
+	{
+		memset(&m_identity, 0, sizeof(m_identity));
+		memset(&m_authinfo, 0, sizeof(m_authinfo));
+		m_authinfo.dwAuthnSvc = RPC_C_AUTHN_WINNT;
+		m_authinfo.dwAuthnLevel = RPC_C_AUTHN_LEVEL_DEFAULT;
+		m_authinfo.dwAuthzSvc = RPC_C_AUTHZ_NONE;
+		m_authinfo.dwCapabilities = EOAC_NONE;
+		m_authinfo.dwImpersonationLevel = RPC_C_IMP_LEVEL_IMPERSONATE;
+		m_authinfo.pAuthIdentityData = NULL;
+		m_authinfo.pwszServerPrincName = NULL;
+	}
+	~lvDCOMAuthIdentity()
+	{
+		if (m_password.size() > 0)
+		{
+			SecureZeroMemory(&(m_password[0]), m_password.size());
+		}
+	}
+	/// set the account to use, an empty \a user means connect as the account the IOC is running under.
+	/// Must be called before any proxy is given identity(), as it changes the strings it points to
+	void set(const std::string& user, const std::string& domain, const std::string& pass)
+	{
+		m_user = user;
+		m_domain = domain;
+		m_password = pass;
+		m_identity.User = reinterpret_cast<USHORT*>(const_cast<char*>(m_user.c_str()));
+		m_identity.UserLength = static_cast<ULONG>(m_user.size());
+		m_identity.Domain = reinterpret_cast<USHORT*>(const_cast<char*>(m_domain.c_str()));
+		m_identity.DomainLength = static_cast<ULONG>(m_domain.size());
+		m_identity.Password = reinterpret_cast<USHORT*>(const_cast<char*>(m_password.c_str()));
+		m_identity.PasswordLength = static_cast<ULONG>(m_password.size());
+		m_identity.Flags = SEC_WINNT_AUTH_IDENTITY_ANSI;
+		m_authinfo.pAuthIdentityData = identity();
+	}
+	/// identity for CoSetProxyBlanket(), or NULL to use the default
+	COAUTHIDENTITY* identity() { return (m_user.size() > 0 ? &m_identity : NULL); }
+	/// authentication information for COSERVERINFO
+	COAUTHINFO* authInfo() { return &m_authinfo; }
+
+private:
+	std::string m_user;
+	std::string m_domain;
+	std::string m_password;
+	COAUTHIDENTITY m_identity;  ///< points into the strings above
+	COAUTHINFO m_authinfo;      ///< points to m_identity
+	lvDCOMAuthIdentity(const lvDCOMAuthIdentity&);
+	lvDCOMAuthIdentity& operator=(const lvDCOMAuthIdentity&);
+};
+
+#endif /* LV_DCOM_AUTH_IDENTITY_H */
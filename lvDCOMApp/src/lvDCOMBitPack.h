@@ -0,0 +1,63 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMBitPack.h Packing of LabVIEW boolean arrays into 32 bit words for asynUInt32Digital.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#ifndef LV_DCOM_BIT_PACK_H
+#define LV_DCOM_BIT_PACK_H
+
+#include <stddef.h>
+
+#include <epicsTypes.h>
+
+/// Pack \a n truth values from \a src (any non-zero value is true, so a VARIANT_BOOL array can be used directly) into \a words,
+/// element i going to bit i % 32 of word i / 32. Each whole word is made by a fixed length loop with no branches,
+/// which the compiler can unroll and vectorise. Any bits of the last word beyond \a n are zero.
+template <typename T>
+void packBits(const T* src, size_t n, epicsUInt32* words)
+{
+	size_t nfull = n / 32;
+	for(size_t j = 0; j < nfull; ++j)
+	{
+		const T* s = src + 32 * j;
+		epicsUInt32 w = 0;
+		for(int i = 0; i < 32; ++i)
+		{
+			w |= static_cast<epicsUInt32>(s[i] != 0) << i;
+		}
+		words[j] = w;
+	}
+	size_t nrest = n % 32;
+	if (nrest > 0)
+	{
+		const T* s = src + 32 * nfull;
+		epicsUInt32 w = 0;
+		for(size_t i = 0; i < nrest; ++i)
+		{
+			w |= static_cast<epicsUInt32>(s[i] != 0) << i;
+		}
+		words[nfull] = w;
+	}
+}
+
+/// Set the elements of \a dest (of length \a n) that correspond to the bits of \a mask in word \a word to the matching
+/// bit of \a value, as \a true_value or \a false_value. The reverse of packBits() for a masked write.
+template <typename T>
+void unpackBits(epicsUInt32 value, epicsUInt32 mask, size_t word, T* dest, size_t n, T true_value, T false_value)
+{
+	size_t first = 32 * word;
+	for(size_t i = 0; i < 32 && first + i < n; ++i)
+	{
+		if ( (mask >> i) & 1 )
+		{
+			dest[first + i] = ( ((value >> i) & 1) ? true_value : false_value );
+		}
+	}
+}
+
+#endif /* LV_DCOM_BIT_PACK_H */
@@ -0,0 +1,85 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMBitPackTest.cpp Unit tests of packBits() and unpackBits().
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "lvDCOMBitPack.h"
+
+/// element \a i of the test pattern, VARIANT_BOOL style (-1 true, 0 false)
+static short pattern(size_t i)
+{
+	return ((i * 7 + i / 5) % 3 == 0 ? -1 : 0);
+}
+
+MAIN(lvDCOMBitPackTest)
+{
+	testPlan(10);
+	const size_t n = 70;  // two whole words and 6 bits of a third
+	short bools[n];
+	for(size_t i = 0; i < n; ++i)
+	{
+		bools[i] = pattern(i);
+	}
+
+	testDiag("packBits");
+	epicsUInt32 words[3] = { 0xdeadbeef, 0xdeadbeef, 0xdeadbeef };
+	packBits(bools, n, words);
+	int wrong = 0;
+	for(size_t i = 0; i < n; ++i)
+	{
+		wrong += (((words[i / 32] >> (i % 32)) & 1) != (bools[i] != 0 ? 1u : 0u));
+	}
+	testOk(wrong == 0, "%d of %d bits wrong", wrong, static_cast<int>(n));
+	testOk1((words[2] >> 6) == 0);
+	const char all_true[32] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+	epicsUInt32 word = 0;
+	packBits(all_true, 32, &word);
+	testOk1(word == 0xffffffff);
+	word = 0xffffffff;
+	packBits(all_true, 1, &word);
+	testOk1(word == 1);
+	word = 12345;
+	packBits(all_true, 0, &word);
+	testOk1(word == 12345);
+
+	testDiag("unpackBits");
+	short dest[n];
+	for(size_t i = 0; i < n; ++i)
+	{
+		dest[i] = 7;
+	}
+	unpackBits<short>(0x0000000a, 0x0000000f, 1, dest, n, -1, 0);
+	testOk1(dest[32] == 0 && dest[33] == -1 && dest[34] == 0 && dest[35] == -1);
+	testOk1(dest[31] == 7 && dest[36] == 7);
+	unpackBits<short>(0xffffffff, 0xffffffff, 2, dest, n, -1, 0);
+	testOk1(dest[64] == -1 && dest[69] == -1);
+
+	testDiag("unpackBits of every word gives back what was packed");
+	for(size_t j = 0; j < 3; ++j)
+	{
+		unpackBits<short>(words[j], 0xffffffff, j, dest, n, -1, 0);
+	}
+	wrong = 0;
+	for(size_t i = 0; i < n; ++i)
+	{
+		wrong += (dest[i] != bools[i]);
+	}
+	testOk(wrong == 0, "%d of %d elements wrong", wrong, static_cast<int>(n));
+	unpackBits<short>(0, 0xffffffff, 3, dest, n, -1, 0);
+	wrong = 0;
+	for(size_t i = 0; i < n; ++i)
+	{
+		wrong += (dest[i] != bools[i]);
+	}
+	testOk(wrong == 0, "word past the end changes %d elements", wrong);
+
+	return testDone();
+}
@@ -0,0 +1,770 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMBroker.cpp Shares one connection to LabVIEW between all the IOCs on a machine.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+///
+/// Usage: lvDCOMBroker [-p port] [-r period] [-a max_age] [-t timeout] [-s seconds] [-o options] [-x extint] [upstream]
+///
+///   -p port       port to listen on, on the loopback interface only (default 5332)
+///   -r period     seconds between reads of each control an IOC has subscribed to (default 0.1)
+///   -a max_age    a get is answered without asking LabVIEW if the control was read at most this many seconds ago (default 0)
+///   -t timeout    seconds to wait for LabVIEW to answer each request (default 10, 0 for ever)
+///   -s seconds    print counts of requests every this many seconds (default 0, never)
+///   -o options    #lvDCOMOptions, as the lvDCOMConfigure options argument (Windows only)
+///   -x extint     path of the extint VI, for writes an IOC asks to be signalled (Windows only)
+///   upstream      where LabVIEW is, given as the lvDCOMConfigure host argument: empty (the default) or a host name
+///                 for DCOM (Windows only), tcp://host:port for the TCP transport, or sim for an in memory
+///                 #lvDCOMSimBackend that only knows values it has been given, for testing without LabVIEW
+///
+/// Each IOC uses the broker by giving lvDCOMConfigure the host broker://port (or just broker:// for the default
+/// port). They then talk to it with the TCP transport protocol of lvDCOMTcpProtocol.h, and only the broker talks to
+/// LabVIEW, one request at a time. Overlapping reads are only made once:
+///
+///   - a get that arrives while LabVIEW is being asked for the same control, or waits behind such a request, is
+///     answered with that value rather than asking again
+///   - a control subscribed to by any number of IOCs (tcp_subscribe, the default) is read once every period and each
+///     change is sent to all of them, so they read it from their own copy without asking the broker at all
+///   - with max_age, any get of a control read that recently is answered from the broker's copy
+///
+/// So the load on LabVIEW depends on the number of different controls read, not on the number of IOCs reading them.
+/// A set of a subscribed control is read back and sent to the subscribers before the set is answered, as LabVIEW may
+/// have coerced the value. Calls are always passed on.
+///
+/// Replies and notifications are queued for each connection and sent by a thread of its own, so an IOC that stops
+/// reading holds up nobody else. If more than #max_queued bytes are waiting for a connection it is dropped.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <utility>
+#include <stdexcept>
+
+#include <osiSock.h>  // winsock2.h, which must come before windows.h
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+#include <epicsGuard.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
+#include <epicsSignal.h>
+
+#include "lvDCOMCapture.h"
+#include "lvDCOMSimBackend.h"
+#include "lvDCOMTcpProtocol.h"
+#include "lvDCOMTcpClient.h"
+
+#ifdef _WIN32
+#include "lvDCOMInterface.h"
+#endif
+
+typedef std::pair<std::string, std::string> control_key_t;  ///< (vi, control)
+
+static const size_t max_queued = 16 * 1024 * 1024;  ///< bytes that may wait to be sent to a connection before it is dropped
+
+/// where the broker sends requests, all calls are made one at a time
+class BrokerBackend
+{
+public:
+	virtual ~BrokerBackend() { }
+	virtual void get(const std::string& vi, const std::string& control, CaptureValue& value) = 0;
+	virtual void set(const std::string& vi, const std::string& control, const CaptureValue& value, bool signal) = 0;
+	virtual void call(const std::string& vi, CaptureValue& names_values) = 0;
+	/// a TcpUpdate from a replay, only meaningful for a stand in
+	virtual void update(const std::string& vi, const std::string& control, const CaptureValue& value)
+	{
+		throw std::runtime_error("updates are only accepted by a stand in for LabVIEW");
+	}
+	virtual std::string describe() const = 0;
+};
+
+/// in memory stand in for LabVIEW
+class SimBrokerBackend : public BrokerBackend
+{
+public:
+	void get(const std::string& vi, const std::string& control, CaptureValue& value) { m_backend.getControlValue(vi, control, value, 0.0); }
+	void set(const std::string& vi, const std::string& control, const CaptureValue& value, bool signal) { m_backend.setControlValue(vi, control, value, 0.0); }
+	void call(const std::string& vi, CaptureValue& names_values) { m_backend.call(vi, names_values, 0.0); }
+	void update(const std::string& vi, const std::string& control, const CaptureValue& value)
+	{
+		if (control.size() == 0)
+		{
+			m_backend.updateCall(vi, value);
+		}
+		else
+		{
+			m_backend.update(vi, control, value);
+		}
+	}
+	std::string describe() const { return "simulated LabVIEW"; }
+private:
+	lvDCOMSimBackend m_backend;
+};
+
+/// LabVIEW at the other end of the TCP transport. Every request is a round trip, the broker keeps its own copy of values
+class TcpBrokerBackend : public BrokerBackend
+{
+public:
+	TcpBrokerBackend(const std::string& address, double timeout) : m_client(address, false), m_timeout(timeout) { }
+	void get(const std::string& vi, const std::string& control, CaptureValue& value)
+	{
+		std::vector<TcpItem> items(1, TcpItem(vi, control));
+		m_client.get(items, m_timeout);
+		check(items[0]);
+		value = items[0].value;
+	}
+	void set(const std::string& vi, const std::string& control, const CaptureValue& value, bool signal)
+	{
+		std::vector<TcpItem> items(1, TcpItem(vi, control, (signal ? TcpSignal : 0)));
+		items[0].value = value;
+		m_client.set(items, m_timeout);
+		check(items[0]);
+	}
+	void call(const std::string& vi, CaptureValue& names_values) { m_client.call(vi, names_values, names_values, m_timeout); }
+	void update(const std::string& vi, const std::string& control, const CaptureValue& value)
+	{
+		std::vector<TcpItem> items(1, TcpItem(vi, control));
+		items[0].value = value;
+		m_client.update(items);
+	}
+	std::string describe() const { return "TCP transport to \"" + m_client.address() + "\""; }
+private:
+	lvDCOMTcpClient m_client;
+	double m_timeout;
+	static void check(const TcpItem& item)
+	{
+		if (item.status != 0)
+		{
+			throw std::runtime_error(item.message);
+		}
+	}
+};
+
+#ifdef _WIN32
+/// LabVIEW through #lvDCOMInterface, with no configuration section so any control can be asked for
+class DcomBrokerBackend : public BrokerBackend
+{
+public:
+	DcomBrokerBackend(const std::string& host, int options, const std::string& extint, double timeout) :
+	    m_dcom("", "", host.c_str(), options, NULL, NULL, NULL), m_host(host), m_timeout(timeout)
+	{
+		if (extint.size() > 0)
+		{
+			m_dcom.setExtint(extint);
+		}
+	}
+	void get(const std::string& vi, const std::string& control, CaptureValue& value) { m_dcom.getControlValue(vi, control, value, m_timeout); }
+	void set(const std::string& vi, const std::string& control, const CaptureValue& value, bool signal) { m_dcom.setControlValue(vi, control, value, signal, m_timeout); }
+	void call(const std::string& vi, CaptureValue& names_values) { m_dcom.callVi(vi, names_values, m_timeout); }
+	std::string describe() const { return "LabVIEW on \"" + (m_host.size() > 0 ? m_host : std::string("localhost")) + "\""; }
+private:
+	lvDCOMInterface m_dcom;
+	std::string m_host;
+	double m_timeout;
+};
+#endif
+
+struct BrokerConnection;
+
+/// what the broker knows of a control that has been read
+struct BrokerControl
+{
+	CaptureValue value;      ///< last value read, or written by a set
+	bool valid;              ///< value is current, nothing has failed since
+	epicsTime read_time;     ///< when the read of value was started
+	std::set<BrokerConnection*> subscribers;
+	BrokerControl() : valid(false) { }
+};
+
+/// state shared by all connections
+struct Broker
+{
+	BrokerBackend* backend;
+	double period;
+	double max_age;
+	double stats;             ///< seconds between printing the counts below, 0 for never
+	std::map<control_key_t, BrokerControl> controls;
+	epicsMutex lock;          ///< protects everything but backend, including the send queue of every connection
+	epicsMutex backend_lock;  ///< serialises requests to the backend, taken before lock if both are needed
+	unsigned long connections, gets, shared_gets, backend_gets, sets, calls, notifies, failures, dropped;
+	Broker() : backend(NULL), period(0.1), max_age(0.0), stats(0.0), connections(0), gets(0), shared_gets(0), backend_gets(0), sets(0),
+	    calls(0), notifies(0), failures(0), dropped(0) { }
+};
+
+/// one client connection
+struct BrokerConnection
+{
+	Broker* broker;
+	SOCKET sock;
+	std::string peer;
+	std::deque<std::string> queue;  ///< frames waiting for senderTask(), protected by broker->lock
+	size_t queued;                  ///< bytes in queue
+	bool closing;                   ///< nothing more is to be sent, protected by broker->lock
+	epicsEvent wake;                ///< signalled when a frame is queued or closing is set
+	epicsEvent sender_done;         ///< signalled as senderTask() exits
+	BrokerConnection() : broker(NULL), sock(INVALID_SOCKET), queued(0), closing(false) { }
+};
+
+/// stop sending to \a conn and forget its subscriptions, its connectionTask() sees the socket close and cleans up. Called with broker.lock held
+static void dropConnection(Broker& broker, BrokerConnection* conn)
+{
+	if (conn->closing)
+	{
+		return;
+	}
+	conn->closing = true;
+	conn->queue.clear();
+	conn->queued = 0;
+	for(std::map<control_key_t, BrokerControl>::iterator it = broker.controls.begin(); it != broker.controls.end(); ++it)
+	{
+		it->second.subscribers.erase(conn);
+	}
+	shutdown(conn->sock, 2);  // wakes a blocked send or receive
+	conn->wake.signal();
+}
+
+/// queue \a frame to be sent to \a conn, dropping the connection if it has fallen too far behind. Called with broker.lock held
+static void queueFrame(Broker& broker, BrokerConnection* conn, const std::string& frame)
+{
+	if (conn->closing)
+	{
+		return;
+	}
+	if (conn->queued + frame.size() > max_queued)
+	{
+		printf("lvDCOMBroker: dropping %s, more than %lu bytes waiting to be sent to it\n", conn->peer.c_str(), static_cast<unsigned long>(max_queued));
+		fflush(stdout);
+		++broker.dropped;
+		dropConnection(broker, conn);
+		return;
+	}
+	conn->queue.push_back(frame);
+	conn->queued += frame.size();
+	conn->wake.signal();
+}
+
+/// send the value of control \a key, or that it failed with \a message, to every connection that has subscribed to it. Called with broker.lock held
+static void notify(Broker& broker, const control_key_t& key, const BrokerControl& c, const std::string& message)
+{
+	if (c.subscribers.size() == 0)
+	{
+		return;
+	}
+	TcpMessage msg;
+	msg.type = TcpNotify;
+	msg.items.push_back(TcpItem(key.first, key.second));
+	if (c.valid)
+	{
+		msg.items[0].value = c.value;
+	}
+	else
+	{
+		msg.items[0].status = -1;
+		msg.items[0].message = message;
+	}
+	std::string frame;
+	tcpEncode(msg, frame);
+	// copied, as queueFrame() may drop a connection and so change c.subscribers
+	std::vector<BrokerConnection*> subscribers(c.subscribers.begin(), c.subscribers.end());
+	for(std::vector<BrokerConnection*>::const_iterator it = subscribers.begin(); it != subscribers.end(); ++it)
+	{
+		queueFrame(broker, *it, frame);
+		++broker.notifies;
+	}
+}
+
+/// Put the value of control \a key in \a value. It comes from the broker's copy if that was read at most \a max_age seconds ago,
+/// or if LabVIEW was asked for it after this request arrived (by a request this one waited behind). Otherwise LabVIEW is
+/// asked, and any change sent to subscribers. Returns true if LabVIEW was not asked
+static bool readControl(Broker& broker, const control_key_t& key, CaptureValue& value, double max_age)
+{
+	epicsTime asked = epicsTime::getCurrent();
+	{
+		epicsGuard<epicsMutex> _lock(broker.lock);
+		std::map<control_key_t, BrokerControl>::const_iterator it = broker.controls.find(key);
+		if (it != broker.controls.end() && it->second.valid && asked - it->second.read_time <= max_age)
+		{
+			value = it->second.value;
+			return true;
+		}
+	}
+	epicsGuard<epicsMutex> _backend_lock(broker.backend_lock);
+	{
+		epicsGuard<epicsMutex> _lock(broker.lock);
+		std::map<control_key_t, BrokerControl>::const_iterator it = broker.controls.find(key);
+		if (it != broker.controls.end() && it->second.valid && !(it->second.read_time < asked))
+		{
+			value = it->second.value;
+			return true;
+		}
+	}
+	epicsTime start = epicsTime::getCurrent();
+	CaptureValue v;
+	try
+	{
+		broker.backend->get(key.first, key.second, v);
+	}
+	catch(const std::exception& ex)
+	{
+		epicsGuard<epicsMutex> _lock(broker.lock);
+		++broker.failures;
+		std::map<control_key_t, BrokerControl>::iterator it = broker.controls.find(key);
+		if (it != broker.controls.end() && it->second.valid)
+		{
+			it->second.valid = false;
+			notify(broker, key, it->second, ex.what());
+		}
+		throw;
+	}
+	epicsGuard<epicsMutex> _lock(broker.lock);
+	++broker.backend_gets;
+	BrokerControl& c = broker.controls[key];
+	bool changed = (!c.valid || c.value != v);
+	c.value = v;
+	c.valid = true;
+	c.read_time = start;
+	if (changed)
+	{
+		notify(broker, key, c, "");
+	}
+	value = v;
+	return false;
+}
+
+/// after a set or update of control \a key, send its new value to subscribers (reading it back so they see any coercion
+/// LabVIEW made) or, if it has none, forget the copy. Called with broker.backend_lock held
+static void afterWrite(Broker& broker, const control_key_t& key)
+{
+	{
+		epicsGuard<epicsMutex> _lock(broker.lock);
+		std::map<control_key_t, BrokerControl>::iterator it = broker.controls.find(key);
+		if (it == broker.controls.end())
+		{
+			return;
+		}
+		it->second.valid = false;
+		if (it->second.subscribers.size() == 0)
+		{
+			return;
+		}
+	}
+	epicsTime start = epicsTime::getCurrent();
+	CaptureValue v;
+	try
+	{
+		broker.backend->get(key.first, key.second, v);
+	}
+	catch(const std::exception& ex)
+	{
+		epicsGuard<epicsMutex> _lock(broker.lock);
+		++broker.failures;
+		notify(broker, key, broker.controls[key], ex.what());
+		return;
+	}
+	epicsGuard<epicsMutex> _lock(broker.lock);
+	++broker.backend_gets;
+	BrokerControl& c = broker.controls[key];
+	c.value = v;
+	c.valid = true;
+	c.read_time = start;
+	notify(broker, key, c, "");
+}
+
+/// do the request \a msg, turning it into its reply. Returns false if there is no reply to send
+static bool handle(Broker& broker, TcpMessage& msg)
+{
+	for(std::vector<TcpItem>::iterator it = msg.items.begin(); it != msg.items.end(); ++it)
+	{
+		TcpItem& item = *it;
+		control_key_t key(item.vi, item.control);
+		item.status = 0;
+		try
+		{
+			switch(msg.type)
+			{
+				case TcpHello:
+					if (item.value.kind != CaptureValue::Int32 || item.value.ival != tcp_protocol_version)
+					{
+						throw std::runtime_error("unsupported protocol version");
+					}
+					break;
+				case TcpGet:
+					{
+						bool shared = readControl(broker, key, item.value, broker.max_age);
+						epicsGuard<epicsMutex> _lock(broker.lock);
+						++broker.gets;
+						broker.shared_gets += (shared ? 1 : 0);
+					}
+					break;
+				case TcpSet:
+					{
+						epicsGuard<epicsMutex> _backend_lock(broker.backend_lock);
+						broker.backend->set(item.vi, item.control, item.value, (item.flags & TcpSignal) != 0);
+						afterWrite(broker, key);
+					}
+					{
+						epicsGuard<epicsMutex> _lock(broker.lock);
+						++broker.sets;
+					}
+					item.value = CaptureValue();  // no need to send it back
+					break;
+				case TcpCall:
+					{
+						epicsGuard<epicsMutex> _backend_lock(broker.backend_lock);
+						broker.backend->call(item.vi, item.value);
+					}
+					{
+						epicsGuard<epicsMutex> _lock(broker.lock);
+						++broker.calls;
+					}
+					break;
+				case TcpUpdate:
+					{
+						epicsGuard<epicsMutex> _backend_lock(broker.backend_lock);
+						broker.backend->update(item.vi, item.control, item.value);
+						if (item.control.size() > 0)
+						{
+							afterWrite(broker, key);
+						}
+					}
+					break;
+				default:
+					throw std::runtime_error("unknown request");
+			}
+		}
+		catch(const std::exception& ex)
+		{
+			item.status = -1;
+			item.message = ex.what();
+			item.value = CaptureValue();
+		}
+	}
+	msg.type |= TcpReply;
+	return msg.type != (TcpUpdate | TcpReply);
+}
+
+/// send the frames queued for a connection, so only this thread waits for a slow client
+static void senderTask(void* arg)
+{
+	BrokerConnection* conn = static_cast<BrokerConnection*>(arg);
+	Broker& broker = *(conn->broker);
+	std::string frame;
+	while(true)
+	{
+		{
+			epicsGuard<epicsMutex> _lock(broker.lock);
+			if (conn->closing)
+			{
+				break;
+			}
+			if (conn->queue.size() > 0)
+			{
+				frame.swap(conn->queue.front());
+				conn->queue.pop_front();
+				conn->queued -= frame.size();
+			}
+			else
+			{
+				frame.clear();
+			}
+		}
+		if (frame.size() == 0)
+		{
+			conn->wake.wait();
+		}
+		else if (!tcpSend(conn->sock, frame))
+		{
+			epicsGuard<epicsMutex> _lock(broker.lock);
+			dropConnection(broker, conn);
+			break;
+		}
+	}
+	conn->sender_done.signal();
+}
+
+static void connectionTask(void* arg)
+{
+	BrokerConnection* conn = static_cast<BrokerConnection*>(arg);
+	Broker& broker = *(conn->broker);
+	std::string body, frame;
+	TcpMessage msg;
+	printf("lvDCOMBroker: connection from %s\n", conn->peer.c_str());
+	fflush(stdout);
+	if (epicsThreadCreate("lvDCOMBrokerSend", epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackSmall),
+	        senderTask, conn) == 0)
+	{
+		fprintf(stderr, "lvDCOMBroker: epicsThreadCreate failure\n");
+		conn->sender_done.signal();
+		epicsGuard<epicsMutex> _lock(broker.lock);
+		dropConnection(broker, conn);
+	}
+	while(tcpReceive(conn->sock, body) && tcpDecode(body, msg))
+	{
+		if (!handle(broker, msg))
+		{
+			continue;
+		}
+		tcpEncode(msg, frame);
+		epicsGuard<epicsMutex> _lock(broker.lock);
+		queueFrame(broker, conn, frame);
+		if (conn->closing)
+		{
+			break;
+		}
+		if (msg.type != (TcpGet | TcpReply))
+		{
+			continue;
+		}
+		// subscriptions start once the reply is queued, so no notify can overtake it. Anything newer than the reply is sent now
+		for(std::vector<TcpItem>::const_iterator it = msg.items.begin(); it != msg.items.end(); ++it)
+		{
+			if (it->status != 0 || (it->flags & TcpSubscribe) == 0)
+			{
+				continue;
+			}
+			control_key_t key(it->vi, it->control);
+			BrokerControl& c = broker.controls[key];
+			if (c.subscribers.insert(conn).second && c.valid && c.value != it->value)
+			{
+				BrokerControl just_this;
+				just_this.value = c.value;
+				just_this.valid = true;
+				just_this.subscribers.insert(conn);
+				notify(broker, key, just_this, "");
+			}
+		}
+	}
+	{
+		epicsGuard<epicsMutex> _lock(broker.lock);
+		dropConnection(broker, conn);
+		--broker.connections;
+	}
+	conn->sender_done.wait();
+	printf("lvDCOMBroker: %s disconnected\n", conn->peer.c_str());
+	fflush(stdout);
+	epicsSocketDestroy(conn->sock);
+	delete conn;
+}
+
+/// read every subscribed control once a period, unless a get has just read it
+static void pollTask(void* arg)
+{
+	Broker& broker = *static_cast<Broker*>(arg);
+	std::vector<control_key_t> keys;
+	CaptureValue value;
+	while(true)
+	{
+		epicsTime start = epicsTime::getCurrent();
+		keys.clear();
+		{
+			epicsGuard<epicsMutex> _lock(broker.lock);
+			for(std::map<control_key_t, BrokerControl>::const_iterator it = broker.controls.begin(); it != broker.controls.end(); ++it)
+			{
+				if (it->second.subscribers.size() > 0)
+				{
+					keys.push_back(it->first);
+				}
+			}
+		}
+		for(std::vector<control_key_t>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+		{
+			try
+			{
+				readControl(broker, *it, value, broker.period / 2.0);
+			}
+			catch(const std::exception&)
+			{
+				// subscribers have been told
+			}
+		}
+		double left = broker.period - (epicsTime::getCurrent() - start);
+		epicsThreadSleep(left > 0.0 ? left : 0.0);
+	}
+}
+
+static void statsTask(void* arg)
+{
+	Broker& broker = *static_cast<Broker*>(arg);
+	while(true)
+	{
+		epicsThreadSleep(broker.stats);
+		epicsGuard<epicsMutex> _lock(broker.lock);
+		size_t subscribed = 0;
+		for(std::map<control_key_t, BrokerControl>::const_iterator it = broker.controls.begin(); it != broker.controls.end(); ++it)
+		{
+			subscribed += (it->second.subscribers.size() > 0 ? 1 : 0);
+		}
+		printf("lvDCOMBroker: %lu connection(s), %lu control(s) (%lu subscribed), %lu get(s) of which %lu shared, %lu LabVIEW read(s), "
+		    "%lu set(s), %lu call(s), %lu notification(s), %lu failure(s), %lu connection(s) dropped\n", broker.connections, static_cast<unsigned long>(broker.controls.size()),
+		    static_cast<unsigned long>(subscribed), broker.gets, broker.shared_gets, broker.backend_gets, broker.sets, broker.calls,
+		    broker.notifies, broker.failures, broker.dropped);
+		fflush(stdout);
+	}
+}
+
+static void usage()
+{
+	fprintf(stderr, "Usage: lvDCOMBroker [-p port] [-r period] [-a max_age] [-t timeout] [-s seconds] [-o options] [-x extint] [upstream]\n");
+	exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+	int port = broker_default_port;
+	double timeout = 10.0;
+	std::string upstream;
+#ifdef _WIN32
+	int options = 0;
+	std::string extint;
+#endif
+	bool have_upstream = false;
+	Broker broker;
+	for(int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-p") && i + 1 < argc)
+		{
+			port = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+		{
+			broker.period = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-a") && i + 1 < argc)
+		{
+			broker.max_age = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+		{
+			timeout = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+		{
+			broker.stats = atof(argv[++i]);
+		}
+#ifdef _WIN32
+		else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+		{
+			options = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-x") && i + 1 < argc)
+		{
+			extint = argv[++i];
+		}
+#endif
+		else if (argv[i][0] != '-' && !have_upstream)
+		{
+			upstream = argv[i];
+			have_upstream = true;
+		}
+		else
+		{
+			usage();
+		}
+	}
+	if (port <= 0 || port > 65535 || broker.period <= 0.0 || broker.max_age < 0.0 || timeout < 0.0 || broker.stats < 0.0)
+	{
+		usage();
+	}
+	if (!osiSockAttach())
+	{
+		fprintf(stderr, "lvDCOMBroker: osiSockAttach failed\n");
+		return 1;
+	}
+	epicsSignalInstallSigPipeIgnore();  // a send to a dropped connection fails rather than ending the broker
+	try
+	{
+		if (upstream == "sim")
+		{
+			broker.backend = new SimBrokerBackend;
+		}
+		else if (upstream.compare(0, 6, "tcp://") == 0)
+		{
+			broker.backend = new TcpBrokerBackend(upstream.substr(6), timeout);
+		}
+		else
+		{
+#ifdef _WIN32
+			broker.backend = new DcomBrokerBackend(upstream, options, extint, timeout);
+#else
+			fprintf(stderr, "lvDCOMBroker: DCOM is only available on Windows, give tcp://host:port or sim\n");
+			return 1;
+#endif
+		}
+	}
+	catch(const std::exception& ex)
+	{
+		fprintf(stderr, "lvDCOMBroker: %s\n", ex.what());
+		return 1;
+	}
+	SOCKET listener = epicsSocketCreate(AF_INET, SOCK_STREAM, 0);
+	if (listener == INVALID_SOCKET)
+	{
+		fprintf(stderr, "lvDCOMBroker: cannot create socket\n");
+		return 1;
+	}
+	epicsSocketEnableAddressReuseDuringTimeWaitState(listener);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // only IOCs on this machine
+	addr.sin_port = htons(static_cast<unsigned short>(port));
+	if (bind(listener, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listener, 10) != 0)
+	{
+		fprintf(stderr, "lvDCOMBroker: cannot listen on port %d\n", port);
+		epicsSocketDestroy(listener);
+		return 1;
+	}
+	printf("lvDCOMBroker: listening on port %d for %s, reading subscribed controls every %g seconds\n", port, broker.backend->describe().c_str(), broker.period);
+	fflush(stdout);
+	if (epicsThreadCreate("lvDCOMBrokerPoll", epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackMedium), pollTask, &broker) == 0)
+	{
+		fprintf(stderr, "lvDCOMBroker: epicsThreadCreate failure\n");
+		return 1;
+	}
+	if (broker.stats > 0.0 && epicsThreadCreate("lvDCOMBrokerStats", epicsThreadPriorityLow, epicsThreadGetStackSize(epicsThreadStackSmall), statsTask, &broker) == 0)
+	{
+		fprintf(stderr, "lvDCOMBroker: epicsThreadCreate failure\n");
+		return 1;
+	}
+	while(true)
+	{
+		struct sockaddr_in peer;
+		osiSocklen_t len = sizeof(peer);
+		SOCKET sock = epicsSocketAccept(listener, reinterpret_cast<struct sockaddr*>(&peer), &len);
+		if (sock == INVALID_SOCKET)
+		{
+			continue;
+		}
+		tcpNoDelay(sock);
+		BrokerConnection* conn = new BrokerConnection;
+		char name[64];
+		ipAddrToDottedIP(&peer, name, sizeof(name));
+		conn->broker = &broker;
+		conn->sock = sock;
+		conn->peer = name;
+		{
+			epicsGuard<epicsMutex> _lock(broker.lock);
+			++broker.connections;
+		}
+		if (epicsThreadCreate("lvDCOMBroker", epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackMedium),
+		        connectionTask, conn) == 0)
+		{
+			fprintf(stderr, "lvDCOMBroker: epicsThreadCreate failure\n");
+			epicsSocketDestroy(sock);
+			delete conn;
+			epicsGuard<epicsMutex> _lock(broker.lock);
+			--broker.connections;
+		}
+	}
+	return 0;
+}
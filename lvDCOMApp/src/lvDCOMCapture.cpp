@@ -0,0 +1,357 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMCapture.cpp Implementation of #lvDCOMCaptureWriter and #lvDCOMCaptureReader classes.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+///
+/// File layout, all integers and doubles little endian:
+///   "LVDCOMC1"  magic
+///   records     for each: uint32 length of what follows, uint8 op, float64 time, float64 duration, int32 hresult,
+///               string vi, string control, value
+/// where a string is a uint32 length and UTF-8 bytes, and a value is a uint8 #CaptureValue::Kind followed by
+/// an int32 (Boolean, Int32), a float64 (Float64), a string (String), or for arrays a uint8 number of dimensions,
+/// a uint32 for each dimension and then the packed elements (Int32Array, BooleanArray, Float64Array) or a value for each element (Array).
+/// The same encoding is used for the messages of the TCP transport, see lvDCOMTcpProtocol.h
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+#include <epicsMutex.h>
+#include <epicsGuard.h>
+
+#include "lvDCOMCapture.h"
+
+static const char capture_magic[] = "LVDCOMC1";
+
+bool CaptureValue::operator==(const CaptureValue& v) const
+{
+	if (kind != v.kind)
+	{
+		return false;
+	}
+	switch(kind)
+	{
+		case Boolean:
+		case Int32:
+			return ival == v.ival;
+		case Float64:
+			return memcmp(&dval, &(v.dval), sizeof(dval)) == 0;  // so NaN compares equal to itself
+		case String:
+			return sval == v.sval;
+		case Int32Array:
+		case BooleanArray:
+			return dims == v.dims && iarray == v.iarray;
+		case Float64Array:
+			return dims == v.dims && farray.size() == v.farray.size() &&
+			    (farray.size() == 0 || memcmp(&(farray[0]), &(v.farray[0]), farray.size() * sizeof(epicsFloat64)) == 0);
+		case Array:
+			return dims == v.dims && elements == v.elements;
+		default:
+			return true;
+	}
+}
+
+void capturePutU32(std::string& buffer, epicsUInt32 u)
+{
+	for(int i = 0; i < 4; ++i)
+	{
+		buffer.push_back(static_cast<char>((u >> (8 * i)) & 0xff));
+	}
+}
+
+void capturePutF64(std::string& buffer, epicsFloat64 d)
+{
+	epicsUInt32 words[2];
+	memcpy(words, &d, sizeof(d));
+	// IEEE754 doubles have the same word order as 64 bit integers on all platforms we support
+	const epicsUInt32 one = 1;
+	bool little = (*reinterpret_cast<const char*>(&one) == 1);
+	capturePutU32(buffer, little ? words[0] : words[1]);
+	capturePutU32(buffer, little ? words[1] : words[0]);
+}
+
+void capturePutString(std::string& buffer, const std::string& s)
+{
+	capturePutU32(buffer, static_cast<epicsUInt32>(s.size()));
+	buffer.append(s);
+}
+
+void capturePutValue(std::string& buffer, const CaptureValue& v)
+{
+	buffer.push_back(static_cast<char>(v.kind));
+	switch(v.kind)
+	{
+		case CaptureValue::Boolean:
+		case CaptureValue::Int32:
+			capturePutU32(buffer, static_cast<epicsUInt32>(v.ival));
+			return;
+		case CaptureValue::Float64:
+			capturePutF64(buffer, v.dval);
+			return;
+		case CaptureValue::String:
+			capturePutString(buffer, v.sval);
+			return;
+		case CaptureValue::Int32Array:
+		case CaptureValue::BooleanArray:
+		case CaptureValue::Float64Array:
+		case CaptureValue::Array:
+			break;
+		default:
+			return;
+	}
+	buffer.push_back(static_cast<char>(v.dims.size()));
+	for(size_t i = 0; i < v.dims.size(); ++i)
+	{
+		capturePutU32(buffer, v.dims[i]);
+	}
+	if (v.kind == CaptureValue::Int32Array || v.kind == CaptureValue::BooleanArray)
+	{
+		capturePutU32(buffer, static_cast<epicsUInt32>(v.iarray.size()));
+		for(size_t i = 0; i < v.iarray.size(); ++i)
+		{
+			capturePutU32(buffer, static_cast<epicsUInt32>(v.iarray[i]));
+		}
+	}
+	else if (v.kind == CaptureValue::Float64Array)
+	{
+		capturePutU32(buffer, static_cast<epicsUInt32>(v.farray.size()));
+		for(size_t i = 0; i < v.farray.size(); ++i)
+		{
+			capturePutF64(buffer, v.farray[i]);
+		}
+	}
+	else
+	{
+		capturePutU32(buffer, static_cast<epicsUInt32>(v.elements.size()));
+		for(size_t i = 0; i < v.elements.size(); ++i)
+		{
+			capturePutValue(buffer, v.elements[i]);
+		}
+	}
+}
+
+epicsUInt8 CaptureParser::getU8()
+{
+	if (!check(1))
+	{
+		return 0;
+	}
+	return static_cast<epicsUInt8>(m_buffer[m_pos++]);
+}
+
+epicsUInt32 CaptureParser::getU32()
+{
+	if (!check(4))
+	{
+		return 0;
+	}
+	epicsUInt32 u = 0;
+	for(int i = 0; i < 4; ++i)
+	{
+		u |= static_cast<epicsUInt32>(static_cast<unsigned char>(m_buffer[m_pos++])) << (8 * i);
+	}
+	return u;
+}
+
+epicsFloat64 CaptureParser::getF64()
+{
+	const epicsUInt32 one = 1;
+	bool little = (*reinterpret_cast<const char*>(&one) == 1);
+	epicsUInt32 words[2];
+	epicsUInt32 lo = getU32(), hi = getU32();
+	words[0] = (little ? lo : hi);
+	words[1] = (little ? hi : lo);
+	epicsFloat64 d;
+	memcpy(&d, words, sizeof(d));
+	return d;
+}
+
+std::string CaptureParser::getString()
+{
+	epicsUInt32 n = getU32();
+	if (!check(n))
+	{
+		return "";
+	}
+	std::string s(m_buffer, m_pos, n);
+	m_pos += n;
+	return s;
+}
+
+void CaptureParser::getValue(CaptureValue& v)
+{
+	v.kind = static_cast<CaptureValue::Kind>(getU8());
+	epicsUInt32 n;
+	switch(v.kind)
+	{
+		case CaptureValue::Empty:
+			return;
+		case CaptureValue::Boolean:
+		case CaptureValue::Int32:
+			v.ival = static_cast<epicsInt32>(getU32());
+			return;
+		case CaptureValue::Float64:
+			v.dval = getF64();
+			return;
+		case CaptureValue::String:
+			v.sval = getString();
+			return;
+		case CaptureValue::Int32Array:
+		case CaptureValue::BooleanArray:
+		case CaptureValue::Float64Array:
+		case CaptureValue::Array:
+			break;
+		default:
+			m_ok = false;
+			return;
+	}
+	v.dims.resize(getU8());
+	for(size_t i = 0; i < v.dims.size(); ++i)
+	{
+		v.dims[i] = getU32();
+	}
+	n = getU32();
+	// every element takes at least one byte, so this guards against allocating for a corrupt count
+	if (!check(n))
+	{
+		return;
+	}
+	if (v.kind == CaptureValue::Int32Array || v.kind == CaptureValue::BooleanArray)
+	{
+		v.iarray.resize(n);
+		for(epicsUInt32 i = 0; i < n && m_ok; ++i)
+		{
+			v.iarray[i] = static_cast<epicsInt32>(getU32());
+		}
+	}
+	else if (v.kind == CaptureValue::Float64Array)
+	{
+		v.farray.resize(n);
+		for(epicsUInt32 i = 0; i < n && m_ok; ++i)
+		{
+			v.farray[i] = getF64();
+		}
+	}
+	else
+	{
+		v.elements.resize(n);
+		for(epicsUInt32 i = 0; i < n && m_ok; ++i)
+		{
+			getValue(v.elements[i]);
+		}
+	}
+}
+
+bool CaptureParser::check(size_t n)
+{
+	if (m_ok && m_pos + n > m_buffer.size())
+	{
+		m_ok = false;
+	}
+	return m_ok;
+}
+
+lvDCOMCaptureWriter::lvDCOMCaptureWriter(const std::string& file_name) : m_file_name(file_name),
+    m_start(epicsTime::getCurrent()), m_records(0)
+{
+	m_fs.open(m_file_name.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!m_fs.good())
+	{
+		throw std::runtime_error("lvDCOMCaptureWriter: cannot create " + m_file_name);
+	}
+	m_fs.write(capture_magic, 8);
+}
+
+/// append \a rec to the file, \a start is when the operation began and is used to fill in its time and duration
+void lvDCOMCaptureWriter::write(CaptureRecord& rec, const epicsTime& start)
+{
+	epicsTime now = epicsTime::getCurrent();
+	epicsGuard<epicsMutex> _lock(m_lock);
+	if (!m_fs.is_open())
+	{
+		return;
+	}
+	rec.time = start - m_start;
+	rec.duration = now - start;
+	m_buffer.clear();
+	m_buffer.push_back(static_cast<char>(rec.op));
+	capturePutF64(m_buffer, rec.time);
+	capturePutF64(m_buffer, rec.duration);
+	capturePutU32(m_buffer, static_cast<epicsUInt32>(rec.hresult));
+	capturePutString(m_buffer, rec.vi);
+	capturePutString(m_buffer, rec.control);
+	capturePutValue(m_buffer, rec.value);
+	std::string length;
+	capturePutU32(length, static_cast<epicsUInt32>(m_buffer.size()));
+	m_fs.write(length.data(), length.size());
+	m_fs.write(m_buffer.data(), m_buffer.size());
+	++m_records;
+}
+
+void lvDCOMCaptureWriter::close()
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	if (m_fs.is_open())
+	{
+		m_fs.close();
+	}
+}
+
+lvDCOMCaptureReader::lvDCOMCaptureReader(const std::string& file_name) : m_file_name(file_name)
+{
+	char magic[8];
+	m_fs.open(m_file_name.c_str(), std::ios::in | std::ios::binary);
+	if (!m_fs.good())
+	{
+		throw std::runtime_error("lvDCOMCaptureReader: cannot open " + m_file_name);
+	}
+	if ( !m_fs.read(magic, sizeof(magic)) || memcmp(magic, capture_magic, sizeof(magic)) != 0 )
+	{
+		throw std::runtime_error("lvDCOMCaptureReader: " + m_file_name + " is not a capture file");
+	}
+}
+
+/// read the next record into \a rec, returns false at the end of the file. A record cut short by the IOC
+/// stopping while it was being written is treated as the end of the file, anything else damaged throws.
+bool lvDCOMCaptureReader::next(CaptureRecord& rec)
+{
+	char length[4];
+	if ( !m_fs.read(length, sizeof(length)) )
+	{
+		return false;
+	}
+	epicsUInt32 n = 0;
+	for(int i = 0; i < 4; ++i)
+	{
+		n |= static_cast<epicsUInt32>(static_cast<unsigned char>(length[i])) << (8 * i);
+	}
+	std::string buffer(n, '\0');
+	if ( n > 0 && !m_fs.read(&(buffer[0]), n) )
+	{
+		return false;
+	}
+	CaptureParser parser(buffer);
+	rec = CaptureRecord();
+	rec.op = static_cast<CaptureRecord::Op>(parser.getU8());
+	rec.time = parser.getF64();
+	rec.duration = parser.getF64();
+	rec.hresult = static_cast<epicsInt32>(parser.getU32());
+	rec.vi = parser.getString();
+	rec.control = parser.getString();
+	parser.getValue(rec.value);
+	if ( !parser.ok() || rec.op < CaptureRecord::Get || rec.op > CaptureRecord::Call )
+	{
+		throw std::runtime_error("lvDCOMCaptureReader: damaged record in " + m_file_name);
+	}
+	return true;
+}
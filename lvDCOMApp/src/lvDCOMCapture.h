@@ -0,0 +1,131 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMCapture.h header for #lvDCOMCaptureWriter and #lvDCOMCaptureReader classes.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+///
+/// A capture file records every GetControlValue, SetControlValue and Call made by #lvDCOMInterface, so real
+/// instrument traffic can be replayed later by lvDCOMReplay against #lvDCOMSimBackend. Nothing here depends
+/// on Windows, values are held as #CaptureValue rather than VARIANT and the file is always little endian.
+
+#ifndef LV_DCOM_CAPTURE_H
+#define LV_DCOM_CAPTURE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+#include <epicsMutex.h>
+
+/// Portable copy of a VARIANT value passed to or from LabVIEW
+struct CaptureValue
+{
+	enum Kind
+	{
+		Empty = 0,         ///< VT_EMPTY, or a type we cannot represent
+		Boolean = 1,       ///< uses ival
+		Int32 = 2,         ///< uses ival
+		Float64 = 3,       ///< uses dval
+		String = 4,        ///< uses sval (UTF-8)
+		Int32Array = 5,    ///< uses dims and iarray
+		Float64Array = 6,  ///< uses dims and farray
+		Array = 7,         ///< array of anything else (strings, variants), uses dims and elements
+		BooleanArray = 8   ///< uses dims and iarray, each element 0 or -1 as VARIANT_BOOL
+	};
+	Kind kind;
+	epicsInt32 ival;
+	epicsFloat64 dval;
+	std::string sval;
+	std::vector<epicsUInt32> dims;  ///< array dimensions, slowest varying first
+	std::vector<epicsInt32> iarray;
+	std::vector<epicsFloat64> farray;
+	std::vector<CaptureValue> elements;
+	CaptureValue() : kind(Empty), ival(0), dval(0.0) { }
+	bool operator==(const CaptureValue& v) const;
+	bool operator!=(const CaptureValue& v) const { return !(*this == v); }
+};
+
+/// One operation made on a LabVIEW VI
+struct CaptureRecord
+{
+	enum Op
+	{
+		Get = 1,    ///< GetControlValue, value is what was read
+		Set = 2,    ///< SetControlValue, value is what was written
+		Call = 3    ///< Call, control is empty and value is the array of values returned
+	};
+	Op op;
+	double time;          ///< seconds from start of capture to start of operation
+	double duration;      ///< seconds the operation took
+	epicsInt32 hresult;   ///< HRESULT of the operation, negative if it failed
+	std::string vi;
+	std::string control;
+	CaptureValue value;
+	CaptureRecord() : op(Get), time(0.0), duration(0.0), hresult(0) { }
+};
+
+void capturePutU32(std::string& buffer, epicsUInt32 u);
+void capturePutF64(std::string& buffer, epicsFloat64 d);
+void capturePutString(std::string& buffer, const std::string& s);
+void capturePutValue(std::string& buffer, const CaptureValue& v);
+
+/// Sequential decoding of a capture record body, or of a TCP transport message, every get fails once any read has run past the end
+class CaptureParser
+{
+public:
+	CaptureParser(const std::string& buffer) : m_buffer(buffer), m_pos(0), m_ok(true) { }
+	bool ok() const { return m_ok; }
+	bool atEnd() const { return m_pos == m_buffer.size(); }
+	epicsUInt8 getU8();
+	epicsUInt32 getU32();
+	epicsFloat64 getF64();
+	std::string getString();
+	void getValue(CaptureValue& v);
+private:
+	const std::string& m_buffer;
+	size_t m_pos;
+	bool m_ok;
+	bool check(size_t n);
+};
+
+/// Appends #CaptureRecord to a capture file, may be called from any thread
+class lvDCOMCaptureWriter
+{
+public:
+	explicit lvDCOMCaptureWriter(const std::string& file_name);
+	~lvDCOMCaptureWriter() { close(); }
+	void write(CaptureRecord& rec, const epicsTime& start);
+	void close();
+	const std::string& fileName() const { return m_file_name; }
+	unsigned long records() const { return m_records; }
+	/// time capture started, #CaptureRecord::time is relative to this
+	const epicsTime& startTime() const { return m_start; }
+
+private:
+	std::string m_file_name;
+	std::fstream m_fs;
+	epicsMutex m_lock;
+	epicsTime m_start;
+	unsigned long m_records;
+	std::string m_buffer;   ///< re-used for serialising each record
+};
+
+/// Reads #CaptureRecord back from a file written by #lvDCOMCaptureWriter
+class lvDCOMCaptureReader
+{
+public:
+	explicit lvDCOMCaptureReader(const std::string& file_name);
+	bool next(CaptureRecord& rec);
+
+private:
+	std::string m_file_name;
+	std::fstream m_fs;
+};
+
+#endif /* LV_DCOM_CAPTURE_H */
@@ -0,0 +1,108 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMCircuitBreaker.cpp Implementation of #lvDCOMCircuitBreaker class.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#include <stdio.h>
+
+#include <epicsMutex.h>
+#include <epicsGuard.h>
+#include <epicsTime.h>
+
+#include "lvDCOMCircuitBreaker.h"
+
+lvDCOMCircuitBreaker::lvDCOMCircuitBreaker(double retry_interval) : m_state(Closed), m_retry_interval(retry_interval),
+    m_next_probe(epicsTime::getCurrent()), m_refused(0), m_trips(0)
+{
+}
+
+/// returns true if the caller may go ahead and make a request. If this returns true the caller
+/// must later call either recordSuccess() or recordFailure()
+bool lvDCOMCircuitBreaker::allowRequest()
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	switch(m_state)
+	{
+		case Closed:
+			return true;
+
+		case Open:
+			if (epicsTime::getCurrent() >= m_next_probe)
+			{
+				m_state = HalfOpen; // this caller is the probe, everybody else is refused until it completes
+				return true;
+			}
+			break;
+
+		case HalfOpen:
+		default:
+			break;
+	}
+	++m_refused;
+	return false;
+}
+
+void lvDCOMCircuitBreaker::recordSuccess()
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	m_state = Closed;
+}
+
+void lvDCOMCircuitBreaker::recordFailure()
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	if (m_state == Closed)
+	{
+		++m_trips;
+	}
+	m_state = Open;
+	m_next_probe = epicsTime::getCurrent() + m_retry_interval;
+}
+
+/// an allowed request was abandoned without testing the resource, so let somebody else probe
+void lvDCOMCircuitBreaker::cancelRequest()
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	if (m_state == HalfOpen)
+	{
+		m_state = Open;
+	}
+}
+
+lvDCOMCircuitBreaker::State lvDCOMCircuitBreaker::state()
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	return m_state;
+}
+
+void lvDCOMCircuitBreaker::setRetryInterval(double retry_interval)
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	m_retry_interval = retry_interval;
+}
+
+const char* lvDCOMCircuitBreaker::stateName(State state)
+{
+	switch(state)
+	{
+		case Closed:
+			return "closed";
+		case Open:
+			return "open";
+		case HalfOpen:
+			return "half-open";
+		default:
+			return "unknown";
+	}
+}
+
+void lvDCOMCircuitBreaker::report(FILE* fp, const char* name)
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	fprintf(fp, "Circuit breaker \"%s\": %s (tripped %lu times, %lu requests refused)\n", name, stateName(m_state), m_trips, m_refused);
+}
@@ -0,0 +1,46 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMCircuitBreaker.h header for #lvDCOMCircuitBreaker class.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#ifndef LV_DCOM_CIRCUIT_BREAKER_H
+#define LV_DCOM_CIRCUIT_BREAKER_H
+
+#include <stdio.h>
+
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+/// Circuit breaker used to fail fast when LabVIEW, or a particular VI, is unavailable.
+/// When closed all requests are allowed. After a failure the breaker opens and requests are refused
+/// until \a retry_interval has passed, a single probe request is then allowed through (half open) and
+/// its outcome either closes the breaker again or re-opens it for another interval.
+class lvDCOMCircuitBreaker
+{
+public:
+	enum State { Closed = 0, Open = 1, HalfOpen = 2 };
+	explicit lvDCOMCircuitBreaker(double retry_interval = 5.0);
+	bool allowRequest();
+	void recordSuccess();
+	void recordFailure();
+	void cancelRequest();
+	State state();
+	void setRetryInterval(double retry_interval);
+	void report(FILE* fp, const char* name);
+	static const char* stateName(State state);
+
+private:
+	epicsMutex m_lock;
+	State m_state;
+	double m_retry_interval; ///< seconds to stay open before allowing a probe request
+	epicsTime m_next_probe;  ///< earliest time we will let a probe request through
+	unsigned long m_refused; ///< number of requests refused while open
+	unsigned long m_trips;   ///< number of times we have gone from closed to open
+};
+
+#endif /* LV_DCOM_CIRCUIT_BREAKER_H */
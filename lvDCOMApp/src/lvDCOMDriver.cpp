@@ -16,6 +16,8 @@
 #include <exception>
 #include <iostream>
 #include <map>
+#include <set>
+#include <algorithm>
 
 #include <epicsTypes.h>
 #include <epicsTime.h>
@@ -24,8 +26,11 @@
 #include <epicsTimer.h>
 #include <epicsMutex.h>
 #include <epicsEvent.h>
+#include <epicsAlgorithm.h>
 #include <errlog.h>
 #include <iocsh.h>
+#include <initHooks.h>
+#include <alarm.h>
 
 #include "lvDCOMDriver.h"
 #include <epicsExport.h>
@@ -49,6 +54,20 @@ static void registerStructuredExceptionHandler()
 	_set_se_translator(seTransFunction);
 }
 
+/// Map an exception thrown by #lvDCOMInterface to the asyn status to return to the record
+static asynStatus exceptionStatus(const std::exception& ex)
+{
+	if (dynamic_cast<const COMTimeoutException*>(&ex) != NULL)
+	{
+		return asynTimeout;
+	}
+	if (dynamic_cast<const COMDisconnectedException*>(&ex) != NULL)
+	{
+		return asynDisconnected;
+	}
+	return asynError;
+}
+
 template<typename T>
 asynStatus lvDCOMDriver::writeValue(asynUser *pasynUser, const char* functionName, T value)
 {
@@ -63,19 +82,49 @@ asynStatus lvDCOMDriver::writeValue(asynUser *pasynUser, const char* functionNam
 		{
 			throw std::runtime_error("m_lvdcom is NULL");
 		}
-		m_lvdcom->setLabviewValue(paramName, value);
+		T readback;
+		bool readback_valid = m_lvdcom->setLabviewValue(paramName, value, (hasReadback(function) ? &readback : NULL));
 		asynPrint(pasynUser, ASYN_TRACEIO_DRIVER, 
 			"%s:%s: function=%d, name=%s, value=%s\n", 
 			driverName, functionName, function, paramName, convertToString(value).c_str());
+		if (readback_valid)
+		{
+			postReadback(function, readback, asynSuccess);
+		}
+		requestPoll(function);
 		return asynSuccess;
 	}
 	catch(const std::exception& ex)
 	{
+		status = exceptionStatus(ex);
 		epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize, 
 			"%s:%s: status=%d, function=%d, name=%s, value=%s, error=%s", 
 			driverName, functionName, status, function, paramName, convertToString(value).c_str(), ex.what());
-		return asynError;
+		postReadback(function, value, status);
+		return status;
+	}
+}
+
+/// Update the parameters that read back the control written by parameter \a function with the value 
+/// returned from the write, or just their status if the write failed. Called with the port lock held.
+template<typename T>
+void lvDCOMDriver::postReadback(int function, const T& value, asynStatus status)
+{
+	std::map<int, std::vector<int> >::const_iterator it = m_readbacks.find(function);
+	if (it == m_readbacks.end())
+	{
+		return;
 	}
+	for(std::vector<int>::const_iterator itr = it->second.begin(); itr != it->second.end(); ++itr)
+	{
+		if (status == asynSuccess)
+		{
+			setParamValue(*itr, value);
+			markLive(*itr);
+		}
+		setParamStatus(*itr, status);
+	}
+	callParamCallbacks();
 }
 
 template<typename T>
@@ -86,6 +135,16 @@ asynStatus lvDCOMDriver::readValue(asynUser *pasynUser, const char* functionName
 	const char *paramName = NULL;
 	registerStructuredExceptionHandler();
 	getParamName(function, &paramName);
+	if (isPolled(function))
+	{
+		// value is kept up to date by lvDCOMPollTask()
+		if ( (status = getParamValue(function, value)) == asynSuccess )
+		{
+			getParamStatus(function, &status);
+			staleValue(pasynUser, function);
+		}
+		return status;
+	}
 	try
 	{
 		if (m_lvdcom == NULL)
@@ -96,14 +155,20 @@ asynStatus lvDCOMDriver::readValue(asynUser *pasynUser, const char* functionName
 		asynPrint(pasynUser, ASYN_TRACEIO_DRIVER, 
 			"%s:%s: function=%d, name=%s, value=%s\n", 
 			driverName, functionName, function, paramName, convertToString(*value).c_str());
+		recordValue(function, *value);
 		return asynSuccess;
 	}
 	catch(const std::exception& ex)
 	{
+		status = exceptionStatus(ex);
 		epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize, 
 			"%s:%s: status=%d, function=%d, name=%s, value=%s, error=%s", 
 			driverName, functionName, status, function, paramName, convertToString(*value).c_str(), ex.what());
-		return asynError;
+		if (staleValue(pasynUser, function) && getParamValue(function, value) == asynSuccess)
+		{
+			return asynSuccess;
+		}
+		return status;
 	}
 }
 
@@ -115,26 +180,46 @@ asynStatus lvDCOMDriver::readArray(asynUser *pasynUser, const char* functionName
 	const char *paramName = NULL;
 	registerStructuredExceptionHandler();
 	getParamName(function, &paramName);
-
+	lvDCOMArrayBuffer<T>* buffer = findArrayBuffer(function, value);
+	size_t dims[2] = { 0, 0 };
+	if (buffer != NULL)
+	{
+		// copy of the array last read by lvDCOMPollTask(), we hold the port lock so it cannot be swapped under us
+		*nIn = buffer->read(value, nElements);
+		getParamStatus(function, &status);
+		staleValue(pasynUser, function);
+		return status;
+	}
 	try
 	{
 		if (m_lvdcom == NULL)
 		{
 			throw std::runtime_error("m_lvdcom is NULL");
 		}
-		m_lvdcom->getLabviewValue(paramName, value, nElements, *nIn);
+		m_lvdcom->getLabviewValue(paramName, value, nElements, *nIn, dims);
 		asynPrint(pasynUser, ASYN_TRACEIO_DRIVER, 
 			"%s:%s: function=%d, name=%s\n", 
 			driverName, functionName, function, paramName);
+		bool derived = addArraySample(function, value, *nIn);
+		if (m_array_dims.count(function) > 0)
+		{
+			setArrayDims(function, dims);
+			derived = true;
+		}
+		if (derived)
+		{
+			callParamCallbacks();
+		}
 		return asynSuccess;
 	}
 	catch(const std::exception& ex)
 	{
+		status = exceptionStatus(ex);
 		*nIn = 0;
 		epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize, 
 			"%s:%s: status=%d, function=%d, name=%s, error=%s", 
 			driverName, functionName, status, function, paramName, ex.what());
-		return asynError;
+		return status;
 	}
 }
 
@@ -145,11 +230,55 @@ asynStatus lvDCOMDriver::writeFloat64(asynUser *pasynUser, epicsFloat64 value)
 
 asynStatus lvDCOMDriver::writeInt32(asynUser *pasynUser, epicsInt32 value)
 {
+	if (m_write_groups.count(pasynUser->reason) > 0)
+	{
+		return writeGroup(pasynUser, value);
+	}
 	return writeValue(pasynUser, "writeInt32", value);
 }
 
+/// Writing non-zero to a write group parameter commits the values staged by writes to its members, zero discards them
+asynStatus lvDCOMDriver::writeGroup(asynUser *pasynUser, epicsInt32 value)
+{
+	int function = pasynUser->reason;
+	asynStatus status = asynSuccess;
+	const char *paramName = NULL;
+	const char* functionName = "writeGroup";
+	registerStructuredExceptionHandler();
+	getParamName(function, &paramName);
+	try
+	{
+		m_lvdcom->commitWriteGroup(paramName, (value != 0));
+		asynPrint(pasynUser, ASYN_TRACEIO_DRIVER, 
+			"%s:%s: function=%d, name=%s, value=%d\n", 
+			driverName, functionName, function, paramName, value);
+		setIntegerParam(function, 0);
+		setParamStatus(function, asynSuccess);
+		callParamCallbacks();
+		return asynSuccess;
+	}
+	catch(const std::exception& ex)
+	{
+		status = exceptionStatus(ex);
+		epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize, 
+			"%s:%s: status=%d, function=%d, name=%s, value=%d, error=%s", 
+			driverName, functionName, status, function, paramName, value, ex.what());
+		setParamStatus(function, status);
+		callParamCallbacks();
+		return status;
+	}
+}
+
 asynStatus lvDCOMDriver::readFloat64Array(asynUser *pasynUser, epicsFloat64 *value, size_t nElements, size_t *nIn)
 {
+	std::map<int, int>::const_iterator it = m_history_params.find(pasynUser->reason);
+	if (it != m_history_params.end())
+	{
+		// the history is kept by the driver, LabVIEW is not asked
+		const lvDCOMHistory& h = *(m_history[it->second]);
+		*nIn = (pasynUser->reason == h.valuesParam() ? h.copyValues(value, nElements) : h.copyTimes(value, nElements));
+		return asynSuccess;
+	}
 	return readArray(pasynUser, "readFloat64Array", value, nElements, nIn);
 }
 
@@ -158,32 +287,189 @@ asynStatus lvDCOMDriver::readInt32Array(asynUser *pasynUser, epicsInt32 *value,
 	return readArray(pasynUser, "readInt32Array", value, nElements, nIn);
 }
 
+/// read a word of a booleanarray parameter, the whole array is read from LabVIEW (unless it is polled) and all its words updated
+asynStatus lvDCOMDriver::readUInt32Digital(asynUser *pasynUser, epicsUInt32 *value, epicsUInt32 mask)
+{
+	int function = pasynUser->reason;
+	asynStatus status = asynSuccess;
+	const char *functionName = "readUInt32Digital";
+	const char *paramName = NULL;
+	registerStructuredExceptionHandler();
+	std::map<int, std::pair<int,int> >::const_iterator itw = m_word_of.find(function);
+	if (itw == m_word_of.end())
+	{
+		return asynPortDriver::readUInt32Digital(pasynUser, value, mask);
+	}
+	int index = itw->second.first;
+	getParamName(index, &paramName);
+	if (!isPolled(index))
+	{
+		std::vector<epicsUInt32> words;
+		try
+		{
+			m_lvdcom->getLabviewBits(paramName, words);
+			asynPrint(pasynUser, ASYN_TRACEIO_DRIVER, 
+				"%s:%s: function=%d, name=%s, words=%d\n", 
+				driverName, functionName, function, paramName, static_cast<int>(words.size()));
+		}
+		catch(const std::exception& ex)
+		{
+			status = exceptionStatus(ex);
+			epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize, 
+				"%s:%s: status=%d, function=%d, name=%s, error=%s", 
+				driverName, functionName, status, function, paramName, ex.what());
+		}
+		setBitWords(index, words, status);
+		callParamCallbacks();
+		if (status != asynSuccess)
+		{
+			return status;
+		}
+	}
+	if ( (status = getUIntDigitalParam(function, value, mask)) == asynSuccess )
+	{
+		getParamStatus(function, &status);
+	}
+	return status;
+}
+
+/// Masked write to a word of a booleanarray parameter, only the LabVIEW array elements for the bits in \a mask are changed
+asynStatus lvDCOMDriver::writeUInt32Digital(asynUser *pasynUser, epicsUInt32 value, epicsUInt32 mask)
+{
+	int function = pasynUser->reason;
+	asynStatus status = asynSuccess;
+	const char *functionName = "writeUInt32Digital";
+	const char *paramName = NULL;
+	registerStructuredExceptionHandler();
+	std::map<int, std::pair<int,int> >::const_iterator itw = m_word_of.find(function);
+	if (itw == m_word_of.end())
+	{
+		return asynPortDriver::writeUInt32Digital(pasynUser, value, mask);
+	}
+	int index = itw->second.first;
+	getParamName(index, &paramName);
+	try
+	{
+		if (m_lvdcom == NULL)
+		{
+			throw std::runtime_error("m_lvdcom is NULL");
+		}
+		m_lvdcom->setLabviewBits(paramName, itw->second.second, value, mask);
+		asynPrint(pasynUser, ASYN_TRACEIO_DRIVER, 
+			"%s:%s: function=%d, name=%s, word=%d, value=0x%x, mask=0x%x\n", 
+			driverName, functionName, function, paramName, itw->second.second, value, mask);
+		setUIntDigitalParam(function, value, mask);
+		callParamCallbacks();
+		requestPoll(index);
+		return asynSuccess;
+	}
+	catch(const std::exception& ex)
+	{
+		status = exceptionStatus(ex);
+		epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize, 
+			"%s:%s: status=%d, function=%d, name=%s, value=0x%x, mask=0x%x, error=%s", 
+			driverName, functionName, status, function, paramName, value, mask, ex.what());
+		return status;
+	}
+}
+
+/// Set the words of booleanarray parameter \a index from \a words, just read from LabVIEW with \a status. Records only get
+/// a callback for bits in their mask that have changed. Called with the port lock held. Returns true if any bit or the status changed.
+bool lvDCOMDriver::setBitWords(int index, const std::vector<epicsUInt32>& words, asynStatus status)
+{
+	bool changed = false;
+	std::vector<int>& word_params = m_bit_words[index];
+	for(size_t j = 0; j < word_params.size(); ++j)
+	{
+		asynStatus old_status = asynSuccess;
+		getParamStatus(word_params[j], &old_status);
+		if (status == asynSuccess && j < words.size())
+		{
+			epicsUInt32 old_value = 0;
+			changed |= ( getUIntDigitalParam(word_params[j], &old_value, 0xFFFFFFFF) != asynSuccess || old_value != words[j] );
+			setUIntDigitalParam(word_params[j], words[j], 0xFFFFFFFF);
+			markLive(word_params[j]);
+		}
+		changed |= (old_status != status);
+		setParamStatus(word_params[j], status);
+	}
+	return changed;
+}
+
 asynStatus lvDCOMDriver::readFloat64(asynUser *pasynUser, epicsFloat64 *value)
 {
+	if (m_stats_params.count(pasynUser->reason) > 0)
+	{
+		// set when the parameter they are the statistics of is read
+		return getDoubleParam(pasynUser->reason, value);
+	}
 	return readValue(pasynUser, "readFloat64", value);
 }
 
 asynStatus lvDCOMDriver::readInt32(asynUser *pasynUser, epicsInt32 *value)
 {
+	if (m_write_groups.count(pasynUser->reason) > 0)
+	{
+		// number of member writes waiting to be committed
+		const char *paramName = NULL;
+		getParamName(pasynUser->reason, &paramName);
+		*value = m_lvdcom->stagedWrites(paramName);
+		return asynSuccess;
+	}
+	if (m_dims_params.count(pasynUser->reason) > 0)
+	{
+		// set when the 2D array is read
+		return getIntegerParam(pasynUser->reason, value);
+	}
+	if (m_state_params.count(pasynUser->reason) > 0)
+	{
+		// set by lvDCOMViStateTask()
+		return getIntegerParam(pasynUser->reason, value);
+	}
 	return readValue(pasynUser, "readInt32", value);
 }
 
 asynStatus lvDCOMDriver::readOctet(asynUser *pasynUser, char *value, size_t maxChars, size_t *nActual, int *eomReason)
 {
 	int function = pasynUser->reason;
-	int status=0;
+	asynStatus status = asynSuccess;
 	const char *functionName = "readOctet";
 	const char *paramName = NULL;
 	registerStructuredExceptionHandler();
 	getParamName(function, &paramName);
 	std::string value_s;
+	size_t dims[2] = { 0, 0 };
+	if (isPolled(function))
+	{
+		if ( (status = getStringParam(function, static_cast<int>(maxChars), value)) == asynSuccess )
+		{
+			*nActual = strlen(value);
+			getParamStatus(function, &status);
+			staleValue(pasynUser, function);
+		}
+		else
+		{
+			*nActual = 0;
+		}
+		if (eomReason) { *eomReason = ASYN_EOM_END; }
+		return status;
+	}
 	try
 	{
 		if (m_lvdcom == NULL)
 		{
 			throw std::runtime_error("m_lvdcom is NULL");
 		}
-		m_lvdcom->getLabviewValue(paramName, &value_s);
+		if (isTable(function))
+		{
+			m_lvdcom->getLabviewTable(paramName, &value_s, dims);
+			setArrayDims(function, dims);
+			callParamCallbacks();
+		}
+		else
+		{
+			m_lvdcom->getLabviewValue(paramName, &value_s);
+		}
 		if ( value_s.size() > maxChars ) // did we read more than we have space for?
 		{
 			*nActual = maxChars;
@@ -201,17 +487,24 @@ asynStatus lvDCOMDriver::readOctet(asynUser *pasynUser, char *value, size_t maxC
 				driverName, functionName, function, paramName, value_s.c_str());
 		}
 		strncpy(value, value_s.c_str(), maxChars); // maxChars  will NULL pad if possible, change to  *nActual  if we do not want this
+		recordValue(function, value_s);
 		return asynSuccess;
 	}
 	catch(const std::exception& ex)
 	{
+		status = exceptionStatus(ex);
 		epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize, 
 			"%s:%s: status=%d, function=%d, name=%s, value=\"%s\", error=%s", 
 			driverName, functionName, status, function, paramName, value_s.c_str(), ex.what());
-		*nActual = 0;
 		if (eomReason) { *eomReason = ASYN_EOM_END; }
+		if (staleValue(pasynUser, function) && getStringParam(function, static_cast<int>(maxChars), value) == asynSuccess)
+		{
+			*nActual = strlen(value);
+			return asynSuccess;
+		}
+		*nActual = 0;
 		value[0] = '\0';
-		return asynError;
+		return status;
 	}
 }
 
@@ -230,20 +523,28 @@ asynStatus lvDCOMDriver::writeOctet(asynUser *pasynUser, const char *value, size
 		{
 			throw std::runtime_error("m_lvdcom is NULL");
 		}
-		m_lvdcom->setLabviewValue(paramName, value_s);
+		std::string readback;
+		bool readback_valid = m_lvdcom->setLabviewValue(paramName, value_s, (hasReadback(function) ? &readback : NULL));
 		asynPrint(pasynUser, ASYN_TRACEIO_DRIVER, 
 			"%s:%s: function=%d, name=%s, value=%s\n", 
 			driverName, functionName, function, paramName, value_s.c_str());
 		*nActual = value_s.size();
+		if (readback_valid)
+		{
+			postReadback(function, readback, asynSuccess);
+		}
+		requestPoll(function);
 		return asynSuccess;
 	}
 	catch(const std::exception& ex)
 	{
+		status = exceptionStatus(ex);
 		epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize, 
 			"%s:%s: status=%d, function=%d, name=%s, value=%s, error=%s", 
 			driverName, functionName, status, function, paramName, value_s.c_str(), ex.what());
 		*nActual = 0;
-		return asynError;
+		postReadback(function, value_s, status);
+		return status;
 	}
 }
 
@@ -255,6 +556,78 @@ void lvDCOMDriver::report(FILE* fp, int details)
 	{
 		fprintf(fp, "Asyn param \"%s\" lvdcom type \"%s\"\n", it->first.c_str(), it->second.c_str());
 	}
+	if (m_reloads > 0 || m_reload_errors > 0)
+	{
+		fprintf(fp, "Configuration reloaded %lu times, %lu failed reloads\n", m_reloads, m_reload_errors);
+	}
+	if (m_polled.size() > 0)
+	{
+		fprintf(fp, "Polling budget %g reads per second (0 = unlimited), %lu reads deferred by budget\n", m_lvdcom->getPollBudget(), m_polls_deferred);
+	}
+	if (m_vi_state_period > 0.0)
+	{
+		fprintf(fp, "Checking %d VI(s) are running every %g seconds, %d not running, %lu reads not made as the VI was not running, %lu VI restarts\n", 
+			static_cast<int>(m_vi_state_params.size()), m_vi_state_period, static_cast<int>(m_idle_vis.size()), m_polls_suspended, m_vi_restarts);
+		for(std::set<std::string>::const_iterator it = m_idle_vis.begin(); it != m_idle_vis.end(); ++it)
+		{
+			fprintf(fp, "  \"%s\" is not running\n", it->c_str());
+		}
+	}
+	if (m_snapshot != NULL)
+	{
+		fprintf(fp, "Snapshot file \"%s\" saved every %g seconds, %lu saves, %lu failed saves, %lu values not yet read since preload\n", 
+			m_snapshot->fileName().c_str(), m_snapshot_period, m_snapshots_saved, m_snapshot_errors, static_cast<unsigned long>(m_stale.size()));
+	}
+	if (m_table != NULL)
+	{
+		fprintf(fp, "Value table \"%s\" of %d slots, %lu slot updates, %lu left out for want of a slot\n", m_table->fileName().c_str(), 
+			static_cast<int>(m_table->slots()), m_table->updates(), m_table->dropped());
+	}
+	for(polled_map_t::const_iterator it=m_polled.begin(); it != m_polled.end(); ++it)
+	{
+		const PolledParam& p = it->second;
+		fprintf(fp, "Asyn param \"%s\" polled every %g seconds (last status %d)", p.name.c_str(), p.period, p.status);
+		if (p.adaptive())
+		{
+			fprintf(fp, ", adaptive %g to %g seconds, %lu changes", p.poll_min, p.poll_max, p.changes);
+		}
+		if (p.cluster.size() > 0)
+		{
+			fprintf(fp, ", cluster element read with %d other polled element(s)", static_cast<int>(m_clusters[p.cluster].size()) - 1);
+		}
+		if (p.type == asynParamUInt32Digital)
+		{
+			fprintf(fp, ", %d word(s) from one read", static_cast<int>(m_bit_words[p.index].size()));
+		}
+		if (p.type == asynParamFloat64Array || p.type == asynParamInt32Array)
+		{
+			fprintf(fp, ", deadband %g, %lu updates posted, %lu unchanged updates suppressed", p.deadband, p.updates, p.suppressed);
+		}
+		fprintf(fp, "\n");
+	}
+	for(std::map<int, lvDCOMHistory*>::const_iterator it=m_history.begin(); it != m_history.end(); ++it)
+	{
+		const char* paramName = NULL;
+		getParamName(it->first, &paramName);
+		const lvDCOMHistory& h = *(it->second);
+		fprintf(fp, "Asyn param \"%s\" history of %d samples (%d held) posted at most every %g seconds, %lu samples, %lu posts\n", 
+			(paramName != NULL ? paramName : ""), static_cast<int>(h.capacity()), static_cast<int>(h.size()), h.period(), h.samples(), h.posts());
+	}
+	for(std::map<int, lvDCOMStats*>::const_iterator it=m_stats.begin(); it != m_stats.end(); ++it)
+	{
+		const char* paramName = NULL;
+		getParamName(it->first, &paramName);
+		const lvDCOMStats& s = *(it->second);
+		if (s.window() > 0)
+		{
+			fprintf(fp, "Asyn param \"%s\" statistics over the last %d values (%d held), %lu values\n", 
+				(paramName != NULL ? paramName : ""), static_cast<int>(s.window()), static_cast<int>(s.size()), s.samples());
+		}
+		else
+		{
+			fprintf(fp, "Asyn param \"%s\" statistics of each array, %lu arrays\n", (paramName != NULL ? paramName : ""), s.samples());
+		}
+	}
 	if (m_lvdcom != NULL)
 	{
 		m_lvdcom->report(fp, details);
@@ -276,47 +649,32 @@ lvDCOMDriver::lvDCOMDriver(lvDCOMInterface* dcomint, const char *portName)
 	: asynPortDriver(portName, 
 	0, /* maxAddr */ 
 	dcomint->nParams(),
-	asynInt32Mask | asynInt32ArrayMask | asynFloat64Mask | asynFloat64ArrayMask | asynOctetMask | asynDrvUserMask, /* Interface mask */
-	asynInt32Mask | asynInt32ArrayMask | asynFloat64Mask | asynFloat64ArrayMask | asynOctetMask,  /* Interrupt mask */
+	asynInt32Mask | asynInt32ArrayMask | asynFloat64Mask | asynFloat64ArrayMask | asynOctetMask | asynUInt32DigitalMask | asynDrvUserMask, /* Interface mask */
+	asynInt32Mask | asynInt32ArrayMask | asynFloat64Mask | asynFloat64ArrayMask | asynOctetMask | asynUInt32DigitalMask,  /* Interrupt mask */
 	ASYN_CANBLOCK, /* asynFlags.  This driver can block but it is not multi-device */
 	1, /* Autoconnect */
 	0, /* Default priority */
 	0),	/* Default stack size*/
-	m_lvdcom(dcomint)
+	m_lvdcom(dcomint), m_polls_deferred(0), m_snapshot(NULL), m_snapshot_period(60.0), m_snapshots_saved(0), m_snapshot_errors(0),
+	m_poller_started(false), m_reloads(0), m_reload_errors(0), m_table(NULL), m_vi_state_period(0.0), m_polls_suspended(0), m_vi_restarts(0)
 {
-	int i;
 	const char *functionName = "lvDCOMDriver";
+	m_vi_state_period = m_lvdcom->getViStatePeriod();
 	m_lvdcom->getParams(m_params);
 	for(std::map<std::string,std::string>::const_iterator it=m_params.begin(); it != m_params.end(); ++it)
 	{
-		if (it->second == "float64")
-		{
-			createParam(it->first.c_str(), asynParamFloat64, &i);
-		}
-		else if (it->second == "int32" || it->second == "enum" || it->second == "ring" || it->second == "boolean")
-		{
-			createParam(it->first.c_str(), asynParamInt32, &i);
-		}
-		else if (it->second == "string")
-		{
-			createParam(it->first.c_str(), asynParamOctet, &i);
-		}
-		else if (it->second == "float64array")
-		{
-			createParam(it->first.c_str(), asynParamFloat64Array, &i);
-		}
-		else if (it->second == "int32array")
-		{
-			createParam(it->first.c_str(), asynParamInt32Array, &i);
-		}
-		else
+		int i = createLvParam(it->first, it->second);
+		if (i >= 0 && m_write_groups.count(i) == 0)
 		{
-			errlogSevPrintf(errlogMajor, "%s:%s: unknown type %s for parameter %s\n", driverName, functionName, it->second.c_str(), it->first.c_str());
-//			std::cerr << driverName << ":" << functionName << ": unknown type " << it->second << " for parameter " << it->first << std::endl;
+			addPolledParam(i, it->first, m_param_types[i]);
 		}
 	}
+	createViStateParams();
+	buildReadbacks();
+	loadSnapshot();
+	openValueTable();
 
-	// Create the thread for background tasks (not used at present, could be used for I/O intr scanning) 
+	// Create the thread for background tasks 
 	if (epicsThreadCreate("lvDCOMDriverTask",
 		epicsThreadPriorityMedium,
 		epicsThreadGetStackSize(epicsThreadStackMedium),
@@ -325,55 +683,1452 @@ lvDCOMDriver::lvDCOMDriver(lvDCOMInterface* dcomint, const char *portName)
 		printf("%s:%s: epicsThreadCreate failure\n", driverName, functionName);
 		return;
 	}
+	if (m_polled.size() > 0)
+	{
+		startPoller();
+	}
+	if (m_snapshot != NULL && epicsThreadCreate("lvDCOMSnapshot",
+		epicsThreadPriorityLow,
+		epicsThreadGetStackSize(epicsThreadStackMedium),
+		(EPICSTHREADFUNC)lvDCOMSnapshotTaskC, this) == 0)
+	{
+		printf("%s:%s: epicsThreadCreate failure\n", driverName, functionName);
+		return;
+	}
+	if (m_lvdcom->getReloadPeriod() > 0.0 && epicsThreadCreate("lvDCOMReload",
+		epicsThreadPriorityLow,
+		epicsThreadGetStackSize(epicsThreadStackMedium),
+		(EPICSTHREADFUNC)lvDCOMReloadTaskC, this) == 0)
+	{
+		printf("%s:%s: epicsThreadCreate failure\n", driverName, functionName);
+		return;
+	}
+	if (m_vi_state_period > 0.0 && epicsThreadCreate("lvDCOMViState",
+		epicsThreadPriorityLow,
+		epicsThreadGetStackSize(epicsThreadStackMedium),
+		(EPICSTHREADFUNC)lvDCOMViStateTaskC, this) == 0)
+	{
+		printf("%s:%s: epicsThreadCreate failure\n", driverName, functionName);
+		return;
+	}
 }
 
-void lvDCOMDriver::lvDCOMTaskC(void* arg) 
-{ 
-	lvDCOMDriver* driver = (lvDCOMDriver*)arg;
-	driver->lvDCOMTask();
-}
-
-/// @todo Might use this for background polling if implementing I/O Intr scanning
-void lvDCOMDriver::lvDCOMTask() 
-{ 
-	registerStructuredExceptionHandler();
-	while(true)
+/// Create the asyn parameter (or find it, if it survives from before a reload) for lvinput.xml parameter \a name of lvDCOM type
+/// \a lvtype, along with any extra parameters that type needs. Returns the asyn parameter index, or -1 if it cannot be created.
+int lvDCOMDriver::createLvParam(const std::string& name, const std::string& lvtype)
+{
+	static const char* functionName = "createLvParam";
+	asynParamType type;
+	if (lvtype == "float64")
 	{
-		lock();
-	    bool new_blocks = m_lvdcom->checkForNewBlockDetails();
-		unlock();
-		if (new_blocks)
+		type = asynParamFloat64;
+	}
+	else if (lvtype == "int32" || lvtype == "enum" || lvtype == "ring" || lvtype == "boolean")
+	{
+		type = asynParamInt32;
+	}
+	else if (lvtype == "group")
+	{
+		type = asynParamInt32;
+	}
+	else if (lvtype == "string")
+	{
+		type = asynParamOctet;
+	}
+	else if (lvtype == "float64array" || lvtype == "float64array2d")
+	{
+		type = asynParamFloat64Array;
+	}
+	else if (lvtype == "int32array" || lvtype == "int32array2d")
+	{
+		type = asynParamInt32Array;
+	}
+	else if (lvtype == "stringarray2d")
+	{
+		type = asynParamOctet;
+	}
+	else if (lvtype == "booleanarray")
+	{
+		type = asynParamUInt32Digital;
+	}
+	else
+	{
+		errlogSevPrintf(errlogMajor, "%s:%s: unknown type %s for parameter %s\n", driverName, functionName, lvtype.c_str(), name.c_str());
+		return -1;
+	}
+	int i = findOrCreateParam(name, type);
+	if (i < 0)
+	{
+		return -1;
+	}
+	if (lvtype.size() > 7 && lvtype.compare(lvtype.size() - 7, 7, "array2d") == 0)
+	{
+		int nrows = findOrCreateParam(name + "_NROWS", asynParamInt32);
+		int ncols = findOrCreateParam(name + "_NCOLS", asynParamInt32);
+		if (nrows >= 0 && ncols >= 0)
 		{
-			std::cerr << "Terminating as in SECI mode and new blocks detected" << std::endl;
-			epicsExit(0);
+			m_array_dims[i] = std::pair<int,int>(nrows, ncols);
+			m_dims_params.insert(nrows);
+			m_dims_params.insert(ncols);
 		}
-		epicsThreadSleep(30);
 	}
-}
-
-extern "C" {
-
-	/// EPICS iocsh callable function to call constructor of lvDCOMInterface().
-	/// The function is registered via lvDCOMRegister().
-	///
-	/// @param[in] portName @copydoc initArg0
-	/// @param[in] configSection @copydoc initArg1
-	/// @param[in] configFile @copydoc initArg2
-	/// @param[in] host @copydoc initArg3
-	/// @param[in] options @copydoc initArg4
-	/// @param[in] progid @copydoc initArg5
-	/// @param[in] username @copydoc initArg6
-	/// @param[in] password @copydoc initArg7
-	int lvDCOMConfigure(const char *portName, const char* configSection, const char *configFile, const char *host, int options, 
-		const char* progid, const char* username, const char* password)
+	int history = 0;
+	double history_period = 1.0;
+	m_lvdcom->getHistory(name.c_str(), history, history_period);
+	if ( history > 0 && (type == asynParamFloat64 || type == asynParamInt32) && m_history.find(i) == m_history.end() )
 	{
-		registerStructuredExceptionHandler();
-		try
+		int values = findOrCreateParam(name + "_HIST", asynParamFloat64Array);
+		int times = findOrCreateParam(name + "_HIST_TIME", asynParamFloat64Array);
+		if (values >= 0 && times >= 0)
 		{
-			lvDCOMInterface* dcomint = new lvDCOMInterface(configSection, configFile, host, options, progid, username, password);
-			if (dcomint != NULL)
-			{
+			m_history[i] = new lvDCOMHistory(history, history_period, values, times);
+			m_history_params[values] = i;
+			m_history_params[times] = i;
+		}
+	}
+	int stats = 0;
+	std::string stats_set;
+	m_lvdcom->getStats(name.c_str(), stats, stats_set);
+	if ( stats > 0 && type != asynParamOctet && type != asynParamUInt32Digital && m_stats.find(i) == m_stats.end() )
+	{
+		bool array = (type == asynParamFloat64Array || type == asynParamInt32Array);
+		unsigned mask = lvDCOMStats::parseSet(stats_set, array);
+		lvDCOMStats* s = new lvDCOMStats(array ? 0 : stats);
+		for(int j = 0; j < StatsCount; ++j)
+		{
+			// mean and stddev of a single array, or sum and centroid of a single scalar, are not offered
+			bool applies = (array ? (j != StatsMean && j != StatsStdDev) : (j != StatsSum && j != StatsCentroid));
+			if ( applies && (mask & (1 << j)) != 0 )
+			{
+				s->param(j) = findOrCreateParam(name + lvDCOMStats::suffix(j), asynParamFloat64);
+				m_stats_params.insert(s->param(j));
+			}
+		}
+		m_stats[i] = s;
+	}
+	if (lvtype == "booleanarray")
+	{
+		// word 0 is the parameter itself, further words are <name>_W1, <name>_W2 ...
+		std::vector<int>& words = m_bit_words[i];
+		int nwords = m_lvdcom->getBitWords(name.c_str());
+		words.assign(1, i);
+		m_word_of[i] = std::pair<int,int>(i, 0);
+		for(int j = 1; j < nwords; ++j)
+		{
+			char word_name[16];
+			epicsSnprintf(word_name, sizeof(word_name), "_W%d", j);
+			int w = findOrCreateParam(name + word_name, asynParamUInt32Digital);
+			if (w >= 0)
+			{
+				words.push_back(w);
+				m_word_of[w] = std::pair<int,int>(i, j);
+			}
+		}
+	}
+	if (lvtype == "group")
+	{
+		m_write_groups.insert(i);
+	}
+	return i;
+}
+
+/// index of asyn parameter \a name, created if it does not exist. Returns -1 if it exists with a different type
+int lvDCOMDriver::findOrCreateParam(const std::string& name, asynParamType type)
+{
+	static const char* functionName = "findOrCreateParam";
+	int i;
+	if (findParam(name.c_str(), &i) == asynSuccess)
+	{
+		std::map<int, asynParamType>::const_iterator it = m_param_types.find(i);
+		if (it != m_param_types.end() && it->second != type)
+		{
+			errlogSevPrintf(errlogMajor, "%s:%s: parameter %s already exists with a different type\n", driverName, functionName, name.c_str());
+			return -1;
+		}
+		return i;
+	}
+	if (createParam(name.c_str(), type, &i) != asynSuccess)
+	{
+		return -1;
+	}
+	m_param_types[i] = type;
+	return i;
+}
+
+/// work out which parameters read back the control each parameter writes, for postReadback()
+void lvDCOMDriver::buildReadbacks()
+{
+	std::vector<std::string> readbacks;
+	int index, rb_index;
+	m_readbacks.clear();
+	for(std::map<std::string,std::string>::const_iterator it=m_params.begin(); it != m_params.end(); ++it)
+	{
+		if (findParam(it->first.c_str(), &index) != asynSuccess)
+		{
+			continue;
+		}
+		m_lvdcom->getReadbackParams(it->first.c_str(), m_params, readbacks);
+		for(std::vector<std::string>::const_iterator itr = readbacks.begin(); itr != readbacks.end(); ++itr)
+		{
+			// the readback value has the type of the parameter written, so can only be used for a parameter of the same type
+			if (findParam(itr->c_str(), &rb_index) == asynSuccess && m_param_types[rb_index] == m_param_types[index])
+			{
+				m_readbacks[index].push_back(rb_index);
+			}
+		}
+	}
+}
+
+/// start lvDCOMPollTask() if it is not already running
+void lvDCOMDriver::startPoller()
+{
+	if (m_poller_started)
+	{
+		return;
+	}
+	if (epicsThreadCreate("lvDCOMPoller",
+		epicsThreadPriorityMedium,
+		epicsThreadGetStackSize(epicsThreadStackMedium),
+		(EPICSTHREADFUNC)lvDCOMPollTaskC, this) == 0)
+	{
+		printf("%s:startPoller: epicsThreadCreate failure\n", driverName);
+		return;
+	}
+	m_poller_started = true;
+}
+
+/// Apply the changes made to the configuration file since it was loaded, without restarting the IOC (see lvDCOMInterface::reloadConfig()).
+/// New parameters are created, changed ones are read from their new target and polled to their new settings, and removed ones stop 
+/// being polled and are given a disconnected status. Parameters that have not changed carry on being served throughout. Records 
+/// only connect to parameters at iocInit, so a new parameter is only seen by clients connecting later (e.g. an asyn record).
+/// With a vi_state_period the VIs checked for running are updated to those now in the file.
+/// Returns the number of parameters added, changed and removed; throws if the file cannot be used, leaving everything as it was.
+int lvDCOMDriver::reloadConfig()
+{
+	static const char* functionName = "reloadConfig";
+	epicsGuard<epicsMutex> _reload_lock(m_reload_lock);
+	ConfigChanges changes;
+	try
+	{
+		m_lvdcom->reloadConfig(changes);
+	}
+	catch(const std::exception&)
+	{
+		++m_reload_errors;
+		throw;
+	}
+	int index;
+	lock();
+	for(std::map<std::string,std::string>::const_iterator it = changes.added.begin(); it != changes.added.end(); ++it)
+	{
+		m_params[it->first] = it->second;
+		if ( (index = createLvParam(it->first, it->second)) >= 0 && m_write_groups.count(index) == 0 )
+		{
+			m_poll_adds.insert(index);
+			m_poll_removals.erase(index);
+			setParamStatus(index, asynSuccess);
+		}
+	}
+	for(std::vector<std::string>::const_iterator it = changes.changed.begin(); it != changes.changed.end(); ++it)
+	{
+		if ( findParam(it->c_str(), &index) == asynSuccess && m_write_groups.count(index) == 0 )
+		{
+			// stop polling with the old settings then start with the new, which also reads it straight away
+			m_poll_removals.insert(index);
+			m_poll_adds.insert(index);
+		}
+	}
+	for(std::vector<std::string>::const_iterator it = changes.removed.begin(); it != changes.removed.end(); ++it)
+	{
+		m_params.erase(*it);
+		if (findParam(it->c_str(), &index) != asynSuccess)
+		{
+			continue;
+		}
+		m_write_groups.erase(index);
+		m_poll_adds.erase(index);
+		m_poll_removals.insert(index);
+		m_value_times.erase(index);
+		m_stale.erase(index);
+		setParamStatus(index, asynDisconnected);
+	}
+	buildReadbacks();
+	callParamCallbacks();
+	bool poll_changes = (m_poll_adds.size() > 0 || m_poll_removals.size() > 0);
+	unlock();
+	createViStateParams();
+	if (poll_changes)
+	{
+		startPoller();
+		m_poll_event.signal();
+	}
+	++m_reloads;
+	errlogSevPrintf(errlogInfo, "%s:%s: %d parameters added, %d changed, %d removed, %d VI references released\n", driverName, functionName, 
+		static_cast<int>(changes.added.size()), static_cast<int>(changes.changed.size()), static_cast<int>(changes.removed.size()), changes.vis_released);
+	for(std::vector<std::string>::const_iterator it = changes.section_changed.begin(); it != changes.section_changed.end(); ++it)
+	{
+		errlogSevPrintf(errlogMinor, "%s:%s: section attribute %s has changed, the IOC must be restarted to apply this\n", driverName, functionName, it->c_str());
+	}
+	return static_cast<int>(changes.added.size() + changes.changed.size() + changes.removed.size());
+}
+
+void lvDCOMDriver::lvDCOMReloadTaskC(void* arg) 
+{ 
+	lvDCOMDriver* driver = (lvDCOMDriver*)arg;
+	driver->lvDCOMReloadTask();
+}
+
+/// If the section has a reload_period, check the configuration file that often and reload it when it has been written to
+void lvDCOMDriver::lvDCOMReloadTask() 
+{ 
+	static const char* functionName = "lvDCOMReloadTask";
+	registerStructuredExceptionHandler();
+	double period = m_lvdcom->getReloadPeriod();
+	while(true)
+	{
+		epicsThreadSleep(period);
+		if (!m_lvdcom->configFileChanged())
+		{
+			continue;
+		}
+		try
+		{
+			reloadConfig();
+		}
+		catch(const std::exception& ex)
+		{
+			errlogSevPrintf(errlogMajor, "%s:%s: reload failed, keeping current configuration: %s\n", driverName, functionName, ex.what());
+		}
+	}
+}
+
+/// Create the int32 parameter named by the state_param attribute of each \<vi\>, if the section has a vi_state_period, and
+/// make the VIs of the live configuration the ones lvDCOMViStateTask() checks. Called again by reloadConfig(), when a VI 
+/// no longer in the file stops being checked and, if it was not running, has its parameters polled again
+void lvDCOMDriver::createViStateParams()
+{
+	if (m_vi_state_period <= 0.0)
+	{
+		return;
+	}
+	std::map<std::string,std::string> state_params;
+	m_lvdcom->getViStateParams(state_params);
+	std::map<std::string, int> vi_state_params;
+	lock();
+	for(std::map<std::string,std::string>::const_iterator it = state_params.begin(); it != state_params.end(); ++it)
+	{
+		int index = -1;
+		if (it->second.size() > 0 && (index = findOrCreateParam(it->second, asynParamInt32)) >= 0)
+		{
+			m_state_params.insert(index);
+		}
+		vi_state_params[it->first] = index;
+	}
+	for(std::map<std::string, int>::const_iterator it = m_vi_state_params.begin(); it != m_vi_state_params.end(); ++it)
+	{
+		if (vi_state_params.count(it->first) == 0)
+		{
+			m_idle_vis.erase(it->first);
+			if (it->second >= 0)
+			{
+				setParamStatus(it->second, asynDisconnected);
+			}
+		}
+	}
+	m_vi_state_params.swap(vi_state_params);
+	callParamCallbacks();
+	unlock();
+}
+
+void lvDCOMDriver::lvDCOMViStateTaskC(void* arg) 
+{ 
+	lvDCOMDriver* driver = (lvDCOMDriver*)arg;
+	driver->lvDCOMViStateTask();
+}
+
+/// Check every vi_state_period seconds whether each VI is running. This only asks LabVIEW for the execution state of the VI, 
+/// so is much cheaper than the reads it saves while a VI is stopped or being edited
+void lvDCOMDriver::lvDCOMViStateTask() 
+{ 
+	registerStructuredExceptionHandler();
+	while(true)
+	{
+		// reloadConfig() replaces m_vi_state_params, so check the VIs as they are now
+		lock();
+		std::map<std::string, int> vi_state_params(m_vi_state_params);
+		unlock();
+		for(std::map<std::string, int>::const_iterator it = vi_state_params.begin(); it != vi_state_params.end(); ++it)
+		{
+			checkViState(it->first, it->second);
+		}
+		epicsThreadSleep(m_vi_state_period);
+	}
+}
+
+/// Find whether \a vi_path is running, restarting it if it has stopped and #viStartIfIdle is set, and post the state to 
+/// parameter \a index (if not -1) with a STATE/MAJOR alarm if it is not running. Polling of the parameters of a VI that
+/// is not running is suspended, and when it runs again they are read straight away. If the state cannot be found (e.g. 
+/// LabVIEW is not there) polling carries on, the parameters will report the failure themselves.
+void lvDCOMDriver::checkViState(const std::string& vi_path, int index)
+{
+	static const char* functionName = "checkViState";
+	int state = ViExecUnknown;
+	bool restarted = false;
+	asynStatus status = asynSuccess;
+	try
+	{
+		state = m_lvdcom->getViExecState(vi_path, m_lvdcom->restartIfIdle(), restarted);
+	}
+	catch(const std::exception& ex)
+	{
+		status = exceptionStatus(ex);
+		asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: \"%s\": %s\n", driverName, functionName, vi_path.c_str(), ex.what());
+	}
+	bool idle = (status == asynSuccess && (state == ViExecIdle || state == ViExecBad));
+	lock();
+	if (restarted)
+	{
+		++m_vi_restarts;
+	}
+	if (idle && m_idle_vis.insert(vi_path).second)
+	{
+		errlogSevPrintf(errlogMinor, "%s:%s: \"%s\" is not running, its parameters are not polled until it is\n", driverName, functionName, vi_path.c_str());
+	}
+	else if (!idle && m_idle_vis.erase(vi_path) > 0)
+	{
+		errlogSevPrintf(errlogInfo, "%s:%s: \"%s\" is running again\n", driverName, functionName, vi_path.c_str());
+		for(polled_map_t::const_iterator itp = m_polled.begin(); itp != m_polled.end(); ++itp)
+		{
+			if (itp->second.vi == vi_path)
+			{
+				m_poll_requests.insert(itp->first);
+			}
+		}
+		m_poll_event.signal();
+	}
+	if (index >= 0)
+	{
+		setIntegerParam(index, state);
+		setParamStatus(index, status);
+		setParamAlarmStatus(index, (idle ? STATE_ALARM : NO_ALARM));
+		setParamAlarmSeverity(index, (idle ? MAJOR_ALARM : NO_ALARM));
+		callParamCallbacks();
+	}
+	unlock();
+}
+
+/// If the lvinput.xml \<read\> element for parameter \a name has a \a poll attribute, arrange for lvDCOMPollTask() to read it
+/// in the background. Arrays also get a double buffer so the poller never holds the port lock during a DCOM call.
+void lvDCOMDriver::addPolledParam(int index, const std::string& name, asynParamType type)
+{
+	double period = m_lvdcom->getPollPeriod(name.c_str());
+	if (period <= 0.0)
+	{
+		return;
+	}
+	if (type == asynParamFloat64Array)
+	{
+		m_float64_arrays[index] = new lvDCOMArrayBuffer<epicsFloat64>;
+	}
+	else if (type == asynParamInt32Array)
+	{
+		m_int32_arrays[index] = new lvDCOMArrayBuffer<epicsInt32>;
+	}
+	PolledParam p(index, name, type, period);
+	p.deadband = m_lvdcom->getDeadband(name.c_str());
+	m_lvdcom->getPollLimits(name.c_str(), p.poll_min, p.poll_max);
+	if (p.adaptive())
+	{
+		p.period = epicsMax(p.poll_min, epicsMin(p.period, p.poll_max));
+	}
+	p.cluster = m_lvdcom->getClusterKey(name.c_str());
+	if (m_vi_state_period > 0.0)
+	{
+		p.vi = m_lvdcom->getParamViPath(name.c_str());
+	}
+	if (p.cluster.size() > 0)
+	{
+		m_clusters[p.cluster].push_back(index);
+	}
+	m_polled.insert(polled_map_t::value_type(index, p));
+}
+
+void lvDCOMDriver::lvDCOMPollTaskC(void* arg) 
+{ 
+	lvDCOMDriver* driver = (lvDCOMDriver*)arg;
+	driver->lvDCOMPollTask();
+}
+
+/// order polled parameters so the most overdue is read first
+static bool pollOrder(const PolledParam* p1, const PolledParam* p2)
+{
+	return p1->next_poll < p2->next_poll;
+}
+
+/// Read each polled parameter when it is due, the DCOM call is made without the port lock so
+/// records for other parameters are not held up behind it. If the section has a poll_budget, at most that
+/// many reads a second are made and parameters are stretched beyond their period, most overdue first, to fit. 
+void lvDCOMDriver::lvDCOMPollTask() 
+{ 
+	static const double max_wait = 1.0;
+	registerStructuredExceptionHandler();
+	double budget = m_lvdcom->getPollBudget();
+	// a bucket smaller than one read would never allow one, so a budget below 1 still holds a whole read
+	double capacity = epicsMax(budget, 1.0);
+	double tokens = capacity;
+	epicsTime last_refill = epicsTime::getCurrent();
+	std::vector<PolledParam*> due;
+	std::set<std::string> idle_vis;
+	while(true)
+	{
+		applyConfigChanges();
+		applyPollRequests();
+		if (m_vi_state_period > 0.0)
+		{
+			lock();
+			idle_vis = m_idle_vis;
+			unlock();
+		}
+		epicsTime now = epicsTime::getCurrent();
+		if (budget > 0.0)
+		{
+			tokens = epicsMin(capacity, tokens + (now - last_refill) * budget);
+			last_refill = now;
+		}
+		double wait = max_wait;
+		due.clear();
+		for(polled_map_t::iterator it = m_polled.begin(); it != m_polled.end(); ++it)
+		{
+			double next = it->second.next_poll - now;
+			if (next <= 0.0)
+			{
+				due.push_back(&(it->second));
+			}
+			else if (next < wait)
+			{
+				wait = next;
+			}
+		}
+		std::sort(due.begin(), due.end(), pollOrder);
+		for(std::vector<PolledParam*>::iterator it = due.begin(); it != due.end(); ++it)
+		{
+			PolledParam& p = **it;
+			if (p.next_poll > now)
+			{
+				continue;  // already read along with the rest of its cluster
+			}
+			if (idle_vis.size() > 0 && idle_vis.count(p.vi) > 0)
+			{
+				// nothing new to read until lvDCOMViStateTask() sees the VI running again, when it asks for a read straight away
+				++m_polls_suspended;
+				p.next_poll = now + p.period;
+				continue;
+			}
+			if (budget > 0.0)
+			{
+				if (tokens < 1.0)
+				{
+					m_polls_deferred += static_cast<unsigned long>(due.end() - it);
+					wait = epicsMin(wait, (1.0 - tokens) / budget);
+					break;
+				}
+				tokens -= 1.0;
+			}
+			adaptPollPeriod(p, pollParam(p));
+			p.next_poll = epicsTime::getCurrent() + p.period;
+			if (p.period < wait)
+			{
+				wait = p.period;
+			}
+		}
+		m_poll_event.wait(wait);
+	}
+}
+
+/// A value has just been written to parameter \a function, so poll it and anything reading back the same control
+/// straight away. Called with the port lock held.
+void lvDCOMDriver::requestPoll(int function)
+{
+	bool requested = false;
+	if (isPolled(function))
+	{
+		m_poll_requests.insert(function);
+		requested = true;
+	}
+	std::map<int, std::vector<int> >::const_iterator it = m_readbacks.find(function);
+	if (it != m_readbacks.end())
+	{
+		for(std::vector<int>::const_iterator itr = it->second.begin(); itr != it->second.end(); ++itr)
+		{
+			if (isPolled(*itr))
+			{
+				m_poll_requests.insert(*itr);
+				requested = true;
+			}
+		}
+	}
+	if (requested)
+	{
+		m_poll_event.signal();
+	}
+}
+
+/// make the parameters passed to requestPoll() due now, and an adaptive parameter goes back to its fastest rate
+void lvDCOMDriver::applyPollRequests()
+{
+	std::set<int> requests;
+	lock();
+	requests.swap(m_poll_requests);
+	unlock();
+	epicsTime now = epicsTime::getCurrent();
+	for(std::set<int>::const_iterator it = requests.begin(); it != requests.end(); ++it)
+	{
+		polled_map_t::iterator itp = m_polled.find(*it);
+		if (itp == m_polled.end())
+		{
+			continue;  // no longer polled after a reload
+		}
+		PolledParam& p = itp->second;
+		if (p.adaptive())
+		{
+			p.period = p.poll_min;
+		}
+		p.next_poll = now;
+	}
+}
+
+/// Make the changes to what is polled queued by reloadConfig(). Once it is running only this thread changes #m_polled, and it 
+/// does so under the port lock as other threads look parameters up in it
+void lvDCOMDriver::applyConfigChanges()
+{
+	const char* paramName = NULL;
+	lock();
+	for(std::set<int>::const_iterator it = m_poll_removals.begin(); it != m_poll_removals.end(); ++it)
+	{
+		polled_map_t::iterator itp = m_polled.find(*it);
+		if (itp == m_polled.end())
+		{
+			continue;
+		}
+		std::map<std::string, std::vector<int> >::iterator itc = m_clusters.find(itp->second.cluster);
+		if (itc != m_clusters.end())
+		{
+			itc->second.erase(std::remove(itc->second.begin(), itc->second.end(), *it), itc->second.end());
+			if (itc->second.size() == 0)
+			{
+				m_clusters.erase(itc);
+			}
+		}
+		m_polled.erase(itp);
+		if (m_float64_arrays.count(*it) > 0)
+		{
+			delete m_float64_arrays[*it];
+			m_float64_arrays.erase(*it);
+		}
+		if (m_int32_arrays.count(*it) > 0)
+		{
+			delete m_int32_arrays[*it];
+			m_int32_arrays.erase(*it);
+		}
+	}
+	for(std::set<int>::const_iterator it = m_poll_adds.begin(); it != m_poll_adds.end(); ++it)
+	{
+		if (getParamName(*it, &paramName) == asynSuccess)
+		{
+			addPolledParam(*it, paramName, m_param_types[*it]);
+		}
+	}
+	m_poll_removals.clear();
+	m_poll_adds.clear();
+	unlock();
+}
+
+/// Adjust the period of an adaptive polled parameter. After a change we poll at poll_min to catch any burst of changes,
+/// while the value stays the same the period doubles each poll up to half the (smoothed) interval seen between changes, 
+/// or poll_max if it has never changed, so a value is read about twice per change.
+void lvDCOMDriver::adaptPollPeriod(PolledParam& p, bool changed)
+{
+	if (!p.adaptive())
+	{
+		return;
+	}
+	epicsTime now = epicsTime::getCurrent();
+	if (changed)
+	{
+		if (p.changes > 0)
+		{
+			double interval = now - p.last_change;
+			p.change_interval = (p.changes > 1 ? 0.75 * p.change_interval + 0.25 * interval : interval);
+		}
+		++p.changes;
+		p.last_change = now;
+		p.period = p.poll_min;
+	}
+	else
+	{
+		double limit = (p.changes > 1 ? epicsMax(p.poll_min, p.change_interval / 2.0) : p.poll_max);
+		p.period = epicsMin(epicsMin(2.0 * p.period, limit), p.poll_max);
+	}
+}
+
+/// Read a single polled parameter from LabVIEW and post it to the parameter library. An array is read into the
+/// back buffer, then made visible by a swap under the port lock and passed to callbacks without a further copy.
+/// Returns true if the value or read status changed.
+bool lvDCOMDriver::pollParam(PolledParam& p)
+{
+	static const char* functionName = "pollParam";
+	if (p.cluster.size() > 0)
+	{
+		return pollCluster(p);
+	}
+	asynStatus status = asynSuccess;
+	epicsFloat64 dval = 0.0;
+	epicsInt32 ival = 0;
+	std::string sval;
+	std::vector<epicsUInt32> words;
+	size_t dims[2] = { 0, 0 };
+	bool table = isTable(p.index);
+	try
+	{
+		switch(p.type)
+		{
+			case asynParamFloat64:
+				m_lvdcom->getLabviewValue(p.name.c_str(), &dval);
+				break;
+			case asynParamInt32:
+				m_lvdcom->getLabviewValue(p.name.c_str(), &ival);
+				break;
+			case asynParamOctet:
+				if (table)
+				{
+					m_lvdcom->getLabviewTable(p.name.c_str(), &sval, dims);
+				}
+				else
+				{
+					m_lvdcom->getLabviewValue(p.name.c_str(), &sval);
+				}
+				break;
+			case asynParamFloat64Array:
+				m_lvdcom->getLabviewValue(p.name.c_str(), m_float64_arrays[p.index]->back(), dims);
+				break;
+			case asynParamInt32Array:
+				m_lvdcom->getLabviewValue(p.name.c_str(), m_int32_arrays[p.index]->back(), dims);
+				break;
+			case asynParamUInt32Digital:
+				m_lvdcom->getLabviewBits(p.name.c_str(), words);
+				break;
+			default:
+				break;
+		}
+	}
+	catch(const std::exception& ex)
+	{
+		status = exceptionStatus(ex);
+		if (status != p.status) // only report changes, we will be called again shortly
+		{
+			asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: status=%d, name=%s, error=%s\n", 
+				driverName, functionName, status, p.name.c_str(), ex.what());
+		}
+	}
+	bool changed = (status != p.status);
+	p.status = status;
+	lock();
+	if (p.type == asynParamUInt32Digital)
+	{
+		changed = setBitWords(p.index, words, status);
+		callParamCallbacks();
+		unlock();
+		return changed;
+	}
+	if (status == asynSuccess)
+	{
+		switch(p.type)
+		{
+			case asynParamFloat64:
+				changed |= setPolledValue(p.index, dval);
+				break;
+			case asynParamInt32:
+				changed |= setPolledValue(p.index, ival);
+				break;
+			case asynParamOctet:
+				changed |= setPolledValue(p.index, sval);
+				break;
+			default:
+				break;
+		}
+		setArrayDims(p.index, dims);
+		markLive(p.index);
+	}
+	// a value preloaded from the snapshot is still the best we have, so keep it readable (with its alarm) until LabVIEW answers
+	setParamStatus(p.index, ((status != asynSuccess && isStale(p.index)) ? asynSuccess : status));
+	if (p.type == asynParamFloat64Array)
+	{
+		changed = postArray(p, *(m_float64_arrays[p.index]), changed);
+	}
+	else if (p.type == asynParamInt32Array)
+	{
+		changed = postArray(p, *(m_int32_arrays[p.index]), changed);
+	}
+	callParamCallbacks();
+	unlock();
+	return changed;
+}
+
+/// Read the whole cluster that polled parameter \a p reads an element of with one DCOM call, and post every polled element 
+/// of it from that read. Those other elements are then not due again until their own period has passed. 
+/// Returns true if the value or read status of \a p changed.
+bool lvDCOMDriver::pollCluster(PolledParam& p)
+{
+	static const char* functionName = "pollCluster";
+	asynStatus status = asynSuccess;
+	std::vector<ClusterField> fields;
+	bool changed_p = false;
+	m_lvdcom->getClusterFields(p.cluster, fields);
+	try
+	{
+		m_lvdcom->getLabviewCluster(fields);
+	}
+	catch(const std::exception& ex)
+	{
+		status = exceptionStatus(ex);
+		if (status != p.status) // only report changes, we will be called again shortly
+		{
+			asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: status=%d, name=%s, error=%s\n", 
+				driverName, functionName, status, p.name.c_str(), ex.what());
+		}
+	}
+	epicsTime now = epicsTime::getCurrent();
+	lock();
+	for(std::vector<ClusterField>::const_iterator it = fields.begin(); it != fields.end(); ++it)
+	{
+		int index;
+		polled_map_t::iterator itp;
+		if ( findParam(it->param.c_str(), &index) != asynSuccess || (itp = m_polled.find(index)) == m_polled.end() )
+		{
+			continue;
+		}
+		PolledParam& m = itp->second;
+		asynStatus m_status = ((status == asynSuccess && !it->ok) ? asynError : status);
+		bool changed = (m_status != m.status);
+		m.status = m_status;
+		if (m_status == asynSuccess)
+		{
+			switch(m.type)
+			{
+				case asynParamFloat64:
+					changed |= setPolledValue(index, static_cast<epicsFloat64>(it->dval));
+					break;
+				case asynParamInt32:
+					changed |= setPolledValue(index, static_cast<epicsInt32>(it->ival));
+					break;
+				case asynParamOctet:
+					changed |= setPolledValue(index, it->sval);
+					break;
+				default:
+					break;
+			}
+			markLive(index);
+		}
+		setParamStatus(index, ((m_status != asynSuccess && isStale(index)) ? asynSuccess : m_status));
+		if (&m == &p)
+		{
+			changed_p = changed;
+		}
+		else
+		{
+			adaptPollPeriod(m, changed);
+			m.next_poll = now + m.period;
+		}
+	}
+	callParamCallbacks();
+	unlock();
+	return changed_p;
+}
+
+/// if parameter \a index is a 2D array, set its _NROWS and _NCOLS parameters from the \a dims just read.
+/// Called with the port lock held, before callParamCallbacks()
+void lvDCOMDriver::setArrayDims(int index, const size_t* dims)
+{
+	std::map<int, std::pair<int,int> >::const_iterator it = m_array_dims.find(index);
+	if (it != m_array_dims.end())
+	{
+		setIntegerParam(it->second.first, static_cast<epicsInt32>(dims[0]));
+		setIntegerParam(it->second.second, static_cast<epicsInt32>(dims[1]));
+	}
+}
+
+/// set a polled scalar value in the parameter library, returns true if it differs from the value already there
+template<typename T>
+bool lvDCOMDriver::setPolledValue(int index, const T& value)
+{
+	T old_value;
+	bool changed = ( getParamValue(index, &old_value) != asynSuccess || !(old_value == value) );
+	setParamValue(index, value);
+	addSample(index, value);
+	return changed;
+}
+
+/// Make a freshly polled array visible and post it to "I/O Intr" records, but only if it differs from
+/// the value last posted (by more than the deadband) or the read status has changed. Called with the port lock held.
+/// Returns true if the array was posted.
+template<typename T>
+bool lvDCOMDriver::postArray(PolledParam& p, lvDCOMArrayBuffer<T>& buffer, bool status_changed)
+{
+	if (p.status == asynSuccess)
+	{
+		if (p.updates > 0 && !status_changed && !buffer.changed(p.deadband))
+		{
+			++p.suppressed;
+			return false;
+		}
+		buffer.swap();
+		addArraySample(p.index, (buffer.front().size() > 0 ? &(buffer.front()[0]) : static_cast<T*>(NULL)), buffer.front().size());
+	}
+	++p.updates;
+	std::vector<T>& value = buffer.front();
+	doArrayCallbacks((value.size() > 0 ? &(value[0]) : NULL), value.size(), p.index);
+	return true;
+}
+
+static std::vector<lvDCOMDriver*> snapshot_drivers;  ///< drivers with values preloaded from a snapshot, for snapshotInitHook()
+
+/// records only register for "I/O Intr" callbacks during iocInit, so values preloaded in the constructor are posted again once it completes
+static void snapshotInitHook(initHookState state)
+{
+	if (state == initHookAfterIocRunning)
+	{
+		for(std::vector<lvDCOMDriver*>::const_iterator it = snapshot_drivers.begin(); it != snapshot_drivers.end(); ++it)
+		{
+			(*it)->postSnapshotValues();
+		}
+	}
+}
+
+/// If the section has a snapshot_file attribute, preload the parameter library (and polled array buffers) with the values saved
+/// in it by a previous run. These are flagged with a COMM/MINOR alarm until a value is read from LabVIEW, so records have a
+/// usable value from iocInit even if LabVIEW is slow to answer or not yet running.
+void lvDCOMDriver::loadSnapshot()
+{
+	static const char* functionName = "loadSnapshot";
+	static bool hook_registered = false;
+	std::string file_name = m_lvdcom->getSnapshotFile();
+	if (file_name.size() == 0)
+	{
+		return;
+	}
+	m_snapshot = new lvDCOMSnapshot(file_name);
+	m_snapshot_period = m_lvdcom->getSnapshotPeriod();
+	if (m_snapshot_period <= 0.0)
+	{
+		m_snapshot_period = 60.0;
+	}
+	std::vector<SnapshotEntry> entries;
+	if (!m_snapshot->load(entries))
+	{
+		errlogSevPrintf(errlogMinor, "%s:%s: no usable snapshot in \"%s\", parameters will be undefined until read\n", driverName, functionName, file_name.c_str());
+		return;
+	}
+	int index;
+	for(std::vector<SnapshotEntry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		// skip anything removed or changed in type since the snapshot was written
+		std::map<int, asynParamType>::const_iterator itt;
+		if ( findParam(it->name.c_str(), &index) != asynSuccess || (itt = m_param_types.find(index)) == m_param_types.end() ||
+		     itt->second != it->type || m_write_groups.count(index) > 0 )
+		{
+			continue;
+		}
+		lvDCOMArrayBuffer<epicsFloat64>* fbuffer = NULL;
+		lvDCOMArrayBuffer<epicsInt32>* ibuffer = NULL;
+		switch(it->type)
+		{
+			case asynParamFloat64:
+				setDoubleParam(index, it->dval);
+				break;
+			case asynParamInt32:
+				setIntegerParam(index, it->ival);
+				break;
+			case asynParamOctet:
+				setStringParam(index, it->sval.c_str());
+				break;
+			case asynParamFloat64Array:
+				if ( (fbuffer = findArrayBuffer(index, static_cast<epicsFloat64*>(NULL))) == NULL )
+				{
+					continue;
+				}
+				fbuffer->front() = it->farray;
+				break;
+			case asynParamInt32Array:
+				if ( (ibuffer = findArrayBuffer(index, static_cast<epicsInt32*>(NULL))) == NULL )
+				{
+					continue;
+				}
+				ibuffer->front() = it->iarray;
+				break;
+			default:
+				continue;
+		}
+		setParamAlarmStatus(index, COMM_ALARM);
+		setParamAlarmSeverity(index, MINOR_ALARM);
+		m_stale.insert(index);
+		m_value_times[index] = it->stamp;
+	}
+	errlogSevPrintf(errlogInfo, "%s:%s: preloaded %d of %d values from snapshot \"%s\"\n", driverName, functionName, 
+		static_cast<int>(m_stale.size()), static_cast<int>(entries.size()), file_name.c_str());
+	if (m_stale.size() > 0)
+	{
+		snapshot_drivers.push_back(this);
+		if (!hook_registered)
+		{
+			initHookRegister(snapshotInitHook);
+			hook_registered = true;
+		}
+	}
+}
+
+/// Post any values preloaded by loadSnapshot() that have not yet been replaced by a read from LabVIEW, each with the time it was
+/// originally read (seen by records with TSE=-2). Called by snapshotInitHook() once records are listening for callbacks.
+void lvDCOMDriver::postSnapshotValues()
+{
+	lock();
+	for(std::set<int>::const_iterator it = m_stale.begin(); it != m_stale.end(); ++it)
+	{
+		int index = *it;
+		epicsTimeStamp stamp = m_value_times[index];
+		setTimeStamp(&stamp);
+		// the value itself is unchanged, so toggle the alarm to get callParamCallbacks() to send it
+		setParamAlarmStatus(index, NO_ALARM);
+		setParamAlarmStatus(index, COMM_ALARM);
+		callParamCallbacks();
+		lvDCOMArrayBuffer<epicsFloat64>* fbuffer = findArrayBuffer(index, static_cast<epicsFloat64*>(NULL));
+		lvDCOMArrayBuffer<epicsInt32>* ibuffer = findArrayBuffer(index, static_cast<epicsInt32*>(NULL));
+		if (fbuffer != NULL)
+		{
+			doArrayCallbacks((fbuffer->front().size() > 0 ? &(fbuffer->front()[0]) : NULL), fbuffer->front().size(), index);
+		}
+		else if (ibuffer != NULL)
+		{
+			doArrayCallbacks((ibuffer->front().size() > 0 ? &(ibuffer->front()[0]) : NULL), ibuffer->front().size(), index);
+		}
+	}
+	updateTimeStamp();
+	unlock();
+}
+
+/// A value for parameter \a index has just been read from LabVIEW and is in the parameter library, so note when for the 
+/// snapshot and clear any alarm left from preloading. Called with the port lock held.
+void lvDCOMDriver::markLive(int index)
+{
+	if (m_snapshot == NULL)
+	{
+		return;
+	}
+	epicsTimeStamp now;
+	epicsTimeGetCurrent(&now);
+	m_value_times[index] = now;
+	if (m_stale.erase(index) > 0)
+	{
+		setParamAlarmStatus(index, NO_ALARM);
+		setParamAlarmSeverity(index, NO_ALARM);
+	}
+}
+
+/// keep a value read on request from LabVIEW in the parameter library so it can be saved in the snapshot. Called with the port lock held.
+template<typename T>
+void lvDCOMDriver::recordValue(int index, const T& value)
+{
+	bool derived = addSample(index, value);
+	if (m_snapshot != NULL || m_table != NULL)
+	{
+		setParamValue(index, value);
+		markLive(index);
+	}
+	if (derived)
+	{
+		callParamCallbacks();
+	}
+	else
+	{
+		publishValueTable();
+	}
+}
+
+/// If the section has a value_table attribute, create the memory mapped file that other programs on this machine read parameter
+/// values from (see lvDCOMValueTable.h) and write every parameter to it, including any values preloaded by loadSnapshot()
+void lvDCOMDriver::openValueTable()
+{
+	static const char* functionName = "openValueTable";
+	std::string file_name = m_lvdcom->getValueTableFile();
+	if (file_name.size() == 0)
+	{
+		return;
+	}
+	// the table cannot grow while readers have it mapped, so leave room for parameters a reload adds
+	size_t nparams = m_lvdcom->nParams();
+	size_t slots = nparams + epicsMax(nparams / 2, static_cast<size_t>(64));
+	try
+	{
+		m_table = new lvDCOMValueTableWriter(file_name, portName, slots);
+	}
+	catch(const std::exception& ex)
+	{
+		errlogSevPrintf(errlogMajor, "%s:%s: value table \"%s\" not available: %s\n", driverName, functionName, file_name.c_str(), ex.what());
+		return;
+	}
+	lock();
+	for(std::map<int, asynParamType>::const_iterator it = m_param_types.begin(); it != m_param_types.end(); ++it)
+	{
+		m_table_changed.insert(it->first);
+	}
+	publishValueTable();
+	unlock();
+}
+
+/// Write the parameters changed since the last call to the value table, with their status and alarm. A value preloaded from
+/// the snapshot keeps the time it was originally read, others are given the current time. Called with the port lock held.
+void lvDCOMDriver::publishValueTable()
+{
+	static const char* functionName = "publishValueTable";
+	if (m_table == NULL || m_table_changed.size() == 0)
+	{
+		return;
+	}
+	epicsTimeStamp now;
+	epicsTimeGetCurrent(&now);
+	const char* paramName = NULL;
+	for(std::set<int>::const_iterator it = m_table_changed.begin(); it != m_table_changed.end(); ++it)
+	{
+		int index = *it;
+		std::map<int, asynParamType>::const_iterator itt = m_param_types.find(index);
+		if (itt == m_param_types.end() || getParamName(index, &paramName) != asynSuccess)
+		{
+			continue;
+		}
+		ValueTableEntry entry;
+		entry.name = paramName;
+		asynStatus status = asynSuccess;
+		epicsUInt32 uval = 0;
+		lvDCOMArrayBuffer<epicsFloat64>* fbuffer = NULL;
+		lvDCOMArrayBuffer<epicsInt32>* ibuffer = NULL;
+		switch(itt->second)
+		{
+			case asynParamInt32:
+				entry.type = ValueTableInt32;
+				status = getIntegerParam(index, &(entry.ival));
+				break;
+			case asynParamFloat64:
+				entry.type = ValueTableFloat64;
+				status = getDoubleParam(index, &(entry.dval));
+				break;
+			case asynParamOctet:
+				entry.type = ValueTableString;
+				status = getStringParam(index, entry.sval);
+				break;
+			case asynParamUInt32Digital:
+				entry.type = ValueTableUInt32Digital;
+				status = getUIntDigitalParam(index, &uval, 0xFFFFFFFF);
+				entry.ival = static_cast<epicsInt32>(uval);
+				break;
+			case asynParamFloat64Array:
+				entry.type = ValueTableFloat64Array;
+				if ( (fbuffer = findArrayBuffer(index, static_cast<epicsFloat64*>(NULL))) != NULL )
+				{
+					entry.length = fbuffer->front().size();
+				}
+				break;
+			case asynParamInt32Array:
+				entry.type = ValueTableInt32Array;
+				if ( (ibuffer = findArrayBuffer(index, static_cast<epicsInt32*>(NULL))) != NULL )
+				{
+					entry.length = ibuffer->front().size();
+				}
+				break;
+			default:
+				continue;
+		}
+		if (status == asynParamUndefined)
+		{
+			entry.flags |= ValueTableUndefined;
+		}
+		getParamStatus(index, &status);
+		entry.status = status;
+		getParamAlarmStatus(index, &(entry.alarm_status));
+		getParamAlarmSeverity(index, &(entry.alarm_severity));
+		entry.stamp = (isStale(index) ? m_value_times[index] : now);
+		if ( !m_table->publish(index, entry) && m_table->dropped() == 1 )
+		{
+			errlogSevPrintf(errlogMinor, "%s:%s: value table \"%s\" has only %d slots, \"%s\" and later parameters added by a reload are left out until a restart\n", 
+				driverName, functionName, m_table->fileName().c_str(), static_cast<int>(m_table->slots()), paramName);
+		}
+	}
+	m_table_changed.clear();
+}
+
+asynStatus lvDCOMDriver::setIntegerParam(int list, int index, int value)
+{
+	tableChanged(index);
+	return asynPortDriver::setIntegerParam(list, index, value);
+}
+
+asynStatus lvDCOMDriver::setDoubleParam(int list, int index, double value)
+{
+	tableChanged(index);
+	return asynPortDriver::setDoubleParam(list, index, value);
+}
+
+asynStatus lvDCOMDriver::setStringParam(int list, int index, const char* value)
+{
+	tableChanged(index);
+	return asynPortDriver::setStringParam(list, index, value);
+}
+
+asynStatus lvDCOMDriver::setStringParam(int list, int index, const std::string& value)
+{
+	tableChanged(index);
+	return asynPortDriver::setStringParam(list, index, value);
+}
+
+asynStatus lvDCOMDriver::setUIntDigitalParam(int list, int index, epicsUInt32 value, epicsUInt32 valueMask)
+{
+	tableChanged(index);
+	return asynPortDriver::setUIntDigitalParam(list, index, value, valueMask);
+}
+
+asynStatus lvDCOMDriver::setUIntDigitalParam(int list, int index, epicsUInt32 value, epicsUInt32 valueMask, epicsUInt32 interruptMask)
+{
+	tableChanged(index);
+	return asynPortDriver::setUIntDigitalParam(list, index, value, valueMask, interruptMask);
+}
+
+asynStatus lvDCOMDriver::setParamStatus(int list, int index, asynStatus status)
+{
+	tableChanged(index);
+	return asynPortDriver::setParamStatus(list, index, status);
+}
+
+asynStatus lvDCOMDriver::setParamAlarmStatus(int list, int index, int status)
+{
+	tableChanged(index);
+	return asynPortDriver::setParamAlarmStatus(list, index, status);
+}
+
+asynStatus lvDCOMDriver::setParamAlarmSeverity(int list, int index, int severity)
+{
+	tableChanged(index);
+	return asynPortDriver::setParamAlarmSeverity(list, index, severity);
+}
+
+/// post changed parameters to records as asynPortDriver does, and write them to the value table. Called with the port lock held.
+asynStatus lvDCOMDriver::callParamCallbacks(int list, int addr)
+{
+	asynStatus status = asynPortDriver::callParamCallbacks(list, addr);
+	publishValueTable();
+	return status;
+}
+
+/// add \a value, just read from LabVIEW, to the history of parameter \a index (if it keeps one) and post the _HIST
+/// and _HIST_TIME waveforms if they have not been posted for history_period. Then update its statistics parameters 
+/// (if it has any) and return true, these still need callParamCallbacks(). Called with the port lock held.
+bool lvDCOMDriver::addSample(int index, epicsFloat64 value)
+{
+	std::map<int, lvDCOMHistory*>::iterator it = m_history.find(index);
+	if (it != m_history.end())
+	{
+		lvDCOMHistory& h = *(it->second);
+		epicsTimeStamp now;
+		epicsTimeGetCurrent(&now);
+		h.add(value, now);
+		if (h.due(now))
+		{
+			size_t n = h.publish(now);
+			setTimeStamp(&now);
+			doCallbacksFloat64Array(h.values(), n, h.valuesParam(), 0);
+			doCallbacksFloat64Array(h.times(), n, h.timesParam(), 0);
+		}
+	}
+	std::map<int, lvDCOMStats*>::iterator its = m_stats.find(index);
+	if (its == m_stats.end())
+	{
+		return false;
+	}
+	lvDCOMStats& s = *(its->second);
+	s.add(value);
+	for(int j = 0; j < StatsCount; ++j)
+	{
+		if (s.param(j) >= 0)
+		{
+			setDoubleParam(s.param(j), s.result(j));
+		}
+	}
+	return true;
+}
+
+/// update the statistics parameters of array parameter \a index (if it has any) from the \a n elements of \a value just read,
+/// returns true if it has, these still need callParamCallbacks(). Called with the port lock held.
+template<typename T>
+bool lvDCOMDriver::addArraySample(int index, const T* value, size_t n)
+{
+	std::map<int, lvDCOMStats*>::iterator its = m_stats.find(index);
+	if (its == m_stats.end())
+	{
+		return false;
+	}
+	lvDCOMStats& s = *(its->second);
+	s.addArray(value, n);
+	for(int j = 0; j < StatsCount; ++j)
+	{
+		if (s.param(j) >= 0)
+		{
+			setDoubleParam(s.param(j), s.result(j));
+		}
+	}
+	return true;
+}
+
+/// if parameter \a function still holds a value preloaded from the snapshot, flag it as such in \a pasynUser and return true
+bool lvDCOMDriver::staleValue(asynUser *pasynUser, int function)
+{
+	if (!isStale(function))
+	{
+		return false;
+	}
+	pasynUser->alarmStatus = COMM_ALARM;
+	pasynUser->alarmSeverity = MINOR_ALARM;
+	return true;
+}
+
+void lvDCOMDriver::lvDCOMSnapshotTaskC(void* arg) 
+{ 
+	lvDCOMDriver* driver = (lvDCOMDriver*)arg;
+	driver->lvDCOMSnapshotTask();
+}
+
+/// Periodically save the snapshot file, the file is written without holding the port lock
+void lvDCOMDriver::lvDCOMSnapshotTask() 
+{ 
+	registerStructuredExceptionHandler();
+	while(true)
+	{
+		epicsThreadSleep(m_snapshot_period);
+		saveSnapshot();
+	}
+}
+
+/// copy the current value of every parameter that has one under the port lock, then write them to the snapshot file
+void lvDCOMDriver::saveSnapshot()
+{
+	static const char* functionName = "saveSnapshot";
+	std::vector<SnapshotEntry> entries;
+	const char* paramName = NULL;
+	lock();
+	entries.reserve(m_value_times.size());
+	for(std::map<int, epicsTimeStamp>::const_iterator it = m_value_times.begin(); it != m_value_times.end(); ++it)
+	{
+		int index = it->first;
+		SnapshotEntry entry;
+		asynStatus status = getParamName(index, &paramName);
+		if (status != asynSuccess)
+		{
+			continue;
+		}
+		entry.name = paramName;
+		entry.type = m_param_types[index];
+		entry.stamp = it->second;
+		lvDCOMArrayBuffer<epicsFloat64>* fbuffer = NULL;
+		lvDCOMArrayBuffer<epicsInt32>* ibuffer = NULL;
+		switch(entry.type)
+		{
+			case asynParamFloat64:
+				status = getDoubleParam(index, &(entry.dval));
+				break;
+			case asynParamInt32:
+				status = getIntegerParam(index, &(entry.ival));
+				break;
+			case asynParamOctet:
+				status = getStringParam(index, entry.sval);
+				break;
+			case asynParamFloat64Array:
+				if ( (fbuffer = findArrayBuffer(index, static_cast<epicsFloat64*>(NULL))) != NULL )
+				{
+					entry.farray = fbuffer->front();
+				}
+				break;
+			case asynParamInt32Array:
+				if ( (ibuffer = findArrayBuffer(index, static_cast<epicsInt32*>(NULL))) != NULL )
+				{
+					entry.iarray = ibuffer->front();
+				}
+				break;
+			default:
+				status = asynError;
+				break;
+		}
+		if (status == asynSuccess)
+		{
+			entries.push_back(entry);
+		}
+	}
+	unlock();
+	try
+	{
+		m_snapshot->save(entries);
+		++m_snapshots_saved;
+	}
+	catch(const std::exception& ex)
+	{
+		++m_snapshot_errors;
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: error=%s\n", driverName, functionName, ex.what());
+	}
+}
+
+void lvDCOMDriver::lvDCOMTaskC(void* arg) 
+{ 
+	lvDCOMDriver* driver = (lvDCOMDriver*)arg;
+	driver->lvDCOMTask();
+}
+
+/// Check for SECI configuration changes, background polling of parameters is done by lvDCOMPollTask()
+void lvDCOMDriver::lvDCOMTask() 
+{ 
+	registerStructuredExceptionHandler();
+	while(true)
+	{
+		lock();
+	    bool new_blocks = m_lvdcom->checkForNewBlockDetails();
+		unlock();
+		if (new_blocks)
+		{
+			std::cerr << "Terminating as in SECI mode and new blocks detected" << std::endl;
+			epicsExit(0);
+		}
+		epicsThreadSleep(30);
+	}
+}
+
+extern "C" {
+
+	/// EPICS iocsh callable function to call constructor of lvDCOMInterface().
+	/// The function is registered via lvDCOMRegister().
+	///
+	/// @param[in] portName @copydoc initArg0
+	/// @param[in] configSection @copydoc initArg1
+	/// @param[in] configFile @copydoc initArg2
+	/// @param[in] host @copydoc initArg3
+	/// @param[in] options @copydoc initArg4
+	/// @param[in] progid @copydoc initArg5
+	/// @param[in] username @copydoc initArg6
+	/// @param[in] password @copydoc initArg7
+	int lvDCOMConfigure(const char *portName, const char* configSection, const char *configFile, const char *host, int options, 
+		const char* progid, const char* username, const char* password)
+	{
+		registerStructuredExceptionHandler();
+		try
+		{
+			lvDCOMInterface* dcomint = new lvDCOMInterface(configSection, configFile, host, options, progid, username, password);
+			if (dcomint != NULL)
+			{
 				new lvDCOMDriver(dcomint, portName);
+				dcomint->warmUpViRefs(dcomint->warmUpThreads());
 				return(asynSuccess);
 			}
 			else
@@ -410,21 +2165,16 @@ extern "C" {
 			// need to specify both of these so we also get restarted when labview disappears (SECI restart / config change)
 			options |= static_cast<int>(lvDCOMOptions::lvNoStart);
 			options |= static_cast<int>(lvDCOMOptions::lvSECIConfig);
-			lvDCOMInterface* dcomint = new lvDCOMInterface("", "", host, 0x0, progid, username, password);
-			if (dcomint != NULL)
 			{
-			    while(dcomint->generateFilesFromSECI(portName, macros, configSection, configFile, dbSubFile, blocks_match, (options & static_cast<int>(lvDCOMOptions::lvSECINoSetter) != 0)) == 0)
+				// only needed to generate the files, and destroyed before the port makes its own connection
+				lvDCOMInterface dcomint("", "", host, 0x0, progid, username, password);
+				while(dcomint.generateFilesFromSECI(portName, macros, configSection, configFile, dbSubFile, blocks_match, (options & static_cast<int>(lvDCOMOptions::lvSECINoSetter) != 0)) == 0)
 				{
 					std::cerr << "lvDCOMSECIConfigure found no blocks - retrying\n";
 					epicsThreadSleep(30);
 				}
-			    return lvDCOMConfigure(portName, configSection, configFile, host, options, progid, username, password);
-			}
-			else
-			{
-				errlogSevPrintf(errlogFatal, "lvDCOMSECIConfigure failed (NULL)\n");
-				return(asynError);
 			}
+			return lvDCOMConfigure(portName, configSection, configFile, host, options, progid, username, password);
 		}
 		catch(const std::exception& ex)
 		{
@@ -432,12 +2182,68 @@ extern "C" {
 			return(asynError);
 		}
 	}
+	/// EPICS iocsh callable function to generate an lvinput.xml file and a substitutions file for every front panel control of a VI,
+	/// see lvDCOMInterface::discoverControls(). Use lvDCOMConfigure() to load the generated file.
+	///
+	/// @param[in] portName @copydoc discoverArg0
+	/// @param[in] macros @copydoc discoverArg1
+	/// @param[in] viPath @copydoc discoverArg2
+	/// @param[in] configSection @copydoc discoverArg3
+	/// @param[in] configFile @copydoc discoverArg4
+	/// @param[in] dbSubFile @copydoc discoverArg5
+	/// @param[in] host @copydoc discoverArg6
+	/// @param[in] stringsFile @copydoc discoverArg7
+	/// @param[in] threads @copydoc discoverArg8
+	/// @param[in] progid @copydoc discoverArg9
+	/// @param[in] username @copydoc discoverArg10
+	/// @param[in] password @copydoc discoverArg11
+	int lvDCOMDiscover(const char *portName, const char* macros, const char* viPath, const char* configSection, const char *configFile,
+	      const char* dbSubFile, const char *host, const char* stringsFile, int threads, const char* progid, const char* username, const char* password)
+	{
+		registerStructuredExceptionHandler();
+		try
+		{
+			lvDCOMInterface dcomint("", "", host, 0x0, progid, username, password);
+			dcomint.discoverControls(portName, macros, viPath, configSection, configFile, dbSubFile, stringsFile, (threads > 0 ? threads : 4));
+			return(asynSuccess);
+		}
+		catch(const std::exception& ex)
+		{
+			errlogSevPrintf(errlogMajor, "lvDCOMDiscover failed: %s\n", ex.what());
+			return(asynError);
+		}
+	}
+
+	/// EPICS iocsh callable function to reload the lvinput.xml file of a port created by lvDCOMConfigure(), see lvDCOMDriver::reloadConfig()
+	///
+	/// @param[in] portName @copydoc reloadArg0
+	int lvDCOMReload(const char *portName)
+	{
+		registerStructuredExceptionHandler();
+		lvDCOMDriver* driver = (portName != NULL ? dynamic_cast<lvDCOMDriver*>(static_cast<asynPortDriver*>(findAsynPortDriver(portName))) : NULL);
+		if (driver == NULL)
+		{
+			errlogSevPrintf(errlogMajor, "lvDCOMReload: no lvDCOM port \"%s\"\n", (portName != NULL ? portName : ""));
+			return(asynError);
+		}
+		try
+		{
+			driver->reloadConfig();
+			return(asynSuccess);
+		}
+		catch(const std::exception& ex)
+		{
+			errlogSevPrintf(errlogMajor, "lvDCOMReload failed, keeping current configuration: %s\n", ex.what());
+			return(asynError);
+		}
+	}
+
 	// EPICS iocsh shell commands 
 
 	static const iocshArg initArg0 = { "portName", iocshArgString};			///< A name for the asyn driver instance we will create - used to refer to it from EPICS DB files
 	static const iocshArg initArg1 = { "configSection", iocshArgString};	///< section name of \a configFile we will load settings from
 	static const iocshArg initArg2 = { "configFile", iocshArgString};		///< Path to the XML input file to load configuration information from
-	static const iocshArg initArg3 = { "host", iocshArgString};				///< host name where LabVIEW is running ("" for localhost) 
+	static const iocshArg initArg3 = { "host", iocshArgString};				///< host name where LabVIEW is running ("" for localhost), or tcp://host:port to use the TCP transport (see lvDCOMTcpProtocol.h), or shm://name the shared memory transport to LabVIEW on this machine (see lvDCOMShm.h), or broker://[port] the lvDCOMBroker on this machine, rather than DCOM 
 	static const iocshArg initArg4 = { "options", iocshArgInt};			    ///< options as per #lvDCOMOptions enum
 	static const iocshArg initArg5 = { "progid", iocshArgString};			///< (optional) DCOM ProgID (required if connecting to a compiled LabVIEW application)
 	static const iocshArg initArg6 = { "username", iocshArgString};			///< (optional) remote username for \a host
@@ -455,6 +2261,21 @@ extern "C" {
 	static const iocshArg initArgSECI9 = { "username", iocshArgString};			///< (optional) remote username for \a host
 	static const iocshArg initArgSECI10 = { "password", iocshArgString};			///< (optional) remote password for \a username on \a host
 
+	static const iocshArg reloadArg0 = { "portName", iocshArgString};			///< port name given to lvDCOMConfigure()
+
+	static const iocshArg discoverArg0 = { "portName", iocshArgString};			///< asyn port name the generated records will use
+	static const iocshArg discoverArg1 = { "macros", iocshArgString};	///< macros to substitute when generating \a dbSubFile (P, SCAN, POLL, POLL_MIN, POLL_MAX as lvDCOMSECIConfigure())
+	static const iocshArg discoverArg2 = { "viPath", iocshArgString};			///< full path to the VI, as it will appear in \a configFile
+	static const iocshArg discoverArg3 = { "configSection", iocshArgString};	///< section name of \a configFile to write settings to (default: frontpanel)
+	static const iocshArg discoverArg4 = { "configFile", iocshArgString};		///< Path to the XML output file name to write configuration information to
+	static const iocshArg discoverArg5 = { "dbSubFile", iocshArgString};		///< Path to the epics db substitution file to generate
+	static const iocshArg discoverArg6 = { "host", iocshArgString};				///< host name where LabVIEW is running ("" for localhost) 
+	static const iocshArg discoverArg7 = { "stringsFile", iocshArgString};		///< (optional) where LabVIEW exports the VI strings, default a temporary file. Required for a remote \a host, and must be reachable from both computers
+	static const iocshArg discoverArg8 = { "threads", iocshArgInt};		        ///< (optional) number of controls to read at once when finding their types, default 4
+	static const iocshArg discoverArg9 = { "progid", iocshArgString};			///< (optional) DCOM ProgID (required if connecting to a compiled LabVIEW application)
+	static const iocshArg discoverArg10 = { "username", iocshArgString};			///< (optional) remote username for \a host
+	static const iocshArg discoverArg11 = { "password", iocshArgString};			///< (optional) remote password for \a username on \a host
+
 	static const iocshArg * const initArgs[] = { &initArg0,
 		&initArg1,
 		&initArg2,
@@ -478,6 +2299,21 @@ extern "C" {
 
 	static const iocshFuncDef initFuncDef = { "lvDCOMConfigure", sizeof(initArgs) / sizeof(iocshArg*), initArgs};
 	static const iocshFuncDef initFuncDefSECI = { "lvDCOMSECIConfigure", sizeof(initArgsSECI) / sizeof(iocshArg*), initArgsSECI};
+	static const iocshArg * const reloadArgs[] = { &reloadArg0 };
+	static const iocshFuncDef reloadFuncDef = { "lvDCOMReload", sizeof(reloadArgs) / sizeof(iocshArg*), reloadArgs};
+	static const iocshArg * const discoverArgs[] = { &discoverArg0,
+		&discoverArg1,
+		&discoverArg2,
+		&discoverArg3,
+		&discoverArg4,
+		&discoverArg5,
+		&discoverArg6,
+		&discoverArg7,
+		&discoverArg8,
+		&discoverArg9,
+		&discoverArg10,
+		&discoverArg11 };
+	static const iocshFuncDef discoverFuncDef = { "lvDCOMDiscover", sizeof(discoverArgs) / sizeof(iocshArg*), discoverArgs};
 
 	static void initCallFunc(const iocshArgBuf *args)
 	{
@@ -489,11 +2325,23 @@ extern "C" {
 		lvDCOMSECIConfigure(args[0].sval, args[1].sval, args[2].sval, args[3].sval, args[4].sval, args[5].sval, args[6].ival, args[7].sval, args[8].sval, args[9].sval, args[10].sval);
 	}
 
+	static void reloadCallFunc(const iocshArgBuf *args)
+	{
+		lvDCOMReload(args[0].sval);
+	}
+
+	static void discoverCallFunc(const iocshArgBuf *args)
+	{
+		lvDCOMDiscover(args[0].sval, args[1].sval, args[2].sval, args[3].sval, args[4].sval, args[5].sval, args[6].sval, args[7].sval, args[8].ival, args[9].sval, args[10].sval, args[11].sval);
+	}
+
 	/// Register new commands with EPICS IOC shell
 	static void lvDCOMRegister(void)
 	{
 		iocshRegister(&initFuncDef, initCallFunc);
 		iocshRegister(&initFuncDefSECI, initCallFuncSECI);
+		iocshRegister(&reloadFuncDef, reloadCallFunc);
+		iocshRegister(&discoverFuncDef, discoverCallFunc);
 	}
 
 	epicsExportRegistrar(lvDCOMRegister);
@@ -11,10 +11,51 @@
 #ifndef LVDCOMDRIVER_H
 #define LVDCOMDRIVER_H
 
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+#include <epicsTime.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+
 #include "asynPortDriver.h"
+#include "lvDCOMArrayBuffer.h"
+#include "lvDCOMHistory.h"
+#include "lvDCOMStats.h"
+#include "lvDCOMSnapshot.h"
+#include "lvDCOMValueTable.h"
 
 class lvDCOMInterface;
 
+/// A driver parameter that is read in the background by lvDCOMDriver::lvDCOMPollTask() rather than on request. 
+/// Values are posted via callbacks, so records should use SCAN="I/O Intr"
+struct PolledParam
+{
+	int index;              ///< asyn parameter index
+	std::string name;       ///< asyn parameter name
+	asynParamType type;     
+	double period;          ///< poll period (seconds)
+	epicsTime next_poll;    ///< when this parameter is next due to be read
+	asynStatus status;      ///< status of last read
+	double deadband;        ///< array elements must change by more than this for a new value to be posted
+	unsigned long updates;     ///< number of array values posted
+	unsigned long suppressed;  ///< number of array reads not posted as they matched the last value posted
+	double poll_min;        ///< shortest period (seconds) for an adaptive parameter
+	double poll_max;        ///< longest period (seconds) for an adaptive parameter
+	double change_interval; ///< smoothed time (seconds) between observed changes of value
+	epicsTime last_change;  ///< when the value last changed
+	unsigned long changes;  ///< number of changes of value seen
+	std::string cluster;    ///< if not empty, key of the cluster this reads an element of (see lvDCOMInterface::getClusterKey())
+	std::string vi;         ///< path of the VI it is on, if the section has a vi_state_period so it is not read while the VI is not running
+	PolledParam(int index_, const std::string& name_, asynParamType type_, double period_) : index(index_), name(name_), type(type_), 
+	    period(period_), next_poll(epicsTime::getCurrent()), status(asynSuccess), deadband(0.0), updates(0), suppressed(0),
+		poll_min(period_), poll_max(period_), change_interval(0.0), last_change(epicsTime::getCurrent()), changes(0) { }
+	/// is the period adjusted to match how often the value changes
+	bool adaptive() const { return poll_min < poll_max; }
+};
+
 /// EPICS Asyn port driver class. 
 class lvDCOMDriver : public asynPortDriver 
 {
@@ -30,18 +71,133 @@ public:
 	virtual asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t maxChars, size_t *nActual);
 	virtual asynStatus readFloat64Array(asynUser *pasynUser, epicsFloat64 *value, size_t nElements, size_t *nIn);
 	virtual asynStatus readInt32Array(asynUser *pasynUser, epicsInt32 *value, size_t nElements, size_t *nIn);
+	virtual asynStatus readUInt32Digital(asynUser *pasynUser, epicsUInt32 *value, epicsUInt32 mask);
+	virtual asynStatus writeUInt32Digital(asynUser *pasynUser, epicsUInt32 value, epicsUInt32 mask);
 	virtual void report(FILE* fp, int details);
+	// parameter library changes are also noted for the section value_table, see publishValueTable()
+	using asynPortDriver::setIntegerParam;
+	using asynPortDriver::setDoubleParam;
+	using asynPortDriver::setStringParam;
+	using asynPortDriver::setUIntDigitalParam;
+	using asynPortDriver::setParamStatus;
+	using asynPortDriver::setParamAlarmStatus;
+	using asynPortDriver::setParamAlarmSeverity;
+	using asynPortDriver::callParamCallbacks;
+	virtual asynStatus setIntegerParam(int list, int index, int value);
+	virtual asynStatus setDoubleParam(int list, int index, double value);
+	virtual asynStatus setStringParam(int list, int index, const char* value);
+	virtual asynStatus setStringParam(int list, int index, const std::string& value);
+	virtual asynStatus setUIntDigitalParam(int list, int index, epicsUInt32 value, epicsUInt32 valueMask);
+	virtual asynStatus setUIntDigitalParam(int list, int index, epicsUInt32 value, epicsUInt32 valueMask, epicsUInt32 interruptMask);
+	virtual asynStatus setParamStatus(int list, int index, asynStatus status);
+	virtual asynStatus setParamAlarmStatus(int list, int index, int status);
+	virtual asynStatus setParamAlarmSeverity(int list, int index, int severity);
+	virtual asynStatus callParamCallbacks(int list, int addr);
 	void lvDCOMTask();
+	void lvDCOMPollTask();
+	void lvDCOMSnapshotTask();
+	void lvDCOMReloadTask();
+	void lvDCOMViStateTask();
+	void saveSnapshot();
+	void postSnapshotValues();
+	int reloadConfig();
 
 private:
 	lvDCOMInterface* m_lvdcom;
 	std::map<std::string,std::string> m_params;
+	typedef std::map<int, PolledParam> polled_map_t;
+	polled_map_t m_polled;    ///< parameters read by lvDCOMPollTask(), keyed by asyn parameter index
+	std::map<int, lvDCOMArrayBuffer<epicsFloat64>*> m_float64_arrays;  ///< driver side copy of polled float64array parameters, keyed by asyn parameter index
+	std::map<int, lvDCOMArrayBuffer<epicsInt32>*> m_int32_arrays;      ///< driver side copy of polled int32array parameters, keyed by asyn parameter index
+	epicsEvent m_poll_event;   ///< signalled to wake lvDCOMPollTask() early
+	std::set<int> m_write_groups;  ///< asyn parameter indexes of write \<group\> commit parameters
+	std::map<int, std::vector<int> > m_readbacks;  ///< asyn parameter index -> indexes of parameters that read the control it writes
+	std::set<int> m_poll_requests;  ///< polled parameters to read as soon as possible, protected by the port lock
+	unsigned long m_polls_deferred;  ///< number of times a due read was delayed by the section poll_budget
+	lvDCOMSnapshot* m_snapshot;    ///< last known values file from section snapshot_file, or NULL if not used
+	double m_snapshot_period;      ///< seconds between saves of m_snapshot
+	std::map<int, asynParamType> m_param_types;   ///< asyn parameter index -> type
+	std::map<int, epicsTimeStamp> m_value_times;  ///< parameters with a value worth saving in m_snapshot, and when it was read
+	std::set<int> m_stale;         ///< parameters whose value was preloaded from m_snapshot and has not yet been read from LabVIEW
+	unsigned long m_snapshots_saved;   ///< number of times m_snapshot has been written
+	unsigned long m_snapshot_errors;   ///< number of failed attempts to write m_snapshot
+	std::map<int, std::pair<int,int> > m_array_dims;  ///< 2D array parameter index -> indexes of its _NROWS and _NCOLS parameters
+	std::set<int> m_dims_params;   ///< asyn parameter indexes of _NROWS and _NCOLS parameters
+	std::map<std::string, std::vector<int> > m_clusters;  ///< cluster key -> indexes of polled parameters reading its elements, read together by pollCluster()
+	std::map<int, std::vector<int> > m_bit_words;  ///< booleanarray parameter index -> indexes of the parameters for each of its words, in order
+	std::map<int, std::pair<int,int> > m_word_of;   ///< booleanarray word parameter index -> (booleanarray parameter index, word number)
+	std::map<int, lvDCOMHistory*> m_history;   ///< asyn parameter index -> its history, for parameters with a history attribute
+	std::map<int, int> m_history_params;        ///< _HIST or _HIST_TIME parameter index -> index of the parameter it is the history of
+	std::map<int, lvDCOMStats*> m_stats;       ///< asyn parameter index -> its statistics, for parameters with a stats attribute
+	std::set<int> m_stats_params;               ///< asyn parameter indexes of _MIN, _MAX, _MEAN ... statistics parameters
+	std::set<int> m_poll_adds;      ///< parameters for lvDCOMPollTask() to (re)start polling after a reload, protected by the port lock
+	std::set<int> m_poll_removals;  ///< parameters for lvDCOMPollTask() to stop polling after a reload, protected by the port lock
+	bool m_poller_started;          ///< lvDCOMPollTask() is running
+	epicsMutex m_reload_lock;       ///< serialises reloadConfig()
+	unsigned long m_reloads;        ///< number of successful reloadConfig()
+	unsigned long m_reload_errors;  ///< number of failed reloadConfig()
+	lvDCOMValueTableWriter* m_table;  ///< value table file from section value_table, or NULL if not used
+	std::set<int> m_table_changed;    ///< parameters changed since they were last written to m_table, protected by the port lock
+	double m_vi_state_period;       ///< section vi_state_period, seconds between checks of whether each VI is running, 0 if not checked
+	std::map<std::string, int> m_vi_state_params;  ///< path of each VI checked by lvDCOMViStateTask() -> index of its state_param parameter, or -1, protected by the port lock
+	std::set<int> m_state_params;   ///< asyn parameter indexes of the VI state parameters
+	std::set<std::string> m_idle_vis;  ///< VIs found not running, whose parameters lvDCOMPollTask() does not read, protected by the port lock
+	unsigned long m_polls_suspended;   ///< number of due reads not made as the VI was not running
+	unsigned long m_vi_restarts;       ///< number of times a VI that had stopped was run again
 
 	template<typename T> asynStatus writeValue(asynUser *pasynUser, const char* functionName, T value);
+	asynStatus writeGroup(asynUser *pasynUser, epicsInt32 value);
+	template<typename T> void postReadback(int function, const T& value, asynStatus status);
+	bool hasReadback(int function) const { return m_readbacks.find(function) != m_readbacks.end(); }
 	template<typename T> asynStatus readValue(asynUser *pasynUser, const char* functionName, T* value);
 	template<typename T> asynStatus readArray(asynUser *pasynUser, const char* functionName, T *value, size_t nElements, size_t *nIn);
+	bool pollParam(PolledParam& p);
+	bool pollCluster(PolledParam& p);
+	bool setBitWords(int index, const std::vector<epicsUInt32>& words, asynStatus status);
+	template<typename T> bool postArray(PolledParam& p, lvDCOMArrayBuffer<T>& buffer, bool status_changed);
+	template<typename T> bool setPolledValue(int index, const T& value);
+	void requestPoll(int function);
+	void applyPollRequests();
+	void applyConfigChanges();
+	void startPoller();
+	int createLvParam(const std::string& name, const std::string& lvtype);
+	int findOrCreateParam(const std::string& name, asynParamType type);
+	void buildReadbacks();
+	void adaptPollPeriod(PolledParam& p, bool changed);
+	void addPolledParam(int index, const std::string& name, asynParamType type);
+	void loadSnapshot();
+	void createViStateParams();
+	void checkViState(const std::string& vi_path, int index);
+	void openValueTable();
+	void tableChanged(int index) { if (m_table != NULL) { m_table_changed.insert(index); } }
+	void publishValueTable();
+	void markLive(int index);
+	template<typename T> void recordValue(int index, const T& value);
+	bool addSample(int index, epicsFloat64 value);
+	bool addSample(int index, epicsInt32 value) { return addSample(index, static_cast<epicsFloat64>(value)); }
+	bool addSample(int index, const std::string& value) { return false; }
+	template<typename T> bool addArraySample(int index, const T* value, size_t n);
+	bool isStale(int index) const { return m_stale.find(index) != m_stale.end(); }
+	bool staleValue(asynUser *pasynUser, int function);
+	bool isPolled(int index) const { return m_polled.find(index) != m_polled.end(); }
+	bool isTable(int index) const { return m_array_dims.find(index) != m_array_dims.end() && m_param_types.find(index)->second == asynParamOctet; }
+	void setArrayDims(int index, const size_t* dims);
+	lvDCOMArrayBuffer<epicsFloat64>* findArrayBuffer(int index, const epicsFloat64*) { return (m_float64_arrays.count(index) > 0 ? m_float64_arrays[index] : NULL); }
+	lvDCOMArrayBuffer<epicsInt32>* findArrayBuffer(int index, const epicsInt32*) { return (m_int32_arrays.count(index) > 0 ? m_int32_arrays[index] : NULL); }
+	asynStatus doArrayCallbacks(epicsFloat64* value, size_t nElements, int reason) { return doCallbacksFloat64Array(value, nElements, reason, 0); }
+	asynStatus doArrayCallbacks(epicsInt32* value, size_t nElements, int reason) { return doCallbacksInt32Array(value, nElements, reason, 0); }
+	asynStatus getParamValue(int index, epicsFloat64* value) { return getDoubleParam(index, value); }
+	asynStatus getParamValue(int index, epicsInt32* value) { return getIntegerParam(index, value); }
+	asynStatus getParamValue(int index, std::string* value) { return getStringParam(index, *value); }
+	asynStatus setParamValue(int index, epicsFloat64 value) { return setDoubleParam(index, value); }
+	asynStatus setParamValue(int index, epicsInt32 value) { return setIntegerParam(index, value); }
+	asynStatus setParamValue(int index, const std::string& value) { return setStringParam(index, value.c_str()); }
 
 	static void lvDCOMTaskC(void* arg);
+	static void lvDCOMPollTaskC(void* arg);
+	static void lvDCOMSnapshotTaskC(void* arg);
+	static void lvDCOMReloadTaskC(void* arg);
+	static void lvDCOMViStateTaskC(void* arg);
 };
 
 #endif /* LVDCOMDRIVER_H */
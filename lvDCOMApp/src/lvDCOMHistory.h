@@ -0,0 +1,115 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMHistory.h header for #lvDCOMHistory class.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#ifndef LV_DCOM_HISTORY_H
+#define LV_DCOM_HISTORY_H
+
+#include <string.h>
+#include <vector>
+
+#include <epicsTime.h>
+
+/// Fixed size ring buffer of the last values read for a parameter and when they were read, published as the
+/// <name>_HIST and <name>_HIST_TIME waveform parameters. All storage is allocated up front, so adding a sample
+/// never allocates. Used with the asyn port lock held.
+class lvDCOMHistory
+{
+public:
+	lvDCOMHistory(size_t capacity, double period, int values_param, int times_param) : m_values(capacity), m_times(capacity),
+	    m_out_values(capacity), m_out_times(capacity), m_next(0), m_count(0), m_period(period), m_published(false),
+		m_values_param(values_param), m_times_param(times_param), m_samples(0), m_posts(0) { }
+	/// record \a value read at \a time, the oldest sample is dropped once the buffer is full
+	void add(double value, const epicsTimeStamp& time)
+	{
+		if (m_values.size() == 0)
+		{
+			return;
+		}
+		m_values[m_next] = value;
+		m_times[m_next] = time.secPastEpoch + 1.0e-9 * time.nsec;
+		m_next = (m_next + 1 == m_values.size() ? 0 : m_next + 1);
+		m_count = (m_count < m_values.size() ? m_count + 1 : m_count);
+		++m_samples;
+	}
+	/// true if the waveforms have not been published for at least the decimation period
+	bool due(const epicsTimeStamp& now) const
+	{
+		return !m_published || (epicsTime(now) - epicsTime(m_last_publish)) >= m_period;
+	}
+	/// fill the publish buffers returned by values() and times(), oldest first, and note the time. Returns the number of samples
+	size_t publish(const epicsTimeStamp& now)
+	{
+		copyValues(m_out_values.size() > 0 ? &(m_out_values[0]) : NULL, m_out_values.size());
+		copyTimes(m_out_times.size() > 0 ? &(m_out_times[0]) : NULL, m_out_times.size());
+		m_last_publish = now;
+		m_published = true;
+		++m_posts;
+		return m_count;
+	}
+	/// copy the newest \a n (or fewer) values, oldest first, to \a dest. Returns the number copied
+	size_t copyValues(double* dest, size_t n) const
+	{
+		size_t count = (m_count < n ? m_count : n);
+		size_t start = (m_next + m_values.size() - count) % (m_values.size() > 0 ? m_values.size() : 1);
+		size_t first = (start + count > m_values.size() ? m_values.size() - start : count);  // before wrapping round
+		if (count > 0)
+		{
+			memcpy(dest, &(m_values[start]), first * sizeof(double));
+			if (count > first)
+			{
+				memcpy(dest + first, &(m_values[0]), (count - first) * sizeof(double));
+			}
+		}
+		return count;
+	}
+	/// copy the times of the newest \a n (or fewer) samples, oldest first, to \a dest as seconds before the newest sample (so 0 or negative).
+	/// The newest sample is at the timestamp of the waveform. Returns the number copied
+	size_t copyTimes(double* dest, size_t n) const
+	{
+		size_t count = (m_count < n ? m_count : n);
+		if (count == 0)
+		{
+			return 0;
+		}
+		size_t size = m_times.size();
+		double newest = m_times[(m_next + size - 1) % size];
+		for(size_t i = 0, j = (m_next + size - count) % size; i < count; ++i, j = (j + 1 == size ? 0 : j + 1))
+		{
+			dest[i] = m_times[j] - newest;
+		}
+		return count;
+	}
+	double* values() { return (m_out_values.size() > 0 ? &(m_out_values[0]) : NULL); }
+	double* times() { return (m_out_times.size() > 0 ? &(m_out_times[0]) : NULL); }
+	size_t size() const { return m_count; }
+	size_t capacity() const { return m_values.size(); }
+	double period() const { return m_period; }
+	int valuesParam() const { return m_values_param; }
+	int timesParam() const { return m_times_param; }
+	unsigned long samples() const { return m_samples; }
+	unsigned long posts() const { return m_posts; }
+
+private:
+	std::vector<double> m_values;      ///< ring buffer
+	std::vector<double> m_times;       ///< ring buffer, seconds past the EPICS epoch
+	std::vector<double> m_out_values;  ///< values in time order, as last published
+	std::vector<double> m_out_times;   ///< times in time order, as last published
+	size_t m_next;                     ///< where the next sample goes
+	size_t m_count;                    ///< number of samples held
+	double m_period;                   ///< minimum seconds between publishing
+	bool m_published;
+	epicsTimeStamp m_last_publish;
+	int m_values_param;                ///< asyn parameter index of <name>_HIST
+	int m_times_param;                 ///< asyn parameter index of <name>_HIST_TIME
+	unsigned long m_samples;           ///< number of samples ever added
+	unsigned long m_posts;             ///< number of times published
+};
+
+#endif /* LV_DCOM_HISTORY_H */
@@ -0,0 +1,82 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMHistoryTest.cpp Unit tests of #lvDCOMHistory.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "lvDCOMHistory.h"
+
+static epicsTimeStamp stamp(unsigned sec, unsigned nsec)
+{
+	epicsTimeStamp ts;
+	ts.secPastEpoch = sec;
+	ts.nsec = nsec;
+	return ts;
+}
+
+/// true if the first \a n of \a x are \a first, \a first + \a step, ...
+static bool sequence(const double* x, size_t n, double first, double step)
+{
+	for(size_t i = 0; i < n; ++i)
+	{
+		if (x[i] != first + step * static_cast<double>(i))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+MAIN(lvDCOMHistoryTest)
+{
+	testPlan(19);
+	double values[8], times[8];
+	lvDCOMHistory hist(4, 1.0, 10, 11);
+	testOk1(hist.capacity() == 4 && hist.size() == 0 && hist.valuesParam() == 10 && hist.timesParam() == 11);
+	testOk1(hist.copyValues(values, 8) == 0 && hist.copyTimes(times, 8) == 0);
+
+	testDiag("before the buffer is full");
+	for(unsigned i = 1; i <= 3; ++i)
+	{
+		hist.add(i, stamp(1000 + i, 0));
+	}
+	testOk1(hist.size() == 3 && hist.samples() == 3);
+	testOk1(hist.copyValues(values, 8) == 3 && sequence(values, 3, 1.0, 1.0));
+	testOk1(hist.copyTimes(times, 8) == 3 && sequence(times, 3, -2.0, 1.0));
+
+	testDiag("exactly full");
+	hist.add(4, stamp(1004, 0));
+	testOk1(hist.copyValues(values, 8) == 4 && sequence(values, 4, 1.0, 1.0));
+
+	testDiag("wrapped round, oldest dropped");
+	hist.add(5, stamp(1005, 0));
+	hist.add(6, stamp(1006, 500000000));
+	testOk1(hist.size() == 4 && hist.samples() == 6);
+	testOk1(hist.copyValues(values, 8) == 4 && sequence(values, 4, 3.0, 1.0));
+	testOk1(hist.copyTimes(times, 8) == 4 && times[3] == 0.0);
+	testOk(times[0] > -3.50001 && times[0] < -3.49999, "oldest time %g seconds before newest", times[0]);
+	testOk1(hist.copyValues(values, 2) == 2 && sequence(values, 2, 5.0, 1.0));
+	testOk1(hist.copyTimes(times, 1) == 1 && times[0] == 0.0);
+
+	testDiag("publishing");
+	testOk1(hist.due(stamp(2000, 0)));
+	testOk1(hist.publish(stamp(2000, 0)) == 4 && hist.posts() == 1);
+	testOk1(sequence(hist.values(), 4, 3.0, 1.0) && hist.times()[3] == 0.0);
+	testOk1(!hist.due(stamp(2000, 500000000)));
+	testOk1(hist.due(stamp(2001, 0)));
+
+	testDiag("no capacity");
+	lvDCOMHistory none(0, 1.0, -1, -1);
+	none.add(1.0, stamp(1000, 0));
+	testOk1(none.size() == 0 && none.samples() == 0 && none.copyValues(values, 8) == 0);
+	testOk1(none.publish(stamp(1000, 0)) == 0 && none.values() == NULL && none.times() == NULL);
+
+	return testDone();
+}
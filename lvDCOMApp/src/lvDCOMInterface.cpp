@@ -22,7 +22,8 @@
 ///  @example lvinput.xml
 ///  An lvDOM configuration file, loaded via lvDCOMConfigure() from @link st.cmd @endlink. This file specifies the mapping from
 ///  Asyn port name and associated driver parameters (used in @link example.db @endlink) -> LabVIEW front panel control/indicator.
-///  An initial version of this file can be generated 
+///  An initial version of this file, and a substitutions file for its records, can be generated directly from the VI by lvDCOMDiscover().
+///  Alternatively it can be generated 
 ///  from @link controls.xml @endlink via the XSLT stylesheet @link lvstrings2input.xsl @endlink. This configuration file can also be used to 
 ///  generate an initial set of EPICS DB records @link example.db @endlink via the XSLT stylesheet @link lvinput2db.xsl @endlink 
 
@@ -57,9 +58,29 @@
 ///  @example lvDCOM_string.template
 ///  template file used by substitutions file generated from lvDCOMSECIConfigure()
 
+///  @example lvDCOM_float64array.template
+///  template file used by substitutions file generated from lvDCOMDiscover()
+
+///  @example lvDCOM_int32array.template
+///  template file used by substitutions file generated from lvDCOMDiscover()
+
+///  @example lvDCOM_booleanarray.template
+///  template file for a word of a booleanarray parameter
+
+///  @example lvDCOM_bit.template
+///  template file for a single bit of a booleanarray parameter
+
+///  @example lvDCOM_history.template
+///  template file for the history waveforms of a parameter with a history attribute on its \<read\>
+
+///  @example lvDCOM_stat.template
+///  template file for one of the statistics of a parameter with a stats attribute on its \<read\>
+
 #include <stdio.h>
+#include <ctype.h>
 
 //#define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
+#include <winsock2.h>  // for osiSock.h, must come before windows.h
 #include <windows.h>
 
 #define _ATL_CSTRING_EXPLICIT_CONSTRUCTORS      // some CString constructors will be explicit
@@ -78,18 +99,29 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
 #include <list>
 #include <stdexcept>
 #include <sstream>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <algorithm>
 
 #include "lvDCOMInterface.h"
 #include "variant_utils.h"
+#include "variant_convert.h"
+#include "lvDCOMTranspose.h"
+#include "lvDCOMBitPack.h"
+#include "lvDCOMVIStrings.h"
+#include "lvDCOMTcpClient.h"
+#include "lvDCOMShm.h"
 
 #include <macLib.h>
 #include <epicsGuard.h>
+#include <epicsTime.h>
+#include <epicsEvent.h>
+#include <epicsAlgorithm.h>
 #include <cantProceed.h>
 #include <errlog.h>
 
@@ -140,6 +172,96 @@ static void initCOM(void*)
 	_set_com_error_handler(my_com_raise_error);    // replace default _com_raise_error
 }
 
+/// Calls work() once for each of a number of items, shared out between several threads. Used by 
+/// lvDCOMInterface::warmUpViRefs() and lvDCOMInterface::discoverControls()
+class ParallelWork
+{
+public:
+	explicit ParallelWork(size_t nitems) : m_nitems(nitems), m_next(0), m_threads(0) { }
+	virtual ~ParallelWork() { }
+	void run(const char* name, int nthreads);
+protected:
+	virtual void work(size_t i) = 0;  ///< process item \a i, must not throw
+	epicsMutex m_lock;                ///< protects our counters, work() may also use it for its own
+private:
+	size_t m_nitems;
+	size_t m_next;                    ///< next item to hand out
+	int m_threads;                    ///< threads that have not yet finished
+	epicsEvent m_finished;            ///< signalled by the last thread to finish
+	static void workerTask(void* arg);
+};
+
+/// Process all items using up to \a nthreads threads called \a name followed by a number, returns when they are
+/// done. If no thread can be created the work is done on the calling thread.
+void ParallelWork::run(const char* name, int nthreads)
+{
+	nthreads = epicsMin(nthreads, static_cast<int>(m_nitems));
+	if (nthreads <= 0)
+	{
+		return;
+	}
+	{
+		epicsGuard<epicsMutex> _lock(m_lock);
+		m_threads = nthreads;
+	}
+	int created = 0;
+	for(int i=0; i<nthreads; ++i)
+	{
+		char thread_name[64];
+		epicsSnprintf(thread_name, sizeof(thread_name), "%s%d", name, i);
+		if (epicsThreadCreate(thread_name, epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackMedium),
+			(EPICSTHREADFUNC)workerTask, this) != 0)
+		{
+			++created;
+		}
+		else
+		{
+			epicsGuard<epicsMutex> _lock(m_lock);
+			--m_threads;
+		}
+	}
+	if (created == 0)
+	{
+		m_threads = 1;  // do the work ourselves
+		workerTask(this);
+	}
+	// the threads may all have finished already, and if a later creation failed the last of them did not know
+	// it was the last and so did not signal
+	bool running;
+	{
+		epicsGuard<epicsMutex> _lock(m_lock);
+		running = (m_threads > 0);
+	}
+	if (running)
+	{
+		m_finished.wait();
+	}
+}
+
+void ParallelWork::workerTask(void* arg)
+{
+	ParallelWork* pw = static_cast<ParallelWork*>(arg);
+	bool last = false;
+	while(true)
+	{
+		size_t i;
+		{
+			epicsGuard<epicsMutex> _lock(pw->m_lock);
+			if (pw->m_next >= pw->m_nitems)
+			{
+				last = (--(pw->m_threads) == 0);
+				break;
+			}
+			i = (pw->m_next)++;
+		}
+		pw->work(i);
+	}
+	if (last)
+	{
+		pw->m_finished.signal(); // pw may be destroyed as soon as we do this
+	}
+}
+
 /// expand epics environment strings using previously saved environment  
 /// based on EPICS macEnvExpand()
 /// returns NULL if undefined macros
@@ -171,14 +293,27 @@ char* lvDCOMInterface::envExpand(const char *str)
     return dest;
 }
 
+/// envExpand() into a std::string, "" if \a str contains undefined macros
+std::string lvDCOMInterface::expandMacros(const char *str)
+{
+	std::string res;
+	char* expanded = envExpand(str);
+	if (expanded != NULL)
+	{
+		res = expanded;
+		free(expanded);
+	}
+	return res;
+}
+
 // return "" if no value at path
 std::string lvDCOMInterface::doXPATH(const std::string& xpath)
 {
+	epicsGuard<epicsMutex> _lock(m_lock);
 	if (m_pxmldom == NULL)
 	{
 		throw std::runtime_error("m_pxmldom is NULL");
 	}
-	epicsGuard<epicsMutex> _lock(m_lock);
 	std::map<std::string,std::string>::const_iterator it = m_xpath_map.find(xpath);
 	if (it != m_xpath_map.end())
 	{
@@ -193,11 +328,7 @@ std::string lvDCOMInterface::doXPATH(const std::string& xpath)
 		hr=pNode->get_text(&bstrValue);
 		if (SUCCEEDED(hr))
 		{
-            char* res = envExpand(CW2CT(bstrValue));
-            if (res != NULL) {
-                S_res = res;
-                free(res);
-            }
+			S_res = expandMacros(CW2CT(bstrValue));
 			SysFreeString(bstrValue);
 		}
 		pNode->Release();
@@ -212,11 +343,11 @@ std::string lvDCOMInterface::doXPATH(const std::string& xpath)
 
 bool lvDCOMInterface::doXPATHbool(const std::string& xpath)
 {
+	epicsGuard<epicsMutex> _lock(m_lock);
 	if (m_pxmldom == NULL)
 	{
 		throw std::runtime_error("m_pxmldom is NULL");
 	}
-	epicsGuard<epicsMutex> _lock(m_lock);
 	std::map<std::string,bool>::const_iterator it = m_xpath_bool_map.find(xpath);
 	if (it != m_xpath_bool_map.end())
 	{
@@ -232,11 +363,7 @@ bool lvDCOMInterface::doXPATHbool(const std::string& xpath)
 		hr=pNode->get_text(&bstrValue);
 		if (SUCCEEDED(hr))
 		{
-            char* str = envExpand(CW2CT(bstrValue));
-            if (str != NULL) {
-                bool_str = str;
-                free(str);
-            }
+			bool_str = expandMacros(CW2CT(bstrValue));
 			if (bool_str.size() == 0)
 			{
 				res = false;
@@ -313,25 +440,366 @@ std::string lvDCOMInterface::doPath(const std::string& xpath)
 	return S_res;
 }
 
+/// the VI and the control that \a param reads (\a op "read") or writes (\a op "set"), empty if not configured
+void lvDCOMInterface::paramTarget(const char* param, const char* op, CComBSTR& vi_name, CComBSTR& control_name)
+{
+	char xpath[MAX_PATH_LEN];
+	_snprintf(xpath, sizeof(xpath), "/lvinput/section[@name='%s']/vi[param[@name='%s']]/@path", m_configSection.c_str(), param);
+	vi_name = doPath(xpath).c_str();
+	_snprintf(xpath, sizeof(xpath), "/lvinput/section[@name='%s']/vi/param[@name='%s']/%s/@target", m_configSection.c_str(), param, op);
+	control_name = doXPATH(xpath).c_str();
+}
+
+/// attribute \a attr of the \<read\> (\a op "read") or \<set\> (\a op "set") element of \a param, "" if it is not given
+std::string lvDCOMInterface::paramAttribute(const char* param, const char* op, const char* attr)
+{
+	char xpath[MAX_PATH_LEN];
+	_snprintf(xpath, sizeof(xpath), "/lvinput/section[@name='%s']/vi/param[@name='%s']/%s/@%s", m_configSection.c_str(), param, op, attr);
+	return doXPATH(xpath);
+}
+
+/// deadline (seconds) for a DCOM \a op ("read" or "set") on \a param. This is taken from the timeout attribute of the
+/// relevant &lt;read&gt; or &lt;set&gt; element if present, otherwise the timeout attribute of the &lt;section&gt;
+double lvDCOMInterface::getTimeout(const char* param, const char* op)
+{
+	std::string timeout = paramAttribute(param, op, "timeout");
+	return (timeout.size() > 0 ? atof(timeout.c_str()) : m_timeout);
+}
+
 void lvDCOMInterface::DomFromCOM()
 {
-	m_pxmldom = NULL;
+	m_pxmldom = createDom();
+}
+
+/// a new, empty, XML document to load a configuration file into, the caller must Release() it
+IXMLDOMDocument2* lvDCOMInterface::createDom()
+{
+	IXMLDOMDocument2* pxmldom = NULL;
 	HRESULT hr=CoCreateInstance(CLSID_DOMDocument, NULL, CLSCTX_SERVER,
-		IID_IXMLDOMDocument2, (void**)&m_pxmldom);
+		IID_IXMLDOMDocument2, (void**)&pxmldom);
 	if (FAILED(hr))
 	{
 		throw std::runtime_error("Cannot load DomFromCom");
 	}
-	if (m_pxmldom != NULL)
+	if (pxmldom != NULL)
 	{
-		m_pxmldom->put_async(VARIANT_FALSE);
-		m_pxmldom->put_validateOnParse(VARIANT_FALSE);
-		m_pxmldom->put_resolveExternals(VARIANT_FALSE); 
+		pxmldom->put_async(VARIANT_FALSE);
+		pxmldom->put_validateOnParse(VARIANT_FALSE);
+		pxmldom->put_resolveExternals(VARIANT_FALSE); 
 	}
 	else
 	{
 		throw std::runtime_error("Cannot load DomFromCom");
 	}
+	return pxmldom;
+}
+
+/// Last write time of \a file_name, or zero if it cannot be found
+static FILETIME fileWriteTime(const std::string& file_name)
+{
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	FILETIME zero = { 0, 0 };
+	if ( GetFileAttributesEx(file_name.c_str(), GetFileExInfoStandard, &data) == 0 )
+	{
+		return zero;
+	}
+	return data.ftLastWriteTime;
+}
+
+/// text of the node at \a xpath relative to \a pNode, or "" if there is none
+static std::string nodeText(IXMLDOMNode* pNode, const char* xpath)
+{
+	std::string res;
+	IXMLDOMNode* pText = NULL;
+	if ( SUCCEEDED(pNode->selectSingleNode(_bstr_t(xpath), &pText)) && pText != NULL )
+	{
+		BSTR bstrValue = NULL;
+		if ( SUCCEEDED(pText->get_text(&bstrValue)) )
+		{
+			res = CW2CT(bstrValue);
+			SysFreeString(bstrValue);
+		}
+		pText->Release();
+	}
+	return res;
+}
+
+/// The definition of every \<param\> and \<group\> of our section in \a dom, as their type and their XML along with
+/// the path of the VI they are on. Two definitions that compare equal access LabVIEW in the same way.
+void lvDCOMInterface::paramDefinitions(IXMLDOMDocument2* dom, param_defs_t& defs)
+{
+	defs.clear();
+	char xpath[MAX_PATH_LEN];
+	_snprintf(xpath, sizeof(xpath), "/lvinput/section[@name='%s']/vi/param | /lvinput/section[@name='%s']/vi/group", m_configSection.c_str(), m_configSection.c_str());
+	IXMLDOMNodeList* pXMLDomNodeList = NULL;
+	HRESULT hr = dom->selectNodes(_bstr_t(xpath), &pXMLDomNodeList);
+	if (FAILED(hr) || pXMLDomNodeList == NULL)
+	{
+		return;
+	}
+	long n = 0;
+	pXMLDomNodeList->get_length(&n);
+	for(long i=0; i<n; ++i)
+	{
+		IXMLDOMNode* pNode = NULL;
+		if ( FAILED(pXMLDomNodeList->get_item(i, &pNode)) || pNode == NULL )
+		{
+			continue;
+		}
+		CComBSTR nodeName, xml;
+		pNode->get_nodeName(&nodeName);
+		pNode->get_xml(&xml);
+		std::string type = (nodeName == L"group" ? "group" : nodeText(pNode, "@type"));
+		defs[nodeText(pNode, "@name")] = std::pair<std::string,std::string>(type, nodeText(pNode, "../@path") + "\n" + std::string(CW2CT(xml)));
+		pNode->Release();
+	}
+	pXMLDomNodeList->Release();
+}
+
+/// The live configuration document, with a reference held for the caller. reloadConfig() only releases its own
+/// reference to the document it replaces, so a caller can go on using this (and nodes from it) without holding #m_lock
+CComPtr<IXMLDOMDocument2> lvDCOMInterface::configDom()
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	if (m_pxmldom == NULL)
+	{
+		throw std::runtime_error("m_pxmldom is NULL");
+	}
+	return CComPtr<IXMLDOMDocument2>(m_pxmldom);
+}
+
+/// name -> value of every attribute of our \<section\> in \a dom
+void lvDCOMInterface::sectionAttributes(IXMLDOMDocument2* dom, std::map<std::string,std::string>& attrs)
+{
+	attrs.clear();
+	char xpath[MAX_PATH_LEN];
+	_snprintf(xpath, sizeof(xpath), "/lvinput/section[@name='%s']/@*", m_configSection.c_str());
+	IXMLDOMNodeList* pXMLDomNodeList = NULL;
+	HRESULT hr = dom->selectNodes(_bstr_t(xpath), &pXMLDomNodeList);
+	if (FAILED(hr) || pXMLDomNodeList == NULL)
+	{
+		return;
+	}
+	long n = 0;
+	pXMLDomNodeList->get_length(&n);
+	for(long i=0; i<n; ++i)
+	{
+		IXMLDOMNode* pNode = NULL;
+		if ( FAILED(pXMLDomNodeList->get_item(i, &pNode)) || pNode == NULL )
+		{
+			continue;
+		}
+		CComBSTR name, value;
+		pNode->get_nodeName(&name);
+		pNode->get_text(&value);
+		attrs[std::string(CW2CT(name))] = (value.Length() > 0 ? std::string(CW2CT(value)) : "");
+		pNode->Release();
+	}
+	pXMLDomNodeList->Release();
+}
+
+/// text of the node at \a xpath relative to \a pNode with EPICS macros expanded, as doXPATH() would give
+std::string lvDCOMInterface::expandedNodeText(IXMLDOMNode* pNode, const char* xpath)
+{
+	std::string text = nodeText(pNode, xpath);
+	epicsGuard<epicsMutex> _lock(m_lock);  // for m_mac_env
+	return expandMacros(text.c_str());
+}
+
+/// expanded paths of the VIs in our section, each listed once
+void lvDCOMInterface::getViPaths(std::vector<std::string>& vi_names)
+{
+	char vi_xpath[MAX_PATH_LEN];
+	vi_names.clear();
+	_snprintf(vi_xpath, sizeof(vi_xpath), "/lvinput/section[@name='%s']/vi", m_configSection.c_str());
+	CComPtr<IXMLDOMDocument2> dom = configDom();
+	IXMLDOMNodeList* pXMLDomNodeList = NULL;
+	HRESULT hr = dom->selectNodes(_bstr_t(vi_xpath), &pXMLDomNodeList);
+	if (FAILED(hr) || pXMLDomNodeList == NULL)
+	{
+		return;
+	}
+	long n = 0;
+	pXMLDomNodeList->get_length(&n);
+	for(long i=0; i<n; ++i)
+	{
+		IXMLDOMNode* pNode = NULL;
+		if ( FAILED(pXMLDomNodeList->get_item(i, &pNode)) || pNode == NULL )
+		{
+			continue;
+		}
+		std::string vi_name = expandedNodeText(pNode, "@path");
+		pNode->Release();
+		std::replace(vi_name.begin(), vi_name.end(), '/', '\\');  // as doPath()
+		if (vi_name.size() > 0 && std::find(vi_names.begin(), vi_names.end(), vi_name) == vi_names.end())
+		{
+			vi_names.push_back(vi_name);
+		}
+	}
+	pXMLDomNodeList->Release();
+}
+
+/// Load the configuration file again and make it the live configuration, returning in \a changes how it differs from before. 
+/// Cached XPath results are discarded and cluster elements recompiled, and references to VIs no parameter now uses are
+/// released (stopping the VI if we started it). Only \<vi\>, \<param\> and \<group\> changes are applied, section 
+/// attributes (poll_budget, vi_state_period, snapshot_file etc.) and extint are as read at start; section attributes that 
+/// differ are listed in ConfigChanges::section_changed so they can be reported. If the file cannot be loaded, or a parameter 
+/// has changed type (asyn parameters cannot change type) an exception is thrown and the live configuration is left as it was.
+/// Anything still using the previous document from configDom() keeps it alive until it has finished.
+void lvDCOMInterface::reloadConfig(ConfigChanges& changes)
+{
+	changes = ConfigChanges();
+	if (m_configFile.size() == 0)
+	{
+		throw std::runtime_error("reloadConfig: no configuration file loaded");
+	}
+	FILETIME config_time = fileWriteTime(m_configFile);
+	{
+		// a file that fails to load is not tried again by the driver's reload watcher until it is next written
+		epicsGuard<epicsMutex> _lock(m_lock);
+		m_config_time = config_time;
+	}
+	IXMLDOMDocument2* dom = createDom();
+	short sResult = FALSE;
+	HRESULT hr = dom->load(_variant_t(m_configFile.c_str()), &sResult);
+	if (FAILED(hr) || sResult != VARIANT_TRUE)
+	{
+		dom->Release();
+		throw std::runtime_error("Cannot load XML \"" + m_configFile + "\": load failure");
+	}
+	param_defs_t defs;
+	paramDefinitions(dom, defs);
+	for(param_defs_t::const_iterator it = defs.begin(); it != defs.end(); ++it)
+	{
+		param_defs_t::const_iterator itold = m_param_defs.find(it->first);
+		if (itold == m_param_defs.end())
+		{
+			changes.added[it->first] = it->second.first;
+		}
+		else if (itold->second.first != it->second.first)
+		{
+			dom->Release();
+			throw std::runtime_error("parameter \"" + it->first + "\" has changed type from " + itold->second.first + " to " + 
+			    it->second.first + ", the IOC must be restarted to apply this");
+		}
+		else if (itold->second.second != it->second.second)
+		{
+			changes.changed.push_back(it->first);
+		}
+	}
+	for(param_defs_t::const_iterator it = m_param_defs.begin(); it != m_param_defs.end(); ++it)
+	{
+		if (defs.find(it->first) == defs.end())
+		{
+			changes.removed.push_back(it->first);
+		}
+	}
+	std::map<std::string,std::string> old_attrs, new_attrs;
+	sectionAttributes(configDom(), old_attrs);
+	sectionAttributes(dom, new_attrs);
+	for(std::map<std::string,std::string>::const_iterator it = new_attrs.begin(); it != new_attrs.end(); ++it)
+	{
+		std::map<std::string,std::string>::const_iterator itold = old_attrs.find(it->first);
+		if (itold == old_attrs.end() || itold->second != it->second)
+		{
+			changes.section_changed.push_back(it->first);
+		}
+	}
+	for(std::map<std::string,std::string>::const_iterator it = old_attrs.begin(); it != old_attrs.end(); ++it)
+	{
+		if (new_attrs.find(it->first) == new_attrs.end())
+		{
+			changes.section_changed.push_back(it->first);
+		}
+	}
+	IXMLDOMDocument2* old_dom = NULL;
+	{
+		epicsGuard<epicsMutex> _lock(m_lock);
+		old_dom = m_pxmldom;
+		m_pxmldom = dom;
+		m_param_defs.swap(defs);
+		m_xpath_map.clear();
+		m_xpath_bool_map.clear();
+	}
+	old_dom->Release();  // freed once the last configDom() reference to it is gone
+	compileClusters();
+	// a changed parameter may now write a different control
+	{
+		epicsGuard<epicsMutex> _lock(m_setpoint_lock);
+		for(vi_setpoint_map_t::iterator vi = m_setpoints.begin(); vi != m_setpoints.end(); ++vi)
+		{
+			for(std::vector<std::string>::const_iterator it = changes.removed.begin(); it != changes.removed.end(); ++it)
+			{
+				vi->second.erase(*it);
+			}
+			for(std::vector<std::string>::const_iterator it = changes.changed.begin(); it != changes.changed.end(); ++it)
+			{
+				vi->second.erase(*it);
+			}
+		}
+	}
+	// drop references to VIs that are no longer used, outside the lock as stopping one is a DCOM call
+	std::vector<std::string> vi_names;
+	std::vector<ViRef> unused;
+	getViPaths(vi_names);
+	std::wstring extint(m_extint.Length() > 0 ? static_cast<const wchar_t*>(m_extint) : L"");
+	{
+		epicsGuard<epicsMutex> _lock(m_lock);
+		for(vi_map_t::iterator it = m_vimap.begin(); it != m_vimap.end(); )
+		{
+			std::string vi_name(CW2CT(it->first.c_str()));
+			if ( it->first != extint && std::find(vi_names.begin(), vi_names.end(), vi_name) == vi_names.end() )
+			{
+				unused.push_back(it->second);
+				m_vimap.erase(it++);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+	for(std::vector<ViRef>::iterator it = unused.begin(); it != unused.end(); ++it)
+	{
+		if (!it->started || it->vi_ref == NULL)
+		{
+			continue;
+		}
+		DCOMCallDeadline deadline(m_watchdog, "Abort", NULL, NULL, m_timeout);
+		try
+		{
+			if (it->vi_ref->ExecState != LabVIEW::eIdle)
+			{
+				it->vi_ref->Abort();
+			}
+		}
+		catch(const std::exception& ex)
+		{
+			std::cerr << "error stopping vi: " << (deadline.finish() ? "exceeded deadline and was cancelled" : ex.what()) << std::endl;
+		}
+	}
+	changes.vis_released = static_cast<int>(unused.size());
+}
+
+/// has the configuration file been written to since it was last loaded
+bool lvDCOMInterface::configFileChanged()
+{
+	if (m_configFile.size() == 0)
+	{
+		return false;
+	}
+	FILETIME config_time = fileWriteTime(m_configFile);
+	epicsGuard<epicsMutex> _lock(m_lock);
+	return CompareFileTime(&config_time, &m_config_time) != 0;
+}
+
+/// period (seconds) at which to check for the configuration file changing and reload it, 0 if not wanted
+double lvDCOMInterface::getReloadPeriod()
+{
+	char xpath[MAX_PATH_LEN];
+	_snprintf(xpath, sizeof(xpath), "/lvinput/section[@name='%s']/@reload_period", m_configSection.c_str());
+	std::string period = doXPATH(xpath);
+	return (period.size() > 0 ? atof(period.c_str()) : 0.0);
 }
 
 
@@ -343,7 +811,9 @@ void lvDCOMInterface::DomFromCOM()
 /// \param[in] username @copydoc initArg6
 /// \param[in] password @copydoc initArg7
 lvDCOMInterface::lvDCOMInterface(const char *configSection, const char* configFile, const char* host, int options, const char* progid, const char* username, const char* password) : 
-m_configSection(configSection), m_pidentity(NULL), m_pxmldom(NULL), m_options(options), 
+m_configSection(configSection), m_watchdog(configSection), m_timeout(0.0), m_retry_interval(5.0), m_warm_up_threads(4), m_warming_up(false), 
+	m_restore_setpoints(false), m_setpoint_seq(0), m_restoring(false), m_restores(0), m_restore_writes(0), m_restore_failures(0), m_restore_time(0.0),
+	m_capture(NULL), m_tcp(NULL), m_shm(NULL), m_pxmldom(NULL), m_options(options), 
 	m_progid(progid != NULL? progid : ""), m_username(username != NULL? username : ""), m_password(password != NULL ? password : ""),
 	m_mac_env(NULL)
 	
@@ -367,6 +837,9 @@ m_configSection(configSection), m_pidentity(NULL), m_pxmldom(NULL), m_options(op
 		//		}			
 		m_host = "localhost";
 	}
+	m_identity.set(m_username, m_host, m_password);
+	memset(&m_config_time, 0, sizeof(m_config_time));
+	bool tcp_subscribe = true;
 	if (macCreateHandle(&m_mac_env, NULL) != 0)
 	{
 		throw std::runtime_error("Cannot create mac handle");
@@ -414,8 +887,81 @@ m_configSection(configSection), m_pidentity(NULL), m_pxmldom(NULL), m_options(op
 	    }
 	    std::cerr << "Loaded XML config file \"" << m_configFile << "\" (expanded from \"" << configFile << "\")" << std::endl;
 	    m_extint = doPath("/lvinput/extint/@path").c_str();
+		char timeout_xpath[MAX_PATH_LEN];
+		_snprintf(timeout_xpath, sizeof(timeout_xpath), "/lvinput/section[@name='%s']/@timeout", m_configSection.c_str());
+		std::string timeout = doXPATH(timeout_xpath);
+		if (timeout.size() > 0)
+		{
+			m_timeout = atof(timeout.c_str());
+		}
+		_snprintf(timeout_xpath, sizeof(timeout_xpath), "/lvinput/section[@name='%s']/@warm_up_threads", m_configSection.c_str());
+		std::string warm_up_threads = doXPATH(timeout_xpath);
+		if (warm_up_threads.size() > 0)
+		{
+			m_warm_up_threads = atoi(warm_up_threads.c_str());
+		}
+		_snprintf(timeout_xpath, sizeof(timeout_xpath), "/lvinput/section[@name='%s']/@retry_interval", m_configSection.c_str());
+		std::string retry_interval = doXPATH(timeout_xpath);
+		if (retry_interval.size() > 0)
+		{
+			m_retry_interval = atof(retry_interval.c_str());
+			m_host_breaker.setRetryInterval(m_retry_interval);
+		}
+		_snprintf(timeout_xpath, sizeof(timeout_xpath), "/lvinput/section[@name='%s']/@capture_file", m_configSection.c_str());
+		std::string capture_file = doXPATH(timeout_xpath);
+		if (capture_file.size() > 0)
+		{
+			try
+			{
+				m_capture = new lvDCOMCaptureWriter(capture_file);
+				std::cerr << "Capturing LabVIEW operations to \"" << capture_file << "\"" << std::endl;
+			}
+			catch(const std::exception& ex)
+			{
+				errlogSevPrintf(errlogMajor, "lvDCOMInterface: capture disabled: %s\n", ex.what());
+			}
+		}
+		_snprintf(timeout_xpath, sizeof(timeout_xpath), "/lvinput/section[@name='%s']/@restore_setpoints", m_configSection.c_str());
+		m_restore_setpoints = doXPATHbool(timeout_xpath);
+		_snprintf(timeout_xpath, sizeof(timeout_xpath), "/lvinput/section[@name='%s']/@tcp_subscribe", m_configSection.c_str());
+		tcp_subscribe = (doXPATH(timeout_xpath).size() == 0 || doXPATHbool(timeout_xpath));
+		m_config_time = fileWriteTime(m_configFile);
+		paramDefinitions(m_pxmldom, m_param_defs);
+		compileClusters();
+	}
+	// there is no way to remove an exit handler, so only register one when there is something for it to do. An 
+	// interface made just to generate files (lvDCOMSECIConfigure(), lvDCOMDiscover()) is destroyed long before exit
+	if ( m_capture != NULL || checkOption(viAlwaysStopOnExit) || checkOption(viStopOnExitIfStarted) )
+	{
+		epicsAtExit(epicsExitFunc, this);
+	}
+	if (m_host.compare(0, 6, "tcp://") == 0)
+	{
+		// no DCOM, so no ProgID to look up and no local LabVIEW to wait for
+		m_tcp = new lvDCOMTcpClient(m_host.substr(6), tcp_subscribe);
+		std::cerr << "Using TCP transport to \"" << m_tcp->address() << "\"" << std::endl;
+		return;
+	}
+	if (m_host.compare(0, 9, "broker://") == 0)
+	{
+		// lvDCOMBroker shares one LabVIEW connection between the IOCs on this machine, and speaks the TCP transport protocol
+		std::string port = m_host.substr(9);
+		if (port.size() == 0)
+		{
+			char buffer[16];
+			_snprintf(buffer, sizeof(buffer), "%u", static_cast<unsigned>(broker_default_port));
+			port = buffer;
+		}
+		m_tcp = new lvDCOMTcpClient("localhost:" + port, tcp_subscribe);
+		std::cerr << "Using lvDCOMBroker at \"" << m_tcp->address() << "\"" << std::endl;
+		return;
+	}
+	if (m_host.compare(0, 6, "shm://") == 0)
+	{
+		m_shm = new lvDCOMShmClient(m_host.substr(6));
+		std::cerr << "Using shared memory transport \"" << m_shm->name() << "\"" << std::endl;
+		return;
 	}
-	epicsAtExit(epicsExitFunc, this);
 	if (m_progid.size() > 0)
 	{
 		if ( CLSIDFromProgID(CT2W(m_progid.c_str()), &m_clsid) != S_OK )
@@ -453,25 +999,64 @@ m_configSection(configSection), m_pidentity(NULL), m_pxmldom(NULL), m_options(op
 	}
 }
 
-void lvDCOMInterface::epicsExitFunc(void* arg)
+lvDCOMInterface::~lvDCOMInterface()
 {
-	lvDCOMInterface* dcomint = static_cast<lvDCOMInterface*>(arg);
-	if (dcomint == NULL)
+	// the TCP client destructor waits for its reader thread to finish
+	delete m_tcp;
+	m_tcp = NULL;
+	delete m_shm;
+	m_shm = NULL;
+	if (m_capture != NULL)
 	{
-		return;
+		m_capture->close();
+		delete m_capture;
+		m_capture = NULL;
 	}
-	if ( dcomint->checkOption(viAlwaysStopOnExit) )
+	for(breaker_map_t::iterator it = m_vi_breakers.begin(); it != m_vi_breakers.end(); ++it)
 	{
-		dcomint->stopVis(false);
+		delete it->second;
 	}
-	else if ( dcomint->checkOption(viStopOnExitIfStarted) )
+	m_vi_breakers.clear();
+	for(create_lock_map_t::iterator it = m_vi_create_locks.begin(); it != m_vi_create_locks.end(); ++it)
 	{
-		dcomint->stopVis(true);
+		delete it->second;
+	}
+	m_vi_create_locks.clear();
+	if (m_pxmldom != NULL)
+	{
+		m_pxmldom->Release();
+		m_pxmldom = 0;
+	}
+	if (m_mac_env != NULL)
+	{
+		macDeleteHandle(m_mac_env);
+		m_mac_env = NULL;
 	}
 }
 
-/// wait for LabVIEW to have been running for m_minLVUptime seconds
-double lvDCOMInterface::waitForLabVIEW()
+void lvDCOMInterface::epicsExitFunc(void* arg)
+{
+	lvDCOMInterface* dcomint = static_cast<lvDCOMInterface*>(arg);
+	if (dcomint == NULL)
+	{
+		return;
+	}
+	if (dcomint->m_capture != NULL)
+	{
+		dcomint->m_capture->close();
+	}
+	if ( dcomint->checkOption(viAlwaysStopOnExit) )
+	{
+		dcomint->stopVis(false);
+	}
+	else if ( dcomint->checkOption(viStopOnExitIfStarted) )
+	{
+		dcomint->stopVis(true);
+	}
+}
+
+/// wait for LabVIEW to have been running for m_minLVUptime seconds
+double lvDCOMInterface::waitForLabVIEW()
 {
 	double lvuptime = getLabviewUptime();
 	if (lvuptime < m_minLVUptime)
@@ -485,54 +1070,35 @@ double lvDCOMInterface::waitForLabVIEW()
 	return lvuptime;
 }
 	
+static void arraySlice(VARIANT& v, ArraySlice& slice);
+static void copyStringTable(VARIANT& v, const ArraySlice& slice, std::vector< std::vector<std::string> >& values);
+
 void lvDCOMInterface::getBlockDetails(std::vector< std::vector<std::string> >& values)
 {
 	CComBSTR vi_name("c:\\LabVIEW Modules\\dae\\monitor\\dae_monitor.vi");
 	CComBSTR control_name("Parameter details");
-	int n, nr, nc;
-
 	waitForLabVIEW();
     // wait until table populated i.e. non zero number of rows, also non-black first block name
 	do {
 		epicsThreadSleep(5.0);
 		CComVariant v;
-	    getLabviewValue(vi_name, control_name, &v);
+	    getLabviewValue(vi_name, control_name, &v, m_timeout);
 	    if ( v.vt != (VT_ARRAY | VT_BSTR) )
 	    {
 		    throw std::runtime_error("GetBlockDetails failed (type mismatch)");
 	    }
-		n = nr = nc = 0;
 		values.clear();
-	    CComSafeArray<BSTR> sa;
-	    sa.Attach(v.parray);
-		if (sa.GetDimensions() == 2)
+		if (SafeArrayGetDim(v.parray) == 2)
 		{
-	        nr = sa.GetCount(0);
-	        nc = sa.GetCount(1);
-			if (nc > 5)
+			ArraySlice slice;
+			arraySlice(v, slice);
+			if (slice.nc > 5)
 			{
-				nc = 5; // we only want (and use) the first 5 columns
-			}
-	        values.resize(nr);
-	        for(int i=0; i<nr; ++i)
-	        {
-				values[i].clear();
-				values[i].reserve(nc);
-	            for(int j=0; j<nc; ++j)
-				{
-					BSTR t = NULL;
-					LONG dims[2] = { i, j };
-					if (sa.MultiDimGetAt(dims, t) == S_OK)
-					{
-		                values[i].push_back(static_cast<const char*>(CW2CT(t)));
-						SysFreeString(t);
-						++n;
-					}
-				}
+				slice.nc = 5; // we only want (and use) the first 5 columns
 			}
+			copyStringTable(v, slice, values);
 	    }
-	    sa.Detach();
-	} while ( (nr * nc) == 0 || (nr * nc) != n || values[0][0].size() == 0 );
+	} while ( values.size() == 0 || values[0].size() == 0 || values[0][0].size() == 0 );
 }
 
 bool lvDCOMInterface::checkForNewBlockDetails()
@@ -574,6 +1140,7 @@ int lvDCOMInterface::generateFilesFromSECI(const char* portName, const char* mac
 		blocks_match = ".*";
 	}
     pcrecpp::RE blocks_re(blocks_match);
+	std::string scan, poll_attrs = pollAttributes(scan);
 	int nblocks = 0;
 	for(int i=0; i<nr; ++i)
 	{
@@ -604,7 +1171,7 @@ int lvDCOMInterface::generateFilesFromSECI(const char* portName, const char* mac
 		if (set_type != "unknown")
 		{
             fs << "      <param name=\"" << name << "_set\" type=\"" << set_type << "\">\n";
-            fs << "        <read method=\"GCV\" target=\"" << replaceWithEntities(m_seci_values[i][3]) << "\"/>\n";
+            fs << "        <read method=\"GCV\" target=\"" << replaceWithEntities(m_seci_values[i][3]) << "\"" << poll_attrs << "/>\n";
             fs << "        <set method=\"SCV\" extint=\"true\" target=\"" << replaceWithEntities(m_seci_values[i][3]) << "\"";
 		    if (m_seci_values[i][4].size() > 0 && m_seci_values[i][4] != "none")
 		    {
@@ -619,7 +1186,7 @@ int lvDCOMInterface::generateFilesFromSECI(const char* portName, const char* mac
 		if (read_type != "unknown")
 		{
             fs << "      <param name=\"" << name << "_read\" type=\"" << read_type << "\">\n";
-            fs << "        <read method=\"GCV\" target=\"" << replaceWithEntities(m_seci_values[i][2]) << "\"/>\n";
+            fs << "        <read method=\"GCV\" target=\"" << replaceWithEntities(m_seci_values[i][2]) << "\"" << poll_attrs << "/>\n";
 		    fs << "      </param>\n";
 			rsuffix = "_read";
 			pv_type = read_type;
@@ -635,8 +1202,8 @@ int lvDCOMInterface::generateFilesFromSECI(const char* portName, const char* mac
 		if (rsuffix.size() > 0 && ssuffix.size() > 0)
 		{
 		    fsdb  << "file \"${LVDCOM}/db/lvDCOM_" << pv_type << ".template\" {\n";
-		    fsdb  << "    { P=\"" << envExpand("$(P=)") << "\",PORT=\"" << portName << "\",SCAN=\"" 
-		          << envExpand("$(SCAN=1 second)") << "\",PARAM=\"" << name
+		    fsdb  << "    { P=\"" << expandMacros("$(P=)") << "\",PORT=\"" << portName << "\",SCAN=\"" 
+		          << scan << "\",PARAM=\"" << name
 				  << "\",NOSET=\"" << (no_setter ? "#" : " ")
 				  << "\",RPARAM=\"" << name << rsuffix << "\",SPARAM=\"" << name << ssuffix << "\" }\n";
 		    fsdb  << "}\n\n";
@@ -655,343 +1222,1951 @@ int lvDCOMInterface::generateFilesFromSECI(const char* portName, const char* mac
 	return nblocks;
 }
 
-void lvDCOMInterface::stopVis(bool only_ones_we_started)
+/// SCAN for generated records, from the SCAN macro (default "1 second"). With SCAN=I/O Intr the driver polls values 
+/// itself, adapting the rate to how often each value changes, and the \<read\> attributes to do this are returned.
+/// Macros must have been installed by the caller
+std::string lvDCOMInterface::pollAttributes(std::string& scan)
 {
-	for(vi_map_t::const_iterator it = m_vimap.begin(); it != m_vimap.end(); ++it)
+	std::string poll_attrs;
+	scan = expandMacros("$(SCAN=1 second)");
+	if (scan == "I/O Intr")
 	{
-		LabVIEW::VirtualInstrumentPtr vi_ref = it->second.vi_ref;
-		if ( (!only_ones_we_started || it->second.started) && (vi_ref != NULL) )
+		poll_attrs = std::string(" poll=\"") + expandMacros("$(POLL=1.0)") + "\" poll_min=\"" + expandMacros("$(POLL_MIN=0.1)") + 
+		    "\" poll_max=\"" + expandMacros("$(POLL_MAX=10.0)") + "\"";
+	}
+	return poll_attrs;
+}
+
+/// a front panel control found by discoverControls()
+struct DiscoveredControl
+{
+	VIStringsControl control;
+	std::string param;   ///< asyn parameter name
+	std::string type;    ///< lvDCOM parameter type, "unknown" if the control cannot be used as one
+	int nelm;            ///< elements of an array, or bits of a booleanarray
+	bool has_set;
+	std::string xml;     ///< its \<param\> in the previous configuration file, kept if the control has not changed since
+	DiscoveredControl() : type("unknown"), nelm(0), has_set(true) { }
+};
+
+/// probes the type of each control for discoverControls()
+struct ControlDiscovery : public ParallelWork
+{
+	lvDCOMInterface* dcom;
+	std::string vi_name;
+	std::vector<DiscoveredControl*>& controls;  ///< controls to be probed
+	ControlDiscovery(lvDCOMInterface* dcom_, const std::string& vi_name_, std::vector<DiscoveredControl*>& controls_) : 
+	    ParallelWork(controls_.size()), dcom(dcom_), vi_name(vi_name_), controls(controls_) { }
+	void work(size_t i);
+};
+
+/// the lvDCOM parameter type for a control with value \a v, for arrays \a nelm is set to the number of elements
+static std::string variantParamType(VARIANT& v, int& nelm)
+{
+	nelm = 0;
+	if ( (V_VT(&v) & VT_ARRAY) == 0 )
+	{
+		switch(variantKind(V_VT(&v)))
 		{
-			if (vi_ref->ExecState != LabVIEW::eIdle) // don't try to stop it if it is already stopped
-			{
-				std::cerr << "stopping \"" << CW2CT(it->first.c_str()) << "\" as it was auto-started and is still running" << std::endl;
-				try
-				{
-					vi_ref->Abort();
-				}
-				catch(const std::exception& ex)
-				{
-					std::cerr << "error stopping vi: " << ex.what() << std::endl;
-				}
-				catch(...)  
-				{ 
-					std::cerr << "error stopping vi: unknown" << std::endl;
-				}
-			}
+			case VariantKindBoolean:
+				return "boolean";
+			case VariantKindString:
+				return "string";
+			case VariantKindInt32:
+				return "int32";
+			case VariantKindFloat64:
+				return "float64";
+			default:
+				break;
+		}
+		CComVariant vd;
+		return ( SUCCEEDED(vd.ChangeType(VT_R8, &v)) ? "float64" : "unknown" );
+	}
+	if (V_ARRAY(&v) == NULL)
+	{
+		return "unknown";
+	}
+	VARTYPE vt = V_VT(&v) & ~VT_ARRAY;
+	bool is2d = (SafeArrayGetDim(V_ARRAY(&v)) == 2);
+	nelm = arrayVariantLength(&v);
+	if (SafeArrayGetDim(V_ARRAY(&v)) > 2)
+	{
+		return "unknown";
+	}
+	if (vt == VT_VARIANT && !is2d)
+	{
+		// a cluster, which we can only use directly if it is a bank of booleans. Elements can be mapped individually 
+		// with the element attribute of <read>
+		VARIANT* members = NULL;
+		bool all_bool = (nelm > 0);
+		if ( accessArrayVariant(&v, &members) != 0 || members == NULL )
+		{
+			return "unknown";
 		}
+		for(int i = 0; i < nelm && all_bool; ++i)
+		{
+			all_bool = (V_VT(&members[i]) == VT_BOOL);
+		}
+		unaccessArrayVariant(&v);
+		return (all_bool ? "booleanarray" : "unknown");
+	}
+	switch(variantKind(vt))
+	{
+		case VariantKindBoolean:
+			return (is2d ? "unknown" : "booleanarray");
+		case VariantKindString:
+			return (is2d ? "stringarray2d" : "unknown");
+		case VariantKindInt32:
+			return (is2d ? "int32array2d" : "int32array");
+		case VariantKindFloat64:
+			return (is2d ? "float64array2d" : "float64array");
+		default:
+			return "unknown";
 	}
 }
 
-long lvDCOMInterface::nParams()
+/// the lvDCOM parameter type of \a control on \a vi_name. String, boolean, enum and ring controls are known from 
+/// the VI strings, others are read to see what type LabVIEW gives them. 
+std::string lvDCOMInterface::probeControlType(BSTR vi_name, const VIStringsControl& control, int& nelm)
 {
-	long n = 0;
-	char control_name_xpath[MAX_PATH_LEN];
-	_snprintf(control_name_xpath, sizeof(control_name_xpath), "/lvinput/section[@name='%s']/vi/param", m_configSection.c_str());
-	IXMLDOMNodeList* pXMLDomNodeList = NULL;
-	HRESULT hr = m_pxmldom->selectNodes(_bstr_t(control_name_xpath), &pXMLDomNodeList);
-	if (SUCCEEDED(hr) && pXMLDomNodeList != NULL)
+	nelm = 0;
+	if (control.type == "String")
 	{
-		pXMLDomNodeList->get_length(&n);
-		pXMLDomNodeList->Release();
+		return "string";
 	}
-	return n;
+	else if (control.type == "Boolean")
+	{
+		return "boolean";
+	}
+	else if (control.type == "Enum")
+	{
+		return "enum";
+	}
+	else if (control.type == "Ring")
+	{
+		return "ring";
+	}
+	CComVariant v;
+	getLabviewValue(vi_name, CComBSTR(control.name.c_str()), &v, m_timeout);
+	return variantParamType(v, nelm);
 }
 
-void lvDCOMInterface::getParams(std::map<std::string,std::string>& res)
+void ControlDiscovery::work(size_t i)
 {
-	res.clear();
-	char control_name_xpath[MAX_PATH_LEN];
-	_snprintf(control_name_xpath, sizeof(control_name_xpath), "/lvinput/section[@name='%s']/vi/param", m_configSection.c_str());
+	DiscoveredControl* c = controls[i];
+	try
+	{
+		c->type = dcom->probeControlType(CComBSTR(vi_name.c_str()), c->control, c->nelm);
+	}
+	catch(const std::exception& ex)
+	{
+		c->type = "unknown";
+		errlogSevPrintf(errlogMinor, "lvDCOMDiscover: cannot read \"%s\": %s\n", c->control.name.c_str(), ex.what());
+	}
+}
+
+/// the previously discovered controls of \a vi_path in section \a configSection of \a configFile, as control name -> 
+/// definition. Only \<param\> elements written by discoverControls() (which carry the signature of their control in a 
+/// comment) are returned, any changes made to them since are kept.
+static void previousDiscovery(const char* configFile, const char* configSection, const std::string& vi_path, std::map<std::string, DiscoveredControl>& previous)
+{
+	previous.clear();
+	IXMLDOMDocument2* dom = NULL;
+	try
+	{
+		dom = lvDCOMInterface::createDom();
+	}
+	catch(const std::exception&)
+	{
+		return;
+	}
+	short sResult = FALSE;
+	dom->put_preserveWhiteSpace(VARIANT_TRUE);  // so kept definitions are laid out as before
+	char xpath[MAX_PATH_LEN];
+	_snprintf(xpath, sizeof(xpath), "/lvinput/section[@name='%s']/vi/param", configSection);
 	IXMLDOMNodeList* pXMLDomNodeList = NULL;
-	HRESULT hr = m_pxmldom->selectNodes(_bstr_t(control_name_xpath), &pXMLDomNodeList);
-	if (FAILED(hr) || pXMLDomNodeList == NULL)
+	if ( dom->load(_variant_t(configFile), &sResult) != S_OK || FAILED(dom->selectNodes(_bstr_t(xpath), &pXMLDomNodeList)) || pXMLDomNodeList == NULL )
 	{
+		dom->Release();
 		return;
 	}
-	IXMLDOMNode *pNode, *pAttrNode1, *pAttrNode2;
 	long n = 0;
 	pXMLDomNodeList->get_length(&n);
 	for(long i=0; i<n; ++i)
 	{
-		pNode = NULL;
-		hr = pXMLDomNodeList->get_item(i, &pNode);
-		if (SUCCEEDED(hr) && pNode != NULL)
+		IXMLDOMNode* pNode = NULL;
+		if ( FAILED(pXMLDomNodeList->get_item(i, &pNode)) || pNode == NULL )
 		{
-			IXMLDOMNamedNodeMap *attributeMap = NULL;
-			pAttrNode1 = pAttrNode2 = NULL;
-			pNode->get_attributes(&attributeMap);
-			hr = attributeMap->getNamedItem(_bstr_t("name"), &pAttrNode1);
-			hr = attributeMap->getNamedItem(_bstr_t("type"), &pAttrNode2);
-			BSTR bstrValue1 = NULL, bstrValue2 = NULL;
-			hr=pAttrNode1->get_text(&bstrValue1);
-			hr=pAttrNode2->get_text(&bstrValue2);
-			res[std::string(COLE2CT(bstrValue1))] = COLE2CT(bstrValue2);
-			SysFreeString(bstrValue1);
-			SysFreeString(bstrValue2);
-			pAttrNode1->Release();
-			pAttrNode2->Release();
-			attributeMap->Release();
-			pNode->Release();
+			continue;
 		}
-	}	
+		unsigned signature = 0;
+		int nelm = 0;
+		std::string comment = nodeText(pNode, "comment()"), target = nodeText(pNode, "read/@target");
+		if ( nodeText(pNode, "../@path") == vi_path && target.size() > 0 && sscanf(comment.c_str(), " lvDCOMDiscover %x %d", &signature, &nelm) == 2 )
+		{
+			DiscoveredControl& c = previous[target];
+			CComBSTR xml;
+			pNode->get_xml(&xml);
+			c.xml = CW2CT(xml);
+			// our default namespace is declared on <lvinput>, it need not be repeated on the <param> 
+			std::string::size_type ns = c.xml.find(" xmlns=\"");
+			if ( ns != std::string::npos && ns < c.xml.find('>') )
+			{
+				c.xml.erase(ns, c.xml.find('"', ns + 8) - ns + 1);
+			}
+			c.param = nodeText(pNode, "@name");
+			c.type = nodeText(pNode, "@type");
+			c.has_set = (nodeText(pNode, "set/@target").size() > 0);
+			c.nelm = nelm;
+			c.control.signature = signature;
+		}
+		pNode->Release();
+	}
 	pXMLDomNodeList->Release();
+	dom->Release();
 }
 
-COAUTHIDENTITY* lvDCOMInterface::createIdentity(const std::string& user, const std::string&  domain, const std::string& pass)
+/// replace characters that cannot be used in an asyn parameter (or its \<param\> name attribute) with _, as lvstrings2input.xsl does
+static std::string paramNameFor(const std::string& control_name, std::set<std::string>& used)
 {
-	if (user.size() == 0)
+	std::string name(control_name);
+	for(size_t i = 0; i < name.size(); ++i)
+	{
+		if ( !isalnum(static_cast<unsigned char>(name[i])) && name[i] != '_' && name[i] != '-' && name[i] != '.' )
+		{
+			name[i] = '_';
+		}
+	}
+	if (name.size() == 0 || !(isalpha(static_cast<unsigned char>(name[0])) || name[0] == '_'))
+	{
+		name = "_" + name;
+	}
+	std::string unique_name(name);
+	char suffix[16];
+	for(int i = 2; used.find(unique_name) != used.end(); ++i)
 	{
-		return NULL;
+		epicsSnprintf(suffix, sizeof(suffix), "_%d", i);
+		unique_name = name + suffix;
 	}
-	COAUTHIDENTITY* pidentity = new COAUTHIDENTITY;
-	pidentity->Domain = (USHORT*)strdup(domain.c_str());
-	pidentity->DomainLength = static_cast<ULONG>(strlen((const char*)pidentity->Domain));
-	pidentity->Flags = SEC_WINNT_AUTH_IDENTITY_ANSI;
-	pidentity->Password = (USHORT*)strdup(pass.c_str());
-	pidentity->PasswordLength = static_cast<ULONG>(strlen((const char*)pidentity->Password));
-	pidentity->User = (USHORT*)strdup(user.c_str());
-	pidentity->UserLength = static_cast<ULONG>(strlen((const char*)pidentity->User));
-	return pidentity;
+	used.insert(unique_name);
+	return unique_name;
 }
 
-HRESULT lvDCOMInterface::setIdentity(COAUTHIDENTITY* pidentity, IUnknown* pUnk)
+/// record template for each lvDCOM parameter type
+static const char* templateFor(const std::string& type)
 {
-	HRESULT hr;
-	if (pidentity != NULL)
+	static const char* templates[][2] = { { "float64", "float64" }, { "int32", "int32" }, { "enum", "int32" }, { "ring", "int32" },
+		{ "boolean", "boolean" }, { "string", "string" }, { "float64array", "float64array" }, { "int32array", "int32array" }, 
+		{ "float64array2d", "float64array" }, { "int32array2d", "int32array" }, { "stringarray2d", "charwaveform" }, 
+		{ "booleanarray", "booleanarray" } };
+	for(size_t i = 0; i < sizeof(templates) / sizeof(templates[0]); ++i)
 	{
-		hr = CoSetProxyBlanket(pUnk, RPC_C_AUTHN_WINNT, RPC_C_AUTHZ_NONE, NULL, 
-			RPC_C_AUTHN_LEVEL_DEFAULT, RPC_C_IMP_LEVEL_IMPERSONATE, pidentity, EOAC_NONE);
-		if (FAILED(hr))
+		if (type == templates[i][0])
 		{
-			std::cerr << "setIdentity failed" << std::endl;
-			return hr;
+			return templates[i][1];
 		}
 	}
-	return S_OK;
+	return NULL;
 }
 
-
-void lvDCOMInterface::getViRef(BSTR vi_name, bool reentrant, LabVIEW::VirtualInstrumentPtr& vi)
+/// write \a text to \a file_name unless it already has exactly that content, so an unchanged configuration 
+/// file is not reloaded by a running IOC. Returns true if the file was written.
+static bool writeIfChanged(const char* file_name, const std::string& text)
 {
-	UINT len = SysStringLen(vi_name);
-	std::wstring ws(vi_name, SysStringLen(vi_name));
-
-	epicsGuard<epicsMutex> _lock(m_lock);
-	vi_map_t::iterator it = m_vimap.find(ws);
-	if(it != m_vimap.end())
+	std::fstream fsin(file_name, std::ios::in | std::ios::binary);
+	if (fsin.good())
 	{
-		vi = it->second.vi_ref;
-		try
-		{
-			vi->GetExecState();
-		}
-		catch(...)
+		std::string old_text((std::istreambuf_iterator<char>(fsin)), std::istreambuf_iterator<char>());
+		fsin.close();
+		if (old_text == text)
 		{
-			//Gets here if VI ref is not longer valid
-			createViRef(vi_name, reentrant, vi);
+			return false;
 		}
 	}
-	else
+	std::fstream fs(file_name, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!fs.good())
 	{
-		createViRef(vi_name, reentrant, vi);
+		throw std::runtime_error(std::string("lvDCOMDiscover: cannot create ") + file_name);
 	}
-}
-
-/// returns -1.0 if labview not running, else labview uptime in seconds
-double lvDCOMInterface::getLabviewUptime()
-{
-  HANDLE hProcess;
-  double lvUptime = -1.0;
-  int lvCount = 0; // number of LabVIEW.exe processes found
-  PROCESSENTRY32 pe32;
-  FILETIME lvCreationTime, lvExitTime, lvKernelTime, lvUserTime, sysTime;
-  epicsGuard<epicsMutex> _lock(m_lock); // just to restrict number of simultaneous snapshots
-  HANDLE hProcessSnap = CreateToolhelp32Snapshot( TH32CS_SNAPPROCESS, 0 );
-  if( hProcessSnap == INVALID_HANDLE_VALUE )
-  {
-	return lvUptime;
-  }
-  pe32.dwSize = sizeof( PROCESSENTRY32 );
-  if( !Process32First( hProcessSnap, &pe32 ) )
-  {
-    CloseHandle( hProcessSnap );
-    return lvUptime;
-  }
-  do
-  {
-	if ( !stricmp(pe32.szExeFile, "LabVIEW.exe") )
+	fs.write(text.data(), text.size());
+	fs.close();
+	if (fs.fail())
 	{
-		++lvCount;
-        hProcess = OpenProcess(PROCESS_QUERY_INFORMATION, FALSE, pe32.th32ProcessID);
-        if( hProcess != NULL )
-	    {
-		   if (GetProcessTimes(hProcess, &lvCreationTime, &lvExitTime, &lvKernelTime, &lvUserTime) != 0)
-		   {
-               GetSystemTimeAsFileTime(&sysTime);
-		       lvUptime = diffFileTimes(sysTime, lvCreationTime);
-		   }
-           CloseHandle( hProcess );
-	    }
+		throw std::runtime_error(std::string("lvDCOMDiscover: error writing ") + file_name);
 	}
-  } while( Process32Next( hProcessSnap, &pe32 ) );
-  CloseHandle( hProcessSnap );
-//  std::cerr << "lvuptime=" << lvUptime << "s lvcount=" << lvCount << std::endl;
-  return lvUptime;
-}
-
-/// filetime uses 100ns units, returns difference in seconds
-double lvDCOMInterface::diffFileTimes(const FILETIME& f1, const FILETIME& f2)
-{
-	ULARGE_INTEGER u1, u2;
-	u1.LowPart = f1.dwLowDateTime;
-	u1.HighPart = f1.dwHighDateTime;
-	u2.LowPart = f2.dwLowDateTime;
-	u2.HighPart = f2.dwHighDateTime;
-	return static_cast<double>(u1.QuadPart - u2.QuadPart) / 1e7;
+	return true;
 }
 
-void lvDCOMInterface::maybeWaitForLabVIEWOrExit()
+/// true if LabVIEW is on another computer, so a file it writes cannot be assumed to be readable here under the same name.
+/// The constructor makes an empty host "localhost"; broker:// and shm:// are always this computer
+bool lvDCOMInterface::isRemoteHost() const
 {
-	if ( checkOption(lvNoStart) )
+	std::string host = m_host;
+	if (host.compare(0, 9, "broker://") == 0 || host.compare(0, 6, "shm://") == 0)
 	{
-		if (getLabviewUptime() < m_minLVUptime)
+		return false;
+	}
+	if (host.compare(0, 6, "tcp://") == 0)
+	{
+		host = host.substr(6, host.find(':', 6) - 6);
+	}
+	if (host.size() == 0 || !stricmp(host.c_str(), "localhost") || host == "127.0.0.1" || host == "::1" || host == ".")
+	{
+		return false;
+	}
+	static const COMPUTER_NAME_FORMAT formats[] = { ComputerNameNetBIOS, ComputerNameDnsHostname, ComputerNameDnsFullyQualified };
+	for(size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i)
+	{
+		char name[256];
+		DWORD name_size = sizeof(name);
+		if ( GetComputerNameExA(formats[i], name, &name_size) != 0 && !stricmp(host.c_str(), name) )
 		{
-			if ( checkOption(lvSECIConfig) )
-			{
-				// likely a seci restart, so exit and procServ will restart us ready for new config
-				std::cerr << "Terminating as in SECI mode and no LabVIEW" << std::endl;
-				epicsExit(0);
-			}
-			else
-			{
-				waitForLabVIEW();
-				//throw std::runtime_error("LabVIEW not running and \"lvNoStart\" requested");
-			}
+			return false;
 		}
 	}
+	return true;
 }
 
-// this is called with m_lock held
-void lvDCOMInterface::createViRef(BSTR vi_name, bool reentrant, LabVIEW::VirtualInstrumentPtr& vi)
+/// Generate \a configFile (section \a configSection) and the substitutions file \a dbSubFile for every front panel control 
+/// of \a viPath, found by asking LabVIEW to export the VI strings to \a stringsFile and parsing these directly. Controls whose
+/// type is not clear from the strings are read, using \a nthreads threads at once. 
+///
+/// If \a configFile was written by an earlier discovery of the same VI, the \<param\> of each control that has not changed
+/// since (including any edits made to it) is kept and the control is not read again; the files are only rewritten if 
+/// something differs. Returns the number of controls that could be mapped to parameters.
+int lvDCOMInterface::discoverControls(const char* portName, const char* macros, const char* viPath, const char* configSection, 
+	const char* configFile, const char* dbSubFile, const char* stringsFile, int nthreads)
 {
-	epicsThreadOnce(&onceId, initCOM, NULL);
-	std::wstring ws(vi_name, SysStringLen(vi_name));
-	HRESULT hr = E_FAIL;
-	// we do maybeWaitForLabVIEWOrExit() either side of this to try and avoid a race condition...
-	maybeWaitForLabVIEWOrExit();
-	if (m_lv != NULL)
+	if (viPath == NULL || *viPath == '\0' || configFile == NULL || *configFile == '\0' || dbSubFile == NULL || *dbSubFile == '\0')
+	{
+		throw std::runtime_error("lvDCOMDiscover: viPath, configFile and dbSubFile are required");
+	}
+	configSection = ( (configSection != NULL && *configSection != '\0') ? configSection : "frontpanel" );
+	portName = (portName != NULL ? portName : "");
+	char** pairs = NULL;
+	macPushScope(m_mac_env);
+	macParseDefns(m_mac_env, macros, &pairs);
+	macInstallMacros(m_mac_env, pairs);
+	std::string vi_name = expandMacros(viPath), strings_file;
+	std::replace(vi_name.begin(), vi_name.end(), '/', '\\');
+	bool temp_strings = (stringsFile == NULL || *stringsFile == '\0');
+	if (!temp_strings)
+	{
+		strings_file = expandMacros(stringsFile);
+	}
+	else if (isRemoteHost())
+	{
+		macPopScope(m_mac_env);
+		throw std::runtime_error("lvDCOMDiscover: LabVIEW is on " + m_host + " so a stringsFile it and this computer can both reach (e.g. a UNC path) must be given");
+	}
+	else
+	{
+		char temp_path[MAX_PATH], temp_file[MAX_PATH];
+		if ( GetTempPath(sizeof(temp_path), temp_path) == 0 || GetTempFileName(temp_path, "lvd", 0, temp_file) == 0 )
+		{
+			macPopScope(m_mac_env);
+			throw std::runtime_error("lvDCOMDiscover: cannot create temporary file");
+		}
+		strings_file = temp_file;
+	}
+	std::vector<DiscoveredControl> controls;
+	try
 	{
+		LabVIEW::VirtualInstrumentPtr vi;
+		CComBSTR vi_bstr(vi_name.c_str());
+		getViRef(vi_bstr, false, vi);
+		std::cerr << "lvDCOMDiscover: exporting strings of \"" << vi_name << "\" to \"" << strings_file << "\"" << std::endl;
 		try
 		{
-			hr = m_lv->CheckConnection();
+			vi->ExportVIStrings(_bstr_t(strings_file.c_str()), VARIANT_FALSE, _bstr_t(""), VARIANT_FALSE, VARIANT_FALSE);
 		}
 		catch(const std::exception&)
 		{
-			hr = E_FAIL;
+			vi.Detach();
+			throw;
+		}
+		vi.Detach();
+		lvDCOMVIStrings vi_strings(lvDCOMVIStrings::readFile(strings_file));
+		if (temp_strings)
+		{
+			DeleteFile(strings_file.c_str());
 		}
-		if ( FAILED(hr) )
+		controls.resize(vi_strings.controls().size());
+		for(size_t i = 0; i < controls.size(); ++i)
 		{
-			epicsThreadSleep(5.0);
+			controls[i].control = vi_strings.controls()[i];
 		}
 	}
-	maybeWaitForLabVIEWOrExit();
-	if (hr == S_OK)
+	catch(const std::exception&)
 	{
-		;
+		if (temp_strings)
+		{
+			DeleteFile(strings_file.c_str());
+		}
+		macPopScope(m_mac_env);
+		throw;
 	}
-	else if (m_host.size() > 0)
+
+	// keep what we can from last time, only controls that are new or have changed need to be read
+	std::map<std::string, DiscoveredControl> previous;
+	std::set<std::string> used_names;
+	std::string vi_path(viPath);
+	std::replace(vi_path.begin(), vi_path.end(), '\\', '/');
+	previousDiscovery(configFile, configSection, vi_path, previous);
+	std::vector<DiscoveredControl*> to_probe;
+	int nkept = 0;
+	for(size_t i = 0; i < controls.size(); ++i)
 	{
-		std::cerr << "(Re)Making connection to LabVIEW on " << m_host << std::endl;
-		CComBSTR host(m_host.c_str());
-		m_pidentity = createIdentity(m_username, m_host, m_password);
-		COAUTHINFO* pauth = new COAUTHINFO;
-		COSERVERINFO csi = { 0, NULL, NULL, 0 };
-		pauth->dwAuthnSvc = RPC_C_AUTHN_WINNT;
-		pauth->dwAuthnLevel = RPC_C_AUTHN_LEVEL_DEFAULT;
-		pauth->dwAuthzSvc = RPC_C_AUTHZ_NONE;
-		pauth->dwCapabilities = EOAC_NONE;
-		pauth->dwImpersonationLevel = RPC_C_IMP_LEVEL_IMPERSONATE;
-		pauth->pAuthIdentityData = m_pidentity;
-		pauth->pwszServerPrincName = NULL;
-		csi.pwszName = host;
-		csi.pAuthInfo = pauth;
-		MULTI_QI mq[ 1 ] = { 0 }; 
-		mq[ 0 ].pIID = &IID_IDispatch;  // &LabVIEW::DIID__Application; // &IID_IDispatch; 
-		mq[ 0 ].pItf = NULL; 
-		mq[ 0 ].hr   = S_OK; 
-		hr = CoCreateInstanceEx( m_clsid, NULL, CLSCTX_REMOTE_SERVER | CLSCTX_LOCAL_SERVER, &csi, 1, mq ); 
+		DiscoveredControl& c = controls[i];
+		std::map<std::string, DiscoveredControl>::const_iterator it = previous.find(c.control.name);
+		if ( it != previous.end() && it->second.control.signature == c.control.signature && used_names.find(it->second.param) == used_names.end() )
+		{
+			c.param = it->second.param;
+			c.type = it->second.type;
+			c.nelm = it->second.nelm;
+			c.has_set = it->second.has_set;
+			c.xml = it->second.xml;
+			used_names.insert(c.param);
+			++nkept;
+		}
+	}
+	for(size_t i = 0; i < controls.size(); ++i)  // probed in front panel order
+	{
+		if (controls[i].xml.size() == 0)
+		{
+			to_probe.push_back(&(controls[i]));
+		}
+	}
+	std::cerr << "lvDCOMDiscover: " << controls.size() << " controls on \"" << vi_name << "\", " << nkept << " unchanged since last discovered, " 
+	          << to_probe.size() << " to read" << std::endl;
+	ControlDiscovery cd(this, vi_name, to_probe);
+	cd.run("lvDCOMDiscover", nthreads);
+
+	std::string scan, poll_attrs = pollAttributes(scan);
+	std::ostringstream fs, fsdb;
+	fs << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+	fs << "<!-- Generated by lvDCOMDiscover from \"" << replaceWithEntities(viPath) << "\". Parameters still marked lvDCOMDiscover are kept when it is run again,\n";
+	fs << "     including any edits to them, unless the control has changed on the VI -->\n";
+	fs << "<lvinput xmlns:xsi=\"http://www.w3.org/2001/XMLSchema-instance\" xmlns=\"http://epics.isis.rl.ac.uk/lvDCOMinput/1.0\" xsi:schemaLocation=\"http://epics.isis.rl.ac.uk/lvDCOMinput/1.0 lvDCOMinput.xsd\">\n";
+	fs << "  <extint path=\"$(LVDCOM=$(TOP))/lvDCOMApp/src/extint/Main/Library/External Interface - Set Value.vi\"/>\n";
+	fs << "  <section name=\"" << replaceWithEntities(configSection) << "\">\n";
+	fs << "    <vi path=\"" << replaceWithEntities(vi_path) << "\">\n";
+	int nparams = 0;
+	for(size_t i = 0; i < controls.size(); ++i)
+	{
+		DiscoveredControl& c = controls[i];
+		const char* db_template = templateFor(c.type);
+		if (db_template == NULL && c.xml.size() == 0)
+		{
+			fs << "      <!-- Ignoring LabVIEW control \"" << replaceWithEntities(c.control.name) << "\" of type \"" << replaceWithEntities(c.control.type) << "\" -->\n";
+			continue;
+		}
+		++nparams;
+		if (c.xml.size() > 0)
+		{
+			fs << "      " << c.xml << "\n";
+		}
+		else
+		{
+			char comment[64];
+			epicsSnprintf(comment, sizeof(comment), "<!-- lvDCOMDiscover %08x %d -->", c.control.signature, c.nelm);
+			c.param = paramNameFor(c.control.name, used_names);
+			c.has_set = (c.type.find("array") == std::string::npos || c.type == "booleanarray");  // other arrays are read only
+			std::string target = replaceWithEntities(c.control.name);
+			fs << "      <param name=\"" << c.param << "\" type=\"" << c.type << "\">" << comment << "\n";
+			if ( c.control.items.size() > 0 && (c.type == "ring" || c.type == "enum" || c.type == "boolean") )
+			{
+				fs << "        <items>\n";
+				for(size_t j = 0; j < c.control.items.size(); ++j)
+				{
+					fs << "          <item name=\"" << replaceWithEntities(c.control.items[j]) << "\" value=\"" << j << "\"/>\n";
+				}
+				fs << "        </items>\n";
+			}
+			fs << "        <read method=\"GCV\" target=\"" << target << "\"" << poll_attrs;
+			if (c.type == "booleanarray" && c.nelm > 32)
+			{
+				fs << " bits=\"" << c.nelm << "\"";
+			}
+			fs << "/>\n";
+			if (c.has_set)
+			{
+				fs << "        <set method=\"SCV\" extint=\"false\" target=\"" << target << "\"/>\n";
+			}
+			fs << "      </param>\n";
+		}
+		if (db_template == NULL)
+		{
+			continue;
+		}
+		fsdb << "file \"${LVDCOM}/db/lvDCOM_" << db_template << ".template\" {\n";
+		fsdb << "    { P=\"" << expandMacros("$(P=)") << "\",PORT=\"" << portName << "\",SCAN=\"" << scan << "\",PARAM=\"" << c.param
+		     << "\",NOSET=\"" << (c.has_set ? " " : "#") << "\",RPARAM=\"" << c.param << "\",SPARAM=\"" << (c.has_set ? c.param : "") << "\"";
+		if (c.type == "boolean" && c.control.items.size() == 2)
+		{
+			fsdb << ",ZNAME=\"" << c.control.items[0] << "\",ONAME=\"" << c.control.items[1] << "\"";
+		}
+		if (c.type.find("array") != std::string::npos && c.type != "booleanarray")
+		{
+			fsdb << ",NELM=\"" << (c.type == "stringarray2d" ? 16 * epicsMax(c.nelm, 16) : epicsMax(c.nelm, 1)) << "\"";
+		}
+		fsdb << " }\n";
+		fsdb << "}\n\n";
+	}
+	fs << "    </vi>\n";
+	fs << "  </section>\n";
+	fs << "</lvinput>\n";
+	macPopScope(m_mac_env);
+	bool written = writeIfChanged(configFile, fs.str());
+	written = writeIfChanged(dbSubFile, fsdb.str()) || written;
+	std::cerr << "lvDCOMDiscover: " << nparams << " parameters, " << (written ? "written to \"" : "no changes to \"") 
+	          << configFile << "\" and \"" << dbSubFile << "\"" << std::endl;
+	return nparams;
+}
+
+void lvDCOMInterface::stopVis(bool only_ones_we_started)
+{
+	for(vi_map_t::const_iterator it = m_vimap.begin(); it != m_vimap.end(); ++it)
+	{
+		LabVIEW::VirtualInstrumentPtr vi_ref = it->second.vi_ref;
+		if ( (!only_ones_we_started || it->second.started) && (vi_ref != NULL) )
+		{
+			CComBSTR vi_name(it->first.c_str());
+			DCOMCallDeadline deadline(m_watchdog, "Abort", vi_name, NULL, m_timeout);
+			try
+			{
+				if (vi_ref->ExecState != LabVIEW::eIdle) // don't try to stop it if it is already stopped
+				{
+					std::cerr << "stopping \"" << CW2CT(it->first.c_str()) << "\" as it was auto-started and is still running" << std::endl;
+					vi_ref->Abort();
+				}
+			}
+			catch(const std::exception& ex)
+			{
+				std::cerr << "error stopping vi: " << (deadline.finish() ? "exceeded deadline and was cancelled" : ex.what()) << std::endl;
+			}
+			catch(...)  
+			{ 
+				std::cerr << "error stopping vi: unknown" << std::endl;
+			}
+		}
+	}
+}
+
+/// number of asyn parameters we need, one per \<param\> and one per write \<group\>
+long lvDCOMInterface::nParams()
+{
+	long n = 0, n2d = 0;
+	char control_name_xpath[MAX_PATH_LEN];
+	CComPtr<IXMLDOMDocument2> dom = configDom();
+	_snprintf(control_name_xpath, sizeof(control_name_xpath), "/lvinput/section[@name='%s']/vi/param | /lvinput/section[@name='%s']/vi/group", m_configSection.c_str(), m_configSection.c_str());
+	IXMLDOMNodeList* pXMLDomNodeList = NULL;
+	HRESULT hr = dom->selectNodes(_bstr_t(control_name_xpath), &pXMLDomNodeList);
+	if (SUCCEEDED(hr) && pXMLDomNodeList != NULL)
+	{
+		pXMLDomNodeList->get_length(&n);
+		pXMLDomNodeList->Release();
+	}
+	// 2D arrays also have _NROWS and _NCOLS parameters
+	_snprintf(control_name_xpath, sizeof(control_name_xpath), "/lvinput/section[@name='%s']/vi/param[@type='float64array2d' or @type='int32array2d' or @type='stringarray2d']", m_configSection.c_str());
+	pXMLDomNodeList = NULL;
+	hr = dom->selectNodes(_bstr_t(control_name_xpath), &pXMLDomNodeList);
+	if (SUCCEEDED(hr) && pXMLDomNodeList != NULL)
+	{
+		pXMLDomNodeList->get_length(&n2d);
+		pXMLDomNodeList->Release();
+	}
+	n += 2 * n2d;
+	// parameters keeping a history also have _HIST and _HIST_TIME parameters
+	_snprintf(control_name_xpath, sizeof(control_name_xpath), "/lvinput/section[@name='%s']/vi/param[read/@history]", m_configSection.c_str());
+	pXMLDomNodeList = NULL;
+	hr = dom->selectNodes(_bstr_t(control_name_xpath), &pXMLDomNodeList);
+	if (SUCCEEDED(hr) && pXMLDomNodeList != NULL)
+	{
+		long nhist = 0;
+		pXMLDomNodeList->get_length(&nhist);
+		n += 2 * nhist;
+		pXMLDomNodeList->Release();
+	}
+	// parameters with statistics have up to four more parameters
+	_snprintf(control_name_xpath, sizeof(control_name_xpath), "/lvinput/section[@name='%s']/vi/param[read/@stats]", m_configSection.c_str());
+	pXMLDomNodeList = NULL;
+	hr = dom->selectNodes(_bstr_t(control_name_xpath), &pXMLDomNodeList);
+	if (SUCCEEDED(hr) && pXMLDomNodeList != NULL)
+	{
+		long nstats = 0;
+		pXMLDomNodeList->get_length(&nstats);
+		n += 4 * nstats;
+		pXMLDomNodeList->Release();
+	}
+	// booleanarray parameters have a parameter for each extra 32 bit word
+	_snprintf(control_name_xpath, sizeof(control_name_xpath), "/lvinput/section[@name='%s']/vi/param[@type='booleanarray']", m_configSection.c_str());
+	pXMLDomNodeList = NULL;
+	hr = dom->selectNodes(_bstr_t(control_name_xpath), &pXMLDomNodeList);
+	if (SUCCEEDED(hr) && pXMLDomNodeList != NULL)
+	{
+		long nb = 0;
+		pXMLDomNodeList->get_length(&nb);
+		for(long i=0; i<nb; ++i)
+		{
+			IXMLDOMNode* pNode = NULL;
+			if ( SUCCEEDED(pXMLDomNodeList->get_item(i, &pNode)) && pNode != NULL )
+			{
+				n += getBitWords(nodeText(pNode, "@name").c_str()) - 1;
+				pNode->Release();
+			}
+		}
+		pXMLDomNodeList->Release();
+	}
+	// a VI can have a parameter for its execution state
+	_snprintf(control_name_xpath, sizeof(control_name_xpath), "/lvinput/section[@name='%s']/vi[@state_param]", m_configSection.c_str());
+	pXMLDomNodeList = NULL;
+	hr = dom->selectNodes(_bstr_t(control_name_xpath), &pXMLDomNodeList);
+	if (SUCCEEDED(hr) && pXMLDomNodeList != NULL)
+	{
+		long nstate = 0;
+		pXMLDomNodeList->get_length(&nstate);
+		n += nstate;
+		pXMLDomNodeList->Release();
+	}
+	return n;
+}
+
+/// map of asyn parameter name to lvDCOM type, a write \<group\> has type "group"
+void lvDCOMInterface::getParams(std::map<std::string,std::string>& res)
+{
+	res.clear();
+	char control_name_xpath[MAX_PATH_LEN];
+	_snprintf(control_name_xpath, sizeof(control_name_xpath), "/lvinput/section[@name='%s']/vi/param | /lvinput/section[@name='%s']/vi/group", m_configSection.c_str(), m_configSection.c_str());
+	IXMLDOMNodeList* pXMLDomNodeList = NULL;
+	CComPtr<IXMLDOMDocument2> dom = configDom();  // m_pxmldom is replaced by reloadConfig()
+	HRESULT hr = dom->selectNodes(_bstr_t(control_name_xpath), &pXMLDomNodeList);
+	if (FAILED(hr) || pXMLDomNodeList == NULL)
+	{
+		return;
+	}
+	IXMLDOMNode *pNode, *pAttrNode1, *pAttrNode2;
+	long n = 0;
+	pXMLDomNodeList->get_length(&n);
+	for(long i=0; i<n; ++i)
+	{
+		pNode = NULL;
+		hr = pXMLDomNodeList->get_item(i, &pNode);
+		if (SUCCEEDED(hr) && pNode != NULL)
+		{
+			IXMLDOMNamedNodeMap *attributeMap = NULL;
+			pAttrNode1 = pAttrNode2 = NULL;
+			CComBSTR nodeName;
+			pNode->get_nodeName(&nodeName);
+			pNode->get_attributes(&attributeMap);
+			hr = attributeMap->getNamedItem(_bstr_t("name"), &pAttrNode1);
+			BSTR bstrValue1 = NULL, bstrValue2 = NULL;
+			hr=pAttrNode1->get_text(&bstrValue1);
+			if (nodeName == L"group")
+			{
+				res[std::string(COLE2CT(bstrValue1))] = "group";
+			}
+			else
+			{
+				hr = attributeMap->getNamedItem(_bstr_t("type"), &pAttrNode2);
+				hr=pAttrNode2->get_text(&bstrValue2);
+				res[std::string(COLE2CT(bstrValue1))] = COLE2CT(bstrValue2);
+				SysFreeString(bstrValue2);
+				pAttrNode2->Release();
+			}
+			SysFreeString(bstrValue1);
+			pAttrNode1->Release();
+			attributeMap->Release();
+			pNode->Release();
+		}
+	}	
+	pXMLDomNodeList->Release();
+}
+
+/// names of the other parameters that read the control written by \a param, so can be updated from a write readback
+void lvDCOMInterface::getReadbackParams(const char* param, const std::map<std::string,std::string>& params, std::vector<std::string>& names)
+{
+	names.clear();
+	std::string target = paramAttribute(param, "set", "target");
+	if (target.size() == 0)
+	{
+		return;
+	}
+	for(std::map<std::string,std::string>::const_iterator it=params.begin(); it != params.end(); ++it)
+	{
+		if (paramAttribute(it->first.c_str(), "read", "target") == target)
+		{
+			names.push_back(it->first);
+		}
+	}
+}
+
+HRESULT lvDCOMInterface::setIdentity(COAUTHIDENTITY* pidentity, IUnknown* pUnk)
+{
+	HRESULT hr;
+	if (pidentity != NULL)
+	{
+		hr = CoSetProxyBlanket(pUnk, RPC_C_AUTHN_WINNT, RPC_C_AUTHZ_NONE, NULL, 
+			RPC_C_AUTHN_LEVEL_DEFAULT, RPC_C_IMP_LEVEL_IMPERSONATE, pidentity, EOAC_NONE);
+		if (FAILED(hr))
+		{
+			std::cerr << "setIdentity failed" << std::endl;
+			return hr;
+		}
+	}
+	return S_OK;
+}
+
+
+/// circuit breaker for an individual VI, created on first use
+lvDCOMCircuitBreaker& lvDCOMInterface::viBreaker(const std::wstring& vi_name)
+{
+	epicsGuard<epicsMutex> _lock(m_breaker_lock);
+	breaker_map_t::iterator it = m_vi_breakers.find(vi_name);
+	if (it == m_vi_breakers.end())
+	{
+		it = m_vi_breakers.insert(breaker_map_t::value_type(vi_name, new lvDCOMCircuitBreaker(m_retry_interval))).first;
+	}
+	return *(it->second);
+}
+
+/// lock held by the one thread making a new reference to \a vi_name, see getViRef()
+epicsMutex& lvDCOMInterface::viCreateLock(const std::wstring& vi_name)
+{
+	epicsGuard<epicsMutex> _lock(m_breaker_lock);
+	create_lock_map_t::iterator it = m_vi_create_locks.find(vi_name);
+	if (it == m_vi_create_locks.end())
+	{
+		it = m_vi_create_locks.insert(create_lock_map_t::value_type(vi_name, new epicsMutex)).first;
+	}
+	return *(it->second);
+}
+
+void lvDCOMInterface::getViRef(BSTR vi_name, bool reentrant, LabVIEW::VirtualInstrumentPtr& vi)
+{
+	UINT len = SysStringLen(vi_name);
+	std::wstring ws(vi_name, SysStringLen(vi_name));
+	lvDCOMCircuitBreaker& vi_breaker = viBreaker(ws);
+	// fail fast, and without waiting for m_lock, if LabVIEW or this VI is already known to be unavailable
+	if ( !m_host_breaker.allowRequest() )
+	{
+		throw COMDisconnectedException("LabVIEW on " + m_host + " unavailable (circuit breaker open)");
+	}
+	if ( !vi_breaker.allowRequest() )
+	{
+		m_host_breaker.cancelRequest();
+		throw COMDisconnectedException("\"" + std::string(CW2CT(vi_name)) + "\" unavailable (circuit breaker open)");
+	}
+	try
+	{
+		bool valid = false;
+		{
+			epicsGuard<epicsMutex> _lock(m_lock);
+			vi_map_t::iterator it = m_vimap.find(ws);
+			// if a previous call on this reference overran its deadline (degraded) do not trust it
+			if(it != m_vimap.end() && !it->second.degraded)
+			{
+				vi = it->second.vi_ref;
+				valid = true;
+			}
+		}
+		if (valid)
+		{
+			DCOMCallDeadline deadline(m_watchdog, "GetExecState", vi_name, NULL, m_timeout);
+			try
+			{
+				vi->GetExecState();
+			}
+			catch(...)
+			{
+				//Gets here if VI ref is not longer valid, or it did not answer in time
+				valid = false;
+			}
+		}
+		if (!valid)
+		{
+			// warm up threads, the port thread and the poller can all want the same VI at once, only one of them makes
+			// the reference and the others then use it
+			epicsGuard<epicsMutex> _create_lock(viCreateLock(ws));
+			{
+				epicsGuard<epicsMutex> _lock(m_lock);
+				vi_map_t::iterator it = m_vimap.find(ws);
+				if(it != m_vimap.end() && !it->second.degraded && it->second.vi_ref != vi)
+				{
+					vi = it->second.vi_ref;  // made while we waited
+					valid = true;
+				}
+			}
+			if (!valid)
+			{
+				createViRef(vi_name, reentrant, vi);
+			}
+		}
+	}
+	catch(const COMDisconnectedException&)
+	{
+		// createViRef() has already tripped the host breaker, this VI has not been tested
+		vi_breaker.cancelRequest();
+		throw;
+	}
+	catch(const std::exception&)
+	{
+		m_host_breaker.cancelRequest();
+		vi_breaker.recordFailure();
+		throw;
+	}
+	m_host_breaker.recordSuccess();
+	vi_breaker.recordSuccess();
+	if (m_restore_setpoints)
+	{
+		restoreSetpoints(ws);
+	}
+}
+
+/// Execution state of \a vi_path as a #ViExecState, found without reading any of its controls. With \a restart a VI that
+/// has gone idle is run again, as #viStartIfIdle does when its reference is first made, and \a restarted is set. The TCP 
+/// and shared memory transports cannot tell, so give #ViExecUnknown
+int lvDCOMInterface::getViExecState(const std::string& vi_path, bool restart, bool& restarted)
+{
+	restarted = false;
+	if (m_tcp != NULL || m_shm != NULL)
+	{
+		return ViExecUnknown;
+	}
+	CComBSTR vi_name(vi_path.c_str());
+	LabVIEW::VirtualInstrumentPtr vi;
+	getViRef(vi_name, false, vi);
+	DCOMCallDeadline deadline(m_watchdog, "ExecState", vi_name, NULL, m_timeout);
+	int state = ViExecUnknown;
+	try
+	{
+		state = vi->ExecState;
+		if (restart && state == LabVIEW::eIdle)
+		{
+			errlogSevPrintf(errlogMinor, "Restarting \"%s\" on %s as it has stopped\n", vi_path.c_str(), (m_host.size() > 0 ? m_host.c_str() : "localhost"));
+			vi->Run(true);
+			restarted = true;
+			state = vi->ExecState;
+		}
+	}
+	catch(const std::exception&)
+	{
+		vi.Detach();
+		checkDeadline(deadline, vi_name, "ExecState");
+		throw;
+	}
+	vi.Detach();
+	if (restarted)
+	{
+		// so viStopOnExitIfStarted stops it
+		epicsGuard<epicsMutex> _lock(m_lock);
+		vi_map_t::iterator it = m_vimap.find(std::wstring(vi_name, vi_name.Length()));
+		if (it != m_vimap.end())
+		{
+			it->second.started = true;
+		}
+	}
+	return state;
+}
+
+/// returns -1.0 if labview not running, else labview uptime in seconds
+double lvDCOMInterface::getLabviewUptime()
+{
+  HANDLE hProcess;
+  double lvUptime = -1.0;
+  int lvCount = 0; // number of LabVIEW.exe processes found
+  PROCESSENTRY32 pe32;
+  FILETIME lvCreationTime, lvExitTime, lvKernelTime, lvUserTime, sysTime;
+  epicsGuard<epicsMutex> _lock(m_lock); // just to restrict number of simultaneous snapshots
+  HANDLE hProcessSnap = CreateToolhelp32Snapshot( TH32CS_SNAPPROCESS, 0 );
+  if( hProcessSnap == INVALID_HANDLE_VALUE )
+  {
+	return lvUptime;
+  }
+  pe32.dwSize = sizeof( PROCESSENTRY32 );
+  if( !Process32First( hProcessSnap, &pe32 ) )
+  {
+    CloseHandle( hProcessSnap );
+    return lvUptime;
+  }
+  do
+  {
+	if ( !stricmp(pe32.szExeFile, "LabVIEW.exe") )
+	{
+		++lvCount;
+        hProcess = OpenProcess(PROCESS_QUERY_INFORMATION, FALSE, pe32.th32ProcessID);
+        if( hProcess != NULL )
+	    {
+		   if (GetProcessTimes(hProcess, &lvCreationTime, &lvExitTime, &lvKernelTime, &lvUserTime) != 0)
+		   {
+               GetSystemTimeAsFileTime(&sysTime);
+		       lvUptime = diffFileTimes(sysTime, lvCreationTime);
+		   }
+           CloseHandle( hProcess );
+	    }
+	}
+  } while( Process32Next( hProcessSnap, &pe32 ) );
+  CloseHandle( hProcessSnap );
+//  std::cerr << "lvuptime=" << lvUptime << "s lvcount=" << lvCount << std::endl;
+  return lvUptime;
+}
+
+/// filetime uses 100ns units, returns difference in seconds
+double lvDCOMInterface::diffFileTimes(const FILETIME& f1, const FILETIME& f2)
+{
+	ULARGE_INTEGER u1, u2;
+	u1.LowPart = f1.dwLowDateTime;
+	u1.HighPart = f1.dwHighDateTime;
+	u2.LowPart = f2.dwLowDateTime;
+	u2.HighPart = f2.dwHighDateTime;
+	return static_cast<double>(u1.QuadPart - u2.QuadPart) / 1e7;
+}
+
+void lvDCOMInterface::maybeWaitForLabVIEWOrExit()
+{
+	if ( checkOption(lvNoStart) )
+	{
+		if (getLabviewUptime() < m_minLVUptime)
+		{
+			if ( checkOption(lvSECIConfig) )
+			{
+				// likely a seci restart, so exit and procServ will restart us ready for new config
+				std::cerr << "Terminating as in SECI mode and no LabVIEW" << std::endl;
+				epicsExit(0);
+			}
+			else
+			{
+				// do not wait here, the circuit breaker will keep us from retrying too often
+				throw std::runtime_error("LabVIEW not running and \"lvNoStart\" requested");
+			}
+		}
+	}
+}
+
+/// make sure we have a working connection to LabVIEW, (re)connecting if needed. This is called with m_lock held
+void lvDCOMInterface::connectToLabVIEW()
+{
+	HRESULT hr = E_FAIL;
+	// we do maybeWaitForLabVIEWOrExit() either side of this to try and avoid a race condition...
+	maybeWaitForLabVIEWOrExit();
+	if (m_lv != NULL)
+	{
+		try
+		{
+			DCOMCallDeadline deadline(m_watchdog, "CheckConnection", NULL, NULL, m_timeout);
+			hr = m_lv->CheckConnection();
+		}
+		catch(const std::exception&)
+		{
+			hr = E_FAIL;
+		}
+	}
+	maybeWaitForLabVIEWOrExit();
+	bool reconnecting = (m_lv != NULL || m_vimap.size() > 0);
+	if (hr == S_OK)
+	{
+		return;
+	}
+	else if (m_host.size() > 0)
+	{
+		std::cerr << "(Re)Making connection to LabVIEW on " << m_host << std::endl;
+		CComBSTR host(m_host.c_str());
+		COSERVERINFO csi = { 0, NULL, NULL, 0 };
+		csi.pwszName = host;
+		csi.pAuthInfo = m_identity.authInfo();
+		MULTI_QI mq[ 1 ] = { 0 }; 
+		mq[ 0 ].pIID = &IID_IDispatch;  // &LabVIEW::DIID__Application; // &IID_IDispatch; 
+		mq[ 0 ].pItf = NULL; 
+		mq[ 0 ].hr   = S_OK; 
+		hr = CoCreateInstanceEx( m_clsid, NULL, CLSCTX_REMOTE_SERVER | CLSCTX_LOCAL_SERVER, &csi, 1, mq ); 
 		if( FAILED( hr ) ) 
 		{ 
 			hr = CoCreateInstanceEx( m_clsid, NULL, CLSCTX_ALL, &csi, 1, mq );
 		}
-		if( FAILED( hr ) ) 
+		if( FAILED( hr ) ) 
+		{
+			throw COMexception("CoCreateInstanceEx (LabVIEW) ", hr);
+		} 
+		if( S_OK != mq[ 0 ].hr || NULL == mq[ 0 ].pItf ) 
+		{ 
+			throw COMexception("CoCreateInstanceEx (LabVIEW)(mq) ", mq[ 0 ].hr);
+		} 
+		setIdentity(m_identity.identity(), mq[ 0 ].pItf);
+		m_lv.Release();
+		m_lv.Attach( reinterpret_cast< LabVIEW::_Application* >( mq[ 0 ].pItf ) ); 
+		std::cerr << "Successfully connected to LabVIEW on " << m_host << std::endl;
+	}
+	else
+	{
+		std::cerr << "(Re)Making local connection to LabVIEW" << std::endl;
+		m_lv.Release();
+		hr = m_lv.CoCreateInstance(m_clsid, NULL, CLSCTX_LOCAL_SERVER);
+		if( FAILED( hr ) ) 
+		{
+			throw COMexception("CoCreateInstance (LabVIEW) ", hr);
+		} 
+		std::cerr << "Successfully connected to local LabVIEW" << std::endl;
+	}
+	// existing VI references are now useless, so resolve them all again in the background rather than one at a time on first use
+	if (reconnecting && m_warm_up_threads > 0 && !m_warming_up)
+	{
+		m_warming_up = true;
+		if (epicsThreadCreate("lvDCOMWarmUp", epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackMedium),
+			(EPICSTHREADFUNC)warmUpThread, this) == 0)
+		{
+			m_warming_up = false;
+		}
+	}
+}
+
+/// a cancelled DCOM call raises a COM error, if the watchdog cancelled the call covered by \a deadline throw a 
+/// COMTimeoutException in its place. Otherwise just returns so the caller can rethrow the original error
+static void throwIfCancelled(DCOMCallDeadline& deadline, BSTR vi_name, const char* op)
+{
+	if (deadline.finish())
+	{
+		throw COMTimeoutException(std::string(op) + " on \"" + std::string(CW2CT(vi_name)) + "\" exceeded deadline and was cancelled");
+	}
+}
+
+/// Create a new reference to \a vi_name. Only the (re)connection to LabVIEW is done with #m_lock held, getting the 
+/// reference itself is not so several VIs can be resolved at once, see warmUpViRefs(). Called by getViRef() with the 
+/// viCreateLock() of the VI held, so there is only ever one reference to a VI being made
+void lvDCOMInterface::createViRef(BSTR vi_name, bool reentrant, LabVIEW::VirtualInstrumentPtr& vi)
+{
+	epicsThreadOnce(&onceId, initCOM, NULL);
+	std::wstring ws(vi_name, SysStringLen(vi_name));
+	CComPtr<LabVIEW::_Application> lv;
+	// m_identity is never changed after construction, so is safe to use without the lock
+	COAUTHIDENTITY* pidentity = (m_host.size() > 0 ? m_identity.identity() : NULL);
+	{
+		epicsGuard<epicsMutex> _lock(m_lock);
+		try
+		{
+			connectToLabVIEW();
+		}
+		catch(const std::exception& ex)
+		{
+			m_host_breaker.recordFailure();
+			throw COMDisconnectedException(std::string("Unable to connect to LabVIEW: ") + ex.what());
+		}
+		lv = m_lv;
+	}
+	m_host_breaker.recordSuccess();
+        if (checkOption(lvDCOMVerbose))
+        {
+	    std::cerr << "Attempting to access \"" << CW2CT(vi_name) << "\" on " << (m_host.size() > 0 ? m_host : "localhost") << std::endl;
+        }
+	{
+		DCOMCallDeadline deadline(m_watchdog, "GetVIReference", vi_name, NULL, m_timeout);
+		try
+		{
+			if (reentrant)
+			{
+				vi = lv->GetVIReference(vi_name, "", 1, 8);
+				setIdentity(pidentity, vi);
+			}
+			else
+			{
+				//If a VI is reentrant then always get it as reentrant
+				vi = lv->GetVIReference(vi_name, "", 0, 0);
+				setIdentity(pidentity, vi);
+				if (vi->IsReentrant)
+				{
+					vi = lv->GetVIReference(vi_name, "", 1, 8);
+					setIdentity(pidentity, vi);
+					reentrant = true;
+				}
+			}
+		}
+		catch(const std::exception&)
+		{
+			throwIfCancelled(deadline, vi_name, "GetVIReference");
+			throw;
+		}
+	}
+	ViRef viref(vi, reentrant, false);
+	// LabVIEW::ExecStateEnum::eIdle = 1
+	// LabVIEW::ExecStateEnum::eRunTopLevel = 2
+	{
+		DCOMCallDeadline deadline(m_watchdog, "ExecState", vi_name, NULL, m_timeout);
+		try
+		{
+			if (vi->ExecState == LabVIEW::eIdle)
+			{
+				if ( checkOption(viStartIfIdle) ) 
+				{
+					std::cerr << "Starting \"" << CW2CT(vi_name) << "\" on " << (m_host.size() > 0 ? m_host : "localhost") << std::endl;
+					vi->Run(true);
+					viref.started = true;
+				}
+				else if ( checkOption(viWarnIfIdle) )
+				{
+					std::cerr << "\"" << CW2CT(vi_name) << "\" is not running on " << (m_host.size() > 0 ? m_host : "localhost") << " and autostart is disabled" << std::endl;
+				}
+			}
+		}
+		catch(const std::exception&)
+		{
+			throwIfCancelled(deadline, vi_name, "ExecState");
+			throw;
+		}
+	}
+	if (m_restore_setpoints)
+	{
+		// restored by getViRef() once the circuit breakers have seen this succeed, so the restore writes are let through
+		epicsGuard<epicsMutex> _lock(m_setpoint_lock);
+		m_restore_pending.insert(ws);
+	}
+	epicsGuard<epicsMutex> _lock(m_lock);
+	vi_map_t::iterator it = m_vimap.find(ws);
+	if (it != m_vimap.end())
+	{
+		// a VI we started and which is still running is found not idle this time, for viStopOnExitIfStarted it is still ours
+		viref.started = (viref.started || it->second.started);
+		it->second = viref;
+	}
+	else
+	{
+		m_vimap.insert(vi_map_t::value_type(ws, viref));
+	}
+}
+
+/// thread started by connectToLabVIEW() to re-resolve VI references after a reconnection
+void lvDCOMInterface::warmUpThread(void* arg)
+{
+	lvDCOMInterface* dcom = static_cast<lvDCOMInterface*>(arg);
+	dcom->warmUpViRefs(dcom->m_warm_up_threads);
+	epicsGuard<epicsMutex> _lock(dcom->m_lock);
+	dcom->m_warming_up = false;
+}
+
+/// resolves the VI references for warmUpViRefs()
+struct ViWarmUp : public ParallelWork
+{
+	lvDCOMInterface* dcom;
+	const std::vector<std::string>& vi_names;  ///< VIs to be resolved
+	int done, failed;                          ///< protected by #m_lock
+	ViWarmUp(lvDCOMInterface* dcom_, const std::vector<std::string>& vi_names_) : ParallelWork(vi_names_.size()), 
+	    dcom(dcom_), vi_names(vi_names_), done(0), failed(0) { }
+	void work(size_t i);
+};
+
+void ViWarmUp::work(size_t i)
+{
+	const std::string& vi_name = vi_names[i];
+	bool ok = true;
+	try
+	{
+		LabVIEW::VirtualInstrumentPtr vi;
+		dcom->getViRef(CComBSTR(vi_name.c_str()), false, vi);
+		vi.Detach();
+	}
+	catch(const std::exception& ex)
+	{
+		ok = false;
+		errlogSevPrintf(errlogMinor, "lvDCOM warm up: \"%s\" failed: %s\n", vi_name.c_str(), ex.what());
+	}
+	epicsGuard<epicsMutex> _lock(m_lock);
+	++done;
+	if (!ok)
+	{
+		++failed;
+	}
+	errlogSevPrintf(errlogInfo, "lvDCOM warm up: %d of %d VI references resolved (%d failed)\n", done, 
+	    static_cast<int>(vi_names.size()), failed);
+}
+
+/// Resolve references to all VIs in our section using up to \a nthreads threads, so the first scan of records does
+/// not pay for getting every VI reference one after another. A VI that fails is only reported, it will be retried
+/// on first use as normal. Returns the number of VIs that failed.
+int lvDCOMInterface::warmUpViRefs(int nthreads)
+{
+	// there are no VI references to resolve through the TCP transport
+	if (m_pxmldom == NULL || nthreads <= 0 || m_tcp != NULL || m_shm != NULL)
+	{
+		return 0;
+	}
+	std::vector<std::string> vi_names;
+	getViPaths(vi_names);
+	if (vi_names.size() == 0)
+	{
+		return 0;
+	}
+	nthreads = (nthreads > static_cast<int>(vi_names.size()) ? static_cast<int>(vi_names.size()) : nthreads);
+	errlogSevPrintf(errlogInfo, "lvDCOM warm up: resolving %d VI references using %d threads\n", static_cast<int>(vi_names.size()), nthreads);
+	epicsTime start = epicsTime::getCurrent();
+	ViWarmUp wu(this, vi_names);
+	wu.run("lvDCOMWarmUp", nthreads);
+	errlogSevPrintf(errlogInfo, "lvDCOM warm up: finished in %.1f seconds, %d of %d VI references failed\n", 
+	    epicsTime::getCurrent() - start, wu.failed, wu.done);
+	return wu.failed;
+}
+
+/// parse a \<read\> element attribute such as "3" or "2.0.1" into the index of the element at each level of nested clusters
+static void parseElementPath(const std::string& param, const std::string& spec, std::vector<int>& path)
+{
+	path.clear();
+	const char* p = spec.c_str();
+	while(*p != '\0')
+	{
+		char* end = NULL;
+		long i = strtol(p, &end, 10);
+		if ( end == p || i < 0 || (*end != '.' && *end != '\0') )
+		{
+			throw std::runtime_error("parameter \"" + param + "\" has invalid cluster element \"" + spec + "\"");
+		}
+		path.push_back(static_cast<int>(i));
+		p = (*end == '.' ? end + 1 : end);
+	}
+}
+
+/// The element at \a path of the cluster in \a v. A LabVIEW cluster arrives as a 1D VARIANT array with an entry for each 
+/// member, in cluster order, and a nested cluster is another such array. The reference returned points into \a v
+static const VARIANT& clusterElement(const VARIANT& v, const std::vector<int>& path)
+{
+	VARIANT* elem = const_cast<VARIANT*>(&v);
+	for(size_t i = 0; i < path.size(); ++i)
+	{
+		VARIANT* members = NULL;
+		if ( V_VT(elem) != (VT_ARRAY | VT_VARIANT) || path[i] >= arrayVariantLength(elem) )
+		{
+			throw std::runtime_error("cluster has no element at configured path");
+		}
+		if ( accessArrayVariant(elem, &members) != 0 || members == NULL )
+		{
+			throw std::runtime_error("cluster element access failed (SafeArrayAccessData)");
+		}
+		// the array data stays put while v is alive, the lock is only needed to get the pointer
+		unaccessArrayVariant(elem);
+		elem = members + path[i];
+	}
+	return *elem;
+}
+
+/// Compile the \<read\> element attribute of every parameter reading part of a cluster, so a cluster read can be decoded 
+/// without any further XPath lookups. Parameters reading the same control on the same VI are grouped under one cluster key.
+void lvDCOMInterface::compileClusters()
+{
+	std::map<std::string,std::string> params;
+	cluster_map_t clusters;
+	std::map<std::string, std::string> cluster_keys;
+	std::map<std::string, std::vector<int> > cluster_paths;
+	getParams(params);
+	for(std::map<std::string,std::string>::const_iterator it = params.begin(); it != params.end(); ++it)
+	{
+		const char* param = it->first.c_str();
+		if (it->second == "group")
+		{
+			continue;
+		}
+		std::string element = paramAttribute(param, "read", "element");
+		if (element.size() == 0)
+		{
+			continue;
+		}
+		if ( it->second != "float64" && it->second != "int32" && it->second != "enum" && it->second != "ring" && 
+		     it->second != "boolean" && it->second != "string" )
+		{
+			throw std::runtime_error("parameter \"" + it->first + "\" of type " + it->second + " cannot read a cluster element");
+		}
+		ClusterField field;
+		field.param = it->first;
+		field.type = it->second;
+		parseElementPath(it->first, element, field.path);
+		CComBSTR vi_name, control_name;
+		paramTarget(param, "read", vi_name, control_name);
+		std::string key = std::string(CW2CT(vi_name)) + "\n" + std::string(CW2CT(control_name));
+		clusters[key].push_back(field);
+		cluster_keys[it->first] = key;
+		cluster_paths[it->first] = field.path;
+	}
+	epicsGuard<epicsMutex> _lock(m_lock);
+	m_clusters.swap(clusters);
+	m_cluster_keys.swap(cluster_keys);
+	m_cluster_paths.swap(cluster_paths);
+}
+
+/// the part of \a v, the value of the control read by \a param, that \a param is for: a cluster element or all of it
+const VARIANT& lvDCOMInterface::readElement(const char* param, const VARIANT& v)
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	std::map<std::string, std::vector<int> >::const_iterator it = m_cluster_paths.find(param);
+	return (it != m_cluster_paths.end() ? clusterElement(v, it->second) : v);
+}
+
+/// key shared by all parameters reading elements of the same cluster as \a param, or empty if \a param does not read a cluster element
+std::string lvDCOMInterface::getClusterKey(const char* param)
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	std::map<std::string, std::string>::const_iterator it = m_cluster_keys.find(param);
+	return (it != m_cluster_keys.end() ? it->second : "");
+}
+
+/// the parameters reading elements of the cluster with key \a key from getClusterKey()
+void lvDCOMInterface::getClusterFields(const std::string& key, std::vector<ClusterField>& fields)
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	cluster_map_t::const_iterator it = m_clusters.find(key);
+	if (it != m_clusters.end())
+	{
+		fields = it->second;
+	}
+	else
+	{
+		fields.clear();
+	}
+}
+
+/// Read the cluster that all of \a fields are elements of with a single GetControlValue, and decode each element into its field.
+/// A field whose element is missing or will not convert to its type has ok set false, only failing to read the cluster throws.
+void lvDCOMInterface::getLabviewCluster(std::vector<ClusterField>& fields)
+{
+	if (fields.size() == 0)
+	{
+		return;
+	}
+	const char* param = fields[0].param.c_str();
+	CComVariant v;
+	CComBSTR vi_name, control_name;
+	paramTarget(param, "read", vi_name, control_name);
+	if (vi_name.Length() == 0 || control_name.Length() == 0)
+	{
+		throw std::runtime_error("getLabviewCluster: vi or control is NULL");
+	}
+	getLabviewValue(vi_name, control_name, &v, getTimeout(param, "read"));
+	for(std::vector<ClusterField>::iterator it = fields.begin(); it != fields.end(); ++it)
+	{
+		it->ok = false;
+		try
+		{
+			const VARIANT& elem = clusterElement(v, it->path);
+			if (it->type == "float64")
+			{
+				it->ok = convertVariant(elem, it->dval);
+			}
+			else if (it->type == "string")
+			{
+				it->ok = convertVariant(elem, it->sval);
+			}
+			else
+			{
+				it->ok = convertVariant(elem, it->ival);
+			}
+		}
+		catch(const std::exception&)
+		{
+			;  // leave ok false, the other elements may still be good
+		}
+	}
+}
+
+/// number of 32 bit words booleanarray \a param is packed into, from the bits attribute of its \<read\> (default 32)
+int lvDCOMInterface::getBitWords(const char* param)
+{
+	std::string bits = paramAttribute(param, "read", "bits");
+	int nbits = (bits.size() > 0 ? atoi(bits.c_str()) : 32);
+	return (nbits > 0 ? (nbits + 31) / 32 : 1);
+}
+
+/// Read a LabVIEW boolean array, or a cluster of booleans (e.g. a bank of LEDs), with one GetControlValue and pack it into
+/// \a words, element i going to bit i % 32 of word i / 32. \a words has getBitWords() entries, elements beyond these are
+/// ignored and missing ones read as 0.
+void lvDCOMInterface::getLabviewBits(const char* param, std::vector<epicsUInt32>& words)
+{
+	if (param == NULL || *param == '\0')
+	{
+		throw std::runtime_error("getLabviewBits: param is NULL");
+	}
+	CComVariant v;
+	CComBSTR vi_name, control_name;
+	paramTarget(param, "read", vi_name, control_name);
+	if (vi_name.Length() == 0 || control_name.Length() == 0)
+	{
+		throw std::runtime_error("getLabviewBits: vi or control is NULL");
+	}
+	words.assign(getBitWords(param), 0);
+	getLabviewValue(vi_name, control_name, &v, getTimeout(param, "read"));
+	size_t n = arrayVariantLength(&v);
+	n = (n > 32 * words.size() ? 32 * words.size() : n);
+	if ( v.vt == (VT_ARRAY | VT_BOOL) )
+	{
+		void* data = NULL;
+		if ( FAILED(SafeArrayAccessData(v.parray, &data)) || data == NULL )
+		{
+			throw std::runtime_error("getLabviewBits failed (SafeArrayAccessData)");
+		}
+		packBits(static_cast<const VARIANT_BOOL*>(data), n, &(words[0]));
+		SafeArrayUnaccessData(v.parray);
+	}
+	else if ( v.vt == (VT_ARRAY | VT_VARIANT) )
+	{
+		VARIANT* members = NULL;
+		std::vector<int> values(n, 0);
+		if ( accessArrayVariant(&v, &members) != 0 || members == NULL )
+		{
+			throw std::runtime_error("getLabviewBits failed (SafeArrayAccessData)");
+		}
+		for(size_t i = 0; i < n; ++i)
 		{
-			throw COMexception("CoCreateInstanceEx (LabVIEW) ", hr);
-		} 
-		if( S_OK != mq[ 0 ].hr || NULL == mq[ 0 ].pItf ) 
-		{ 
-			throw COMexception("CoCreateInstanceEx (LabVIEW)(mq) ", mq[ 0 ].hr);
-		} 
-		setIdentity(m_pidentity, mq[ 0 ].pItf);
-		m_lv.Release();
-		m_lv.Attach( reinterpret_cast< LabVIEW::_Application* >( mq[ 0 ].pItf ) ); 
-		std::cerr << "Successfully connected to LabVIEW on " << m_host << std::endl;
+			convertVariant(members[i], values[i]);
+		}
+		unaccessArrayVariant(&v);
+		packBits((n > 0 ? &(values[0]) : NULL), n, &(words[0]));
 	}
 	else
 	{
-		std::cerr << "(Re)Making local connection to LabVIEW" << std::endl;
-		m_pidentity = NULL;
-		m_lv.Release();
-		hr = m_lv.CoCreateInstance(m_clsid, NULL, CLSCTX_LOCAL_SERVER);
-		if( FAILED( hr ) ) 
+		throw std::runtime_error("getLabviewBits failed (not a boolean array or cluster)");
+	}
+}
+
+/// Set the bits of word \a word of booleanarray \a param that are in \a mask to those in \a value, leaving the rest alone. 
+/// The \<set\> control is read, changed and written back to the same control, so a change made by the VI itself in between 
+/// would be lost. For a write group member a value already staged is changed instead, so the bits of each word written 
+/// before the commit are kept. Bits beyond the end of the array are ignored.
+void lvDCOMInterface::setLabviewBits(const char* param, int word, epicsUInt32 value, epicsUInt32 mask)
+{
+	if (param == NULL || *param == '\0')
+	{
+		throw std::runtime_error("setLabviewBits: param is NULL");
+	}
+	CComVariant v;
+	CComBSTR vi_name, control_name;
+	paramTarget(param, "set", vi_name, control_name);
+	if (vi_name.Length() == 0 || control_name.Length() == 0)
+	{
+		throw std::runtime_error("setLabviewBits: vi or control is NULL");
+	}
+	std::string group = getWriteGroup(param);
+	if (group.size() == 0 || !stagedValue(group, param, &v))
+	{
+		getLabviewValue(vi_name, control_name, &v, getTimeout(param, "set"));
+	}
+	size_t n = arrayVariantLength(&v);
+	if ( v.vt == (VT_ARRAY | VT_BOOL) )
+	{
+		void* data = NULL;
+		if ( FAILED(SafeArrayAccessData(v.parray, &data)) || data == NULL )
 		{
-			throw COMexception("CoCreateInstance (LabVIEW) ", hr);
-		} 
-		std::cerr << "Successfully connected to local LabVIEW" << std::endl;
+			throw std::runtime_error("setLabviewBits failed (SafeArrayAccessData)");
+		}
+		unpackBits(value, mask, word, static_cast<VARIANT_BOOL*>(data), n, static_cast<VARIANT_BOOL>(VARIANT_TRUE), static_cast<VARIANT_BOOL>(VARIANT_FALSE));
+		SafeArrayUnaccessData(v.parray);
 	}
-        if (checkOption(lvDCOMVerbose))
-        {
-	    std::cerr << "Attempting to access \"" << CW2CT(vi_name) << "\" on " << (m_host.size() > 0 ? m_host : "localhost") << std::endl;
-        }
-	if (reentrant)
+	else if ( v.vt == (VT_ARRAY | VT_VARIANT) )
+	{
+		VARIANT* members = NULL;
+		if ( accessArrayVariant(&v, &members) != 0 || members == NULL )
+		{
+			throw std::runtime_error("setLabviewBits failed (SafeArrayAccessData)");
+		}
+		for(size_t i = 0; i < 32 && 32 * word + i < n; ++i)
+		{
+			VARIANT& member = members[32 * word + i];
+			if ( ((mask >> i) & 1) && V_VT(&member) == VT_BOOL )
+			{
+				V_BOOL(&member) = ( ((value >> i) & 1) ? VARIANT_TRUE : VARIANT_FALSE );
+			}
+		}
+		unaccessArrayVariant(&v);
+	}
+	else
+	{
+		throw std::runtime_error("setLabviewBits failed (not a boolean array or cluster)");
+	}
+	if (group.size() > 0)
+	{
+		stageWrite(group, param, v);
+	}
+	else
+	{
+		writeControl(param, v, NULL, true);
+	}
+}
+
+template <>
+void lvDCOMInterface::getLabviewValue(const char* param, std::string* value)
+{
+	if (value == NULL)
+	{
+		throw std::runtime_error("getLabviewValue failed (NULL)");
+	}
+	if (param == NULL || *param == '\0')
+	{
+		throw std::runtime_error("getLabviewValue: param is NULL");
+	}
+	CComVariant v;
+	CComBSTR vi_name, control_name;
+	paramTarget(param, "read", vi_name, control_name);
+	if (vi_name.Length() == 0 || control_name.Length() == 0)
+	{
+		throw std::runtime_error("getLabviewValue: vi or control is NULL");
+	}
+	getLabviewValue(vi_name, control_name, &v, getTimeout(param, "read"));
+	if ( !convertVariant(readElement(param, v), *value) )
+	{
+		throw std::runtime_error("getLabviewValue failed (convertVariant BSTR)");
+	}
+}
+
+/// does an array VARTYPE hold elements we can copy directly into a C++ array of type T
+template <typename T>
+static bool arrayTypeMatches(VARTYPE vt)
+{
+	return ( vt == (VT_ARRAY | CVarTypeInfo<T>::VT) );
+}
+
+/// LabVIEW I32 arrays arrive as VT_I4, which is the same size as a C++ int
+template <>
+bool arrayTypeMatches<int>(VARTYPE vt)
+{
+	return ( vt == (VT_ARRAY | VT_I4) || vt == (VT_ARRAY | VT_INT) );
+}
+
+/// the shape of the whole of the (1D or 2D) array in \a v, as rows and columns
+static void arraySlice(VARIANT& v, ArraySlice& slice)
+{
+	slice = ArraySlice();
+	if (SafeArrayGetDim(v.parray) == 2)
+	{
+		// SAFEARRAY dimension 1 is the LabVIEW row index, and varies fastest in memory
+		long lbound = 0, ubound = -1;
+		SafeArrayGetLBound(v.parray, 1, &lbound);
+		SafeArrayGetUBound(v.parray, 1, &ubound);
+		slice.rows = slice.nr = static_cast<size_t>(ubound - lbound + 1);
+		lbound = 0;
+		ubound = -1;
+		SafeArrayGetLBound(v.parray, 2, &lbound);
+		SafeArrayGetUBound(v.parray, 2, &ubound);
+		slice.nc = static_cast<size_t>(ubound - lbound + 1);
+	}
+	else
+	{
+		slice.rows = slice.nr = 1;
+		slice.nc = arrayVariantLength(&v);
+	}
+}
+
+/// the part of the array in \a v that \a param reads, a 2D array may be sliced by rows and cols attributes on \<read\>
+void lvDCOMInterface::getArraySlice(const char* param, VARIANT& v, ArraySlice& slice)
+{
+	arraySlice(v, slice);
+	if (SafeArrayGetDim(v.parray) != 2)
 	{
-		vi = m_lv->GetVIReference(vi_name, "", 1, 8);
-		setIdentity(m_pidentity, vi);
+		return;
+	}
+	parseSlice(paramAttribute(param, "read", "rows"), slice.rows, slice.row0, slice.nr);
+	parseSlice(paramAttribute(param, "read", "cols"), slice.nc, slice.col0, slice.nc);
+}
+
+/// Copy \a slice of the array elements \a data, in SAFEARRAY order, to \a value, row major. If there is only room for some of
+/// it in \a nElements whole rows are copied where possible. Returns number of elements copied, and if \a dims is not NULL
+/// the rows and columns copied in dims[0] and dims[1]
+template <typename T>
+static size_t copyArrayData(const T* data, const ArraySlice& slice, T* value, size_t nElements, size_t* dims)
+{
+	size_t nr = slice.nr, nc = slice.nc;
+	if (nr * nc > nElements)
+	{
+		if (nc > 0 && nElements >= nc)
+		{
+			nr = nElements / nc;
+		}
+		else
+		{
+			nr = (nElements > 0 ? 1 : 0);
+			nc = nElements;
+		}
+	}
+	if (dims != NULL)
+	{
+		dims[0] = nr;
+		dims[1] = nc;
+	}
+	size_t n = nr * nc;
+	if (n == 0)
+	{
+		return 0;
+	}
+	if (slice.rows == 1)
+	{
+		memcpy(value, data + slice.col0, n * sizeof(T));
 	}
 	else
 	{
-		//If a VI is reentrant then always get it as reentrant
-		vi = m_lv->GetVIReference(vi_name, "", 0, 0);
-		setIdentity(m_pidentity, vi);
-		if (vi->IsReentrant)
-		{
-			vi = m_lv->GetVIReference(vi_name, "", 1, 8);
-			setIdentity(m_pidentity, vi);
-			reentrant = true;
-		}
+		transposeBlocked(data, slice.rows, slice.row0, nr, slice.col0, nc, value);
+	}
+	return n;
+}
+
+/// Copy \a slice of the SAFEARRAY in \a v to \a value as copyArrayData(), using direct access to the array data
+template <typename T>
+static size_t copyArrayVariant(VARIANT& v, const ArraySlice& slice, T* value, size_t nElements, size_t* dims)
+{
+	if (slice.nr * slice.nc == 0 || nElements == 0)
+	{
+		return copyArrayData<T>(NULL, slice, value, nElements, dims);
+	}
+	void* data = NULL;
+	if ( FAILED(SafeArrayAccessData(v.parray, &data)) || data == NULL )
+	{
+		throw std::runtime_error("getLabviewValue failed (SafeArrayAccessData)");
+	}
+	size_t n = copyArrayData(static_cast<const T*>(data), slice, value, nElements, dims);
+	SafeArrayUnaccessData(v.parray);
+	return n;
+}
+
+/// the #CaptureValue kind of a shared memory slot whose elements can be copied directly into a C++ array of type T
+template <typename T>
+static CaptureValue::Kind shmArrayKind();
+
+template <>
+CaptureValue::Kind shmArrayKind<double>()
+{
+	return CaptureValue::Float64Array;
+}
+
+template <>
+CaptureValue::Kind shmArrayKind<int>()
+{
+	return CaptureValue::Int32Array;
+}
+
+/// lvDCOMShmClient::readArray() reader copying a slice of an array slot, as copyArrayVariant() does from a SAFEARRAY
+template <typename T>
+struct ShmArrayCopy
+{
+	T* value;
+	size_t nElements;
+	size_t* dims;
+	std::string rows, cols;   ///< \<read\> rows and cols attributes
+	bool matched;             ///< the slot held elements of type T
+	size_t n;                 ///< elements copied
+	ShmArrayCopy(T* value_, size_t nElements_, size_t* dims_) : value(value_), nElements(nElements_), dims(dims_), matched(false), n(0) { }
+	void operator()(const ShmArrayView& view)
+	{
+		matched = (view.kind == shmArrayKind<T>());
+		n = 0;
+		if (!matched)
+		{
+			return;
+		}
+		ArraySlice slice;
+		if (view.ndims == 2)
+		{
+			// dims are slowest varying first, so the LabVIEW row index is the second
+			slice.rows = slice.nr = view.dims[1];
+			slice.nc = view.dims[0];
+			if (slice.rows * slice.nc != view.n)
+			{
+				return;
+			}
+			parseSlice(rows, slice.rows, slice.row0, slice.nr);
+			parseSlice(cols, slice.nc, slice.col0, slice.nc);
+		}
+		else
+		{
+			slice.rows = slice.nr = 1;
+			slice.nc = view.n;
+		}
+		n = copyArrayData(static_cast<const T*>(view.data), slice, value, nElements, dims);
+	}
+};
+
+/// Read the array \a param reads straight from its shared memory slot into \a value, without a VARIANT, as getLabviewValue()
+/// would. Returns false if the slot does not hold raw elements, when the caller should read it as any other value
+template<typename T> 
+bool lvDCOMInterface::getShmArray(const char* param, T* value, size_t nElements, size_t& nIn, size_t* dims)
+{
+	if (param == NULL || *param == '\0')
+	{
+		throw std::runtime_error("getLabviewValue: param is NULL");
+	}
+	CComBSTR vi_name, control_name;
+	paramTarget(param, "read", vi_name, control_name);
+	std::string vi(CW2A(vi_name, CP_UTF8));
+	std::string control(CW2A(control_name, CP_UTF8));
+	if (vi.size() == 0 || control.size() == 0)
+	{
+		throw std::runtime_error("getLabviewValue: vi or control is NULL");
+	}
+	ShmArrayCopy<T> copy(value, nElements, dims);
+	copy.rows = paramAttribute(param, "read", "rows");
+	copy.cols = paramAttribute(param, "read", "cols");
+	bool raw = false;
+	unsigned long opens = shmBegin();
+	try
+	{
+		raw = m_shm->readArray(vi, control, copy, getTimeout(param, "read"));
+	}
+	catch(const std::exception& ex)
+	{
+		shmThrow(ex);
+	}
+	shmEnd(opens);
+	if (raw && !copy.matched)
+	{
+		throw std::runtime_error("getLabviewValue failed (type mismatch)");
+	}
+	nIn = copy.n;
+	return raw;
+}
+
+/// copy \a slice of the BSTR array in \a v to \a values, one vector per row
+static void copyStringTable(VARIANT& v, const ArraySlice& slice, std::vector< std::vector<std::string> >& values)
+{
+	values.clear();
+	if (slice.nr * slice.nc == 0)
+	{
+		return;
+	}
+	BSTR* data = NULL;
+	if (accessArrayVariant(&v, &data) != 0)
+	{
+		throw std::runtime_error("getLabviewTable failed (SafeArrayAccessData)");
+	}
+	values.resize(slice.nr);
+	for(size_t i = 0; i < slice.nr; ++i)
+	{
+		values[i].reserve(slice.nc);
+		for(size_t j = 0; j < slice.nc; ++j)
+		{
+			BSTR t = data[(slice.col0 + j) * slice.rows + slice.row0 + i];
+			values[i].push_back(t != NULL ? static_cast<const char*>(CW2CT(t)) : "");
+		}
+	}
+	unaccessArrayVariant(&v);
+}
+
+/// read the LabVIEW array mapped to \a param into \a v, checking it has an element type compatible with T
+template<typename T> 
+void lvDCOMInterface::getLabviewArray(const char* param, CComVariant& v)
+{
+	if (param == NULL || *param == '\0')
+	{
+		throw std::runtime_error("getLabviewValue: param is NULL");
+	}
+	CComBSTR vi_name, control_name;
+	paramTarget(param, "read", vi_name, control_name);
+	if (vi_name.Length() == 0 || control_name.Length() == 0)
+	{
+		throw std::runtime_error("getLabviewValue: vi or control is NULL");
+	}
+	getLabviewValue(vi_name, control_name, &v, getTimeout(param, "read"));
+	if ( !arrayTypeMatches<T>(v.vt) )
+	{
+		throw std::runtime_error("getLabviewValue failed (type mismatch)");
+	}
+}
+
+/// read a LabVIEW array into \a value, a 2D array is returned row major. If \a dims is not NULL the number of rows 
+/// and columns read are returned in dims[0] and dims[1], a 1D array is a single row
+template<typename T> 
+void lvDCOMInterface::getLabviewValue(const char* param, T* value, size_t nElements, size_t& nIn, size_t* dims)
+{
+	if (value == NULL)
+	{
+		throw std::runtime_error("getLabviewValue failed (NULL)");
+	}
+	// a capture needs the value as a VARIANT, so only skip that without one
+	if (m_shm != NULL && m_capture == NULL && getShmArray(param, value, nElements, nIn, dims))
+	{
+		return;
+	}
+	CComVariant v;
+	ArraySlice slice;
+	getLabviewArray<T>(param, v);
+	getArraySlice(param, v, slice);
+	nIn = copyArrayVariant(v, slice, value, nElements, dims);
+}
+
+/// read a LabVIEW array into \a value, which is resized to fit the whole array (or the part of it sliced by rows and cols)
+template<typename T> 
+void lvDCOMInterface::getLabviewValue(const char* param, std::vector<T>& value, size_t* dims)
+{
+	CComVariant v;
+	ArraySlice slice;
+	getLabviewArray<T>(param, v);
+	getArraySlice(param, v, slice);
+	value.resize(slice.nr * slice.nc);
+	if (dims != NULL)
+	{
+		dims[0] = slice.nr;
+		dims[1] = slice.nc;
+	}
+	if (value.size() > 0)
+	{
+		copyArrayVariant(v, slice, &(value[0]), value.size(), dims);
+	}
+}
+
+/// read a LabVIEW string array as text, columns separated by tabs and rows by newlines. If \a dims is not NULL 
+/// the number of rows and columns read are returned in dims[0] and dims[1]
+void lvDCOMInterface::getLabviewTable(const char* param, std::string* value, size_t* dims)
+{
+	if (value == NULL)
+	{
+		throw std::runtime_error("getLabviewTable failed (NULL)");
+	}
+	CComVariant v;
+	ArraySlice slice;
+	std::vector< std::vector<std::string> > values;
+	getLabviewArray<BSTR>(param, v);
+	getArraySlice(param, v, slice);
+	copyStringTable(v, slice, values);
+	value->clear();
+	for(size_t i = 0; i < values.size(); ++i)
+	{
+		for(size_t j = 0; j < values[i].size(); ++j)
+		{
+			value->append(j > 0 ? "\t" : "");
+			value->append(values[i][j]);
+		}
+		value->append(i + 1 < values.size() ? "\n" : "");
+	}
+	if (dims != NULL)
+	{
+		dims[0] = slice.nr;
+		dims[1] = slice.nc;
+	}
+}
+
+/// period (seconds) at which the driver should poll \a param in the background, 0.0 if it is only read on request
+double lvDCOMInterface::getPollPeriod(const char* param)
+{
+	std::string poll = paramAttribute(param, "read", "poll");
+	return (poll.size() > 0 ? atof(poll.c_str()) : 0.0);
+}
+
+/// number of samples of \a param to keep for its _HIST waveforms (0 for none) and the minimum \a period (seconds) between
+/// updates of them, from the history and history_period attributes of its \<read\>
+void lvDCOMInterface::getHistory(const char* param, int& capacity, double& period)
+{
+	std::string value = paramAttribute(param, "read", "history");
+	capacity = (value.size() > 0 ? atoi(value.c_str()) : 0);
+	value = paramAttribute(param, "read", "history_period");
+	period = (value.size() > 0 ? atof(value.c_str()) : 1.0);
+}
+
+/// number of values of \a param to compute statistics over (0 for none) and which statistics, from the stats and
+/// stats_set attributes of its \<read\>. For an array any non-zero \a window gives statistics of each array read
+void lvDCOMInterface::getStats(const char* param, int& window, std::string& stats_set)
+{
+	std::string value = paramAttribute(param, "read", "stats");
+	window = (value.size() > 0 ? atoi(value.c_str()) : 0);
+	stats_set = paramAttribute(param, "read", "stats_set");
+}
+
+/// bounds for the poll period of \a param if it is adapted to how often the value changes, left unchanged if not specified
+void lvDCOMInterface::getPollLimits(const char* param, double& poll_min, double& poll_max)
+{
+	std::string value = paramAttribute(param, "read", "poll_min");
+	if (value.size() > 0)
+	{
+		poll_min = atof(value.c_str());
+	}
+	value = paramAttribute(param, "read", "poll_max");
+	if (value.size() > 0)
+	{
+		poll_max = atof(value.c_str());
+	}
+}
+
+/// maximum number of background reads per second the driver should make for this section, 0.0 for no limit
+double lvDCOMInterface::getPollBudget()
+{
+	char xpath[MAX_PATH_LEN];
+	_snprintf(xpath, sizeof(xpath), "/lvinput/section[@name='%s']/@poll_budget", m_configSection.c_str());
+	std::string budget = doXPATH(xpath);
+	return (budget.size() > 0 ? atof(budget.c_str()) : 0.0);
+}
+
+/// file to save last known parameter values to, and preload them from at startup, or empty if not wanted
+std::string lvDCOMInterface::getSnapshotFile()
+{
+	char xpath[MAX_PATH_LEN];
+	_snprintf(xpath, sizeof(xpath), "/lvinput/section[@name='%s']/@snapshot_file", m_configSection.c_str());
+	return doXPATH(xpath);
+}
+
+/// how often (seconds) to save the snapshot file returned by getSnapshotFile()
+double lvDCOMInterface::getSnapshotPeriod()
+{
+	char xpath[MAX_PATH_LEN];
+	_snprintf(xpath, sizeof(xpath), "/lvinput/section[@name='%s']/@snapshot_period", m_configSection.c_str());
+	std::string period = doXPATH(xpath);
+	return (period.size() > 0 ? atof(period.c_str()) : 60.0);
+}
+
+/// memory mapped file to keep the latest value, time and status of every parameter in for other local programs, or empty if not wanted
+std::string lvDCOMInterface::getValueTableFile()
+{
+	char xpath[MAX_PATH_LEN];
+	_snprintf(xpath, sizeof(xpath), "/lvinput/section[@name='%s']/@value_table", m_configSection.c_str());
+	return doXPATH(xpath);
+}
+
+/// how often (seconds) the driver should check whether each VI is running, 0 if not wanted
+double lvDCOMInterface::getViStatePeriod()
+{
+	char xpath[MAX_PATH_LEN];
+	_snprintf(xpath, sizeof(xpath), "/lvinput/section[@name='%s']/@vi_state_period", m_configSection.c_str());
+	std::string period = doXPATH(xpath);
+	return (period.size() > 0 ? atof(period.c_str()) : 0.0);
+}
+
+/// expanded path of every VI in our section -> name of the int32 parameter given by its state_param attribute, or empty if it has none
+void lvDCOMInterface::getViStateParams(std::map<std::string,std::string>& state_params)
+{
+	char xpath[MAX_PATH_LEN];
+	state_params.clear();
+	_snprintf(xpath, sizeof(xpath), "/lvinput/section[@name='%s']/vi", m_configSection.c_str());
+	CComPtr<IXMLDOMDocument2> dom = configDom();
+	IXMLDOMNodeList* pXMLDomNodeList = NULL;
+	HRESULT hr = dom->selectNodes(_bstr_t(xpath), &pXMLDomNodeList);
+	if (FAILED(hr) || pXMLDomNodeList == NULL)
+	{
+		return;
 	}
-	ViRef viref(vi, reentrant, false);
-	// LabVIEW::ExecStateEnum::eIdle = 1
-	// LabVIEW::ExecStateEnum::eRunTopLevel = 2
-	if (vi->ExecState == LabVIEW::eIdle)
+	long n = 0;
+	pXMLDomNodeList->get_length(&n);
+	for(long i=0; i<n; ++i)
 	{
-		if ( checkOption(viStartIfIdle) ) 
+		IXMLDOMNode* pNode = NULL;
+		if ( FAILED(pXMLDomNodeList->get_item(i, &pNode)) || pNode == NULL )
 		{
-			std::cerr << "Starting \"" << CW2CT(vi_name) << "\" on " << (m_host.size() > 0 ? m_host : "localhost") << std::endl;
-			vi->Run(true);
-			viref.started = true;
+			continue;
 		}
-		else if ( checkOption(viWarnIfIdle) )
+		std::string vi_name = expandedNodeText(pNode, "@path");
+		std::string name = expandedNodeText(pNode, "@state_param");
+		pNode->Release();
+		std::replace(vi_name.begin(), vi_name.end(), '/', '\\');  // as doPath()
+		if (vi_name.size() > 0 && (name.size() > 0 || state_params.find(vi_name) == state_params.end()))
 		{
-			std::cerr << "\"" << CW2CT(vi_name) << "\" is not running on " << (m_host.size() > 0 ? m_host : "localhost") << " and autostart is disabled" << std::endl;
+			state_params[vi_name] = name;
 		}
 	}
-	m_vimap[ws] = viref;
+	pXMLDomNodeList->Release();
+}
+
+/// expanded path of the VI that \a param is on
+std::string lvDCOMInterface::getParamViPath(const char* param)
+{
+	char xpath[MAX_PATH_LEN];
+	_snprintf(xpath, sizeof(xpath), "/lvinput/section[@name='%s']/vi[param[@name='%s'] or group[@name='%s']]/@path", m_configSection.c_str(), param, param);
+	return doPath(xpath);
 }
 
+/// for a polled array \a param, the amount by which any element must change before a new value is posted to records
+double lvDCOMInterface::getDeadband(const char* param)
+{
+	std::string deadband = paramAttribute(param, "read", "deadband");
+	return (deadband.size() > 0 ? atof(deadband.c_str()) : 0.0);
+}
 
-template <>
-void lvDCOMInterface::getLabviewValue(const char* param, std::string* value)
+template <typename T>
+void lvDCOMInterface::getLabviewValue(const char* param, T* value)
 {
 	if (value == NULL)
 	{
@@ -1002,105 +3177,147 @@ void lvDCOMInterface::getLabviewValue(const char* param, std::string* value)
 		throw std::runtime_error("getLabviewValue: param is NULL");
 	}
 	CComVariant v;
-	char vi_name_xpath[MAX_PATH_LEN], control_name_xpath[MAX_PATH_LEN];
-	_snprintf(vi_name_xpath, sizeof(vi_name_xpath), "/lvinput/section[@name='%s']/vi[param[@name='%s']]/@path", m_configSection.c_str(), param);
-	_snprintf(control_name_xpath, sizeof(control_name_xpath), "/lvinput/section[@name='%s']/vi/param[@name='%s']/read/@target", m_configSection.c_str(), param);
-	CComBSTR vi_name(doPath(vi_name_xpath).c_str());
-	CComBSTR control_name(doXPATH(control_name_xpath).c_str());
+	CComBSTR vi_name, control_name;
+	paramTarget(param, "read", vi_name, control_name);
 	if (vi_name.Length() == 0 || control_name.Length() == 0)
 	{
 		throw std::runtime_error("getLabviewValue: vi or control is NULL");
 	}
-	getLabviewValue(vi_name, control_name, &v);
-	if ( v.ChangeType(VT_BSTR) == S_OK )
+	getLabviewValue(vi_name, control_name, &v, getTimeout(param, "read"));
+	if ( !convertVariant(readElement(param, v), *value) )
 	{
-		*value = CW2CT(v.bstrVal);
-	}
-	else
-	{
-		throw std::runtime_error("getLabviewValue failed (ChangeType BSTR)");
+		throw std::runtime_error("getLabviewValue failed (convertVariant)");
 	}
 }
 
-template<typename T> 
-void lvDCOMInterface::getLabviewValue(const char* param, T* value, size_t nElements, size_t& nIn)
+/// if the watchdog cancelled the call covered by \a deadline, mark the VI reference as degraded so it is re-created 
+/// on next use and throw a COMTimeoutException in place of the COM error the cancelled call will have raised
+void lvDCOMInterface::checkDeadline(DCOMCallDeadline& deadline, BSTR vi_name, const char* op)
 {
-	if (value == NULL)
+	if ( !deadline.finish() )
 	{
-		throw std::runtime_error("getLabviewValue failed (NULL)");
+		return;
 	}
-	if (param == NULL || *param == '\0')
+	std::wstring ws(vi_name, SysStringLen(vi_name));
+	viBreaker(ws).recordFailure();
+	epicsGuard<epicsMutex> _lock(m_lock);
+	vi_map_t::iterator it = m_vimap.find(ws);
+	if (it != m_vimap.end())
 	{
-		throw std::runtime_error("getLabviewValue: param is NULL");
+		it->second.degraded = true;
 	}
-	CComVariant v;
-	char vi_name_xpath[MAX_PATH_LEN], control_name_xpath[MAX_PATH_LEN];
-	_snprintf(vi_name_xpath, sizeof(vi_name_xpath), "/lvinput/section[@name='%s']/vi[param[@name='%s']]/@path", m_configSection.c_str(), param);
-	_snprintf(control_name_xpath, sizeof(control_name_xpath), "/lvinput/section[@name='%s']/vi/param[@name='%s']/read/@target", m_configSection.c_str(), param);
-	CComBSTR vi_name(doPath(vi_name_xpath).c_str());
-	CComBSTR control_name(doXPATH(control_name_xpath).c_str());
-	if (vi_name.Length() == 0 || control_name.Length() == 0)
+	throw COMTimeoutException(std::string(op) + " on \"" + std::string(CW2CT(vi_name)) + "\" exceeded deadline and was cancelled");
+}
+
+/// the HRESULT to record in a capture file for an operation that threw \a ex
+static HRESULT exceptionHResult(const std::exception& ex)
+{
+	const COMexception* cex = dynamic_cast<const COMexception*>(&ex);
+	return (cex != NULL ? cex->hresult() : E_FAIL);
+}
+
+/// if a capture file is being written, append an operation to it that started at \a start and has just finished
+void lvDCOMInterface::capture(CaptureRecord::Op op, BSTR vi_name, BSTR control_name, const VARIANT* value, HRESULT hr, const epicsTime& start)
+{
+	if (m_capture == NULL)
 	{
-		throw std::runtime_error("getLabviewValue: vi or control is NULL");
+		return;
 	}
-	getLabviewValue(vi_name, control_name, &v);
-	if ( v.vt != (VT_ARRAY | CVarTypeInfo<T>::VT) )
+	CaptureRecord rec;
+	rec.op = op;
+	rec.hresult = hr;
+	rec.vi = CW2A(vi_name, CP_UTF8);
+	if (control_name != NULL)
 	{
-		throw std::runtime_error("getLabviewValue failed (type mismatch)");
+		rec.control = CW2A(control_name, CP_UTF8);
 	}
-	CComSafeArray<T> sa;
-	sa.Attach(v.parray);
-	nIn = ( sa.GetCount() > nElements ? nElements : sa.GetCount() );
-	for(LONG i=0; i<nIn; ++i)
+	if (value != NULL)
 	{
-		value[i] = sa.GetAt(i);
+		variantToCapture(*value, rec.value);
 	}
-	sa.Detach();
+	m_capture->write(rec, start);
 }
 
-template <typename T>
-void lvDCOMInterface::getLabviewValue(const char* param, T* value)
+void lvDCOMInterface::getLabviewValue(BSTR vi_name, BSTR control_name, VARIANT* value, double timeout)
 {
-	if (value == NULL)
+	if (m_tcp != NULL)
 	{
-		throw std::runtime_error("getLabviewValue failed (NULL)");
+		tcpControl(CaptureRecord::Get, vi_name, control_name, NULL, value, 0, timeout);
+		return;
 	}
-	if (param == NULL || *param == '\0')
+	if (m_shm != NULL)
 	{
-		throw std::runtime_error("getLabviewValue: param is NULL");
+		shmControl(CaptureRecord::Get, vi_name, control_name, NULL, value, 0, timeout);
+		return;
 	}
-	CComVariant v;
-	char vi_name_xpath[MAX_PATH_LEN], control_name_xpath[MAX_PATH_LEN];
-	_snprintf(vi_name_xpath, sizeof(vi_name_xpath), "/lvinput/section[@name='%s']/vi[param[@name='%s']]/@path", m_configSection.c_str(), param);
-	_snprintf(control_name_xpath, sizeof(control_name_xpath), "/lvinput/section[@name='%s']/vi/param[@name='%s']/read/@target", m_configSection.c_str(), param);
-	CComBSTR vi_name(doPath(vi_name_xpath).c_str());
-	CComBSTR control_name(doXPATH(control_name_xpath).c_str());
-	if (vi_name.Length() == 0 || control_name.Length() == 0)
+	HRESULT hr = S_OK;
+	LabVIEW::VirtualInstrumentPtr vi;
+	getViRef(vi_name, false, vi);
+	DCOMCallDeadline deadline(m_watchdog, "GetControlValue", vi_name, control_name, timeout);
+	epicsTime start = epicsTime::getCurrent();
+	try
 	{
-		throw std::runtime_error("getLabviewValue: vi or control is NULL");
+		*value = vi->GetControlValue(control_name).Detach();
+	}
+	catch(const std::exception& ex)
+	{
+		vi.Detach();
+		capture(CaptureRecord::Get, vi_name, control_name, NULL, exceptionHResult(ex), start);
+		checkDeadline(deadline, vi_name, "GetControlValue");
+		throw;
+	}
+	vi.Detach();
+	capture(CaptureRecord::Get, vi_name, control_name, value, hr, start);
+	if (FAILED(hr))
+	{
+		throw std::runtime_error("getLabviewValue failed");
 	}
-	getLabviewValue(vi_name, control_name, &v);
-	if ( v.ChangeType(CVarTypeInfo<T>::VT) == S_OK )
+}
+
+/// Read \a control of \a vi, which need not be in the configuration, as a #CaptureValue
+void lvDCOMInterface::getControlValue(const std::string& vi, const std::string& control, CaptureValue& value, double timeout)
+{
+	CComVariant v;
+	getLabviewValue(CComBSTR(CA2W(vi.c_str(), CP_UTF8)), CComBSTR(CA2W(control.c_str(), CP_UTF8)), &v, timeout);
+	variantToCapture(v, value);
+}
+
+/// Write \a value to \a control of \a vi, which need not be in the configuration. With \a signal set it is written by the
+/// extint VI (see setExtint()) so LabVIEW value change events fire
+void lvDCOMInterface::setControlValue(const std::string& vi, const std::string& control, const CaptureValue& value, bool signal, double timeout)
+{
+	CComBSTR vi_name(CA2W(vi.c_str(), CP_UTF8)), control_name(CA2W(control.c_str(), CP_UTF8));
+	CComVariant v, results;
+	captureToVariant(value, v);
+	if (signal)
 	{
-		*value = v.*(CVarTypeInfo<T>::pmField);	
+		if (m_extint.Length() == 0)
+		{
+			throw std::runtime_error("setControlValue: no extint VI to signal \"" + control + "\" with");
+		}
+		setLabviewValueExt(vi_name, control_name, v, &results, timeout);
+		extintResults(control_name, results, NULL);
 	}
 	else
 	{
-		throw std::runtime_error("getLabviewValue failed (ChangeType)");
+		setLabviewValue(vi_name, control_name, v, timeout);
 	}
 }
 
-void lvDCOMInterface::getLabviewValue(BSTR vi_name, BSTR control_name, VARIANT* value)
+/// Run \a vi with \a names_values, an Array of its control names and values arrays as sent by a TCP transport client,
+/// replacing it with the values array afterwards
+void lvDCOMInterface::callVi(const std::string& vi, CaptureValue& names_values, double timeout)
 {
-	HRESULT hr = S_OK;
-	LabVIEW::VirtualInstrumentPtr vi;
-	getViRef(vi_name, false, vi);
-	*value = vi->GetControlValue(control_name).Detach();
-	vi.Detach();
-	if (FAILED(hr))
+	if (names_values.kind != CaptureValue::Array || names_values.elements.size() != 2)
 	{
-		throw std::runtime_error("getLabviewValue failed");
+		throw std::runtime_error("callVi: call of \"" + vi + "\" needs an array of names and values");
 	}
+	CComVariant names, values, results;
+	captureToVariant(names_values.elements[0], names);
+	captureToVariant(names_values.elements[1], values);
+	callLabview(CComBSTR(CA2W(vi.c_str(), CP_UTF8)), names, values, false, &results, timeout);
+	names_values = CaptureValue();
+	variantToCapture(results, names_values);
 }
 
 /// determine best epics type for a labvier variable, this will be used
@@ -1110,190 +3327,576 @@ std::string lvDCOMInterface::getLabviewValueType(BSTR vi_name, BSTR control_name
 	CComVariant v;
 	try 
 	{
-	    getLabviewValue(vi_name, control_name, &v);
+	    getLabviewValue(vi_name, control_name, &v, m_timeout);
 	}
 	catch (const std::exception& ex)
 	{
 		std::cerr << "getLabviewValueType: Unable to read \"" << COLE2CT(control_name) << "\" on \"" << COLE2CT(vi_name) << "\": " << ex.what() << std::endl;
 		return "unknown";		
 	}
-	VARTYPE vt = (&v)->vt;
-	switch(vt)
+	switch(variantKind(v.vt))
+	{
+	    case VariantKindBoolean:
+			return "boolean";		
+
+		case VariantKindString:
+			return "string";		
+
+		case VariantKindInt32:
+			return "int32";
+
+		case VariantKindFloat64:
+			return "float64";
+
+		default:
+		    break;
+	}
+	if ( v.ChangeType(VT_R8) == S_OK )
+	{
+		return "float64";
+	}
+	else 
+	{
+		return "unknown";
+	}	
+}
+
+class StringItem 
+{
+	CComBSTR m_bstr;
+public:
+	StringItem(lvDCOMInterface* dcom, const char* xpath, const char* config_section, const char* param, bool filepath = false)
+	{
+		char base_xpath[MAX_PATH_LEN];
+		_snprintf(base_xpath, sizeof(base_xpath), xpath, config_section, param);
+		if (filepath)
+		{
+			m_bstr = dcom->doPath(base_xpath).c_str();
+		}
+		else
+		{
+			m_bstr = dcom->doXPATH(base_xpath).c_str();
+		}
+	};
+	const CComBSTR& bstr() { return m_bstr; }
+	size_t size() { return m_bstr.Length(); }
+	operator BSTR() { return m_bstr; }
+};
+
+class BoolItem 
+{
+	bool m_value;
+public:
+	BoolItem(lvDCOMInterface* dcom, const char* xpath, const char* config_section, const char* param)
+	{
+		char base_xpath[MAX_PATH_LEN];
+		_snprintf(base_xpath, sizeof(base_xpath), xpath, config_section, param);
+		m_value = dcom->doXPATHbool(base_xpath);
+	};
+	operator bool() { return m_value; }
+};
+
+/// Write \a value to the LabVIEW control for \a param. If \a readback is not NULL and the write tells us the
+/// new value of the control it is returned there: an extint write returns the value the VI now holds, otherwise a
+/// \<set readback="true"/\> does a GetControlValue of the same control straight after the write. Returns true if \a readback was set.
+bool lvDCOMInterface::setLabviewVariant(const char* param, const VARIANT& value, VARIANT* readback)
+{
+	if (param == NULL || *param == '\0')
+	{
+		throw std::runtime_error("setLabviewValue: param is NULL");
+	}
+	std::string group = getWriteGroup(param);
+	if (group.size() > 0)
+	{
+		stageWrite(group, param, value);
+		return false;
+	}
+	return writeControl(param, value, readback, true);
+}
+
+/// Write \a value to the LabVIEW control for \a param, as setLabviewVariant() but never staged. 
+/// The \<set\> post_button is only pushed if \a use_post_button is true, for a write group member the group's button is used instead.
+bool lvDCOMInterface::writeControl(const char* param, const VARIANT& value, VARIANT* readback, bool use_post_button)
+{
+	CComVariant results, button_value(true);
+	CComBSTR vi_name, control_name;
+	bool readback_valid = false;
+	paramTarget(param, "set", vi_name, control_name);
+	StringItem post_button(this, "/lvinput/section[@name='%s']/vi/param[@name='%s']/set/@post_button", m_configSection.c_str(), param);
+	BoolItem post_button_wait(this, "/lvinput/section[@name='%s']/vi/param[@name='%s']/set/@post_button_wait", m_configSection.c_str(), param);
+	BoolItem use_ext(this, "/lvinput/section[@name='%s']/vi/param[@name='%s']/set/@extint", m_configSection.c_str(), param);
+	BoolItem read_after_write(this, "/lvinput/section[@name='%s']/vi/param[@name='%s']/set/@readback", m_configSection.c_str(), param);
+	if (vi_name.Length() == 0 || control_name.Length() == 0)
+	{
+		throw std::runtime_error("setLabviewValue: vi or control is NULL");
+	}
+	bool push_button = use_post_button && (post_button.size() > 0);
+	double timeout = getTimeout(param, "set");
+	if (use_ext)
+	{
+		setLabviewValueExt(vi_name, control_name, value, &results, timeout);	
+		readback_valid = extintResults(control_name, results, readback);
+		if (push_button)
+		{
+			results.Clear();
+			setLabviewValueExt(vi_name, post_button, button_value, &results, timeout);
+			extintResults(post_button, results, NULL);
+		}
+	}
+	else
+	{
+		setLabviewValue(vi_name, control_name, value, timeout);	
+		if (push_button)
+		{
+			setLabviewValue(vi_name, post_button, button_value, timeout);
+		}
+	}
+	if (post_button_wait && push_button)
+	{
+		waitForLabviewBoolean(vi_name, post_button, false, timeout);	
+	}
+	if (readback != NULL && !readback_valid && read_after_write)
+	{
+		getLabviewValue(vi_name, control_name, readback, timeout);
+		readback_valid = true;
+	}
+	if (m_restore_setpoints)
+	{
+		recordSetpoint(vi_name, param, value);
+	}
+	return readback_valid;
+}
+
+/// Check the output of the extint VI after writing \a control_name. A non empty "Return Message" means the write failed and 
+/// is thrown as an exception, otherwise the "Variant Control Value" returned by the VI is copied to \a readback (if not NULL).
+/// Returns true if \a readback was set
+bool lvDCOMInterface::extintResults(BSTR control_name, VARIANT& results, VARIANT* readback)
+{
+	// indexes into the names array passed by setLabviewValueExt()
+	static const int control_value_index = 3, return_message_index = 5;
+	bool readback_valid = false;
+	std::string message;
+	VARIANT* values = NULL;
+	if ( V_VT(&results) != (VT_ARRAY | VT_VARIANT) || arrayVariantLength(&results) <= return_message_index )
+	{
+		return false;
+	}
+	if ( accessArrayVariant(&results, &values) != 0 || values == NULL )
+	{
+		return false;
+	}
+	convertVariant(values[return_message_index], message);
+	if ( readback != NULL && message.size() == 0 && V_VT(&(values[control_value_index])) != VT_EMPTY )
+	{
+		readback_valid = SUCCEEDED(VariantCopyInd(readback, &(values[control_value_index])));
+	}
+	unaccessArrayVariant(&results);
+	if (message.size() > 0)
+	{
+		throw COMexception("extint write of \"" + std::string(CW2CT(control_name)) + "\" failed: " + message);
+	}
+	return readback_valid;
+}
+
+/// name of the write \<group\> \a param belongs to, or an empty string if it is written immediately
+std::string lvDCOMInterface::getWriteGroup(const char* param)
+{
+	char xpath[MAX_PATH_LEN];
+	_snprintf(xpath, sizeof(xpath), "/lvinput/section[@name='%s']/vi/group[member/@param='%s']/@name", m_configSection.c_str(), param);
+	return doXPATH(xpath);
+}
+
+/// hold a write to a group member until the group is committed, a later write to the same member replaces the earlier value
+void lvDCOMInterface::stageWrite(const std::string& group, const std::string& param, const VARIANT& value)
+{
+	epicsGuard<epicsMutex> _lock(m_staged_lock);
+	staged_writes_t& writes = m_staged[group];
+	for(staged_writes_t::iterator it = writes.begin(); it != writes.end(); ++it)
+	{
+		if (it->first == param)
+		{
+			it->second = value;
+			return;
+		}
+	}
+	writes.push_back(std::pair<std::string,CComVariant>(param, value));
+}
+
+/// copy the value staged for \a param in \a group to \a value, returns false if none is staged
+bool lvDCOMInterface::stagedValue(const std::string& group, const std::string& param, VARIANT* value)
+{
+	epicsGuard<epicsMutex> _lock(m_staged_lock);
+	staged_map_t::const_iterator it = m_staged.find(group);
+	if (it == m_staged.end())
+	{
+		return false;
+	}
+	for(staged_writes_t::const_iterator itw = it->second.begin(); itw != it->second.end(); ++itw)
+	{
+		if (itw->first == param)
+		{
+			return SUCCEEDED(VariantCopy(value, &(itw->second)));
+		}
+	}
+	return false;
+}
+
+/// number of writes currently staged for \a group
+int lvDCOMInterface::stagedWrites(const char* group)
+{
+	epicsGuard<epicsMutex> _lock(m_staged_lock);
+	staged_map_t::const_iterator it = m_staged.find(group);
+	return (it != m_staged.end() ? static_cast<int>(it->second.size()) : 0);
+}
+
+/// Write all staged values for \a group to LabVIEW, in the order they were first staged, and then push
+/// the group's post_button once so the VI only ever applies a complete set of values.
+/// If \a apply is false the staged values are discarded instead. 
+void lvDCOMInterface::commitWriteGroup(const char* group, bool apply)
+{
+	staged_writes_t writes;
+	{
+		epicsGuard<epicsMutex> _lock(m_staged_lock);
+		m_staged[group].swap(writes);
+	}
+	if (!apply || writes.size() == 0)
+	{
+		return;
+	}
+	StringItem vi_name(this, "/lvinput/section[@name='%s']/vi[group[@name='%s']]/@path", m_configSection.c_str(), group, true);
+	StringItem post_button(this, "/lvinput/section[@name='%s']/vi/group[@name='%s']/@post_button", m_configSection.c_str(), group);
+	BoolItem post_button_wait(this, "/lvinput/section[@name='%s']/vi/group[@name='%s']/@post_button_wait", m_configSection.c_str(), group);
+	BoolItem use_ext(this, "/lvinput/section[@name='%s']/vi/group[@name='%s']/@extint", m_configSection.c_str(), group);
+	std::vector<std::string> errors;
+	writeControls(writes, errors);
+	for(size_t i = 0; i < errors.size(); ++i)
+	{
+		if (errors[i].size() > 0)
+		{
+			throw COMexception(errors[i]);
+		}
+	}
+	if (post_button.size() > 0)
+	{
+		pushButton(vi_name, post_button, use_ext, post_button_wait, m_timeout);
+	}
+}
+
+/// set \a button on \a vi_name to true (via extint if \a use_ext) and if \a wait, wait for the VI to set it back to false
+void lvDCOMInterface::pushButton(BSTR vi_name, BSTR button, bool use_ext, bool wait, double timeout)
+{
+	CComVariant results, button_value(true);
+	if (use_ext)
+	{
+		setLabviewValueExt(vi_name, button, button_value, &results, timeout);
+		extintResults(button, results, NULL);
+	}
+	else
+	{
+		setLabviewValue(vi_name, button, button_value, timeout);
+	}
+	if (wait)
+	{
+		waitForLabviewBoolean(vi_name, button, false, timeout);	
+	}
+}
+
+/// Write each of \a writes as writeControl() without its post_button, setting the same element of \a errors to why it
+/// failed or an empty string. Through the TCP transport they all go in a single request, rather than a round trip each
+void lvDCOMInterface::writeControls(const staged_writes_t& writes, std::vector<std::string>& errors)
+{
+	errors.assign(writes.size(), "");
+	if (m_tcp == NULL)
+	{
+		for(size_t i = 0; i < writes.size(); ++i)
+		{
+			try
+			{
+				writeControl(writes[i].first.c_str(), writes[i].second, NULL, false);
+			}
+			catch(const std::exception& ex)
+			{
+				errors[i] = ex.what();
+			}
+		}
+		return;
+	}
+	if (writes.size() == 0)
+	{
+		return;
+	}
+	char xpath[MAX_PATH_LEN];
+	std::vector<CComBSTR> vi_names(writes.size()), control_names(writes.size());
+	std::vector<TcpItem> items;
+	items.reserve(writes.size());
+	double timeout = 0.0;
+	for(size_t i = 0; i < writes.size(); ++i)
 	{
-	    case VT_BOOL:
-			return "boolean";		
-
-		case VT_BSTR:
-			return "string";		
-
-		case VT_I1:
-		case VT_I2:
-		case VT_I4:
-		case VT_INT:
-		case VT_UI1:
-		case VT_UI2:
-		case VT_UI4:
-		case VT_UINT:
-			return "int32";
-
-		default:
-		    break;
+		const char* param = writes[i].first.c_str();
+		paramTarget(param, "set", vi_names[i], control_names[i]);
+		if (vi_names[i].Length() == 0 || control_names[i].Length() == 0)
+		{
+			errors[i] = "setLabviewValue: vi or control is NULL";
+		}
+		_snprintf(xpath, sizeof(xpath), "/lvinput/section[@name='%s']/vi/param[@name='%s']/set/@extint", m_configSection.c_str(), param);
+		items.push_back(TcpItem(std::string(CW2A(vi_names[i], CP_UTF8)), std::string(CW2A(control_names[i], CP_UTF8)), (doXPATHbool(xpath) ? TcpSignal : 0)));
+		variantToCapture(writes[i].second, items.back().value);
+		// the batch is allowed the longest deadline of its members, or none if any of them has none
+		double t = getTimeout(param, "set");
+		timeout = (i == 0 ? t : ((t <= 0.0 || timeout <= 0.0) ? 0.0 : (t > timeout ? t : timeout)));
 	}
-	if ( v.ChangeType(VT_R8) == S_OK )
+	epicsTime start = epicsTime::getCurrent();
+	try
 	{
-		return "float64";
+		tcpRequest(CaptureRecord::Set, items, timeout);
 	}
-	else 
+	catch(const std::exception& ex)
 	{
-		return "unknown";
-	}	
-}
-
-class StringItem 
-{
-	CComBSTR m_bstr;
-public:
-	StringItem(lvDCOMInterface* dcom, const char* xpath, const char* config_section, const char* param, bool filepath = false)
+		errors.assign(writes.size(), ex.what());
+	}
+	for(size_t i = 0; i < writes.size(); ++i)
 	{
-		char base_xpath[MAX_PATH_LEN];
-		_snprintf(base_xpath, sizeof(base_xpath), xpath, config_section, param);
-		if (filepath)
+		if (errors[i].size() == 0 && items[i].status != 0)
 		{
-			m_bstr = dcom->doPath(base_xpath).c_str();
+			errors[i] = "SetControlValue of \"" + items[i].control + "\" failed: " + items[i].message;
 		}
-		else
+		capture(CaptureRecord::Set, vi_names[i], control_names[i], &(writes[i].second), (errors[i].size() == 0 ? S_OK : E_FAIL), start);
+		if (m_restore_setpoints && errors[i].size() == 0)
 		{
-			m_bstr = dcom->doXPATH(base_xpath).c_str();
+			recordSetpoint(vi_names[i], writes[i].first.c_str(), writes[i].second);
 		}
-	};
-	const CComBSTR& bstr() { return m_bstr; }
-	size_t size() { return m_bstr.Length(); }
-	operator BSTR() { return m_bstr; }
-};
+	}
+}
 
-class BoolItem 
+/// keep \a value, just written to the control for \a param on \a vi_name, for restoreSetpoints()
+void lvDCOMInterface::recordSetpoint(BSTR vi_name, const char* param, const VARIANT& value)
 {
-	bool m_value;
-public:
-	BoolItem(lvDCOMInterface* dcom, const char* xpath, const char* config_section, const char* param)
+	epicsGuard<epicsMutex> _lock(m_setpoint_lock);
+	setpoint_map_t& setpoints = m_setpoints[std::wstring(vi_name != NULL ? vi_name : L"")];
+	setpoint_map_t::iterator it = setpoints.find(param);
+	if (it != setpoints.end())
 	{
-		char base_xpath[MAX_PATH_LEN];
-		_snprintf(base_xpath, sizeof(base_xpath), xpath, config_section, param);
-		m_value = dcom->doXPATHbool(base_xpath);
-	};
-	operator bool() { return m_value; }
+		it->second.second = value;
+	}
+	else
+	{
+		setpoints[param] = std::pair<unsigned long, CComVariant>(++m_setpoint_seq, CComVariant(value));
+	}
+}
+
+/// a value for restoreSetpoints() to write back, and the button to push once it has been
+struct SetpointWrite
+{
+	std::string param;
+	CComVariant value;
+	int order;              ///< \<set\> restore_order
+	unsigned long seq;      ///< order the parameter was first written in
+	std::string button;     ///< post_button of the \<set\>, or of the write group the parameter is a member of
+	bool button_ext;
+	bool button_wait;
+	bool operator<(const SetpointWrite& rhs) const { return (order < rhs.order || (order == rhs.order && seq < rhs.seq)); }
 };
 
-template <>
-void lvDCOMInterface::setLabviewValue(const char* param, const std::string& value)
+/// Write the last value written to each parameter of \a vi_name back to LabVIEW if its reference has been re-created by
+/// createViRef() (or the TCP transport has reconnected) since we last looked, as after LabVIEW or the VI restarts all its controls are back at their defaults. Values are written in 
+/// \<set\> restore_order (lowest first), then in the order parameters were first written. Within each restore_order all 
+/// values are written first and then each different post_button (for a write group member, the group's) is pushed just
+/// once, rather than a write and a button handshake per parameter. A \<set restore="false"\> parameter is not restored.
+void lvDCOMInterface::restoreSetpoints(const std::wstring& vi_name)
 {
-	CComVariant v(value.c_str()), results, button_value(true);
-	if (param == NULL || *param == '\0')
-	{
-		throw std::runtime_error("setLabviewValue: param is NULL");
-	}
-	StringItem vi_name(this, "/lvinput/section[@name='%s']/vi/@path", m_configSection.c_str(), "", true);
-	StringItem control_name(this, "/lvinput/section[@name='%s']/vi/param[@name='%s']/set/@target", m_configSection.c_str(), param);
-	StringItem post_button(this, "/lvinput/section[@name='%s']/vi/param[@name='%s']/set/@post_button", m_configSection.c_str(), param);
-	BoolItem post_button_wait(this, "/lvinput/section[@name='%s']/vi/param[@name='%s']/set/@post_button_wait", m_configSection.c_str(), param);
-	BoolItem use_ext(this, "/lvinput/section[@name='%s']/vi/param[@name='%s']/set/@extint", m_configSection.c_str(), param);
-	if (vi_name.size() == 0 || control_name.size() == 0)
+	static const char* functionName = "restoreSetpoints";
+	char xpath[MAX_PATH_LEN];
+	std::vector<SetpointWrite> writes;
 	{
-		throw std::runtime_error("setLabviewValue: vi or control is NULL");
+		epicsGuard<epicsMutex> _lock(m_setpoint_lock);
+		// a write made by the restore can itself re-create the reference
+		vi_setpoint_map_t::const_iterator vi = m_setpoints.find(vi_name);
+		if (m_restore_pending.erase(vi_name) == 0 || m_restoring || vi == m_setpoints.end() || vi->second.size() == 0)
+		{
+			return;
+		}
+		m_restoring = true;
+		for(setpoint_map_t::const_iterator it = vi->second.begin(); it != vi->second.end(); ++it)
+		{
+			SetpointWrite w;
+			w.param = it->first;
+			w.seq = it->second.first;
+			w.value = it->second.second;
+			writes.push_back(w);
+		}
 	}
-	if (use_ext)
+	// fill in the configuration outside m_setpoint_lock, doXPATH() takes m_lock
+	for(std::vector<SetpointWrite>::iterator it = writes.begin(); it != writes.end(); )
 	{
-		setLabviewValueExt(vi_name, control_name, v, &results);	
-		if (post_button.size() > 0)
+		const char* param = it->param.c_str();
+		if (paramAttribute(param, "set", "restore") == "false")
+		{
+			it = writes.erase(it);
+			continue;
+		}
+		it->order = atoi(paramAttribute(param, "set", "restore_order").c_str());
+		std::string group = getWriteGroup(param);
+		if (group.size() > 0)
+		{
+			_snprintf(xpath, sizeof(xpath), "/lvinput/section[@name='%s']/vi/group[@name='%s']", m_configSection.c_str(), group.c_str());
+		}
+		else
 		{
-			setLabviewValueExt(vi_name, post_button, button_value, &results);
+			_snprintf(xpath, sizeof(xpath), "/lvinput/section[@name='%s']/vi/param[@name='%s']/set", m_configSection.c_str(), param);
 		}
+		std::string base(xpath);
+		it->button = doXPATH(base + "/@post_button");
+		it->button_ext = doXPATHbool(base + "/@extint");
+		it->button_wait = doXPATHbool(base + "/@post_button_wait");
+		++it;
 	}
-	else
+	std::stable_sort(writes.begin(), writes.end());
+	CComBSTR vi_bstr(vi_name.c_str());
+	epicsTime start = epicsTime::getCurrent();
+	unsigned long nwritten = 0, nfailed = 0;
+	for(size_t i = 0; i < writes.size(); )
 	{
-		setLabviewValue(vi_name, control_name, v);	
-		if (post_button.size() > 0)
+		std::vector<const SetpointWrite*> buttons;  // distinct buttons of this restore_order, in order of first use
+		staged_writes_t level;
+		size_t j = i;
+		for(; j < writes.size() && writes[j].order == writes[i].order; ++j)
+		{
+			level.push_back(staged_writes_t::value_type(writes[j].param, writes[j].value));
+		}
+		std::vector<std::string> errors;
+		writeControls(level, errors);
+		for(size_t w = i; w < j; ++w)
+		{
+			if (errors[w - i].size() > 0)
+			{
+				++nfailed;
+				errlogSevPrintf(errlogMinor, "lvDCOMInterface:%s: cannot restore \"%s\": %s\n", functionName, writes[w].param.c_str(), errors[w - i].c_str());
+				continue;
+			}
+			++nwritten;
+			size_t k = 0;
+			for(; k < buttons.size() && buttons[k]->button != writes[w].button; ++k)
+			{
+			}
+			if (writes[w].button.size() > 0 && k == buttons.size())
+			{
+				buttons.push_back(&(writes[w]));
+			}
+		}
+		for(std::vector<const SetpointWrite*>::const_iterator it = buttons.begin(); it != buttons.end(); ++it)
 		{
-			setLabviewValue(vi_name, post_button, button_value);
+			try
+			{
+				pushButton(vi_bstr, CComBSTR((*it)->button.c_str()), (*it)->button_ext, (*it)->button_wait, m_timeout);
+				++nwritten;
+			}
+			catch(const std::exception& ex)
+			{
+				++nfailed;
+				errlogSevPrintf(errlogMinor, "lvDCOMInterface:%s: cannot push \"%s\": %s\n", functionName, (*it)->button.c_str(), ex.what());
+			}
 		}
+		i = j;
 	}
-	if (post_button_wait && (post_button.size() > 0) )
+	double elapsed = epicsTime::getCurrent() - start;
 	{
-		waitForLabviewBoolean(vi_name, post_button, false);	
+		epicsGuard<epicsMutex> _lock(m_setpoint_lock);
+		m_restoring = false;
+		++m_restores;
+		m_restore_writes += nwritten;
+		m_restore_failures += nfailed;
+		m_restore_time = elapsed;
 	}
+	errlogSevPrintf(errlogInfo, "lvDCOMInterface:%s: restored %d setpoints of \"%s\" in %.3f seconds (%lu writes, %lu failed)\n", functionName, 
+		static_cast<int>(writes.size()), static_cast<const char*>(CW2CT(vi_name.c_str())), elapsed, nwritten, nfailed);
 }
 
-void lvDCOMInterface::waitForLabviewBoolean(BSTR vi_name, BSTR control_name, bool value)
+template <>
+bool lvDCOMInterface::setLabviewValue(const char* param, const std::string& value, std::string* readback)
+{
+	CComVariant v(value.c_str()), rb;
+	return ( setLabviewVariant(param, v, (readback != NULL ? &rb : NULL)) && convertVariant(rb, *readback) );
+}
+
+/// wait for a boolean control to reach \a value, giving up after \a timeout seconds (if greater than 0.0)
+void lvDCOMInterface::waitForLabviewBoolean(BSTR vi_name, BSTR control_name, bool value, double timeout)
 {
 	CComVariant v;
 	bool done = false;
+	epicsTime start = epicsTime::getCurrent();
 	while(!done)
 	{
-		getLabviewValue(vi_name, control_name, &v);
-		if ( v.ChangeType(VT_BOOL) == S_OK )
+		if ( timeout > 0.0 && (epicsTime::getCurrent() - start) > timeout )
 		{
-			done = ( v.boolVal == (value ? VARIANT_TRUE : VARIANT_FALSE) );
-			v.Clear();
+			throw COMTimeoutException("waitForLabviewBoolean: \"" + std::string(CW2CT(control_name)) + "\" did not reset within deadline");
 		}
+		getLabviewValue(vi_name, control_name, &v, timeout);
+		int state = 0;
+		if ( convertVariant(v, state) )
+		{
+			done = ( (state != 0) == value );
+		}
+		v.Clear();
 		epicsThreadSleep(0.1);
 	}	
 }	
 
 template <typename T>
-void lvDCOMInterface::setLabviewValue(const char* param, const T& value)
+bool lvDCOMInterface::setLabviewValue(const char* param, const T& value, T* readback)
 {
-	CComVariant v(value), results, button_value(true);
-	if (param == NULL || *param == '\0')
-	{
-		throw std::runtime_error("setLabviewValue: param is NULL");
-	}
-	StringItem vi_name(this, "/lvinput/section[@name='%s']/vi/@path", m_configSection.c_str(), "", true);
-	StringItem control_name(this, "/lvinput/section[@name='%s']/vi/param[@name='%s']/set/@target", m_configSection.c_str(), param);
-	StringItem post_button(this, "/lvinput/section[@name='%s']/vi/param[@name='%s']/set/@post_button", m_configSection.c_str(), param);
-	BoolItem post_button_wait(this, "/lvinput/section[@name='%s']/vi/param[@name='%s']/set/@post_button_wait", m_configSection.c_str(), param);
-	BoolItem use_ext(this, "/lvinput/section[@name='%s']/vi/param[@name='%s']/set/@extint", m_configSection.c_str(), param);
-	if (vi_name.size() == 0 || control_name.size() == 0)
+	CComVariant v(value), rb;
+	return ( setLabviewVariant(param, v, (readback != NULL ? &rb : NULL)) && convertVariant(rb, *readback) );
+}
+
+void lvDCOMInterface::setLabviewValue(BSTR vi_name, BSTR control_name, const VARIANT& value, double timeout)
+{
+	if (m_tcp != NULL)
 	{
-		throw std::runtime_error("setLabviewValue: vi or control is NULL");
+		tcpControl(CaptureRecord::Set, vi_name, control_name, &value, NULL, 0, timeout);
+		return;
 	}
-	if (use_ext)
+	if (m_shm != NULL)
 	{
-		setLabviewValueExt(vi_name, control_name, v, &results);	
-		if (post_button.size() > 0)
-		{
-			setLabviewValueExt(vi_name, post_button,button_value, &results);
-		}
+		shmControl(CaptureRecord::Set, vi_name, control_name, &value, NULL, 0, timeout);
+		return;
 	}
-	else
+	HRESULT hr = S_OK;
+	LabVIEW::VirtualInstrumentPtr vi;
+	getViRef(vi_name, false, vi);
+	DCOMCallDeadline deadline(m_watchdog, "SetControlValue", vi_name, control_name, timeout);
+	epicsTime start = epicsTime::getCurrent();
+	try
 	{
-		setLabviewValue(vi_name, control_name, v);	
-		if (post_button.size() > 0)
-		{
-			setLabviewValue(vi_name, post_button, button_value);
-		}
+		hr = vi->SetControlValue(control_name, value);
 	}
-	if (post_button_wait && (post_button.size() > 0) )
+	catch(const std::exception& ex)
 	{
-		waitForLabviewBoolean(vi_name, post_button, false);	
+		vi.Detach();
+		capture(CaptureRecord::Set, vi_name, control_name, &value, exceptionHResult(ex), start);
+		checkDeadline(deadline, vi_name, "SetControlValue");
+		throw;
 	}
-}
-
-void lvDCOMInterface::setLabviewValue(BSTR vi_name, BSTR control_name, const VARIANT& value)
-{
-	HRESULT hr = S_OK;
-	LabVIEW::VirtualInstrumentPtr vi;
-	getViRef(vi_name, false, vi);
-	hr = vi->SetControlValue(control_name, value);
 	vi.Detach();
+	capture(CaptureRecord::Set, vi_name, control_name, &value, hr, start);
 	if (FAILED(hr))
 	{
 		throw std::runtime_error("SetLabviewValue failed");
 	}
 }
 
-void lvDCOMInterface::setLabviewValueExt(BSTR vi_name, BSTR control_name, const VARIANT& value, VARIANT* results)
+void lvDCOMInterface::setLabviewValueExt(BSTR vi_name, BSTR control_name, const VARIANT& value, VARIANT* results, double timeout)
 {
-
+	// the server does the extint write itself, there are no results so extintResults() finds nothing to check
+	if (m_tcp != NULL)
+	{
+		tcpControl(CaptureRecord::Set, vi_name, control_name, &value, NULL, TcpSignal, timeout);
+		return;
+	}
+	if (m_shm != NULL)
+	{
+		shmControl(CaptureRecord::Set, vi_name, control_name, &value, NULL, ShmSignal, timeout);
+		return;
+	}
 	CComSafeArray<BSTR> names(6);
 	names[0].AssignBSTR(_bstr_t(L"VI Name"));
 	names[1].AssignBSTR(_bstr_t(L"Control Name"));
@@ -1318,11 +3921,65 @@ void lvDCOMInterface::setLabviewValueExt(BSTR vi_name, BSTR control_name, const
 	v.vt = VT_ARRAY | VT_VARIANT;
 	v.parray = values.Detach();
 	//Must be called as reentrant!
-	callLabview(m_extint, n, v, true, results);
+	callLabview(m_extint, n, v, true, results, timeout);
 }
 
-void lvDCOMInterface::callLabview(BSTR vi_name, VARIANT& names, VARIANT& values, VARIANT_BOOL reentrant, VARIANT* results)
+void lvDCOMInterface::callLabview(BSTR vi_name, VARIANT& names, VARIANT& values, VARIANT_BOOL reentrant, VARIANT* results, double timeout)
 {
+	if (m_tcp != NULL)
+	{
+		std::vector<TcpItem> items(1, TcpItem(std::string(CW2A(vi_name, CP_UTF8)), ""));
+		CaptureValue& names_values = items[0].value;
+		names_values.kind = CaptureValue::Array;
+		names_values.dims.push_back(2);
+		names_values.elements.resize(2);
+		variantToCapture(names, names_values.elements[0]);
+		variantToCapture(values, names_values.elements[1]);
+		epicsTime start = epicsTime::getCurrent();
+		try
+		{
+			tcpRequest(CaptureRecord::Call, items, timeout);
+		}
+		catch(const std::exception& ex)
+		{
+			capture(CaptureRecord::Call, vi_name, NULL, NULL, exceptionHResult(ex), start);
+			throw;
+		}
+		captureToVariant(items[0].value, *results);
+		capture(CaptureRecord::Call, vi_name, NULL, results, S_OK, start);
+		return;
+	}
+	if (m_shm != NULL)
+	{
+		CaptureValue names_values;
+		names_values.kind = CaptureValue::Array;
+		names_values.dims.push_back(2);
+		names_values.elements.resize(2);
+		variantToCapture(names, names_values.elements[0]);
+		variantToCapture(values, names_values.elements[1]);
+		epicsTime start = epicsTime::getCurrent();
+		try
+		{
+			unsigned long opens = shmBegin();
+			try
+			{
+				m_shm->call(std::string(CW2A(vi_name, CP_UTF8)), names_values, names_values, timeout);
+			}
+			catch(const std::exception& ex)
+			{
+				shmThrow(ex);
+			}
+			shmEnd(opens);
+		}
+		catch(const std::exception& ex)
+		{
+			capture(CaptureRecord::Call, vi_name, NULL, NULL, exceptionHResult(ex), start);
+			throw;
+		}
+		captureToVariant(names_values, *results);
+		capture(CaptureRecord::Call, vi_name, NULL, results, S_OK, start);
+		return;
+	}
 	HRESULT hr = S_OK;
 	LabVIEW::VirtualInstrumentPtr vi;
 	if (reentrant)
@@ -1333,8 +3990,21 @@ void lvDCOMInterface::callLabview(BSTR vi_name, VARIANT& names, VARIANT& values,
 	{
 		getViRef(vi_name, false, vi);
 	}
-	hr = vi->Call(&names, &values);
+	DCOMCallDeadline deadline(m_watchdog, "Call", vi_name, NULL, timeout);
+	epicsTime start = epicsTime::getCurrent();
+	try
+	{
+		hr = vi->Call(&names, &values);
+	}
+	catch(const std::exception& ex)
+	{
+		vi.Detach();
+		capture(CaptureRecord::Call, vi_name, NULL, NULL, exceptionHResult(ex), start);
+		checkDeadline(deadline, vi_name, "Call");
+		throw;
+	}
 	vi.Detach();
+	capture(CaptureRecord::Call, vi_name, NULL, &values, hr, start);
 	CComVariant var(values);
 	var.Detach(results);
 	if (FAILED(hr))
@@ -1343,6 +4013,200 @@ void lvDCOMInterface::callLabview(BSTR vi_name, VARIANT& names, VARIANT& values,
 	}
 }
 
+/// Make a request through the TCP transport, with the host circuit breaker and exceptions of a DCOM call. \a items are
+/// read for CaptureRecord::Get, written for CaptureRecord::Set, and for CaptureRecord::Call the single item is the call. If the
+/// request had to reconnect the server may have restarted, so with restore_setpoints the section VI is restored as when
+/// getViRef() re-creates a VI reference
+void lvDCOMInterface::tcpRequest(CaptureRecord::Op op, std::vector<TcpItem>& items, double timeout)
+{
+	if ( !m_host_breaker.allowRequest() )
+	{
+		throw COMDisconnectedException("LabVIEW on " + m_host + " unavailable (circuit breaker open)");
+	}
+	unsigned long connects = m_tcp->connects();
+	try
+	{
+		switch(op)
+		{
+			case CaptureRecord::Get:
+				m_tcp->get(items, timeout);
+				break;
+			case CaptureRecord::Set:
+				m_tcp->set(items, timeout);
+				break;
+			case CaptureRecord::Call:
+				m_tcp->call(items[0].vi, items[0].value, items[0].value, timeout);
+				break;
+		}
+	}
+	catch(const lvDCOMTcpDisconnected& ex)
+	{
+		m_host_breaker.recordFailure();
+		throw COMDisconnectedException(ex.what());
+	}
+	catch(const lvDCOMTcpTimeout& ex)
+	{
+		m_host_breaker.recordFailure();
+		throw COMTimeoutException(ex.what());
+	}
+	catch(const std::exception& ex)
+	{
+		// the server replied, it was the VI that failed
+		m_host_breaker.recordSuccess();
+		throw COMexception(ex.what());
+	}
+	m_host_breaker.recordSuccess();
+	if (m_tcp->connects() != connects)
+	{
+		restoreAfterReconnect();
+	}
+}
+
+/// The TCP or shared memory server may have restarted, so with restore_setpoints restore every VI that has setpoints
+/// as when getViRef() re-creates a VI reference
+void lvDCOMInterface::restoreAfterReconnect()
+{
+	if ( !m_restore_setpoints )
+	{
+		return;
+	}
+	std::vector<std::wstring> vi_names;
+	{
+		epicsGuard<epicsMutex> _lock(m_setpoint_lock);
+		for(vi_setpoint_map_t::const_iterator it = m_setpoints.begin(); it != m_setpoints.end(); ++it)
+		{
+			vi_names.push_back(it->first);
+			m_restore_pending.insert(it->first);
+		}
+	}
+	for(std::vector<std::wstring>::const_iterator it = vi_names.begin(); it != vi_names.end(); ++it)
+	{
+		restoreSetpoints(*it);
+	}
+}
+
+/// read (into \a result) or write (\a value, with #TcpItemFlags \a flags) one control through the TCP transport, as a DCOM
+/// GetControlValue or SetControlValue would
+void lvDCOMInterface::tcpControl(CaptureRecord::Op op, BSTR vi_name, BSTR control_name, const VARIANT* value, VARIANT* result, epicsUInt8 flags, double timeout)
+{
+	std::vector<TcpItem> items(1, TcpItem(std::string(CW2A(vi_name, CP_UTF8)), std::string(CW2A(control_name, CP_UTF8)), flags));
+	if (value != NULL)
+	{
+		variantToCapture(*value, items[0].value);
+	}
+	epicsTime start = epicsTime::getCurrent();
+	try
+	{
+		tcpRequest(op, items, timeout);
+		if (items[0].status != 0)
+		{
+			throw COMexception(std::string(op == CaptureRecord::Get ? "GetControlValue" : "SetControlValue") + " of \"" + 
+			    items[0].control + "\" on \"" + items[0].vi + "\" failed: " + items[0].message);
+		}
+	}
+	catch(const std::exception& ex)
+	{
+		capture(op, vi_name, control_name, value, exceptionHResult(ex), start);
+		throw;
+	}
+	if (result != NULL)
+	{
+		captureToVariant(items[0].value, *result);
+	}
+	capture(op, vi_name, control_name, (result != NULL ? result : value), S_OK, start);
+}
+
+/// Start a request through the shared memory transport, failing straight away if the host circuit breaker is open. Returns
+/// the number of times the client has opened the region, for shmEnd()
+unsigned long lvDCOMInterface::shmBegin()
+{
+	if ( !m_host_breaker.allowRequest() )
+	{
+		throw COMDisconnectedException("LabVIEW on " + m_host + " unavailable (circuit breaker open)");
+	}
+	return m_shm->opens();
+}
+
+/// A shared memory request started by shmBegin() has succeeded. If the region had to be opened again its server has restarted
+void lvDCOMInterface::shmEnd(unsigned long opens)
+{
+	m_host_breaker.recordSuccess();
+	if (m_shm->opens() != opens)
+	{
+		restoreAfterReconnect();
+	}
+}
+
+/// A shared memory request started by shmBegin() has failed with \a ex, rethrow it as a DCOM call would have failed
+void lvDCOMInterface::shmThrow(const std::exception& ex)
+{
+	if (dynamic_cast<const lvDCOMShmUnavailable*>(&ex) != NULL)
+	{
+		m_host_breaker.recordFailure();
+		throw COMDisconnectedException(ex.what());
+	}
+	if (dynamic_cast<const lvDCOMShmTimeout*>(&ex) != NULL)
+	{
+		m_host_breaker.recordFailure();
+		throw COMTimeoutException(ex.what());
+	}
+	// the server responded, it was the VI that failed
+	m_host_breaker.recordSuccess();
+	throw COMexception(ex.what());
+}
+
+/// read (into \a result) or write (\a value, with #ShmSignal in \a flags) one control through the shared memory transport,
+/// as a DCOM GetControlValue or SetControlValue would. A read comes from the control's slot without involving the server
+void lvDCOMInterface::shmControl(CaptureRecord::Op op, BSTR vi_name, BSTR control_name, const VARIANT* value, VARIANT* result, epicsUInt32 flags, double timeout)
+{
+	std::string vi(CW2A(vi_name, CP_UTF8)), control(CW2A(control_name, CP_UTF8));
+	CaptureValue cv;
+	if (value != NULL)
+	{
+		variantToCapture(*value, cv);
+	}
+	epicsTime start = epicsTime::getCurrent();
+	try
+	{
+		unsigned long opens = shmBegin();
+		try
+		{
+			if (op == CaptureRecord::Get)
+			{
+				m_shm->get(vi, control, cv, timeout);
+			}
+			else
+			{
+				m_shm->set(vi, control, cv, flags, timeout);
+			}
+		}
+		catch(const lvDCOMShmUnavailable& ex)
+		{
+			shmThrow(ex);
+		}
+		catch(const lvDCOMShmTimeout& ex)
+		{
+			shmThrow(ex);
+		}
+		catch(const std::exception& ex)
+		{
+			shmThrow(std::runtime_error(std::string(op == CaptureRecord::Get ? "GetControlValue" : "SetControlValue") + " of \"" + 
+			    control + "\" on \"" + vi + "\" failed: " + ex.what()));
+		}
+		shmEnd(opens);
+	}
+	catch(const std::exception& ex)
+	{
+		capture(op, vi_name, control_name, value, exceptionHResult(ex), start);
+		throw;
+	}
+	if (result != NULL)
+	{
+		captureToVariant(cv, *result);
+	}
+	capture(op, vi_name, control_name, (result != NULL ? result : value), S_OK, start);
+}
+
 /// Helper for EPICS driver report function
 void lvDCOMInterface::report(FILE* fp, int details)
 {
@@ -1352,12 +4216,53 @@ void lvDCOMInterface::report(FILE* fp, int details)
 	fprintf(fp, "DCOM Target ProgID: \"%s\"\n", m_progid.c_str());
 	fprintf(fp, "DCOM Target Host: \"%s\"\n", m_host.c_str());
 	fprintf(fp, "DCOM Target Username: \"%s\"\n", m_username.c_str());
+	fprintf(fp, "DCOM call deadline: %.3f s\n", m_timeout);
+	fprintf(fp, "VI reference warm up threads: %d%s\n", m_warm_up_threads, (m_warming_up ? " (warm up in progress)" : ""));
+	if (m_capture != NULL)
+	{
+		fprintf(fp, "Capturing LabVIEW operations to \"%s\": %lu recorded\n", m_capture->fileName().c_str(), m_capture->records());
+	}
+	if (m_tcp != NULL)
+	{
+		m_tcp->report(fp, details);
+	}
+	if (m_shm != NULL)
+	{
+		m_shm->report(fp, details);
+	}
+	m_watchdog.report(fp, details);
+	m_host_breaker.report(fp, m_host.c_str());
+	{
+		epicsGuard<epicsMutex> _lock(m_breaker_lock);
+		for(breaker_map_t::const_iterator it = m_vi_breakers.begin(); it != m_vi_breakers.end(); ++it)
+		{
+			it->second->report(fp, CW2CT(it->first.c_str()));
+		}
+	}
+	{
+		epicsGuard<epicsMutex> _lock(m_staged_lock);
+		for(staged_map_t::const_iterator it = m_staged.begin(); it != m_staged.end(); ++it)
+		{
+			fprintf(fp, "Write group \"%s\": %u writes staged\n", it->first.c_str(), static_cast<unsigned>(it->second.size()));
+		}
+	}
+	if (m_restore_setpoints)
+	{
+		epicsGuard<epicsMutex> _lock(m_setpoint_lock);
+		size_t nsetpoints = 0;
+		for(vi_setpoint_map_t::const_iterator it = m_setpoints.begin(); it != m_setpoints.end(); ++it)
+		{
+			nsetpoints += it->second.size();
+		}
+		fprintf(fp, "Setpoint restore: %u setpoints held on %u VIs, %lu restores (%lu writes, %lu failed), last took %.3f s%s\n", 
+			static_cast<unsigned>(nsetpoints), static_cast<unsigned>(m_setpoints.size()), m_restores, m_restore_writes, m_restore_failures, m_restore_time, (m_restoring ? " (restore in progress)" : ""));
+	}
 //	fprintf(fp, "Password: %s\n", m_password.c_str());
 	std::string vi_name;
 	for(vi_map_t::const_iterator it = m_vimap.begin(); it != m_vimap.end(); ++it)
 	{
 		vi_name = CW2CT(it->first.c_str());
-		fprintf(fp, "LabVIEW VI: \"%s\"\n", vi_name.c_str());
+		fprintf(fp, "LabVIEW VI: \"%s\"%s\n", vi_name.c_str(), (it->second.degraded ? " (degraded)" : ""));
 	}
 	if (details > 0)
 	{
@@ -1379,14 +4284,17 @@ std::vector< std::vector<std::string> > lvDCOMInterface::m_seci_values;
 
 #ifndef DOXYGEN_SHOULD_SKIP_THIS
 
-template void lvDCOMInterface::setLabviewValue(const char* param, const double& value);
-template void lvDCOMInterface::setLabviewValue(const char* param, const int& value);
+template bool lvDCOMInterface::setLabviewValue(const char* param, const double& value, double* readback);
+template bool lvDCOMInterface::setLabviewValue(const char* param, const int& value, int* readback);
 
 template void lvDCOMInterface::getLabviewValue(const char* param, double* value);
 template void lvDCOMInterface::getLabviewValue(const char* param, int* value);
 
-template void lvDCOMInterface::getLabviewValue(const char* param, double* value, size_t nElements, size_t& nIn);
+template void lvDCOMInterface::getLabviewValue(const char* param, double* value, size_t nElements, size_t& nIn, size_t* dims);
+
+template void lvDCOMInterface::getLabviewValue(const char* param, int* value, size_t nElements, size_t& nIn, size_t* dims);
 
-template void lvDCOMInterface::getLabviewValue(const char* param, int* value, size_t nElements, size_t& nIn);
+template void lvDCOMInterface::getLabviewValue(const char* param, std::vector<double>& value, size_t* dims);
+template void lvDCOMInterface::getLabviewValue(const char* param, std::vector<int>& value, size_t* dims);
 
 #endif /* DOXYGEN_SHOULD_SKIP_THIS */
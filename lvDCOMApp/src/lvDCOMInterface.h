@@ -32,6 +32,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
 #include <list>
 #include <stdexcept>
 #include <sstream>
@@ -47,20 +48,69 @@
 // The above statement would generate labview.tlh and labview.tli from an installed copy of LabVIEW, but we include pre-built versions in the source
 #include "labview.tlh"
 
+#include "lvDCOMWatchdog.h"
+#include "lvDCOMCircuitBreaker.h"
+#include "lvDCOMCapture.h"
+#include "lvDCOMAuthIdentity.h"
+#include "lvDCOMVIStrings.h"
+
 #include <msxml2.h>
 
 // TinyXPath, we tried this but it did not work, so use msxml as we will always be on Windows
 //#include <xpath_processor.h>  
 //#include <xpath_static.h>  
 
+// lvDCOMTcpClient.h brings in osiSock.h and so winsock2.h, which must come before windows.h so is only included by lvDCOMInterface.cpp
+class lvDCOMTcpClient;
+struct TcpItem;
+class lvDCOMShmClient;
+
 /// Hold a reference to a LabVIEW VI
 struct ViRef
 {
 	LabVIEW::VirtualInstrumentPtr vi_ref;
 	bool reentrant;  ///< is the VI reentrant
 	bool started;    ///< did we start this vi because it was idle and #viStartIfIdle was specified  
-	ViRef(LabVIEW::VirtualInstrumentPtr vi_ref_, bool reentrant_, bool started_) : vi_ref(vi_ref_), reentrant(reentrant_), started(started_) { }
-	ViRef() : vi_ref(NULL), reentrant(false), started(false) { }
+	bool degraded;   ///< a call on this reference overran its deadline, so the reference will be re-created before next use
+	ViRef(LabVIEW::VirtualInstrumentPtr vi_ref_, bool reentrant_, bool started_) : vi_ref(vi_ref_), reentrant(reentrant_), started(started_), degraded(false) { }
+	ViRef() : vi_ref(NULL), reentrant(false), started(false), degraded(false) { }
+};
+
+/// The part of a LabVIEW array read by a parameter. A 2D array is held column major in a SAFEARRAY, a 1D array is
+/// treated as a single row.
+struct ArraySlice
+{
+	size_t rows;   ///< number of rows in the whole array
+	size_t row0;   ///< first row read
+	size_t nr;     ///< number of rows read
+	size_t col0;   ///< first column read
+	size_t nc;     ///< number of columns read
+	ArraySlice() : rows(0), row0(0), nr(0), col0(0), nc(0) { }
+};
+
+/// A parameter that reads one element of a LabVIEW cluster control, see lvDCOMInterface::getLabviewCluster(). 
+/// All the parameters reading elements of the same cluster share one GetControlValue.
+struct ClusterField
+{
+	std::string param;       ///< asyn parameter name
+	std::string type;        ///< lvDCOM type of \a param
+	std::vector<int> path;   ///< element index at each level of nesting, outermost first, from the \<read\> element attribute
+	double dval;             ///< value read for a float64 parameter
+	int ival;                ///< value read for an int32, enum, ring or boolean parameter
+	std::string sval;        ///< value read for a string parameter
+	bool ok;                 ///< element was present in the last cluster read and converted to \a type 
+	ClusterField() : dval(0.0), ival(0), ok(false) { }
+};
+
+/// Differences between the live configuration and the file found by lvDCOMInterface::reloadConfig()
+struct ConfigChanges
+{
+	std::map<std::string,std::string> added;  ///< new \<param\> and \<group\> names, and their type
+	std::vector<std::string> changed;         ///< existing parameters whose definition (or VI) has changed
+	std::vector<std::string> removed;         ///< parameters no longer in the file
+	int vis_released;                         ///< number of VI references dropped as no parameter uses the VI
+	std::vector<std::string> section_changed; ///< section attributes that differ, these are not applied until a restart
+	ConfigChanges() : vis_released(0) { }
 };
 
 /// Options that can be passed from EPICS iocsh via #lvDCOMConfigure command.
@@ -71,12 +121,23 @@ enum lvDCOMOptions
 	viStartIfIdle = 2, 				///< (2)  If the LabVIEW VI is idle when we connect to it, attempt to start it
 	viStopOnExitIfStarted = 4, 		///< (4)  On IOC exit, stop any LabVIEW VIs that we started due to #viStartIfIdle being specified
 	viAlwaysStopOnExit = 8,			///< (8)  On IOC exit, stop any LabVIEW VIs that we have connected to
-	lvNoStart = 16,                  ///< (16) Do not start LabVIEW, connect to existing instance otherwise fail. As loading a Vi starts labview, vis will not be loaded or started until a labview instance is detected. Automatically set for lvDCOMSECIConfigure() 
+	lvNoStart = 16,                  ///< (16) Do not start LabVIEW, connect to existing instance otherwise fail. As loading a Vi starts labview, vis will not be loaded or started until a labview instance is detected. Requests made while LabVIEW is not running fail straight away with a disconnected status, and LabVIEW is looked for again at most every section retry_interval (default 5 seconds), rather than a request waiting for it to start. Automatically set for lvDCOMSECIConfigure(), where the IOC exits instead so procServ restarts it 
 	lvSECIConfig = 32,                  ///< (32) Automatically set if lvDCOMSECIConfigure() has been used
 	lvSECINoSetter = 64,                  ///< (64) Do not generate setter XML / :SP PVs in SECI mode
 	lvDCOMVerbose = 128                   ///< (128) print extra messages
 };	
 
+/// Execution state of a VI, as given by lvDCOMInterface::getViExecState() and posted to the parameter of a \<vi\> state_param
+/// attribute. The LabVIEW ExecStateEnum values, plus one for when the transport in use cannot tell
+enum ViExecState
+{
+	ViExecUnknown = -1,             ///< (-1) not known, the VI is treated as running
+	ViExecBad = 0,                  ///< (0)  the VI is broken and cannot run
+	ViExecIdle = 1,                 ///< (1)  the VI is not running, e.g. it has stopped or is being edited
+	ViExecRunTopLevel = 2,          ///< (2)  the VI is running as a top level VI
+	ViExecRunning = 3               ///< (3)  the VI is running as a subVI of another VI
+};
+
 /// Manager class for LabVIEW DCOM Interaction. Parses an @link lvinput.xml @endlink file and provides access to the LabVIEW VI controls/indicators described within. 
 class lvDCOMInterface
 {
@@ -84,10 +145,35 @@ public:
 	lvDCOMInterface(const char* configSection, const char *configFile, const char* host, int options, const char* progid, const char* username, const char* password);
 	long nParams();
 	void getParams(std::map<std::string,std::string>& res);
-	template<typename T> void setLabviewValue(const char* param, const T& value);
+	template<typename T> bool setLabviewValue(const char* param, const T& value, T* readback = NULL);
 	template<typename T> void getLabviewValue(const char* param, T* value);
-	template<typename T> void getLabviewValue(const char* param, T* value, size_t nElements, size_t& nIn);
-	~lvDCOMInterface() { if (m_pxmldom != NULL) { m_pxmldom->Release(); m_pxmldom = 0; } }
+	template<typename T> void getLabviewValue(const char* param, T* value, size_t nElements, size_t& nIn, size_t* dims = NULL);
+	template<typename T> void getLabviewValue(const char* param, std::vector<T>& value, size_t* dims = NULL);
+	void getLabviewTable(const char* param, std::string* value, size_t* dims = NULL);
+	std::string getClusterKey(const char* param);
+	void getClusterFields(const std::string& key, std::vector<ClusterField>& fields);
+	void getLabviewCluster(std::vector<ClusterField>& fields);
+	int getBitWords(const char* param);
+	void getLabviewBits(const char* param, std::vector<epicsUInt32>& words);
+	void setLabviewBits(const char* param, int word, epicsUInt32 value, epicsUInt32 mask);
+	double getPollPeriod(const char* param);
+	double getDeadband(const char* param);
+	void getPollLimits(const char* param, double& poll_min, double& poll_max);
+	void getHistory(const char* param, int& capacity, double& period);
+	void getStats(const char* param, int& window, std::string& stats_set);
+	double getPollBudget();
+	std::string getSnapshotFile();
+	double getSnapshotPeriod();
+	std::string getValueTableFile();
+	double getViStatePeriod();
+	void getViStateParams(std::map<std::string,std::string>& state_params);
+	std::string getParamViPath(const char* param);
+	int getViExecState(const std::string& vi_path, bool restart, bool& restarted);
+	bool restartIfIdle() { return checkOption(viStartIfIdle); }
+	void getReadbackParams(const char* param, const std::map<std::string,std::string>& params, std::vector<std::string>& names);
+	void commitWriteGroup(const char* group, bool apply);
+	int stagedWrites(const char* group);
+	~lvDCOMInterface();
 	std::string doPath(const std::string& xpath);
 	std::string doXPATH(const std::string& xpath);
 	bool doXPATHbool(const std::string& xpath);
@@ -96,10 +182,55 @@ public:
 	int generateFilesFromSECI(const char* portName, const char* macros, const char* configSection, const char* configFile, 
 	    const char* dbSubFile, const char* blocks_match, bool no_setter);
 	bool checkForNewBlockDetails();
+	int discoverControls(const char* portName, const char* macros, const char* viPath, const char* configSection, 
+	    const char* configFile, const char* dbSubFile, const char* stringsFile, int nthreads);
+	int warmUpViRefs(int nthreads);
+	int warmUpThreads() const { return m_warm_up_threads; }
+	void reloadConfig(ConfigChanges& changes);
+	bool configFileChanged();
+	double getReloadPeriod();
+	static IXMLDOMDocument2* createDom();
+	// used by lvDCOMBroker, which passes on requests for any control rather than for the parameters of a section
+	void getControlValue(const std::string& vi, const std::string& control, CaptureValue& value, double timeout);
+	void setControlValue(const std::string& vi, const std::string& control, const CaptureValue& value, bool signal, double timeout);
+	void callVi(const std::string& vi, CaptureValue& names_values, double timeout);
+	void setExtint(const std::string& path) { m_extint = path.c_str(); }
 
 private:
 	std::string m_configSection;  ///< section of \a configFile to load information from
+	lvDCOMWatchdog m_watchdog; ///< cancels DCOM calls that overrun their deadline
+	double m_timeout; ///< default DCOM call deadline (seconds) for this section, 0.0 means no deadline
+	double m_retry_interval; ///< minimum time (seconds) between attempts to reach LabVIEW or a VI after a failure
+	int m_warm_up_threads;   ///< number of threads warmUpViRefs() uses, 0 to only resolve VI references on first use
+	bool m_warming_up;       ///< a background warm up started by connectToLabVIEW() is running, protected by #m_lock
+	lvDCOMCircuitBreaker m_host_breaker; ///< trips when we cannot connect to LabVIEW on #m_host
+	typedef std::map<std::wstring, lvDCOMCircuitBreaker*> breaker_map_t;
+	breaker_map_t m_vi_breakers; ///< per VI circuit breakers, trip if we cannot get a VI reference or a call times out. Owned by us
+	epicsMutex m_breaker_lock;   ///< protects #m_vi_breakers and #m_vi_create_locks, separate from #m_lock so we can fail fast
+	typedef std::map<std::wstring, epicsMutex*> create_lock_map_t;
+	create_lock_map_t m_vi_create_locks; ///< per VI, held while a reference to it is made so only one thread makes it. Owned by us
+	typedef std::vector< std::pair<std::string,CComVariant> > staged_writes_t;
+	typedef std::map<std::string, staged_writes_t> staged_map_t;
+	staged_map_t m_staged;   ///< write group name -> (param, value) writes waiting for commitWriteGroup()
+	epicsMutex m_staged_lock;  ///< protects #m_staged
+	bool m_restore_setpoints;  ///< section restore_setpoints attribute, keep #m_setpoints and write them back when a VI reference is re-created
+	typedef std::map<std::string, std::pair<unsigned long, CComVariant> > setpoint_map_t;
+	typedef std::map<std::wstring, setpoint_map_t> vi_setpoint_map_t;
+	vi_setpoint_map_t m_setpoints;  ///< VI path -> param -> (order first written, last value written) for restoreSetpoints()
+	unsigned long m_setpoint_seq;  ///< number of parameters ever added to #m_setpoints
+	std::set<std::wstring> m_restore_pending;  ///< VIs whose reference createViRef() has (re)created since restoreSetpoints() last looked
+	bool m_restoring;            ///< restoreSetpoints() is running
+	unsigned long m_restores;    ///< number of times restoreSetpoints() has written values
+	unsigned long m_restore_writes, m_restore_failures;  ///< values and buttons written by restoreSetpoints(), and ones that failed
+	double m_restore_time;       ///< seconds the last restore took
+	epicsMutex m_setpoint_lock;  ///< protects #m_setpoints and the restore counters
+	lvDCOMCaptureWriter* m_capture;  ///< records every LabVIEW operation if the section has a capture_file, otherwise NULL
+	lvDCOMTcpClient* m_tcp;     ///< used instead of DCOM if #m_host is tcp://host:port or broker://port, otherwise NULL
+	lvDCOMShmClient* m_shm;     ///< used instead of DCOM if #m_host is shm://name, otherwise NULL
 	std::string m_configFile;   
+	FILETIME m_config_time;     ///< last write time of #m_configFile when it was loaded
+	typedef std::map<std::string, std::pair<std::string,std::string> > param_defs_t;
+	param_defs_t m_param_defs;  ///< parameter name -> (type, XML definition and VI path) as loaded, for reloadConfig() to compare against
 	std::string m_host;
 	std::string m_progid;
 	CLSID m_clsid;
@@ -115,28 +246,73 @@ private:
 	IXMLDOMDocument2 *m_pxmldom;
 	CComBSTR m_extint;
 	CComPtr<LabVIEW::_Application> m_lv;
-	COAUTHIDENTITY* m_pidentity;
+	lvDCOMAuthIdentity m_identity;  ///< account used for DCOM calls to #m_host, shared by every connection and VI reference
 	std::map<std::string,std::string> m_xpath_map;
 	std::map<std::string,bool> m_xpath_bool_map;
+	typedef std::map<std::string, std::vector<ClusterField> > cluster_map_t;
+	cluster_map_t m_clusters;    ///< cluster key (VI path and control) -> parameters reading its elements
+	std::map<std::string, std::string> m_cluster_keys;       ///< cluster element parameter name -> cluster key
+	std::map<std::string, std::vector<int> > m_cluster_paths;  ///< cluster element parameter name -> element path
 	MAC_HANDLE *m_mac_env;
 	static std::vector< std::vector<std::string> > m_seci_values; ///< horrible - do properly some time
 
 	void DomFromCOM();
+	CComPtr<IXMLDOMDocument2> configDom();
+	void paramDefinitions(IXMLDOMDocument2* dom, param_defs_t& defs);
+	void sectionAttributes(IXMLDOMDocument2* dom, std::map<std::string,std::string>& attrs);
+	std::string expandedNodeText(IXMLDOMNode* pNode, const char* xpath);
+	void getViPaths(std::vector<std::string>& vi_names);
+	void paramTarget(const char* param, const char* op, CComBSTR& vi_name, CComBSTR& control_name);
+	std::string paramAttribute(const char* param, const char* op, const char* attr);
 	char* envExpand(const char *str);
+	std::string expandMacros(const char *str);
+	bool isRemoteHost() const;
 	void getViRef(BSTR vi_name, bool reentrant, LabVIEW::VirtualInstrumentPtr &vi);
 	void createViRef(BSTR vi_name, bool reentrant, LabVIEW::VirtualInstrumentPtr &vi);
-	void getLabviewValue(BSTR vi_name, BSTR control_name, VARIANT* value);
-	void setLabviewValue(BSTR vi_name, BSTR control_name, const VARIANT& value);
-	void setLabviewValueExt(BSTR vi_name, BSTR control_name, const VARIANT& value, VARIANT* results);
-	void callLabview(BSTR vi_name, VARIANT& names, VARIANT& values, VARIANT_BOOL reentrant, VARIANT* results);
-	void waitForLabviewBoolean(BSTR vi_name, BSTR control_name, bool value);
-	COAUTHIDENTITY* createIdentity(const std::string& user, const std::string& domain, const std::string& pass);
+	void connectToLabVIEW();
+	friend struct ViWarmUp;
+	static void warmUpThread(void* arg);
+	lvDCOMCircuitBreaker& viBreaker(const std::wstring& vi_name);
+	epicsMutex& viCreateLock(const std::wstring& vi_name);
+	void getLabviewValue(BSTR vi_name, BSTR control_name, VARIANT* value, double timeout);
+	template<typename T> void getLabviewArray(const char* param, CComVariant& v);
+	void compileClusters();
+	const VARIANT& readElement(const char* param, const VARIANT& v);
+	void getArraySlice(const char* param, VARIANT& v, ArraySlice& slice);
+	bool setLabviewVariant(const char* param, const VARIANT& value, VARIANT* readback);
+	bool writeControl(const char* param, const VARIANT& value, VARIANT* readback, bool use_post_button);
+	std::string getWriteGroup(const char* param);
+	void stageWrite(const std::string& group, const std::string& param, const VARIANT& value);
+	bool stagedValue(const std::string& group, const std::string& param, VARIANT* value);
+	void writeControls(const staged_writes_t& writes, std::vector<std::string>& errors);
+	void recordSetpoint(BSTR vi_name, const char* param, const VARIANT& value);
+	void restoreSetpoints(const std::wstring& vi_name);
+	void pushButton(BSTR vi_name, BSTR button, bool use_ext, bool wait, double timeout);
+	void setLabviewValue(BSTR vi_name, BSTR control_name, const VARIANT& value, double timeout);
+	bool extintResults(BSTR control_name, VARIANT& results, VARIANT* readback);
+	void setLabviewValueExt(BSTR vi_name, BSTR control_name, const VARIANT& value, VARIANT* results, double timeout);
+	void callLabview(BSTR vi_name, VARIANT& names, VARIANT& values, VARIANT_BOOL reentrant, VARIANT* results, double timeout);
+	void tcpRequest(CaptureRecord::Op op, std::vector<TcpItem>& items, double timeout);
+	void tcpControl(CaptureRecord::Op op, BSTR vi_name, BSTR control_name, const VARIANT* value, VARIANT* result, epicsUInt8 flags, double timeout);
+	void restoreAfterReconnect();
+	unsigned long shmBegin();
+	void shmEnd(unsigned long opens);
+	void shmThrow(const std::exception& ex);
+	void shmControl(CaptureRecord::Op op, BSTR vi_name, BSTR control_name, const VARIANT* value, VARIANT* result, epicsUInt32 flags, double timeout);
+	template<typename T> bool getShmArray(const char* param, T* value, size_t nElements, size_t& nIn, size_t* dims);
+	void waitForLabviewBoolean(BSTR vi_name, BSTR control_name, bool value, double timeout);
+	double getTimeout(const char* param, const char* op);
+	void checkDeadline(DCOMCallDeadline& deadline, BSTR vi_name, const char* op);
+	void capture(CaptureRecord::Op op, BSTR vi_name, BSTR control_name, const VARIANT* value, HRESULT hr, const epicsTime& start);
 	HRESULT setIdentity(COAUTHIDENTITY* pidentity, IUnknown* pUnk);
 	static void epicsExitFunc(void* arg);
 	void stopVis(bool only_ones_we_started);
 	bool checkOption(lvDCOMOptions option) { return ( m_options & static_cast<int>(option) ) != 0; }
     double getLabviewUptime();
 	std::string getLabviewValueType(BSTR vi_name, BSTR control_name);
+	std::string probeControlType(BSTR vi_name, const VIStringsControl& control, int& nelm);
+	friend struct ControlDiscovery;
+	std::string pollAttributes(std::string& scan);
 	double waitForLabVIEW();
 	void maybeWaitForLabVIEWOrExit();
 	void getBlockDetails(std::vector< std::vector<std::string> >& values);
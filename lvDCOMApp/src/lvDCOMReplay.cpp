@@ -0,0 +1,468 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMReplay.cpp Replay a capture file written by #lvDCOMCaptureWriter against #lvDCOMSimBackend.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+///
+/// Usage: lvDCOMReplay [-s speed] [-l latency_scale] [-t threads] [-c host:port | -m name] capture_file
+///
+///   -s speed          1 (default) replays at the rate captured, 10 ten times faster, 0 as fast as possible
+///   -l latency_scale  each simulated operation takes this multiple (default 1) of the time it took when captured
+///   -t threads        operations are shared between this many threads (default 1), those on the same VI control
+///                     always go to the same thread so stay in order
+///   -c host:port      replay through the TCP transport to a server such as lvDCOMTcpServer, rather than to an
+///                     #lvDCOMSimBackend in this process. Operations then take as long as the server does, not
+///                     latency_scale times the captured duration
+///   -m name           replay through the shared memory transport to a server such as lvDCOMShmWriter, in the same
+///                     way as -c
+///
+/// Before each GetControlValue is replayed the simulated control is given the value captured, as LabVIEW
+/// itself would have changed it, so gets see the same sequence of values as the IOC did. At the end a summary
+/// is printed of how closely the replay kept to the captured schedule and how long each kind of operation took.
+/// Through TCP that value is sent as a TcpUpdate just before the get, and the client does not subscribe, so
+/// every get makes a round trip to the server and sees the value the update gave. Through shared memory it is sent as
+/// a ShmUpdate, which also updates the slot the get then reads.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+
+#include "lvDCOMCapture.h"
+#include "lvDCOMSimBackend.h"
+#include "lvDCOMTcpClient.h"
+#include "lvDCOMShm.h"
+
+static const double tcp_timeout = 10.0;  ///< seconds to wait for a reply through TCP or shared memory
+
+/// timing of one kind of operation
+struct OpStats
+{
+	unsigned long count;
+	unsigned long failed;      ///< failed when captured, so not replayed
+	double captured_total;     ///< seconds
+	double captured_max;
+	double replay_total;
+	double replay_max;
+	OpStats() : count(0), failed(0), captured_total(0.0), captured_max(0.0), replay_total(0.0), replay_max(0.0) { }
+	void add(const OpStats& s)
+	{
+		count += s.count;
+		failed += s.failed;
+		captured_total += s.captured_total;
+		captured_max = (s.captured_max > captured_max ? s.captured_max : captured_max);
+		replay_total += s.replay_total;
+		replay_max = (s.replay_max > replay_max ? s.replay_max : replay_max);
+	}
+};
+
+/// the records one thread replays, and what it found
+struct ReplayThread
+{
+	std::vector<const CaptureRecord*> records;
+	lvDCOMSimBackend* backend;
+	lvDCOMTcpClient* client;   ///< replay through this rather than \a backend if not NULL
+	lvDCOMShmClient* shm;      ///< or through this
+	std::map<std::pair<std::string,std::string>, CaptureValue> last;  ///< last value got or set of each control, through TCP or shared memory
+	epicsTime start;
+	double speed;
+	double latency_scale;
+	epicsEvent done;
+	OpStats stats[4];          ///< indexed by CaptureRecord::Op
+	unsigned long changes;     ///< gets that saw a different value to the previous get of that control
+	unsigned long mismatches;  ///< gets that did not return the captured value
+	unsigned long errors;      ///< operations that failed in replay but not when captured
+	double lag_total;          ///< seconds operations started behind schedule
+	double lag_max;
+	ReplayThread() : backend(NULL), client(NULL), shm(NULL), speed(1.0), latency_scale(1.0), changes(0), mismatches(0), errors(0), lag_total(0.0), lag_max(0.0) { }
+};
+
+/// replay \a rec through the TCP transport
+static void replayTcp(ReplayThread& t, const CaptureRecord& rec, CaptureValue& value)
+{
+	std::vector<TcpItem> items(1, TcpItem(rec.vi, rec.control));
+	items[0].value = rec.value;
+	switch(rec.op)
+	{
+		case CaptureRecord::Get:
+			{
+				t.client->update(items);
+				items[0].value = CaptureValue();
+				t.client->get(items, tcp_timeout);
+				CaptureValue& last = t.last[std::pair<std::string,std::string>(rec.vi, rec.control)];
+				if (items[0].status == 0 && items[0].value != last)
+				{
+					++t.changes;
+					last = items[0].value;
+				}
+				if (items[0].status == 0 && items[0].value != rec.value)
+				{
+					++t.mismatches;
+				}
+			}
+			break;
+		case CaptureRecord::Set:
+			t.client->set(items, tcp_timeout);
+			t.last[std::pair<std::string,std::string>(rec.vi, rec.control)] = rec.value;
+			break;
+		case CaptureRecord::Call:
+			{
+				CaptureValue names_values;
+				names_values.kind = CaptureValue::Array;
+				items[0].control.clear();
+				t.client->update(items);
+				t.client->call(rec.vi, names_values, value, tcp_timeout);
+			}
+			break;
+	}
+	if (items[0].status != 0)
+	{
+		throw std::runtime_error(items[0].message);
+	}
+}
+
+/// replay \a rec through the shared memory transport
+static void replayShm(ReplayThread& t, const CaptureRecord& rec, CaptureValue& value)
+{
+	switch(rec.op)
+	{
+		case CaptureRecord::Get:
+			{
+				t.shm->update(rec.vi, rec.control, rec.value, tcp_timeout);
+				t.shm->get(rec.vi, rec.control, value, tcp_timeout);
+				CaptureValue& last = t.last[std::pair<std::string,std::string>(rec.vi, rec.control)];
+				if (value != last)
+				{
+					++t.changes;
+					last = value;
+				}
+				if (value != rec.value)
+				{
+					++t.mismatches;
+				}
+			}
+			break;
+		case CaptureRecord::Set:
+			t.shm->set(rec.vi, rec.control, rec.value, 0, tcp_timeout);
+			t.last[std::pair<std::string,std::string>(rec.vi, rec.control)] = rec.value;
+			break;
+		case CaptureRecord::Call:
+			{
+				CaptureValue names_values;
+				names_values.kind = CaptureValue::Array;
+				t.shm->update(rec.vi, "", rec.value, tcp_timeout);
+				t.shm->call(rec.vi, names_values, value, tcp_timeout);
+			}
+			break;
+	}
+}
+
+static void replayRecord(ReplayThread& t, const CaptureRecord& rec)
+{
+	OpStats& s = t.stats[rec.op];
+	++s.count;
+	s.captured_total += rec.duration;
+	if (rec.duration > s.captured_max)
+	{
+		s.captured_max = rec.duration;
+	}
+	if (rec.hresult < 0)
+	{
+		++s.failed;
+		return;
+	}
+	double latency = rec.duration * t.latency_scale;
+	CaptureValue value;
+	epicsTime t0 = epicsTime::getCurrent();
+	try
+	{
+		if (t.client != NULL)
+		{
+			replayTcp(t, rec, value);
+		}
+		else if (t.shm != NULL)
+		{
+			replayShm(t, rec, value);
+		}
+		else switch(rec.op)
+		{
+			case CaptureRecord::Get:
+				if (t.backend->update(rec.vi, rec.control, rec.value))
+				{
+					++t.changes;
+				}
+				t.backend->getControlValue(rec.vi, rec.control, value, latency);
+				if (value != rec.value)
+				{
+					++t.mismatches;
+				}
+				break;
+			case CaptureRecord::Set:
+				t.backend->setControlValue(rec.vi, rec.control, rec.value, latency);
+				break;
+			case CaptureRecord::Call:
+				t.backend->updateCall(rec.vi, rec.value);
+				t.backend->call(rec.vi, value, latency);
+				break;
+		}
+	}
+	catch(const std::exception& ex)
+	{
+		if (t.errors++ == 0)
+		{
+			fprintf(stderr, "lvDCOMReplay: %s\n", ex.what());
+		}
+	}
+	double elapsed = epicsTime::getCurrent() - t0;
+	s.replay_total += elapsed;
+	if (elapsed > s.replay_max)
+	{
+		s.replay_max = elapsed;
+	}
+}
+
+static void replayTask(void* arg)
+{
+	ReplayThread& t = *static_cast<ReplayThread*>(arg);
+	for(std::vector<const CaptureRecord*>::const_iterator it = t.records.begin(); it != t.records.end(); ++it)
+	{
+		const CaptureRecord& rec = **it;
+		if (t.speed > 0.0)
+		{
+			epicsTime due = t.start + rec.time / t.speed;
+			double wait = due - epicsTime::getCurrent();
+			if (wait > 0.0)
+			{
+				epicsThreadSleep(wait);
+			}
+			double lag = epicsTime::getCurrent() - due;
+			if (lag > 0.0)
+			{
+				t.lag_total += lag;
+				t.lag_max = (lag > t.lag_max ? lag : t.lag_max);
+			}
+		}
+		replayRecord(t, rec);
+	}
+	t.done.signal();
+}
+
+/// FNV-1a, used to send all operations on a control to the same thread
+static unsigned long controlHash(const CaptureRecord& rec)
+{
+	unsigned long h = 2166136261u;
+	const std::string key = rec.vi + "\n" + rec.control;
+	for(size_t i = 0; i < key.size(); ++i)
+	{
+		h = (h ^ static_cast<unsigned char>(key[i])) * 16777619u;
+	}
+	return h;
+}
+
+static void printStats(const char* name, const OpStats& s)
+{
+	if (s.count == 0)
+	{
+		return;
+	}
+	unsigned long replayed = s.count - s.failed;
+	printf("  %-16s %8lu ops (%lu failed when captured), captured mean %8.3f max %8.3f ms, replay mean %8.3f max %8.3f ms\n",
+		name, s.count, s.failed, 1000.0 * s.captured_total / s.count, 1000.0 * s.captured_max,
+		(replayed > 0 ? 1000.0 * s.replay_total / replayed : 0.0), 1000.0 * s.replay_max);
+}
+
+static void usage()
+{
+	fprintf(stderr, "Usage: lvDCOMReplay [-s speed] [-l latency_scale] [-t threads] [-c host:port | -m name] capture_file\n");
+	exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+	double speed = 1.0, latency_scale = 1.0;
+	int nthreads = 1;
+	const char* file_name = NULL;
+	const char* tcp_address = NULL;
+	const char* shm_name = NULL;
+	for(int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-s") && i + 1 < argc)
+		{
+			speed = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+		{
+			latency_scale = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+		{
+			nthreads = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+		{
+			tcp_address = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-m") && i + 1 < argc)
+		{
+			shm_name = argv[++i];
+		}
+		else if (argv[i][0] != '-' && file_name == NULL)
+		{
+			file_name = argv[i];
+		}
+		else
+		{
+			usage();
+		}
+	}
+	if (file_name == NULL || nthreads < 1 || speed < 0.0 || latency_scale < 0.0 || (tcp_address != NULL && shm_name != NULL))
+	{
+		usage();
+	}
+	std::vector<CaptureRecord> records;
+	try
+	{
+		lvDCOMCaptureReader reader(file_name);
+		CaptureRecord rec;
+		while(reader.next(rec))
+		{
+			records.push_back(rec);
+		}
+	}
+	catch(const std::exception& ex)
+	{
+		fprintf(stderr, "lvDCOMReplay: %s\n", ex.what());
+		return 1;
+	}
+	if (records.size() == 0)
+	{
+		fprintf(stderr, "lvDCOMReplay: no records in %s\n", file_name);
+		return 1;
+	}
+
+	lvDCOMSimBackend backend;
+	lvDCOMTcpClient* client = NULL;
+	lvDCOMShmClient* shm = NULL;
+	if (tcp_address != NULL || shm_name != NULL)
+	{
+		try
+		{
+			if (tcp_address != NULL)
+			{
+				client = new lvDCOMTcpClient(tcp_address, false);
+			}
+			else
+			{
+				shm = new lvDCOMShmClient(shm_name);
+			}
+		}
+		catch(const std::exception& ex)
+		{
+			fprintf(stderr, "lvDCOMReplay: %s\n", ex.what());
+			return 1;
+		}
+	}
+	std::vector<ReplayThread*> threads;
+	for(int i = 0; i < nthreads; ++i)
+	{
+		threads.push_back(new ReplayThread);
+		threads[i]->backend = &backend;
+		threads[i]->client = client;
+		threads[i]->shm = shm;
+		threads[i]->speed = speed;
+		threads[i]->latency_scale = latency_scale;
+	}
+	for(std::vector<CaptureRecord>::const_iterator it = records.begin(); it != records.end(); ++it)
+	{
+		threads[controlHash(*it) % nthreads]->records.push_back(&(*it));
+	}
+	epicsTime start = epicsTime::getCurrent();
+	for(int i = 0; i < nthreads; ++i)
+	{
+		threads[i]->start = start;
+		if (epicsThreadCreate("lvDCOMReplay", epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackMedium),
+		        replayTask, threads[i]) == 0)
+		{
+			fprintf(stderr, "lvDCOMReplay: epicsThreadCreate failure\n");
+			return 1;
+		}
+	}
+	OpStats stats[4];
+	unsigned long changes = 0, mismatches = 0, errors = 0;
+	double lag_total = 0.0, lag_max = 0.0;
+	for(int i = 0; i < nthreads; ++i)
+	{
+		ReplayThread& t = *threads[i];
+		t.done.wait();
+		for(int j = 0; j < 4; ++j)
+		{
+			stats[j].add(t.stats[j]);
+		}
+		changes += t.changes;
+		mismatches += t.mismatches;
+		errors += t.errors;
+		lag_total += t.lag_total;
+		lag_max = (t.lag_max > lag_max ? t.lag_max : lag_max);
+	}
+	double elapsed = epicsTime::getCurrent() - start;
+	double span = 0.0;
+	for(std::vector<CaptureRecord>::const_iterator it = records.begin(); it != records.end(); ++it)
+	{
+		span = (it->time > span ? it->time : span);
+	}
+
+	if (client != NULL)
+	{
+		printf("Replayed %lu operations from \"%s\" with %d thread(s) through TCP to \"%s\"\n", static_cast<unsigned long>(records.size()),
+			file_name, nthreads, tcp_address);
+	}
+	else if (shm != NULL)
+	{
+		printf("Replayed %lu operations from \"%s\" with %d thread(s) through shared memory \"%s\"\n", static_cast<unsigned long>(records.size()),
+			file_name, nthreads, shm_name);
+	}
+	else
+	{
+		printf("Replayed %lu operations on %lu controls from \"%s\" with %d thread(s)\n", static_cast<unsigned long>(records.size()),
+			static_cast<unsigned long>(backend.controls()), file_name, nthreads);
+	}
+	printf("  captured over %.3f s, replayed in %.3f s (%.0f ops/s), speed %g, latency scale %g\n", span, elapsed,
+		records.size() / (elapsed > 0.0 ? elapsed : 1e-9), speed, latency_scale);
+	printStats("GetControlValue", stats[CaptureRecord::Get]);
+	printStats("SetControlValue", stats[CaptureRecord::Set]);
+	printStats("Call", stats[CaptureRecord::Call]);
+	printf("  %lu gets saw a changed value, %lu returned a value other than captured, %lu replay errors\n", changes, mismatches, errors);
+	if (speed > 0.0)
+	{
+		printf("  behind schedule by mean %.3f max %.3f ms\n", 1000.0 * lag_total / records.size(), 1000.0 * lag_max);
+	}
+	if (client != NULL)
+	{
+		client->report(stdout, 0);
+		delete client;
+	}
+	if (shm != NULL)
+	{
+		shm->report(stdout, 0);
+		delete shm;
+	}
+	for(int i = 0; i < nthreads; ++i)
+	{
+		delete threads[i];
+	}
+	return (errors > 0 ? 2 : 0);
+}
@@ -0,0 +1,844 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMShm.cpp Shared memory transport, see lvDCOMShm.h
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+#include <epicsGuard.h>
+#include <epicsAtomic.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <epicsStdio.h>
+
+#include "lvDCOMCapture.h"
+#include "lvDCOMShm.h"
+
+/// seconds past the EPICS epoch, for #ShmHeader::heartbeat
+static epicsInt32 shmNow()
+{
+	epicsTimeStamp ts = epicsTime::getCurrent();
+	return static_cast<epicsInt32>(ts.secPastEpoch);
+}
+
+static size_t shmAlign(size_t n, size_t alignment)
+{
+	return (n + alignment - 1) / alignment * alignment;
+}
+
+/// copy \a s into the fixed size field \a field, failing if it does not fit
+static void putName(char* field, size_t size, const std::string& s, const char* what)
+{
+	if (s.size() >= size)
+	{
+		throw std::runtime_error(std::string("lvDCOMShm: ") + what + " name \"" + s + "\" is too long");
+	}
+	memcpy(field, s.c_str(), s.size() + 1);
+}
+
+/// the string in the fixed size field \a field, which the other side may not have terminated
+static std::string getName(const char* field, size_t size)
+{
+	const char* end = static_cast<const char*>(memchr(field, '\0', size));
+	return std::string(field, (end != NULL ? end - field : size));
+}
+
+/// size of an element of a raw array of \a kind, or 0 if arrays of \a kind are capture encoded
+static size_t rawElementSize(CaptureValue::Kind kind)
+{
+	switch(kind)
+	{
+		case CaptureValue::Float64Array:
+			return sizeof(epicsFloat64);
+		case CaptureValue::Int32Array:
+			return sizeof(epicsInt32);
+		case CaptureValue::BooleanArray:
+			return sizeof(epicsInt16);
+		default:
+			return 0;
+	}
+}
+
+std::string lvDCOMShmRegion::osName(const std::string& name)
+{
+#ifdef _WIN32
+	return "Local\\lvDCOM_" + name;
+#else
+	return "/lvDCOM_" + name;
+#endif
+}
+
+/// create a new region of \a size bytes, all zero, replacing any left by a previous server. On Windows a region that a
+/// client still has open cannot be replaced, so that is re-used instead and the caller must initialise it all
+lvDCOMShmRegion* lvDCOMShmRegion::create(const std::string& name, size_t size)
+{
+	std::string os_name = osName(name);
+	lvDCOMShmRegion* r = new lvDCOMShmRegion;
+#ifdef _WIN32
+	HANDLE h = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, static_cast<DWORD>(static_cast<epicsUInt64>(size) >> 32),
+	    static_cast<DWORD>(size), os_name.c_str());
+	void* base = (h != NULL ? MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, size) : NULL);
+	if (base == NULL)
+	{
+		if (h != NULL)
+		{
+			CloseHandle(h);
+		}
+		delete r;
+		throw std::runtime_error("lvDCOMShm: cannot create shared memory \"" + os_name + "\"");
+	}
+	r->m_handle = h;
+#else
+	shm_unlink(os_name.c_str());
+	int fd = shm_open(os_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0660);
+	void* base = MAP_FAILED;
+	if (fd >= 0 && ftruncate(fd, static_cast<off_t>(size)) == 0)
+	{
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+	if (base == MAP_FAILED)
+	{
+		shm_unlink(os_name.c_str());
+		delete r;
+		throw std::runtime_error("lvDCOMShm: cannot create shared memory \"" + os_name + "\"");
+	}
+	r->m_unlink = os_name;
+#endif
+	r->m_base = static_cast<char*>(base);
+	r->m_size = size;
+	return r;
+}
+
+/// map the region a server has created
+lvDCOMShmRegion* lvDCOMShmRegion::open(const std::string& name)
+{
+	std::string os_name = osName(name);
+	lvDCOMShmRegion* r = new lvDCOMShmRegion;
+#ifdef _WIN32
+	HANDLE h = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, os_name.c_str());
+	void* base = (h != NULL ? MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, 0) : NULL);
+	MEMORY_BASIC_INFORMATION mbi;
+	if (base == NULL || VirtualQuery(base, &mbi, sizeof(mbi)) == 0)
+	{
+		if (base != NULL)
+		{
+			UnmapViewOfFile(base);
+		}
+		if (h != NULL)
+		{
+			CloseHandle(h);
+		}
+		delete r;
+		throw lvDCOMShmUnavailable("lvDCOMShm: no shared memory \"" + os_name + "\", is the server running?");
+	}
+	r->m_handle = h;
+	r->m_size = mbi.RegionSize;
+#else
+	int fd = shm_open(os_name.c_str(), O_RDWR, 0);
+	struct stat st;
+	void* base = MAP_FAILED;
+	if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(ShmHeader)))
+	{
+		r->m_size = static_cast<size_t>(st.st_size);
+		base = mmap(NULL, r->m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+	if (base == MAP_FAILED)
+	{
+		delete r;
+		throw lvDCOMShmUnavailable("lvDCOMShm: no shared memory \"" + os_name + "\", is the server running?");
+	}
+#endif
+	r->m_base = static_cast<char*>(base);
+	return r;
+}
+
+/// Map the whole of file \a path. If \a writable the file is created if need be and made at least \a size bytes, its existing
+/// contents are kept. Otherwise it is mapped read only and \a size is ignored
+lvDCOMShmRegion* lvDCOMShmRegion::mapFile(const std::string& path, size_t size, bool writable)
+{
+	lvDCOMShmRegion* r = new lvDCOMShmRegion;
+#ifdef _WIN32
+	HANDLE f = CreateFileA(path.c_str(), (writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ), FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+	    NULL, (writable ? OPEN_ALWAYS : OPEN_EXISTING), FILE_ATTRIBUTE_NORMAL, NULL);
+	LARGE_INTEGER file_size;
+	file_size.QuadPart = 0;
+	if (f != INVALID_HANDLE_VALUE)
+	{
+		GetFileSizeEx(f, &file_size);
+	}
+	if (writable && static_cast<size_t>(file_size.QuadPart) < size)
+	{
+		file_size.QuadPart = size;  // the mapping extends the file
+	}
+	HANDLE h = NULL;
+	if (f != INVALID_HANDLE_VALUE && file_size.QuadPart > 0)
+	{
+		h = CreateFileMappingA(f, NULL, (writable ? PAGE_READWRITE : PAGE_READONLY), file_size.HighPart, file_size.LowPart, NULL);
+	}
+	void* base = (h != NULL ? MapViewOfFile(h, (writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ), 0, 0, 0) : NULL);
+	if (f != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(f);  // the mapping keeps the file open
+	}
+	if (base == NULL)
+	{
+		if (h != NULL)
+		{
+			CloseHandle(h);
+		}
+		delete r;
+		throw std::runtime_error("lvDCOMShm: cannot map file \"" + path + "\"");
+	}
+	r->m_handle = h;
+	r->m_size = static_cast<size_t>(file_size.QuadPart);
+#else
+	int fd = ::open(path.c_str(), (writable ? O_RDWR | O_CREAT : O_RDONLY), 0664);
+	struct stat st;
+	void* base = MAP_FAILED;
+	if (fd >= 0 && fstat(fd, &st) == 0)
+	{
+		r->m_size = static_cast<size_t>(st.st_size);
+		if (writable && r->m_size < size && ftruncate(fd, static_cast<off_t>(size)) == 0)
+		{
+			r->m_size = size;
+		}
+		if (r->m_size > 0)
+		{
+			base = mmap(NULL, r->m_size, (writable ? PROT_READ | PROT_WRITE : PROT_READ), MAP_SHARED, fd, 0);
+		}
+	}
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+	if (base == MAP_FAILED)
+	{
+		delete r;
+		throw std::runtime_error("lvDCOMShm: cannot map file \"" + path + "\"");
+	}
+#endif
+	r->m_base = static_cast<char*>(base);
+	return r;
+}
+
+lvDCOMShmRegion::~lvDCOMShmRegion()
+{
+#ifdef _WIN32
+	if (m_base != NULL)
+	{
+		UnmapViewOfFile(m_base);
+	}
+	if (m_handle != NULL)
+	{
+		CloseHandle(static_cast<HANDLE>(m_handle));
+	}
+#else
+	if (m_base != NULL)
+	{
+		munmap(m_base, m_size);
+	}
+	if (m_unlink.size() > 0)
+	{
+		shm_unlink(m_unlink.c_str());
+	}
+#endif
+}
+
+lvDCOMShmClient::lvDCOMShmClient(const std::string& name) : m_name(name), m_region(NULL), m_epoch(0), m_slots_seen(0),
+	m_opens(0), m_reads(0), m_retries(0), m_requests(0), m_timeouts(0), m_reopens(0), m_array_reads(0)
+{
+}
+
+lvDCOMShmClient::~lvDCOMShmClient()
+{
+	delete m_region;
+	for(size_t i = 0; i < m_old_regions.size(); ++i)
+	{
+		delete m_old_regions[i];
+	}
+}
+
+void lvDCOMShmClient::countRetry()
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	++m_retries;
+}
+
+/// the current mapping, opening it if need be or again if its server has gone
+lvDCOMShmRegion* lvDCOMShmClient::region()
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	if (m_region != NULL)
+	{
+		ShmHeader* h = m_region->header();
+		if ( epicsAtomicGetIntT(&(h->heartbeat)) >= shmNow() - static_cast<epicsInt32>(shm_stale_after) && h->magic == shm_magic )
+		{
+			if (epicsAtomicGetIntT(&(h->epoch)) != m_epoch)
+			{
+				// initialised again in place by a new server (only on Windows), so slots have moved
+				m_slots.clear();
+				m_slots_seen = 0;
+				m_epoch = epicsAtomicGetIntT(&(h->epoch));
+			}
+			return m_region;
+		}
+		m_old_regions.push_back(m_region);  // another thread may still be reading it
+		m_region = NULL;
+		m_slots.clear();
+		m_slots_seen = 0;
+		++m_reopens;
+	}
+	lvDCOMShmRegion* r = lvDCOMShmRegion::open(m_name);
+	ShmHeader* h = r->header();
+	epicsAtomicReadMemoryBarrier();
+	if ( h->magic != shm_magic || h->version != shm_version || epicsAtomicGetIntT(&(h->heartbeat)) < shmNow() - static_cast<epicsInt32>(shm_stale_after) ||
+	     h->data_offset + h->data_size > r->size() )
+	{
+		delete r;
+		throw lvDCOMShmUnavailable("lvDCOMShmClient: server of shared memory \"" + m_name + "\" is not running");
+	}
+	m_region = r;
+	m_epoch = epicsAtomicGetIntT(&(h->epoch));
+	++m_opens;
+	return m_region;
+}
+
+/// number of times the region has been opened, which goes up when a new server has started
+unsigned long lvDCOMShmClient::opens()
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	return m_opens;
+}
+
+/// the slot of \a control of \a vi in mapping \a r, asking the server to publish it if there is not one yet
+ShmSlot* lvDCOMShmClient::findSlot(const std::string& vi, const std::string& control, double timeout, lvDCOMShmRegion*& r)
+{
+	control_key_t key(vi, control);
+	for(int pass = 0; pass < 2; ++pass)
+	{
+		r = region();
+		{
+			epicsGuard<epicsMutex> _lock(m_lock);
+			if (r == m_region)
+			{
+				size_t n = static_cast<size_t>(epicsAtomicGetIntT(&(r->header()->slot_count)));
+				epicsAtomicReadMemoryBarrier();
+				for(; m_slots_seen < n && m_slots_seen < r->header()->slot_max; ++m_slots_seen)
+				{
+					ShmSlot* s = r->slot(m_slots_seen);
+					m_slots[control_key_t(getName(s->vi, sizeof(s->vi)), getName(s->control, sizeof(s->control)))] = m_slots_seen;
+				}
+				std::map<control_key_t, size_t>::const_iterator it = m_slots.find(key);
+				if (it != m_slots.end())
+				{
+					return r->slot(it->second);
+				}
+			}
+		}
+		if (pass == 0)
+		{
+			request(ShmGet, vi, control, 0, NULL, NULL, timeout);
+		}
+	}
+	throw std::runtime_error("lvDCOMShmClient: server did not publish \"" + control + "\" on \"" + vi + "\"");
+}
+
+/// Read the value of \a control on \a vi from its slot
+void lvDCOMShmClient::get(const std::string& vi, const std::string& control, CaptureValue& value, double timeout)
+{
+	lvDCOMShmRegion* r;
+	ShmSlot* slot = findSlot(vi, control, timeout, r);
+	std::string buffer;
+	epicsTime start = epicsTime::getCurrent();
+	for(int attempt = 0; ; ++attempt)
+	{
+		epicsInt32 seq = epicsAtomicGetIntT(&(slot->seq));
+		if ( (seq & 1) != 0 )
+		{
+			backoff(attempt, start);
+			continue;
+		}
+		epicsAtomicReadMemoryBarrier();
+		CaptureValue::Kind kind = static_cast<CaptureValue::Kind>(slot->kind);
+		bool encoded = (slot->encoded != 0);
+		epicsUInt32 ndims = slot->ndims;
+		epicsUInt32 dims[2] = { slot->dims[0], slot->dims[1] };
+		epicsUInt64 offset = slot->offset, length = slot->length;
+		size_t element = rawElementSize(kind);
+		epicsUInt64 bytes = (encoded ? length : length * element);
+		bool sane = (offset + bytes <= r->size() && (encoded || element > 0) && ndims <= 2);
+		if (sane)
+		{
+			buffer.assign(r->base() + offset, static_cast<size_t>(bytes));
+		}
+		epicsAtomicReadMemoryBarrier();
+		if (epicsAtomicGetIntT(&(slot->seq)) != seq)
+		{
+			countRetry();
+			backoff(attempt, start);
+			continue;
+		}
+		if (!sane)
+		{
+			throw std::runtime_error("lvDCOMShmClient: corrupt slot for \"" + control + "\" on \"" + vi + "\"");
+		}
+		value = CaptureValue();
+		if (encoded)
+		{
+			CaptureParser parser(buffer);
+			parser.getValue(value);
+			if ( !parser.ok() )
+			{
+				throw std::runtime_error("lvDCOMShmClient: corrupt value for \"" + control + "\" on \"" + vi + "\"");
+			}
+		}
+		else
+		{
+			value.kind = kind;
+			value.dims.assign(dims, dims + ndims);
+			size_t n = static_cast<size_t>(length);
+			if (n == 0)
+			{
+				;
+			}
+			else if (kind == CaptureValue::Float64Array)
+			{
+				value.farray.resize(n);
+				memcpy(&(value.farray[0]), buffer.data(), n * element);
+			}
+			else if (kind == CaptureValue::Int32Array)
+			{
+				value.iarray.resize(n);
+				memcpy(&(value.iarray[0]), buffer.data(), n * element);
+			}
+			else
+			{
+				value.iarray.resize(n);
+				for(size_t i = 0; i < n; ++i)
+				{
+					epicsInt16 b;
+					memcpy(&b, buffer.data() + i * element, element);
+					value.iarray[i] = b;
+				}
+			}
+		}
+		epicsGuard<epicsMutex> _lock(m_lock);
+		++m_reads;
+		return;
+	}
+}
+
+/// Write \a value to \a control on \a vi, with #ShmSignal in \a flags to write it as the extint VI would
+void lvDCOMShmClient::set(const std::string& vi, const std::string& control, const CaptureValue& value, epicsUInt32 flags, double timeout)
+{
+	request(ShmSet, vi, control, flags, &value, NULL, timeout);
+}
+
+/// run \a vi with \a names_values an Array of the names and values arrays, returning the values afterwards in \a results
+void lvDCOMShmClient::call(const std::string& vi, const CaptureValue& names_values, CaptureValue& results, double timeout)
+{
+	request(ShmCall, vi, "", 0, &names_values, &results, timeout);
+}
+
+/// change \a control on \a vi as the VI itself would, or with an empty \a control set what the next call returns. Only a
+/// stand in server, such as lvDCOMShmWriter, accepts this
+void lvDCOMShmClient::update(const std::string& vi, const std::string& control, const CaptureValue& value, double timeout)
+{
+	request(ShmUpdate, vi, control, 0, &value, NULL, timeout);
+}
+
+/// put a request on the ring and wait up to \a timeout seconds (for ever if 0.0, unless the server goes) for its response
+void lvDCOMShmClient::request(ShmRequestType type, const std::string& vi, const std::string& control, epicsUInt32 flags,
+    const CaptureValue* value, CaptureValue* result, double timeout)
+{
+	lvDCOMShmRegion* r = region();
+	ShmHeader* h = r->header();
+	std::string buffer;
+	if (value != NULL)
+	{
+		capturePutValue(buffer, *value);
+	}
+	if (buffer.size() > h->request_data_size)
+	{
+		throw std::runtime_error("lvDCOMShmClient: value for \"" + control + "\" on \"" + vi + "\" is larger than the request size of the server");
+	}
+	{
+		epicsGuard<epicsMutex> _lock(m_lock);
+		++m_requests;
+	}
+	epicsTime start = epicsTime::getCurrent();
+	epicsUInt32 mask = h->ring_size - 1;
+	epicsUInt32 pos;
+	ShmRequest* cell;
+	// claim the next cell, as a bounded multi producer queue
+	for(int attempt = 0; ; ++attempt)
+	{
+		pos = static_cast<epicsUInt32>(epicsAtomicGetIntT(&(h->enqueue_pos)));
+		cell = r->cell(pos & mask);
+		epicsInt32 dif = static_cast<epicsInt32>(static_cast<epicsUInt32>(epicsAtomicGetIntT(&(cell->seq))) - pos);
+		if (dif == 0)
+		{
+			if (epicsAtomicCmpAndSwapIntT(&(h->enqueue_pos), static_cast<epicsInt32>(pos), static_cast<epicsInt32>(pos + 1)) == static_cast<epicsInt32>(pos))
+			{
+				break;
+			}
+		}
+		else if (dif < 0)
+		{
+			// ring full, of requests the server has yet to take
+			if ( attempt >= 64 && ((timeout > 0.0 && epicsTime::getCurrent() - start > timeout) || r != region()) )
+			{
+				epicsGuard<epicsMutex> _lock(m_lock);
+				++m_timeouts;
+				throw lvDCOMShmTimeout("lvDCOMShmClient: request ring of \"" + m_name + "\" full");
+			}
+			backoff(attempt, start);
+		}
+	}
+	cell->type = type;
+	cell->flags = flags;
+	cell->status = 0;
+	cell->length = static_cast<epicsUInt32>(buffer.size());
+	putName(cell->vi, sizeof(cell->vi), vi, "VI");
+	putName(cell->control, sizeof(cell->control), control, "control");
+	cell->message[0] = '\0';
+	if (buffer.size() > 0)
+	{
+		memcpy(r->cellData(cell), buffer.data(), buffer.size());
+	}
+	epicsAtomicSetIntT(&(cell->state), ShmRequestReady);
+	epicsAtomicWriteMemoryBarrier();
+	epicsAtomicSetIntT(&(cell->seq), static_cast<epicsInt32>(pos + 1));
+	for(int attempt = 0; epicsAtomicGetIntT(&(cell->state)) != ShmRequestDone; ++attempt)
+	{
+		if ( attempt >= 64 && (attempt % 64) == 0 && ((timeout > 0.0 && epicsTime::getCurrent() - start > timeout) || r != region()) )
+		{
+			// leave the server to free the cell, unless it has just finished with it
+			if (epicsAtomicCmpAndSwapIntT(&(cell->state), ShmRequestReady, ShmRequestAbandoned) == ShmRequestReady)
+			{
+				epicsGuard<epicsMutex> _lock(m_lock);
+				++m_timeouts;
+				char t[64];
+				epicsSnprintf(t, sizeof(t), "%.3f", timeout);
+				throw lvDCOMShmTimeout("lvDCOMShmClient: no response from server of \"" + m_name + "\" within " + t + " s");
+			}
+			break;
+		}
+		backoff(attempt, start);
+	}
+	epicsAtomicReadMemoryBarrier();
+	epicsInt32 status = cell->status;
+	std::string message = getName(cell->message, sizeof(cell->message));
+	epicsUInt32 length = cell->length;
+	if (length <= h->request_data_size)
+	{
+		buffer.assign(reinterpret_cast<const char*>(r->cellData(cell)), length);
+	}
+	epicsAtomicSetIntT(&(cell->seq), static_cast<epicsInt32>(pos + h->ring_size));
+	if (status != 0)
+	{
+		throw std::runtime_error(message);
+	}
+	if (result != NULL)
+	{
+		*result = CaptureValue();
+		CaptureParser parser(buffer);
+		parser.getValue(*result);
+		if ( length > h->request_data_size || !parser.ok() )
+		{
+			throw std::runtime_error("lvDCOMShmClient: corrupt response from server of \"" + m_name + "\"");
+		}
+	}
+}
+
+void lvDCOMShmClient::report(FILE* fp, int details)
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	fprintf(fp, "Shared memory transport \"%s\": %s, %lu slots known, %lu slot reads (%lu in place arrays), %lu seqlock retries, "
+	    "%lu requests, %lu timeouts, %lu re-opens\n", m_name.c_str(), (m_region != NULL ? "open" : "not open"), static_cast<unsigned long>(m_slots.size()),
+	    m_reads, m_array_reads, m_retries, m_requests, m_timeouts, m_reopens);
+	if (details > 0 && m_region != NULL)
+	{
+		ShmHeader* h = m_region->header();
+		fprintf(fp, "  server pid %u, %d/%u slots, %u request cells of %u bytes, %.1f of %.1f MB data used\n", h->server_pid,
+		    epicsAtomicGetIntT(&(h->slot_count)), h->slot_max, h->ring_size, h->request_data_size,
+		    h->data_used / 1048576.0, h->data_size / 1048576.0);
+	}
+}
+
+/// create the region \a name with room for \a slots slots, \a ring_size requests (rounded up to a power of 2) of
+/// \a request_data_size bytes, and \a data_size bytes of slot values
+lvDCOMShmServer::lvDCOMShmServer(const std::string& name, size_t slots, size_t ring_size, size_t request_data_size, size_t data_size) : m_region(NULL)
+{
+	size_t ring = 1;
+	while(ring < ring_size)
+	{
+		ring *= 2;
+	}
+	size_t slot_offset = shmAlign(sizeof(ShmHeader), 64);
+	size_t ring_offset = shmAlign(slot_offset + slots * sizeof(ShmSlot), 64);
+	size_t ring_stride = shmAlign(sizeof(ShmRequest) + request_data_size, 64);
+	size_t data_offset = shmAlign(ring_offset + ring * ring_stride, 64);
+	m_region = lvDCOMShmRegion::create(name, data_offset + data_size);
+	ShmHeader* h = m_region->header();
+	epicsInt32 epoch = (h->magic == shm_magic ? h->epoch + 1 : 1);
+	h->magic = 0;
+	epicsAtomicWriteMemoryBarrier();
+	memset(m_region->base() + sizeof(h->magic), 0, data_offset - sizeof(h->magic));
+	h->version = shm_version;
+	h->epoch = epoch;
+	h->heartbeat = shmNow();
+	h->slot_max = static_cast<epicsUInt32>(slots);
+	h->ring_size = static_cast<epicsUInt32>(ring);
+	h->request_data_size = static_cast<epicsUInt32>(request_data_size);
+	h->slot_offset = slot_offset;
+	h->ring_offset = ring_offset;
+	h->ring_stride = ring_stride;
+	h->data_offset = data_offset;
+	h->data_size = data_size;
+#ifdef _WIN32
+	h->server_pid = GetCurrentProcessId();
+#else
+	h->server_pid = getpid();
+#endif
+	for(size_t i = 0; i < ring; ++i)
+	{
+		m_region->cell(i)->seq = static_cast<epicsInt32>(i);
+	}
+	epicsAtomicWriteMemoryBarrier();
+	h->magic = shm_magic;
+	epicsAtomicWriteMemoryBarrier();
+}
+
+lvDCOMShmServer::~lvDCOMShmServer()
+{
+	epicsAtomicSetIntT(&(m_region->header()->heartbeat), 0);  // so clients know straight away
+	delete m_region;
+}
+
+size_t lvDCOMShmServer::slots()
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	return m_slots.size();
+}
+
+/// tell clients the server is still running, serve() does this too
+void lvDCOMShmServer::heartbeat()
+{
+	epicsAtomicSetIntT(&(m_region->header()->heartbeat), shmNow());
+}
+
+/// Write \a value to the slot of \a control on \a vi. If it has no slot one is added when \a create is set, otherwise
+/// nothing is written and false returned. Space for a value that has outgrown its slot is not re-used, so a slot is
+/// given a quarter more than it needs
+bool lvDCOMShmServer::publish(const std::string& vi, const std::string& control, const CaptureValue& value, bool create)
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	ShmHeader* h = m_region->header();
+	control_key_t key(vi, control);
+	std::map<control_key_t, size_t>::const_iterator it = m_slots.find(key);
+	ShmSlot* s;
+	bool added = false;
+	if (it != m_slots.end())
+	{
+		s = m_region->slot(it->second);
+	}
+	else if (!create)
+	{
+		return false;
+	}
+	else
+	{
+		size_t i = m_slots.size();
+		if (i >= h->slot_max)
+		{
+			throw std::runtime_error("lvDCOMShmServer: all shared memory slots are in use");
+		}
+		s = m_region->slot(i);
+		memset(s, 0, sizeof(ShmSlot));
+		putName(s->vi, sizeof(s->vi), vi, "VI");
+		putName(s->control, sizeof(s->control), control, "control");
+		m_slots[key] = i;
+		added = true;
+	}
+	size_t element = rawElementSize(value.kind);
+	size_t n = (value.kind == CaptureValue::Float64Array ? value.farray.size() : value.iarray.size());
+	bool raw = (element > 0 && value.dims.size() <= 2);
+	size_t bytes;
+	if (raw)
+	{
+		bytes = n * element;
+	}
+	else
+	{
+		m_buffer.clear();
+		capturePutValue(m_buffer, value);
+		bytes = m_buffer.size();
+	}
+	epicsUInt64 offset = s->offset, capacity = s->capacity;
+	if (bytes > capacity || capacity == 0)
+	{
+		size_t need = shmAlign(bytes + bytes / 4 + 8, 8);
+		if (h->data_used + need > h->data_size)
+		{
+			throw std::runtime_error("lvDCOMShmServer: shared memory data area is full");
+		}
+		offset = h->data_offset + h->data_used;
+		capacity = need;
+		h->data_used += need;
+	}
+	epicsInt32 seq = s->seq;
+	epicsAtomicSetIntT(&(s->seq), seq + 1);
+	epicsAtomicWriteMemoryBarrier();
+	s->kind = value.kind;
+	s->encoded = (raw ? 0 : 1);
+	s->ndims = 1;
+	s->dims[0] = static_cast<epicsUInt32>(n);
+	s->dims[1] = 0;
+	if (raw && value.dims.size() > 0)
+	{
+		s->ndims = static_cast<epicsUInt32>(value.dims.size());
+		s->dims[0] = value.dims[0];
+		s->dims[1] = (value.dims.size() > 1 ? value.dims[1] : 0);
+	}
+	s->offset = offset;
+	s->capacity = capacity;
+	s->length = (raw ? n : bytes);
+	char* data = m_region->base() + offset;
+	if (!raw)
+	{
+		memcpy(data, m_buffer.data(), bytes);
+	}
+	else if (n == 0)
+	{
+		;
+	}
+	else if (value.kind == CaptureValue::Float64Array)
+	{
+		memcpy(data, &(value.farray[0]), bytes);
+	}
+	else if (value.kind == CaptureValue::Int32Array)
+	{
+		memcpy(data, &(value.iarray[0]), bytes);
+	}
+	else
+	{
+		for(size_t i = 0; i < n; ++i)
+		{
+			epicsInt16 b = static_cast<epicsInt16>(value.iarray[i]);
+			memcpy(data + i * element, &b, element);
+		}
+	}
+	++(s->updates);
+	epicsAtomicWriteMemoryBarrier();
+	epicsAtomicSetIntT(&(s->seq), seq + 2);
+	if (added)
+	{
+		epicsAtomicSetIntT(&(h->slot_count), static_cast<epicsInt32>(m_slots.size()));
+	}
+	return true;
+}
+
+/// Take up to \a max_requests requests off the ring, in order, passing each to \a handler and giving the client its
+/// response. Returns the number taken, 0 if there were none waiting, when the caller should wait a little before calling again
+int lvDCOMShmServer::serve(handler_t handler, void* arg, int max_requests)
+{
+	ShmHeader* h = m_region->header();
+	heartbeat();
+	int done = 0;
+	std::string buffer;
+	while(done < max_requests)
+	{
+		epicsUInt32 pos = static_cast<epicsUInt32>(h->dequeue_pos);
+		ShmRequest* cell = m_region->cell(pos & (h->ring_size - 1));
+		if (static_cast<epicsUInt32>(epicsAtomicGetIntT(&(cell->seq))) != pos + 1)
+		{
+			break;
+		}
+		epicsAtomicReadMemoryBarrier();
+		ShmRequestType type = static_cast<ShmRequestType>(cell->type);
+		std::string vi = getName(cell->vi, sizeof(cell->vi));
+		std::string control = getName(cell->control, sizeof(cell->control));
+		CaptureValue value;
+		std::string message;
+		bool failed = false;
+		try
+		{
+			if (cell->length > h->request_data_size)
+			{
+				throw std::runtime_error("lvDCOMShmServer: corrupt request");
+			}
+			if (cell->length > 0)
+			{
+				buffer.assign(reinterpret_cast<const char*>(m_region->cellData(cell)), cell->length);
+				CaptureParser parser(buffer);
+				parser.getValue(value);
+				if ( !parser.ok() )
+				{
+					throw std::runtime_error("lvDCOMShmServer: corrupt request value");
+				}
+			}
+			handler(arg, type, vi, control, cell->flags, value);
+			buffer.clear();
+			if (value.kind != CaptureValue::Empty)
+			{
+				capturePutValue(buffer, value);
+			}
+			if (buffer.size() > h->request_data_size)
+			{
+				throw std::runtime_error("lvDCOMShmServer: response is larger than the request size");
+			}
+		}
+		catch(const std::exception& ex)
+		{
+			failed = true;
+			message = ex.what();
+			message.resize(message.size() < sizeof(cell->message) ? message.size() : sizeof(cell->message) - 1);
+		}
+		cell->status = (failed ? -1 : 0);
+		memcpy(cell->message, message.c_str(), message.size() + 1);
+		cell->length = (failed ? 0 : static_cast<epicsUInt32>(buffer.size()));
+		if (cell->length > 0)
+		{
+			memcpy(m_region->cellData(cell), buffer.data(), buffer.size());
+		}
+		epicsAtomicWriteMemoryBarrier();
+		if (epicsAtomicCmpAndSwapIntT(&(cell->state), ShmRequestReady, ShmRequestDone) != ShmRequestReady)
+		{
+			// the client gave up waiting, so the cell is ours to free
+			epicsAtomicSetIntT(&(cell->seq), static_cast<epicsInt32>(pos + h->ring_size));
+		}
+		h->dequeue_pos = static_cast<epicsInt32>(pos + 1);
+		++done;
+	}
+	return done;
+}
@@ -0,0 +1,280 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMShm.h header for #lvDCOMShmRegion, #lvDCOMShmClient and #lvDCOMShmServer classes.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+///
+/// Shared memory transport, used by #lvDCOMInterface instead of DCOM when the host is given as shm://name and the
+/// IOC runs on the same machine as LabVIEW. The region has four parts, all at fixed offsets given in #ShmHeader:
+///
+///   header      #ShmHeader, written by the server when it creates the region and then only its heartbeat changes
+///   slots       a #ShmSlot for each control the server publishes, holding its latest value. The server writes a slot
+///               under a seqlock: #ShmSlot::seq is odd while it is being changed, so a reader copies what it needs and
+///               then checks seq is even and unchanged, trying again if not. Readers never block the server
+///   ring        #ShmHeader::ring_size #ShmRequest cells, a bounded lock free queue any number of clients put requests
+///               on for the single server. Each cell also carries its response back to the client that made the request
+///   data        values of the slots. Numeric and boolean arrays are held as their raw elements, 8 byte aligned, so a
+///               reader copies them straight from the mapping to where they are wanted. Anything else is capture encoded
+///
+/// A client reads a control from its slot without involving the server at all. If the control has no slot yet it asks
+/// the server (#ShmGet) to publish it, from then on the server keeps it up to date. Sets and calls go through the ring.
+/// Nothing here depends on Windows, on Linux the region is POSIX shared memory.
+
+#ifndef LV_DCOM_SHM_H
+#define LV_DCOM_SHM_H
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+#include <epicsGuard.h>
+#include <epicsAtomic.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+#include "lvDCOMCapture.h"
+
+static const epicsUInt32 shm_magic = 0x4d53564c;  ///< "LVSM"
+static const epicsUInt32 shm_version = 1;
+static const double shm_stale_after = 5.0;        ///< seconds without a server heartbeat before the server is taken to have gone
+
+enum ShmRequestType
+{
+	ShmGet = 1,     ///< publish a slot for the control, the response has no value
+	ShmSet = 2,     ///< write the value to the control, and update its slot if it has one
+	ShmCall = 3,    ///< run the VI with value an Array of its names and values arrays, the response value is the values afterwards
+	ShmUpdate = 4   ///< change the control as the VI itself would, or with no control set what the next call returns. Only for a stand in server
+};
+
+static const epicsUInt32 ShmSignal = 1;  ///< #ShmSet flag, write as the extint VI would so LabVIEW value change events fire
+
+/// states of #ShmRequest::state, the client and server hand a request over with compare and swap
+enum ShmRequestState { ShmRequestReady = 1, ShmRequestDone = 2, ShmRequestAbandoned = 3 };
+
+struct ShmHeader
+{
+	epicsUInt32 magic;          ///< #shm_magic once the region is initialised
+	epicsUInt32 version;
+	epicsInt32 epoch;           ///< changes each time a server initialises the region, so clients look their slots up again
+	epicsInt32 heartbeat;       ///< seconds past the EPICS epoch, updated by the server while it runs
+	epicsUInt32 slot_max;
+	epicsInt32 slot_count;      ///< slots in use, a slot is complete before this counts it
+	epicsUInt32 ring_size;      ///< a power of 2
+	epicsUInt32 request_data_size;  ///< bytes of #ShmRequest::data in each ring cell
+	epicsUInt64 slot_offset;
+	epicsUInt64 ring_offset;
+	epicsUInt64 ring_stride;    ///< bytes between ring cells
+	epicsUInt64 data_offset;
+	epicsUInt64 data_size;
+	epicsUInt64 data_used;      ///< bytes of the data area allocated to slots, only the server allocates
+	epicsInt32 enqueue_pos;     ///< next ring position a client will claim
+	epicsInt32 dequeue_pos;     ///< next ring position the server will take
+	epicsUInt32 server_pid;
+	char pad[164];
+};
+
+struct ShmSlot
+{
+	epicsInt32 seq;             ///< seqlock, odd while the server is changing the slot
+	epicsUInt32 kind;           ///< CaptureValue::Kind
+	epicsUInt32 encoded;        ///< 1 if the data is a capture encoded value, 0 for the raw elements of an array
+	epicsUInt32 ndims;
+	epicsUInt32 dims[2];        ///< slowest varying first, as CaptureValue::dims
+	epicsUInt64 offset;         ///< of the data from the start of the region, 8 byte aligned
+	epicsUInt64 capacity;       ///< bytes allocated at offset
+	epicsUInt64 length;         ///< bytes of data, or elements of a raw array
+	epicsUInt64 updates;
+	char vi[256];
+	char control[128];
+};
+
+struct ShmRequest
+{
+	epicsInt32 seq;             ///< ring position this cell is free for, +1 once it holds a request
+	epicsInt32 state;           ///< #ShmRequestState
+	epicsUInt32 type;           ///< #ShmRequestType
+	epicsUInt32 flags;
+	epicsInt32 status;          ///< 0 for success, in the response
+	epicsUInt32 length;         ///< bytes of data used
+	char vi[256];
+	char control[128];
+	char message[256];          ///< why the request failed, in the response
+	// followed by request_data_size bytes of capture encoded value
+};
+
+/// elements of an array held raw in a slot, as passed to a lvDCOMShmClient::readArray() reader
+struct ShmArrayView
+{
+	CaptureValue::Kind kind;    ///< Float64Array (double elements), Int32Array (epicsInt32) or BooleanArray (epicsInt16 VARIANT_BOOL)
+	size_t ndims;
+	size_t dims[2];             ///< slowest varying first
+	size_t n;                   ///< number of elements
+	const void* data;
+};
+
+/// the server has not created the region, or has stopped
+class lvDCOMShmUnavailable : public std::runtime_error
+{
+public:
+	explicit lvDCOMShmUnavailable(const std::string& message) : std::runtime_error(message) { }
+};
+
+/// the server did not respond to a request within the deadline
+class lvDCOMShmTimeout : public std::runtime_error
+{
+public:
+	explicit lvDCOMShmTimeout(const std::string& message) : std::runtime_error(message) { }
+};
+
+/// A named shared memory mapping, or a mapping of a file
+class lvDCOMShmRegion
+{
+public:
+	static lvDCOMShmRegion* create(const std::string& name, size_t size);
+	static lvDCOMShmRegion* open(const std::string& name);
+	static lvDCOMShmRegion* mapFile(const std::string& path, size_t size, bool writable);
+	~lvDCOMShmRegion();
+	char* base() const { return m_base; }
+	size_t size() const { return m_size; }
+	ShmHeader* header() const { return reinterpret_cast<ShmHeader*>(m_base); }
+	ShmSlot* slot(size_t i) const { return reinterpret_cast<ShmSlot*>(m_base + header()->slot_offset) + i; }
+	ShmRequest* cell(size_t i) const { return reinterpret_cast<ShmRequest*>(m_base + header()->ring_offset + i * header()->ring_stride); }
+	unsigned char* cellData(ShmRequest* r) const { return reinterpret_cast<unsigned char*>(r) + sizeof(ShmRequest); }
+	static std::string osName(const std::string& name);
+
+private:
+	lvDCOMShmRegion() : m_base(NULL), m_size(0), m_handle(NULL) { }
+	char* m_base;
+	size_t m_size;
+	void* m_handle;   ///< file mapping HANDLE on Windows, unused elsewhere
+	std::string m_unlink;  ///< name to remove when a region created here is closed, not used on Windows
+};
+
+/// Client side of the shared memory transport, see lvDCOMShm.h. Any number of threads may use it at once. The mapping
+/// is opened on first use, and again if the server restarts. Old mappings are kept until the client is deleted, so a
+/// thread still reading one is never left with an address that has gone.
+class lvDCOMShmClient
+{
+public:
+	explicit lvDCOMShmClient(const std::string& name);
+	~lvDCOMShmClient();
+	void get(const std::string& vi, const std::string& control, CaptureValue& value, double timeout);
+	template <typename Reader> bool readArray(const std::string& vi, const std::string& control, Reader& reader, double timeout);
+	void set(const std::string& vi, const std::string& control, const CaptureValue& value, epicsUInt32 flags, double timeout);
+	void call(const std::string& vi, const CaptureValue& names_values, CaptureValue& results, double timeout);
+	void update(const std::string& vi, const std::string& control, const CaptureValue& value, double timeout);
+	const std::string& name() const { return m_name; }
+	unsigned long opens();
+	void report(FILE* fp, int details);
+
+private:
+	typedef std::pair<std::string, std::string> control_key_t;  ///< (vi, control)
+	std::string m_name;
+	lvDCOMShmRegion* m_region;   ///< current mapping, or NULL
+	std::vector<lvDCOMShmRegion*> m_old_regions;
+	epicsInt32 m_epoch;          ///< of the server that initialised #m_region when #m_slots was built
+	std::map<control_key_t, size_t> m_slots;
+	size_t m_slots_seen;         ///< slots of #m_region already in #m_slots
+	epicsMutex m_lock;           ///< protects everything but the contents of the mapping
+	unsigned long m_opens, m_reads, m_retries, m_requests, m_timeouts, m_reopens, m_array_reads;
+
+	lvDCOMShmRegion* region();
+	ShmSlot* findSlot(const std::string& vi, const std::string& control, double timeout, lvDCOMShmRegion*& r);
+	void request(ShmRequestType type, const std::string& vi, const std::string& control, epicsUInt32 flags,
+	    const CaptureValue* value, CaptureValue* result, double timeout);
+	static void backoff(int attempt, const epicsTime& start);
+	void countRetry();
+};
+
+/// Server side of the shared memory transport, used by the component that sits with LabVIEW (and by lvDCOMShmWriter).
+/// publish() may be called from any thread, serve() from just one.
+class lvDCOMShmServer
+{
+public:
+	/// handles a request taken from the ring, \a value is the request value and is replaced by the response value.
+	/// Throw to fail the request, with the exception message as the reason
+	typedef void (*handler_t)(void* arg, ShmRequestType type, const std::string& vi, const std::string& control, epicsUInt32 flags, CaptureValue& value);
+	lvDCOMShmServer(const std::string& name, size_t slots, size_t ring_size, size_t request_data_size, size_t data_size);
+	~lvDCOMShmServer();
+	bool publish(const std::string& vi, const std::string& control, const CaptureValue& value, bool create);
+	int serve(handler_t handler, void* arg, int max_requests);
+	void heartbeat();
+	size_t slots();
+	size_t dataUsed() const { return static_cast<size_t>(m_region->header()->data_used); }
+
+private:
+	typedef std::pair<std::string, std::string> control_key_t;  ///< (vi, control)
+	lvDCOMShmRegion* m_region;
+	std::map<control_key_t, size_t> m_slots;
+	epicsMutex m_lock;            ///< serialises writers of slots
+	std::string m_buffer;         ///< re-used for encoding
+};
+
+/// wait a little longer each time a seqlock read or a request has to wait for the other side, which started at \a start:
+/// spin at first as the other side is usually just finishing, then yield for 10ms, then sleep a millisecond at a time
+inline void lvDCOMShmClient::backoff(int attempt, const epicsTime& start)
+{
+	if (attempt < 64)
+	{
+		return;
+	}
+	epicsThreadSleep(epicsTime::getCurrent() - start < 0.01 ? 0.0 : 0.001);
+}
+
+/// Read array control \a control of \a vi in place, calling \a reader(const ShmArrayView&) with its elements in the mapping. The
+/// reader must only copy what it needs, as it is called again if the server changed the slot while it was reading. Returns false
+/// without calling \a reader if the value is not a raw array, when the caller should use get() instead
+template <typename Reader>
+bool lvDCOMShmClient::readArray(const std::string& vi, const std::string& control, Reader& reader, double timeout)
+{
+	lvDCOMShmRegion* r;
+	ShmSlot* slot = findSlot(vi, control, timeout, r);
+	epicsTime start = epicsTime::getCurrent();
+	for(int attempt = 0; ; ++attempt)
+	{
+		epicsInt32 seq = epicsAtomicGetIntT(&(slot->seq));
+		if ( (seq & 1) != 0 )
+		{
+			backoff(attempt, start);
+			continue;
+		}
+		epicsAtomicReadMemoryBarrier();
+		ShmArrayView view;
+		view.kind = static_cast<CaptureValue::Kind>(slot->kind);
+		view.ndims = (slot->ndims > 2 ? 2 : slot->ndims);
+		view.dims[0] = slot->dims[0];
+		view.dims[1] = slot->dims[1];
+		view.n = static_cast<size_t>(slot->length);
+		size_t element = (view.kind == CaptureValue::Float64Array ? 8 : (view.kind == CaptureValue::BooleanArray ? 2 : 4));
+		epicsUInt64 offset = slot->offset;
+		bool raw = (slot->encoded == 0);
+		// a torn read can see any values, so check them before use
+		bool sane = raw && offset + view.n * element <= r->size() && offset + slot->capacity <= r->size();
+		view.data = (sane ? r->base() + offset : NULL);
+		if (sane)
+		{
+			reader(view);
+		}
+		epicsAtomicReadMemoryBarrier();
+		if (epicsAtomicGetIntT(&(slot->seq)) == seq)
+		{
+			epicsGuard<epicsMutex> _lock(m_lock);
+			++m_array_reads;
+			return sane;
+		}
+		countRetry();
+		backoff(attempt, start);
+	}
+}
+
+#endif /* LV_DCOM_SHM_H */
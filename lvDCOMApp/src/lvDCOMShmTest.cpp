@@ -0,0 +1,334 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMShmTest.cpp Unit tests of the shared memory transport, #lvDCOMShmServer and #lvDCOMShmClient.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+///
+/// A server in this process serves a map of control values from a thread. Values are read from their slots, set and
+/// called through the request ring, several client threads fill the ring at once, and an array is read in place while
+/// the server keeps changing it, which a broken seqlock would show as an array with elements from two different writes.
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsGuard.h>
+#include <epicsTime.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "lvDCOMCapture.h"
+#include "lvDCOMShm.h"
+
+static const double timeout = 5.0;      ///< seconds to wait for the server
+static const int ring_threads = 4;      ///< client threads putting requests on the ring at once
+static const int ring_requests = 200;   ///< sets made by each of them
+static const size_t array_elements = 10000;
+
+typedef std::pair<std::string, std::string> control_key_t;
+
+/// the stand in for LabVIEW that the server thread serves
+struct TestServer
+{
+	lvDCOMShmServer* server;
+	std::map<control_key_t, CaptureValue> values;
+	epicsMutex lock;               ///< protects values and sets
+	int sets;
+	volatile bool stop;
+	epicsEvent done;
+	TestServer() : server(NULL), sets(0), stop(false) { }
+};
+
+static void handle(void* arg, ShmRequestType type, const std::string& vi, const std::string& control, epicsUInt32 /*flags*/, CaptureValue& value)
+{
+	TestServer& t = *static_cast<TestServer*>(arg);
+	epicsGuard<epicsMutex> _lock(t.lock);
+	std::map<control_key_t, CaptureValue>::const_iterator it;
+	switch(type)
+	{
+		case ShmGet:
+			it = t.values.find(control_key_t(vi, control));
+			if (it == t.values.end())
+			{
+				throw std::runtime_error("no control \"" + control + "\"");
+			}
+			t.server->publish(vi, control, it->second, true);
+			value = CaptureValue();
+			break;
+		case ShmSet:
+			t.values[control_key_t(vi, control)] = value;
+			t.server->publish(vi, control, value, false);
+			++t.sets;
+			value = CaptureValue();
+			break;
+		case ShmCall:
+			value.ival += 1;  // so the caller can tell the call was made
+			break;
+		default:
+			throw std::runtime_error("unknown request");
+	}
+}
+
+static void serveTask(void* arg)
+{
+	TestServer& t = *static_cast<TestServer*>(arg);
+	while(!t.stop)
+	{
+		if (t.server->serve(handle, &t, 16) == 0)
+		{
+			epicsThreadSleep(0.0001);
+		}
+	}
+	t.done.signal();
+}
+
+static CaptureValue int32Value(epicsInt32 i)
+{
+	CaptureValue v;
+	v.kind = CaptureValue::Int32;
+	v.ival = i;
+	return v;
+}
+
+static CaptureValue stringValue(const std::string& s)
+{
+	CaptureValue v;
+	v.kind = CaptureValue::String;
+	v.sval = s;
+	return v;
+}
+
+static CaptureValue arrayValue(size_t n, double first)
+{
+	CaptureValue v;
+	v.kind = CaptureValue::Float64Array;
+	v.dims.assign(1, static_cast<epicsUInt32>(n));
+	v.farray.assign(n, first);
+	return v;
+}
+
+/// one of the client threads filling the ring
+struct RingClient
+{
+	lvDCOMShmClient* client;
+	int id;
+	int failures;
+	epicsEvent done;
+};
+
+static void ringTask(void* arg)
+{
+	RingClient& c = *static_cast<RingClient*>(arg);
+	char control[32];
+	sprintf(control, "ring%d", c.id);
+	for(int i = 0; i < ring_requests; ++i)
+	{
+		try
+		{
+			c.client->set("test.vi", control, int32Value(i), 0, timeout);
+		}
+		catch(const std::exception&)
+		{
+			++c.failures;
+		}
+	}
+	c.done.signal();
+}
+
+/// keeps changing the array while the main thread reads it
+struct ArrayPublisher
+{
+	lvDCOMShmServer* server;
+	volatile bool stop;
+	int writes;
+	epicsEvent done;
+};
+
+static void publishTask(void* arg)
+{
+	ArrayPublisher& p = *static_cast<ArrayPublisher*>(arg);
+	for(p.writes = 1; !p.stop; ++p.writes)
+	{
+		p.server->publish("test.vi", "array", arrayValue(array_elements, p.writes), false);
+	}
+	p.done.signal();
+}
+
+/// checks every element of an array read in place came from the same write
+struct ArrayCheck
+{
+	size_t n;
+	bool consistent;
+	void operator()(const ShmArrayView& view)
+	{
+		const double* data = static_cast<const double*>(view.data);
+		n = view.n;
+		consistent = (view.kind == CaptureValue::Float64Array);
+		for(size_t i = 1; i < view.n && consistent; ++i)
+		{
+			consistent = (data[i] == data[0]);
+		}
+	}
+};
+
+MAIN(lvDCOMShmTest)
+{
+	testPlan(17);
+	char name[64];
+#ifdef _WIN32
+	sprintf(name, "lvDCOMShmTest%lu", static_cast<unsigned long>(GetCurrentProcessId()));
+#else
+	sprintf(name, "lvDCOMShmTest%lu", static_cast<unsigned long>(getpid()));
+#endif
+
+	testDiag("client with no server");
+	lvDCOMShmClient client(name);
+	CaptureValue value;
+	try
+	{
+		client.get("test.vi", "number", value, timeout);
+		testFail("get with no server");
+	}
+	catch(const lvDCOMShmUnavailable&)
+	{
+		testPass("get with no server throws lvDCOMShmUnavailable");
+	}
+
+	TestServer t;
+	t.server = new lvDCOMShmServer(name, 64, 8, 65536, 4 * 1048576);
+	t.values[control_key_t("test.vi", "number")] = int32Value(42);
+	t.values[control_key_t("test.vi", "text")] = stringValue("hello");
+	epicsThreadCreate("lvDCOMShmTest", epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackMedium), serveTask, &t);
+
+	testDiag("slots published on first get, then read without the server");
+	client.get("test.vi", "number", value, timeout);
+	testOk(value == int32Value(42), "number read as %d", value.ival);
+	client.get("test.vi", "text", value, timeout);
+	testOk(value == stringValue("hello"), "text read as \"%s\"", value.sval.c_str());
+	testOk1(t.server->slots() == 2 && client.opens() == 1);
+	try
+	{
+		client.get("test.vi", "missing", value, timeout);
+		testFail("get of an unknown control");
+	}
+	catch(const std::runtime_error& ex)
+	{
+		testOk(strstr(ex.what(), "missing") != NULL, "get of an unknown control fails with \"%s\"", ex.what());
+	}
+
+	testDiag("set and call through the ring");
+	client.set("test.vi", "number", int32Value(7), 0, timeout);
+	client.get("test.vi", "number", value, timeout);
+	testOk(value == int32Value(7), "number set to %d", value.ival);
+	std::string long_text(1000, 'x');
+	client.set("test.vi", "text", stringValue(long_text), 0, timeout);
+	client.get("test.vi", "text", value, timeout);
+	testOk1(value == stringValue(long_text));
+	CaptureValue results;
+	client.call("test.vi", int32Value(10), results, timeout);
+	testOk(results.kind == CaptureValue::Int32 && results.ival == 11, "call returned %d", results.ival);
+	try
+	{
+		client.set("test.vi", "huge", arrayValue(100000, 0.0), 0, timeout);
+		testFail("set larger than the request size");
+	}
+	catch(const std::runtime_error&)
+	{
+		testPass("set larger than the request size throws");
+	}
+
+	testDiag("%d threads each making %d sets through a ring of 8 cells", ring_threads, ring_requests);
+	RingClient clients[ring_threads];
+	{
+		epicsGuard<epicsMutex> _lock(t.lock);
+		t.sets = 0;
+	}
+	for(int i = 0; i < ring_threads; ++i)
+	{
+		clients[i].client = &client;
+		clients[i].id = i;
+		clients[i].failures = 0;
+		epicsThreadCreate("lvDCOMShmRing", epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackMedium), ringTask, &(clients[i]));
+	}
+	int failures = 0;
+	for(int i = 0; i < ring_threads; ++i)
+	{
+		clients[i].done.wait();
+		failures += clients[i].failures;
+	}
+	testOk(failures == 0, "%d sets failed", failures);
+	{
+		epicsGuard<epicsMutex> _lock(t.lock);
+		testOk(t.sets == ring_threads * ring_requests, "server handled %d sets", t.sets);
+		bool last = true;
+		for(int i = 0; i < ring_threads; ++i)
+		{
+			char control[32];
+			sprintf(control, "ring%d", i);
+			last = last && (t.values[control_key_t("test.vi", control)] == int32Value(ring_requests - 1));
+		}
+		testOk(last, "each thread's last set is the value kept");
+	}
+
+	testDiag("array read in place while the server changes it");
+	t.server->publish("test.vi", "array", arrayValue(array_elements, 0.0), true);
+	client.get("test.vi", "array", value, timeout);
+	testOk1(value == arrayValue(array_elements, 0.0));
+	ArrayCheck check;
+	check.n = 0;
+	check.consistent = false;
+	testOk1(client.readArray("test.vi", "array", check, timeout) && check.n == array_elements && check.consistent);
+	testOk1(!client.readArray("test.vi", "text", check, timeout));
+	ArrayPublisher publisher;
+	publisher.server = t.server;
+	publisher.stop = false;
+	publisher.writes = 0;
+	epicsThreadCreate("lvDCOMShmPublish", epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackMedium), publishTask, &publisher);
+	int torn = 0, reads = 0;
+	epicsTime start = epicsTime::getCurrent();
+	for(; epicsTime::getCurrent() - start < 0.5; ++reads)
+	{
+		if (!client.readArray("test.vi", "array", check, timeout) || !check.consistent || check.n != array_elements)
+		{
+			++torn;
+		}
+	}
+	publisher.stop = true;
+	publisher.done.wait();
+	testOk(torn == 0, "%d of %d reads during %d writes saw a torn array", torn, reads, publisher.writes);
+
+	testDiag("server gone");
+	t.stop = true;
+	t.done.wait();
+	delete t.server;
+	try
+	{
+		client.set("test.vi", "number", int32Value(1), 0, timeout);
+		testFail("set after the server has gone");
+	}
+	catch(const lvDCOMShmUnavailable&)
+	{
+		testPass("set after the server has gone throws lvDCOMShmUnavailable");
+	}
+	client.report(stdout, 1);
+
+	return testDone();
+}
@@ -0,0 +1,181 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMShmWriter.cpp Stand in for the LabVIEW side of the shared memory transport, serving #lvDCOMSimBackend.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+///
+/// Usage: lvDCOMShmWriter [-n name] [-l latency] [-d data_mb] [-r request_kb] [-a elements] [-p period]
+///
+///   -n name         shared memory name (default lvDCOM), an IOC uses it with lvDCOMConfigure host shm://name
+///   -l latency      each get, set and call takes this many extra seconds (default 0), to model a slow VI
+///   -d data_mb      megabytes for control values (default 64)
+///   -r request_kb   kilobytes for the value of each request (default 1024), the largest array that can be set
+///   -a elements     also publish a Float64Array control "array" on VI "lvDCOMShmWriter" of this many elements,
+///                   every element changing each period, to measure reading large arrays in place
+///   -p period       seconds between changes of that array (default 0.1)
+///
+/// Serves requests as lvDCOMTcpServer does, publishing the value of each control a client gets and keeping that
+/// up to date as it is set or updated. The component that sits with LabVIEW does the same with the controls of the
+/// real VIs, using lvDCOMShmServer.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+#include "lvDCOMCapture.h"
+#include "lvDCOMSimBackend.h"
+#include "lvDCOMShm.h"
+
+struct ShmWriter
+{
+	lvDCOMShmServer* server;
+	lvDCOMSimBackend backend;
+	double latency;
+	size_t elements;
+	double period;
+	ShmWriter() : server(NULL), latency(0.0), elements(0), period(0.1) { }
+};
+
+static void handle(void* arg, ShmRequestType type, const std::string& vi, const std::string& control, epicsUInt32 /*flags*/, CaptureValue& value)
+{
+	ShmWriter& w = *static_cast<ShmWriter*>(arg);
+	switch(type)
+	{
+		case ShmGet:
+			w.backend.getControlValue(vi, control, value, w.latency);
+			w.server->publish(vi, control, value, true);
+			value = CaptureValue();
+			break;
+		case ShmSet:
+			w.backend.setControlValue(vi, control, value, w.latency);
+			w.server->publish(vi, control, value, false);
+			value = CaptureValue();
+			break;
+		case ShmCall:
+			w.backend.call(vi, value, w.latency);
+			break;
+		case ShmUpdate:
+			if (control.size() == 0)
+			{
+				w.backend.updateCall(vi, value);
+			}
+			else if (w.backend.update(vi, control, value))
+			{
+				w.server->publish(vi, control, value, false);
+			}
+			value = CaptureValue();
+			break;
+		default:
+			throw std::runtime_error("unknown request");
+	}
+}
+
+/// publish the changing array of -a
+static void arrayTask(void* arg)
+{
+	ShmWriter& w = *static_cast<ShmWriter*>(arg);
+	CaptureValue value;
+	value.kind = CaptureValue::Float64Array;
+	value.dims.push_back(static_cast<epicsUInt32>(w.elements));
+	value.farray.resize(w.elements);
+	for(epicsUInt32 n = 0; ; ++n)
+	{
+		for(size_t i = 0; i < w.elements; ++i)
+		{
+			value.farray[i] = n + i * 1e-6;
+		}
+		w.server->publish("lvDCOMShmWriter", "array", value, true);
+		epicsThreadSleep(w.period);
+	}
+}
+
+static void usage()
+{
+	fprintf(stderr, "Usage: lvDCOMShmWriter [-n name] [-l latency] [-d data_mb] [-r request_kb] [-a elements] [-p period]\n");
+	exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+	std::string name = "lvDCOM";
+	double data_mb = 64.0, request_kb = 1024.0;
+	ShmWriter w;
+	for(int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-n") && i + 1 < argc)
+		{
+			name = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+		{
+			w.latency = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-d") && i + 1 < argc)
+		{
+			data_mb = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+		{
+			request_kb = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-a") && i + 1 < argc)
+		{
+			w.elements = static_cast<size_t>(atol(argv[++i]));
+		}
+		else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+		{
+			w.period = atof(argv[++i]);
+		}
+		else
+		{
+			usage();
+		}
+	}
+	if (name.size() == 0 || w.latency < 0.0 || data_mb <= 0.0 || request_kb <= 0.0 || w.period <= 0.0)
+	{
+		usage();
+	}
+	try
+	{
+		w.server = new lvDCOMShmServer(name, 4096, 16, static_cast<size_t>(request_kb * 1024.0), static_cast<size_t>(data_mb * 1048576.0));
+	}
+	catch(const std::exception& ex)
+	{
+		fprintf(stderr, "lvDCOMShmWriter: %s\n", ex.what());
+		return 1;
+	}
+	printf("lvDCOMShmWriter: serving shared memory \"%s\"\n", name.c_str());
+	fflush(stdout);
+	if (w.elements > 0 && epicsThreadCreate("lvDCOMShmArray", epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackMedium),
+	        arrayTask, &w) == 0)
+	{
+		fprintf(stderr, "lvDCOMShmWriter: epicsThreadCreate failure\n");
+		return 1;
+	}
+	// poll the request ring, yielding for 10ms after each request before backing off to a millisecond between polls
+	epicsTime last = epicsTime::getCurrent();
+	while(true)
+	{
+		if (w.server->serve(handle, &w, 64) > 0)
+		{
+			last = epicsTime::getCurrent();
+		}
+		else
+		{
+			epicsThreadSleep(epicsTime::getCurrent() - last < 0.01 ? 0.0 : 0.001);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,84 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMSimBackend.cpp Implementation of #lvDCOMSimBackend class.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#include <string>
+#include <map>
+#include <stdexcept>
+
+#include <epicsMutex.h>
+#include <epicsGuard.h>
+#include <epicsThread.h>
+
+#include "lvDCOMSimBackend.h"
+
+/// block for \a latency seconds, as a DCOM call to LabVIEW would
+void lvDCOMSimBackend::delay(double latency)
+{
+	if (latency > 0.0)
+	{
+		epicsThreadSleep(latency);
+	}
+}
+
+/// read a control, which must have been given a value by setControlValue() or update()
+void lvDCOMSimBackend::getControlValue(const std::string& vi, const std::string& control, CaptureValue& value, double latency)
+{
+	delay(latency);
+	epicsGuard<epicsMutex> _lock(m_lock);
+	std::map<control_key_t, CaptureValue>::const_iterator it = m_controls.find(control_key_t(vi, control));
+	if (it == m_controls.end())
+	{
+		throw std::runtime_error("lvDCOMSimBackend: no control \"" + control + "\" on \"" + vi + "\"");
+	}
+	value = it->second;
+	++m_gets;
+}
+
+void lvDCOMSimBackend::setControlValue(const std::string& vi, const std::string& control, const CaptureValue& value, double latency)
+{
+	delay(latency);
+	epicsGuard<epicsMutex> _lock(m_lock);
+	m_controls[control_key_t(vi, control)] = value;
+	++m_sets;
+}
+
+/// run a VI, \a values is replaced by the result given to updateCall() for it
+void lvDCOMSimBackend::call(const std::string& vi, CaptureValue& values, double latency)
+{
+	delay(latency);
+	epicsGuard<epicsMutex> _lock(m_lock);
+	std::map<std::string, CaptureValue>::const_iterator it = m_call_results.find(vi);
+	if (it == m_call_results.end())
+	{
+		throw std::runtime_error("lvDCOMSimBackend: no call result for \"" + vi + "\"");
+	}
+	values = it->second;
+	++m_calls;
+}
+
+/// change a control from the LabVIEW side, as a running VI updating an indicator would. Returns true if the value differed
+bool lvDCOMSimBackend::update(const std::string& vi, const std::string& control, const CaptureValue& value)
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	CaptureValue& current = m_controls[control_key_t(vi, control)];
+	if (current == value)
+	{
+		return false;
+	}
+	current = value;
+	return true;
+}
+
+/// set what the next call() of \a vi returns
+void lvDCOMSimBackend::updateCall(const std::string& vi, const CaptureValue& values)
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	m_call_results[vi] = values;
+}
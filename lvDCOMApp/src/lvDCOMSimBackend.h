@@ -0,0 +1,50 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMSimBackend.h header for #lvDCOMSimBackend class.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#ifndef LV_DCOM_SIM_BACKEND_H
+#define LV_DCOM_SIM_BACKEND_H
+
+#include <string>
+#include <map>
+#include <utility>
+
+#include <epicsMutex.h>
+
+#include "lvDCOMCapture.h"
+
+/// In memory stand in for LabVIEW, holding a value for each VI control and the last result of calling each VI.
+/// Each operation can be made to take a given time, to model the DCOM round trip of the system that was captured.
+/// Used by lvDCOMReplay, it does not need Windows.
+class lvDCOMSimBackend
+{
+public:
+	lvDCOMSimBackend() : m_gets(0), m_sets(0), m_calls(0) { }
+	void getControlValue(const std::string& vi, const std::string& control, CaptureValue& value, double latency);
+	void setControlValue(const std::string& vi, const std::string& control, const CaptureValue& value, double latency);
+	void call(const std::string& vi, CaptureValue& values, double latency);
+	bool update(const std::string& vi, const std::string& control, const CaptureValue& value);
+	void updateCall(const std::string& vi, const CaptureValue& values);
+	size_t controls() const { return m_controls.size(); }
+	unsigned long gets() const { return m_gets; }
+	unsigned long sets() const { return m_sets; }
+	unsigned long calls() const { return m_calls; }
+
+private:
+	typedef std::pair<std::string, std::string> control_key_t;  ///< (vi, control)
+	std::map<control_key_t, CaptureValue> m_controls;
+	std::map<std::string, CaptureValue> m_call_results;  ///< keyed by vi
+	epicsMutex m_lock;
+	unsigned long m_gets;
+	unsigned long m_sets;
+	unsigned long m_calls;
+	static void delay(double latency);
+};
+
+#endif /* LV_DCOM_SIM_BACKEND_H */
@@ -0,0 +1,219 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMSnapshot.cpp Implementation of #lvDCOMSnapshot class.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+///
+/// File layout (native byte order, the file is only ever read back on the machine that wrote it):
+///   "LVDCOMS1"  magic
+///   uint32      number of entries
+///   entries     for each: uint8 type, uint16 name length, name, uint32 secPastEpoch, uint32 nsec, value
+///               where value is a float64, an int32, or a uint32 count followed by that many chars / elements
+///   uint32      FNV-1a checksum of everything before it
+
+#include <stdio.h>
+#include <string.h>
+
+#include <windows.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+
+#include "lvDCOMSnapshot.h"
+
+static const char snapshot_magic[] = "LVDCOMS1";
+
+lvDCOMSnapshot::lvDCOMSnapshot(const std::string& file_name) : m_file_name(file_name)
+{
+}
+
+epicsUInt32 lvDCOMSnapshot::checksum(const char* data, size_t n)
+{
+	epicsUInt32 h = 2166136261u;
+	for(size_t i = 0; i < n; ++i)
+	{
+		h ^= static_cast<unsigned char>(data[i]);
+		h *= 16777619u;
+	}
+	return h;
+}
+
+bool lvDCOMSnapshot::get(const std::string& buffer, size_t& pos, void* data, size_t n)
+{
+	if (pos + n > buffer.size())
+	{
+		return false;
+	}
+	memcpy(data, buffer.data() + pos, n);
+	pos += n;
+	return true;
+}
+
+/// serialise \a entries and replace the snapshot file with them. The new file is written alongside the
+/// old one and then renamed over it, so readers only ever see a complete file
+void lvDCOMSnapshot::save(const std::vector<SnapshotEntry>& entries)
+{
+	std::string buffer;
+	put(buffer, snapshot_magic, 8);
+	epicsUInt32 n = static_cast<epicsUInt32>(entries.size());
+	put(buffer, &n, sizeof(n));
+	for(std::vector<SnapshotEntry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		epicsUInt8 type = static_cast<epicsUInt8>(it->type);
+		epicsUInt16 name_len = static_cast<epicsUInt16>(it->name.size());
+		put(buffer, &type, sizeof(type));
+		put(buffer, &name_len, sizeof(name_len));
+		put(buffer, it->name.data(), name_len);
+		put(buffer, &(it->stamp.secPastEpoch), sizeof(it->stamp.secPastEpoch));
+		put(buffer, &(it->stamp.nsec), sizeof(it->stamp.nsec));
+		epicsUInt32 count = 0;
+		switch(it->type)
+		{
+			case asynParamFloat64:
+				put(buffer, &(it->dval), sizeof(it->dval));
+				break;
+			case asynParamInt32:
+				put(buffer, &(it->ival), sizeof(it->ival));
+				break;
+			case asynParamOctet:
+				count = static_cast<epicsUInt32>(it->sval.size());
+				put(buffer, &count, sizeof(count));
+				put(buffer, it->sval.data(), count);
+				break;
+			case asynParamFloat64Array:
+				count = static_cast<epicsUInt32>(it->farray.size());
+				put(buffer, &count, sizeof(count));
+				if (count > 0)
+				{
+					put(buffer, &(it->farray[0]), count * sizeof(epicsFloat64));
+				}
+				break;
+			case asynParamInt32Array:
+				count = static_cast<epicsUInt32>(it->iarray.size());
+				put(buffer, &count, sizeof(count));
+				if (count > 0)
+				{
+					put(buffer, &(it->iarray[0]), count * sizeof(epicsInt32));
+				}
+				break;
+			default:
+				throw std::runtime_error("lvDCOMSnapshot: unsupported type for " + it->name);
+		}
+	}
+	epicsUInt32 sum = checksum(buffer.data(), buffer.size());
+	put(buffer, &sum, sizeof(sum));
+
+	std::string tmp_name = m_file_name + ".tmp";
+	std::fstream fs(tmp_name.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!fs.good())
+	{
+		throw std::runtime_error("lvDCOMSnapshot: cannot create " + tmp_name);
+	}
+	fs.write(buffer.data(), buffer.size());
+	fs.close();
+	if (fs.fail())
+	{
+		throw std::runtime_error("lvDCOMSnapshot: error writing " + tmp_name);
+	}
+	if (MoveFileEx(tmp_name.c_str(), m_file_name.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) == 0)
+	{
+		throw std::runtime_error("lvDCOMSnapshot: cannot replace " + m_file_name);
+	}
+}
+
+/// read the snapshot file into \a entries, returns false (and no entries) if it does not exist or is damaged
+bool lvDCOMSnapshot::load(std::vector<SnapshotEntry>& entries)
+{
+	entries.clear();
+	std::fstream fs(m_file_name.c_str(), std::ios::in | std::ios::binary);
+	if (!fs.good())
+	{
+		return false;
+	}
+	std::string buffer((std::istreambuf_iterator<char>(fs)), std::istreambuf_iterator<char>());
+	fs.close();
+	epicsUInt32 sum = 0;
+	if (buffer.size() < 8 + sizeof(epicsUInt32) + sizeof(sum) || buffer.compare(0, 8, snapshot_magic) != 0)
+	{
+		return false;
+	}
+	memcpy(&sum, buffer.data() + buffer.size() - sizeof(sum), sizeof(sum));
+	buffer.resize(buffer.size() - sizeof(sum));
+	if (sum != checksum(buffer.data(), buffer.size()))
+	{
+		return false;
+	}
+	size_t pos = 8;
+	epicsUInt32 n = 0;
+	get(buffer, pos, &n, sizeof(n));
+	for(epicsUInt32 i = 0; i < n; ++i)
+	{
+		SnapshotEntry entry;
+		epicsUInt8 type = 0;
+		epicsUInt16 name_len = 0;
+		epicsUInt32 count = 0;
+		if ( !get(buffer, pos, &type, sizeof(type)) || !get(buffer, pos, &name_len, sizeof(name_len)) || pos + name_len > buffer.size() )
+		{
+			entries.clear();
+			return false;
+		}
+		entry.type = static_cast<asynParamType>(type);
+		entry.name.assign(buffer.data() + pos, name_len);
+		pos += name_len;
+		bool ok = get(buffer, pos, &(entry.stamp.secPastEpoch), sizeof(entry.stamp.secPastEpoch)) &&
+		          get(buffer, pos, &(entry.stamp.nsec), sizeof(entry.stamp.nsec));
+		switch(entry.type)
+		{
+			case asynParamFloat64:
+				ok = ok && get(buffer, pos, &(entry.dval), sizeof(entry.dval));
+				break;
+			case asynParamInt32:
+				ok = ok && get(buffer, pos, &(entry.ival), sizeof(entry.ival));
+				break;
+			case asynParamOctet:
+				ok = ok && get(buffer, pos, &count, sizeof(count)) && (pos + count <= buffer.size());
+				if (ok)
+				{
+					entry.sval.assign(buffer.data() + pos, count);
+					pos += count;
+				}
+				break;
+			case asynParamFloat64Array:
+				ok = ok && get(buffer, pos, &count, sizeof(count)) && (pos + count * sizeof(epicsFloat64) <= buffer.size());
+				if (ok)
+				{
+					entry.farray.resize(count);
+					ok = (count == 0 || get(buffer, pos, &(entry.farray[0]), count * sizeof(epicsFloat64)));
+				}
+				break;
+			case asynParamInt32Array:
+				ok = ok && get(buffer, pos, &count, sizeof(count)) && (pos + count * sizeof(epicsInt32) <= buffer.size());
+				if (ok)
+				{
+					entry.iarray.resize(count);
+					ok = (count == 0 || get(buffer, pos, &(entry.iarray[0]), count * sizeof(epicsInt32)));
+				}
+				break;
+			default:
+				ok = false;
+				break;
+		}
+		if (!ok)
+		{
+			entries.clear();
+			return false;
+		}
+		entries.push_back(entry);
+	}
+	return true;
+}
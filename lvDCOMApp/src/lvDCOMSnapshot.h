@@ -0,0 +1,54 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMSnapshot.h header for #lvDCOMSnapshot class.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#ifndef LV_DCOM_SNAPSHOT_H
+#define LV_DCOM_SNAPSHOT_H
+
+#include <string>
+#include <vector>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+
+#include "asynPortDriver.h"
+
+/// Last known value of one asyn parameter, as held in an #lvDCOMSnapshot file
+struct SnapshotEntry
+{
+	std::string name;       ///< asyn parameter name
+	asynParamType type;     ///< which of the value members below is used
+	epicsTimeStamp stamp;   ///< when the value was last read from LabVIEW
+	epicsFloat64 dval;
+	epicsInt32 ival;
+	std::string sval;
+	std::vector<epicsFloat64> farray;
+	std::vector<epicsInt32> iarray;
+	SnapshotEntry() : type(asynParamNotDefined), dval(0.0), ival(0) { stamp.secPastEpoch = stamp.nsec = 0; }
+};
+
+/// Reads and writes a compact binary file of last known parameter values, used by #lvDCOMDriver to give
+/// records a value at IOC start before LabVIEW can be read. The file is replaced atomically, so a crash
+/// while saving leaves the previous snapshot intact, and is checksummed so a damaged file is ignored.
+class lvDCOMSnapshot
+{
+public:
+	explicit lvDCOMSnapshot(const std::string& file_name);
+	bool load(std::vector<SnapshotEntry>& entries);
+	void save(const std::vector<SnapshotEntry>& entries);
+	const std::string& fileName() const { return m_file_name; }
+
+private:
+	std::string m_file_name;
+	static void put(std::string& buffer, const void* data, size_t n) { buffer.append(static_cast<const char*>(data), n); }
+	static bool get(const std::string& buffer, size_t& pos, void* data, size_t n);
+	static epicsUInt32 checksum(const char* data, size_t n);
+};
+
+#endif /* LV_DCOM_SNAPSHOT_H */
@@ -0,0 +1,252 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMSoak.cpp Soak test of read, write and reconnect cycles against #lvDCOMSimBackend, checking memory use stays flat.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+///
+/// Usage: lvDCOMSoak [-n cycles] [-r reconnect] [-g growth] [-c host:port [-i]]
+///
+///   -n cycles       number of cycles (default 1000000), each sets a number, a string and a 100 element array and
+///                   reads them back
+///   -r reconnect    make a new connection every this many cycles (default 1000), alternating between subscribing
+///                   to the controls and not, so both ways of reading are exercised
+///   -g growth       fail if the memory the process uses grows by more than this many kB (default 1024) between the
+///                   end of the first tenth of the cycles, by when everything should have been allocated, and the end
+///   -c host:port    go through the TCP transport to a server such as lvDCOMTcpServer, which serves an #lvDCOMSimBackend,
+///                   rather than to an #lvDCOMSimBackend in this process (which has no connection, so ignores -r)
+///   -i              (Windows only) with -c, go through an #lvDCOMInterface with the host tcp://host:port, as an IOC
+///                   does, creating and destroying the interface rather than just its connection every -r cycles
+///
+/// Progress, the rate and memory use are printed every tenth of the cycles. The exit status is 0 only if every value
+/// read back was the one written, no operation failed and memory use did not grow by more than the limit. Memory use is
+/// the private bytes of the process on Windows and the resident set elsewhere; where it cannot be found it is not checked.
+/// Talking to LabVIEW over DCOM needs Windows and LabVIEW so is not covered, this soaks the parts that run on any host.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>  // for osiSock.h, must come before windows.h
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+
+#include "lvDCOMCapture.h"
+#include "lvDCOMSimBackend.h"
+#include "lvDCOMTcpClient.h"
+#ifdef _WIN32
+#include "lvDCOMInterface.h"
+#else
+class lvDCOMInterface;  ///< only built on Windows, see -i
+#endif
+
+static const double tcp_timeout = 10.0;  ///< seconds to wait for a reply through TCP
+static const char* soak_vi = "c:\\labview\\soak.vi";
+
+/// kB of memory the process uses, or 0.0 if it cannot be found
+static double memoryUsed()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS_EX pmc;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&pmc), sizeof(pmc)))
+	{
+		return static_cast<double>(pmc.PrivateUsage) / 1024.0;
+	}
+	return 0.0;
+#else
+	FILE* f = fopen("/proc/self/statm", "r");
+	unsigned long size = 0, resident = 0;
+	if (f == NULL)
+	{
+		return 0.0;
+	}
+	if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+	{
+		resident = 0;
+	}
+	fclose(f);
+	return static_cast<double>(resident) * static_cast<double>(sysconf(_SC_PAGESIZE)) / 1024.0;
+#endif
+}
+
+/// the values written in cycle \a i
+static void cycleValues(unsigned long i, std::vector<TcpItem>& items)
+{
+	items.resize(3);
+	items[0] = TcpItem(soak_vi, "number");
+	items[0].value.kind = CaptureValue::Float64;
+	items[0].value.dval = static_cast<double>(i) * 0.5;
+	items[1] = TcpItem(soak_vi, "text");
+	items[1].value.kind = CaptureValue::String;
+	char buffer[32];
+	sprintf(buffer, "cycle %lu", i);
+	items[1].value.sval = buffer;
+	items[2] = TcpItem(soak_vi, "array");
+	items[2].value.kind = CaptureValue::Int32Array;
+	items[2].value.dims.assign(1, 100);
+	items[2].value.iarray.resize(100);
+	for(int j = 0; j < 100; ++j)
+	{
+		items[2].value.iarray[j] = static_cast<epicsInt32>(i + j);
+	}
+}
+
+/// write the values of cycle \a i to \a backend, or through \a client or \a dcom if not NULL, and read them back into \a got.
+/// Returns the number of values that failed or were not read back as written
+static unsigned long cycle(unsigned long i, lvDCOMSimBackend& backend, lvDCOMTcpClient* client, lvDCOMInterface* dcom,
+    std::vector<TcpItem>& items, std::vector<TcpItem>& got)
+{
+	unsigned long errors = 0;
+	cycleValues(i, items);
+	got.resize(items.size());
+	for(size_t j = 0; j < items.size(); ++j)
+	{
+		got[j] = TcpItem(items[j].vi, items[j].control);
+	}
+	if (client != NULL)
+	{
+		client->set(items, tcp_timeout);
+		client->get(got, tcp_timeout);
+	}
+#ifdef _WIN32
+	else if (dcom != NULL)
+	{
+		for(size_t j = 0; j < items.size(); ++j)
+		{
+			dcom->setControlValue(items[j].vi, items[j].control, items[j].value, false, tcp_timeout);
+			dcom->getControlValue(got[j].vi, got[j].control, got[j].value, tcp_timeout);
+		}
+	}
+#endif
+	else
+	{
+		for(size_t j = 0; j < items.size(); ++j)
+		{
+			backend.setControlValue(items[j].vi, items[j].control, items[j].value, 0.0);
+			backend.getControlValue(got[j].vi, got[j].control, got[j].value, 0.0);
+		}
+	}
+	for(size_t j = 0; j < items.size(); ++j)
+	{
+		if (items[j].status != 0 || got[j].status != 0 || got[j].value != items[j].value)
+		{
+			++errors;
+		}
+	}
+	return errors;
+}
+
+static void usage()
+{
+	fprintf(stderr, "Usage: lvDCOMSoak [-n cycles] [-r reconnect] [-g growth] [-c host:port [-i]]\n");
+	exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned long ncycles = 1000000, reconnect = 1000;
+	double max_growth = 1024.0;
+	const char* tcp_address = NULL;
+	bool use_interface = false;
+	for(int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-n") && i + 1 < argc)
+		{
+			ncycles = strtoul(argv[++i], NULL, 0);
+		}
+		else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+		{
+			reconnect = strtoul(argv[++i], NULL, 0);
+		}
+		else if (!strcmp(argv[i], "-g") && i + 1 < argc)
+		{
+			max_growth = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+		{
+			tcp_address = argv[++i];
+		}
+#ifdef _WIN32
+		else if (!strcmp(argv[i], "-i"))
+		{
+			use_interface = true;
+		}
+#endif
+		else
+		{
+			usage();
+		}
+	}
+	if (ncycles < 10 || reconnect < 1 || max_growth < 0.0 || (use_interface && tcp_address == NULL))
+	{
+		usage();
+	}
+
+	lvDCOMSimBackend backend;
+	lvDCOMTcpClient* client = NULL;
+	lvDCOMInterface* dcom = NULL;
+	std::vector<TcpItem> items, got;
+	unsigned long errors = 0, failures = 0, connections = 0;
+	double baseline = 0.0, used = 0.0;
+	epicsTime start = epicsTime::getCurrent();
+	for(unsigned long i = 0; i < ncycles; ++i)
+	{
+		try
+		{
+#ifdef _WIN32
+			if (use_interface && (dcom == NULL || i % reconnect == 0))
+			{
+				delete dcom;
+				dcom = NULL;
+				++connections;
+				dcom = new lvDCOMInterface("", "", (std::string("tcp://") + tcp_address).c_str(), 0, NULL, NULL, NULL);
+			}
+#endif
+			if (tcp_address != NULL && !use_interface && (client == NULL || i % reconnect == 0))
+			{
+				delete client;
+				client = NULL;
+				client = new lvDCOMTcpClient(tcp_address, (connections++ % 2) == 1);
+			}
+			errors += cycle(i, backend, client, dcom, items, got);
+		}
+		catch(const std::exception& ex)
+		{
+			if (++failures <= 10)
+			{
+				fprintf(stderr, "lvDCOMSoak: cycle %lu: %s\n", i, ex.what());
+			}
+		}
+		if ( (i + 1) % (ncycles / 10) == 0 )
+		{
+			used = memoryUsed();
+			baseline = (baseline == 0.0 ? used : baseline);
+			double elapsed = epicsTime::getCurrent() - start;
+			printf("%10lu cycles %8.1f s %10.0f cycles/s %6lu connections %10.0f kB (%+.0f kB)\n", i + 1, elapsed,
+				(elapsed > 0.0 ? static_cast<double>(i + 1) / elapsed : 0.0), connections, used, used - baseline);
+			fflush(stdout);
+		}
+	}
+	delete client;
+#ifdef _WIN32
+	delete dcom;
+#endif
+	bool grew = (baseline > 0.0 && used - baseline > max_growth);
+	printf("%lu values not read back as written, %lu failed cycles, memory grew %.0f kB after the first tenth (limit %.0f kB)%s\n",
+		errors, failures, used - baseline, max_growth, (baseline > 0.0 ? "" : ", memory use not known so not checked"));
+	return (errors == 0 && failures == 0 && !grew ? 0 : 1);
+}
@@ -0,0 +1,211 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMStats.h header for #lvDCOMStats class.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#ifndef LV_DCOM_STATS_H
+#define LV_DCOM_STATS_H
+
+#include <math.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+/// statistics that can be asked for with the stats_set attribute, each is posted as parameter <name>_<suffix>
+enum lvDCOMStatistic { StatsMin = 0, StatsMax, StatsMean, StatsStdDev, StatsSum, StatsCentroid, StatsCount };
+
+/// Statistics of a parameter computed in the driver from the values it reads. For a scalar these are over a sliding window of the
+/// last window() values: mean and variance are updated incrementally (Welford's method, with the oldest value taken back out
+/// once the window is full) and min and max come from monotonic queues, so each new value is O(1) whatever the window length.
+/// For an array they are reductions of each array as read, see reduce(). All storage is allocated up front. Used with the
+/// asyn port lock held.
+class lvDCOMStats
+{
+public:
+	lvDCOMStats(size_t window) : m_values(window), m_min_queue(window), m_max_queue(window), m_seq(0), m_count(0), m_mean(0.0), m_m2(0.0),
+	    m_replaced(0), m_samples(0)
+	{
+		for(int i = 0; i < StatsCount; ++i)
+		{
+			m_params[i] = -1;
+			m_results[i] = 0.0;
+		}
+	}
+	static const char* suffix(int stat)
+	{
+		static const char* suffixes[StatsCount] = { "_MIN", "_MAX", "_MEAN", "_STDDEV", "_SUM", "_CENTROID" };
+		return suffixes[stat];
+	}
+	/// the statistics named in a comma separated \a stats_set e.g. "min,max,mean,stddev" as a bit mask of (1 << #lvDCOMStatistic),
+	/// an empty \a stats_set is those that apply to a scalar (or array if \a array)
+	static unsigned parseSet(const std::string& stats_set, bool array)
+	{
+		static const char* names[StatsCount] = { "min", "max", "mean", "stddev", "sum", "centroid" };
+		if (stats_set.size() == 0)
+		{
+			return (array ? ((1 << StatsMin) | (1 << StatsMax) | (1 << StatsSum) | (1 << StatsCentroid)) :
+			                ((1 << StatsMin) | (1 << StatsMax) | (1 << StatsMean) | (1 << StatsStdDev)));
+		}
+		unsigned mask = 0;
+		size_t start = 0;
+		while(start <= stats_set.size())
+		{
+			size_t end = stats_set.find(',', start);
+			end = (end == std::string::npos ? stats_set.size() : end);
+			std::string name = stats_set.substr(start, end - start);
+			name.erase(0, name.find_first_not_of(" \t"));
+			name.erase(name.find_last_not_of(" \t") + 1);
+			for(int i = 0; i < StatsCount; ++i)
+			{
+				if (name == names[i])
+				{
+					mask |= (1 << i);
+				}
+			}
+			start = end + 1;
+		}
+		return mask;
+	}
+	/// Sum, min, max and centroid (sum of i * x[i] over sum of x[i], as a 0 based element index) of \a n elements of \a x in
+	/// a single pass. The loop body has no branches and separate accumulators, so the compiler can vectorise it.
+	template<typename T>
+	static void reduce(const T* x, size_t n, double& sum, double& min, double& max, double& centroid)
+	{
+		double s = 0.0, ws = 0.0;
+		double lo = (n > 0 ? static_cast<double>(x[0]) : 0.0), hi = lo;
+		for(size_t i = 0; i < n; ++i)
+		{
+			double v = static_cast<double>(x[i]);
+			s += v;
+			ws += v * static_cast<double>(i);
+			lo = (v < lo ? v : lo);
+			hi = (v > hi ? v : hi);
+		}
+		sum = s;
+		min = lo;
+		max = hi;
+		centroid = (s != 0.0 ? ws / s : 0.0);
+	}
+	/// add a scalar value to the window, dropping the oldest if it is full. A NaN is not added, as it would stay in the mean
+	void add(double x)
+	{
+		size_t window = m_values.size();
+		if (window == 0 || x != x)
+		{
+			return;
+		}
+		size_t slot = static_cast<size_t>(m_seq % window);
+		m_min_queue.expire(m_seq, window);
+		m_max_queue.expire(m_seq, window);
+		if (m_count < window)
+		{
+			++m_count;
+			double delta = x - m_mean;
+			m_mean += delta / static_cast<double>(m_count);
+			m_m2 += delta * (x - m_mean);
+		}
+		else
+		{
+			double old = m_values[slot];
+			double old_mean = m_mean;
+			m_mean += (x - old) / static_cast<double>(window);
+			m_m2 += (x - old) * (x - m_mean + old - old_mean);
+		}
+		m_values[slot] = x;
+		m_min_queue.push(m_seq, m_values, std::less_equal<double>());
+		m_max_queue.push(m_seq, m_values, std::greater_equal<double>());
+		++m_seq;
+		++m_samples;
+		// taking values back out slowly loses precision, so recompute exactly once per window of replacements
+		if (m_count == window && ++m_replaced >= window)
+		{
+			recompute();
+		}
+		m_results[StatsMin] = m_values[m_min_queue.front() % window];
+		m_results[StatsMax] = m_values[m_max_queue.front() % window];
+		m_results[StatsMean] = m_mean;
+		m_results[StatsStdDev] = (m_count > 1 && m_m2 > 0.0 ? sqrt(m_m2 / static_cast<double>(m_count - 1)) : 0.0);
+	}
+	/// set the array statistics from \a n elements of \a x
+	template<typename T>
+	void addArray(const T* x, size_t n)
+	{
+		reduce(x, n, m_results[StatsSum], m_results[StatsMin], m_results[StatsMax], m_results[StatsCentroid]);
+		++m_samples;
+	}
+	/// asyn parameter index for statistic \a stat, or -1 if it was not asked for
+	int& param(int stat) { return m_params[stat]; }
+	double result(int stat) const { return m_results[stat]; }
+	size_t window() const { return m_values.size(); }
+	size_t size() const { return m_count; }
+	unsigned long samples() const { return m_samples; }
+
+private:
+	/// fixed size double ended queue of sequence numbers of values in the window, kept in order of value so the front is the extreme
+	class MonotonicQueue
+	{
+	public:
+		explicit MonotonicQueue(size_t capacity) : m_seqs(capacity), m_head(0), m_size(0) { }
+		/// drop the front if it has left the window that ends with sequence number \a seq
+		void expire(unsigned long long seq, size_t window)
+		{
+			if (m_size > 0 && m_seqs[m_head] + window <= seq)
+			{
+				m_head = (m_head + 1) % m_seqs.size();
+				--m_size;
+			}
+		}
+		/// add \a seq, first removing from the back anything \a dominated by its value
+		template <typename Compare>
+		void push(unsigned long long seq, const std::vector<double>& values, Compare dominated)
+		{
+			size_t n = values.size();
+			double x = values[seq % n];
+			while(m_size > 0 && dominated(x, values[m_seqs[(m_head + m_size - 1) % n] % n]))
+			{
+				--m_size;
+			}
+			m_seqs[(m_head + m_size) % n] = seq;
+			++m_size;
+		}
+		unsigned long long front() const { return m_seqs[m_head]; }
+	private:
+		std::vector<unsigned long long> m_seqs;
+		size_t m_head;
+		size_t m_size;
+	};
+	std::vector<double> m_values;        ///< ring buffer of the window, value with sequence number s is at s % window
+	MonotonicQueue m_min_queue;          ///< values increase from the front
+	MonotonicQueue m_max_queue;          ///< values decrease from the front
+	unsigned long long m_seq;            ///< sequence number of the next value
+	size_t m_count;                      ///< values in the window
+	double m_mean;
+	double m_m2;                         ///< sum of squared differences from the mean
+	size_t m_replaced;                   ///< values taken out since the last recompute()
+	unsigned long m_samples;             ///< values (or arrays) ever added
+	int m_params[StatsCount];
+	double m_results[StatsCount];
+	/// mean and m2 from the values in the window with two passes
+	void recompute()
+	{
+		double s = 0.0, s2 = 0.0;
+		for(size_t i = 0; i < m_count; ++i)
+		{
+			s += m_values[i];
+		}
+		m_mean = s / static_cast<double>(m_count);
+		for(size_t i = 0; i < m_count; ++i)
+		{
+			s2 += (m_values[i] - m_mean) * (m_values[i] - m_mean);
+		}
+		m_m2 = s2;
+		m_replaced = 0;
+	}
+};
+
+#endif /* LV_DCOM_STATS_H */
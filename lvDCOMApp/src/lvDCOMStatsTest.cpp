@@ -0,0 +1,147 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMStatsTest.cpp Unit tests of #lvDCOMStats.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+///
+/// The sliding window statistics are checked against the same statistics computed directly from the last window
+/// values, over enough values that the oldest has been taken back out of the mean many times and recompute() has run.
+
+#include <math.h>
+
+#include <deque>
+#include <algorithm>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "lvDCOMStats.h"
+
+static bool approxEqual(double a, double b, double tol)
+{
+	return fabs(a - b) <= tol * (1.0 + fabs(b));
+}
+
+/// mean, sample standard deviation, min and max of \a values directly
+static void direct(const std::deque<double>& values, double& mean, double& stddev, double& min, double& max)
+{
+	double s = 0.0, s2 = 0.0;
+	for(size_t i = 0; i < values.size(); ++i)
+	{
+		s += values[i];
+	}
+	mean = s / static_cast<double>(values.size());
+	for(size_t i = 0; i < values.size(); ++i)
+	{
+		s2 += (values[i] - mean) * (values[i] - mean);
+	}
+	stddev = (values.size() > 1 ? sqrt(s2 / static_cast<double>(values.size() - 1)) : 0.0);
+	min = *std::min_element(values.begin(), values.end());
+	max = *std::max_element(values.begin(), values.end());
+}
+
+/// add \a n pseudo random values of size \a scale about \a offset to a window of \a window and count the values after
+/// which a statistic differs from direct()
+static int compareWindow(size_t window, int n, double offset, double scale)
+{
+	lvDCOMStats stats(window);
+	std::deque<double> values;
+	unsigned long seed = 12345;
+	int mismatches = 0;
+	for(int i = 0; i < n; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		double x = offset + scale * static_cast<double>((seed >> 16) % 1000) / 1000.0;
+		stats.add(x);
+		values.push_back(x);
+		if (values.size() > window)
+		{
+			values.pop_front();
+		}
+		double mean, stddev, min, max;
+		direct(values, mean, stddev, min, max);
+		if (stats.size() != values.size() || !approxEqual(stats.result(StatsMean), mean, 1e-9) || !approxEqual(stats.result(StatsStdDev), stddev, 1e-6) ||
+		    stats.result(StatsMin) != min || stats.result(StatsMax) != max)
+		{
+			++mismatches;
+		}
+	}
+	return mismatches;
+}
+
+MAIN(lvDCOMStatsTest)
+{
+	testPlan(23);
+
+	testDiag("parseSet");
+	testOk1(lvDCOMStats::parseSet("min, max", false) == ((1u << StatsMin) | (1u << StatsMax)));
+	testOk1(lvDCOMStats::parseSet("stddev,unknown,centroid", true) == ((1u << StatsStdDev) | (1u << StatsCentroid)));
+	testOk1(lvDCOMStats::parseSet("", false) == ((1u << StatsMin) | (1u << StatsMax) | (1u << StatsMean) | (1u << StatsStdDev)));
+	testOk1(lvDCOMStats::parseSet("", true) == ((1u << StatsMin) | (1u << StatsMax) | (1u << StatsSum) | (1u << StatsCentroid)));
+
+	testDiag("Welford add until the window is full");
+	lvDCOMStats stats(4);
+	for(int i = 1; i <= 4; ++i)
+	{
+		stats.add(i);
+	}
+	testOk1(stats.size() == 4);
+	testOk(approxEqual(stats.result(StatsMean), 2.5, 1e-12), "mean of 1..4 is %g", stats.result(StatsMean));
+	testOk(approxEqual(stats.result(StatsStdDev), sqrt(5.0 / 3.0), 1e-12), "stddev of 1..4 is %g", stats.result(StatsStdDev));
+	testOk1(stats.result(StatsMin) == 1.0 && stats.result(StatsMax) == 4.0);
+
+	testDiag("oldest values taken back out once the window is full");
+	stats.add(5);
+	stats.add(6);
+	testOk1(stats.size() == 4 && stats.samples() == 6);
+	testOk(approxEqual(stats.result(StatsMean), 4.5, 1e-12), "mean of 3..6 is %g", stats.result(StatsMean));
+	testOk(approxEqual(stats.result(StatsStdDev), sqrt(5.0 / 3.0), 1e-12), "stddev of 3..6 is %g", stats.result(StatsStdDev));
+	testOk1(stats.result(StatsMin) == 3.0 && stats.result(StatsMax) == 6.0);
+
+	testDiag("monotonic queues");
+	lvDCOMStats falling(3);
+	for(int i = 5; i >= 1; --i)
+	{
+		falling.add(i);
+	}
+	testOk1(falling.result(StatsMin) == 1.0 && falling.result(StatsMax) == 3.0);
+	lvDCOMStats spike(3);
+	spike.add(1);
+	spike.add(9);
+	spike.add(2);
+	spike.add(3);
+	testOk1(spike.result(StatsMax) == 9.0 && spike.result(StatsMin) == 2.0);
+	spike.add(4);
+	testOk1(spike.result(StatsMax) == 4.0 && spike.result(StatsMin) == 2.0);
+
+	testDiag("NaN and empty window");
+	stats.add(sqrt(-1.0));
+	testOk1(stats.size() == 4 && stats.samples() == 6 && approxEqual(stats.result(StatsMean), 4.5, 1e-12));
+	lvDCOMStats empty(0);
+	empty.add(1.0);
+	testOk1(empty.size() == 0 && empty.samples() == 0);
+
+	testDiag("against direct computation, including recompute() every window of replacements");
+	int mismatches = compareWindow(7, 1000, 0.0, 10.0);
+	testOk(mismatches == 0, "window 7: %d mismatches", mismatches);
+	mismatches = compareWindow(64, 5000, -50.0, 100.0);
+	testOk(mismatches == 0, "window 64: %d mismatches", mismatches);
+	mismatches = compareWindow(16, 5000, 1e9, 1.0);
+	testOk(mismatches == 0, "window 16 offset 1e9: %d mismatches", mismatches);
+
+	testDiag("array reductions");
+	const int x[] = { 0, 1, 2, 1 };
+	lvDCOMStats array(0);
+	array.addArray(x, 4);
+	testOk1(array.result(StatsSum) == 4.0 && array.result(StatsMin) == 0.0 && array.result(StatsMax) == 2.0);
+	testOk(approxEqual(array.result(StatsCentroid), 2.0, 1e-12), "centroid is %g", array.result(StatsCentroid));
+	double sum, min, max, centroid;
+	lvDCOMStats::reduce(x, 0, sum, min, max, centroid);
+	testOk1(sum == 0.0 && min == 0.0 && max == 0.0 && centroid == 0.0);
+
+	return testDone();
+}
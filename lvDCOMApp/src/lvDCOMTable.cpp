@@ -0,0 +1,315 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMTable.cpp Print, watch or benchmark a value table written by an lvDCOM driver (see lvDCOMValueTable.h).
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+///
+/// Usage: lvDCOMTable [-w period] [-b seconds] [-t threads] [-n name] file
+///        lvDCOMTable -g params [-p period] file
+///
+///   (no option)     print every parameter in the table once
+///   -w period       print parameters as they change, checking every period seconds
+///   -n name         only the parameter called name, read by name rather than by slot
+///   -b seconds      read the whole table (or just -n name) over and over for this many seconds and print the
+///                   reads per second, time per read and seqlock retries
+///   -t threads      for -b, the number of threads reading at once, each with its own reader (default 1)
+///   -g params       write the table instead, as a stand in for a driver with this many parameters of mixed types
+///                   that all change every period seconds (default 0.001), to benchmark against
+///
+/// The value table is read with lvDCOMValueTableReader, the same library other programs link against (lvDCOMValueTable).
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <epicsEvent.h>
+#include <epicsStdio.h>
+
+#include "lvDCOMValueTable.h"
+
+static void usage()
+{
+	fprintf(stderr, "Usage: lvDCOMTable [-w period] [-b seconds] [-t threads] [-n name] file\n");
+	fprintf(stderr, "       lvDCOMTable -g params [-p period] file\n");
+	exit(1);
+}
+
+static void printEntry(const ValueTableEntry& e)
+{
+	char tbuffer[64];
+	epicsTimeToStrftime(tbuffer, sizeof(tbuffer), "%Y-%m-%dT%H:%M:%S.%06f", &(e.stamp));
+	printf("%-32s %-13s ", e.name.c_str(), valueTableTypeName(e.type));
+	if (e.undefined())
+	{
+		printf("%-20s", "(undefined)");
+	}
+	else
+	{
+		switch(e.type)
+		{
+			case ValueTableInt32:
+				printf("%-20d", e.ival);
+				break;
+			case ValueTableUInt32Digital:
+				printf("0x%-18x", static_cast<unsigned>(e.ival));
+				break;
+			case ValueTableFloat64:
+				printf("%-20.10g", e.dval);
+				break;
+			case ValueTableString:
+				printf("\"%s\"%s", e.sval.c_str(), ((e.flags & ValueTableTruncated) != 0 ? "..." : ""));
+				break;
+			default:
+				printf("[%lu elements]%-6s", static_cast<unsigned long>(e.length), "");
+				break;
+		}
+	}
+	printf(" status %d alarm %d/%d %s updates %lu\n", e.status, e.alarm_status, e.alarm_severity, tbuffer, e.updates);
+}
+
+/// print the table, or with \a period > 0 print whatever has changed every period seconds
+static void dump(lvDCOMValueTableReader& reader, const std::string& name, double period)
+{
+	std::map<std::string, unsigned long> seen;  ///< name -> updates when last printed
+	std::vector<ValueTableEntry> entries;
+	printf("Value table of port \"%s\", %d parameters\n", reader.port().c_str(), static_cast<int>(reader.size()));
+	do
+	{
+		entries.clear();
+		ValueTableEntry e;
+		if (name.size() == 0)
+		{
+			reader.readAll(entries);
+		}
+		else if (reader.read(name, e))
+		{
+			entries.push_back(e);
+		}
+		for(std::vector<ValueTableEntry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+		{
+			std::map<std::string, unsigned long>::iterator its = seen.find(it->name);
+			if (its == seen.end() || its->second != it->updates)
+			{
+				printEntry(*it);
+				seen[it->name] = it->updates;
+			}
+		}
+		fflush(stdout);
+		if (period > 0.0)
+		{
+			epicsThreadSleep(period);
+		}
+	}
+	while(period > 0.0);
+}
+
+struct BenchThread
+{
+	std::string file_name;
+	std::string name;
+	double seconds;
+	unsigned long reads;
+	unsigned long retries;
+	double elapsed;
+	std::string error;
+	epicsEvent done;
+	BenchThread() : seconds(0.0), reads(0), retries(0), elapsed(0.0) { }
+};
+
+static void benchTask(void* arg)
+{
+	BenchThread& b = *static_cast<BenchThread*>(arg);
+	try
+	{
+		lvDCOMValueTableReader reader(b.file_name);
+		ValueTableEntry e;
+		epicsTime start = epicsTime::getCurrent(), now = start;
+		size_t n = reader.size();
+		if (n == 0)
+		{
+			throw std::runtime_error("\"" + b.file_name + "\" has no parameters");
+		}
+		while( (now = epicsTime::getCurrent()) - start < b.seconds )
+		{
+			// check the time every 1000 reads so it is not most of what is measured
+			for(int i = 0; i < 1000; ++i)
+			{
+				if (b.name.size() > 0)
+				{
+					reader.read(b.name, e);
+				}
+				else
+				{
+					reader.read(b.reads % n, e);
+				}
+				++b.reads;
+			}
+		}
+		b.elapsed = now - start;
+		b.retries = reader.retries();
+	}
+	catch(const std::exception& ex)
+	{
+		b.error = ex.what();
+	}
+	b.done.signal();
+}
+
+static int benchmark(const std::string& file_name, const std::string& name, double seconds, int nthreads)
+{
+	std::vector<BenchThread*> threads;
+	for(int i = 0; i < nthreads; ++i)
+	{
+		BenchThread* b = new BenchThread;
+		b->file_name = file_name;
+		b->name = name;
+		b->seconds = seconds;
+		threads.push_back(b);
+		if (epicsThreadCreate("lvDCOMTableBench", epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackMedium), benchTask, b) == 0)
+		{
+			fprintf(stderr, "lvDCOMTable: epicsThreadCreate failure\n");
+			return 1;
+		}
+	}
+	unsigned long reads = 0, retries = 0;
+	double elapsed = 0.0;
+	int ret = 0;
+	for(int i = 0; i < nthreads; ++i)
+	{
+		threads[i]->done.wait();
+		if (threads[i]->error.size() > 0)
+		{
+			fprintf(stderr, "lvDCOMTable: %s\n", threads[i]->error.c_str());
+			ret = 1;
+		}
+		reads += threads[i]->reads;
+		retries += threads[i]->retries;
+		elapsed += threads[i]->elapsed;
+	}
+	elapsed /= nthreads;
+	if (reads > 0 && elapsed > 0.0)
+	{
+		printf("%lu reads%s in %.3f seconds by %d thread(s): %.0f reads per second, %.1f ns per read per thread, %lu seqlock retries\n",
+		    reads, (name.size() > 0 ? " by name" : ""), elapsed, nthreads, reads / elapsed, 1e9 * elapsed * nthreads / reads, retries);
+	}
+	return ret;
+}
+
+/// stand in for a driver: \a nparams parameters that all change every \a period seconds
+static int generate(const std::string& file_name, int nparams, double period)
+{
+	lvDCOMValueTableWriter writer(file_name, "lvDCOMTable", nparams);
+	std::vector<ValueTableEntry> entries(nparams);
+	char name[32];
+	for(int i = 0; i < nparams; ++i)
+	{
+		epicsSnprintf(name, sizeof(name), "GEN%d", i);
+		entries[i].name = name;
+		entries[i].type = static_cast<ValueTableType>(ValueTableInt32 + i % 6);
+	}
+	printf("lvDCOMTable: writing %d parameters to \"%s\" every %g seconds\n", nparams, file_name.c_str(), period);
+	fflush(stdout);
+	char value[64];
+	for(epicsUInt32 n = 0; ; ++n)
+	{
+		epicsTimeStamp now = epicsTime::getCurrent();
+		for(int i = 0; i < nparams; ++i)
+		{
+			ValueTableEntry& e = entries[i];
+			e.stamp = now;
+			e.ival = static_cast<epicsInt32>(n + i);
+			e.dval = n + i * 0.001;
+			e.length = n % 1000;
+			if (e.type == ValueTableString)
+			{
+				epicsSnprintf(value, sizeof(value), "value %u of %d", n, i);
+				e.sval = value;
+			}
+			writer.publish(i, e);
+		}
+		epicsThreadSleep(period);
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	double watch = 0.0, bench = 0.0, period = 0.001;
+	int nthreads = 1, generate_params = 0;
+	std::string name, file_name;
+	for(int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-w") && i + 1 < argc)
+		{
+			watch = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+		{
+			bench = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+		{
+			nthreads = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+		{
+			name = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-g") && i + 1 < argc)
+		{
+			generate_params = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+		{
+			period = atof(argv[++i]);
+		}
+		else if (argv[i][0] != '-' && file_name.size() == 0)
+		{
+			file_name = argv[i];
+		}
+		else
+		{
+			usage();
+		}
+	}
+	if (file_name.size() == 0 || watch < 0.0 || bench < 0.0 || nthreads < 1 || generate_params < 0 || period <= 0.0)
+	{
+		usage();
+	}
+	try
+	{
+		if (generate_params > 0)
+		{
+			return generate(file_name, generate_params, period);
+		}
+		if (bench > 0.0)
+		{
+			return benchmark(file_name, name, bench, nthreads);
+		}
+		lvDCOMValueTableReader reader(file_name);
+		if (reader.size() == 0)
+		{
+			fprintf(stderr, "lvDCOMTable: \"%s\" has no parameters\n", file_name.c_str());
+			return 1;
+		}
+		dump(reader, name, watch);
+	}
+	catch(const std::exception& ex)
+	{
+		fprintf(stderr, "lvDCOMTable: %s\n", ex.what());
+		return 1;
+	}
+	return 0;
+}
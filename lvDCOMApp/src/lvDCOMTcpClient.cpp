@@ -0,0 +1,429 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMTcpClient.cpp Implementation of #lvDCOMTcpClient class.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+#include <epicsGuard.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <epicsStdio.h>
+#include <osiSock.h>
+
+#include "lvDCOMCapture.h"
+#include "lvDCOMTcpProtocol.h"
+#include "lvDCOMTcpClient.h"
+
+/// \a address is host:port, the port defaulting to #tcp_default_port. No connection is made until the first request
+lvDCOMTcpClient::lvDCOMTcpClient(const std::string& address, bool subscribe) : m_address(address), m_subscribe(subscribe),
+    m_sock(INVALID_SOCKET), m_next_id(1), m_reader_running(false), m_connects(0), m_requests(0), m_replies(0), m_cache_hits(0),
+	m_notifies(0), m_timeouts(0), m_failures(0), m_rtt_total(0.0), m_rtt_max(0.0)
+{
+	if (!osiSockAttach())
+	{
+		throw std::runtime_error("lvDCOMTcpClient: osiSockAttach failed");
+	}
+}
+
+lvDCOMTcpClient::~lvDCOMTcpClient()
+{
+	SOCKET sock;
+	{
+		epicsGuard<epicsMutex> _lock(m_lock);
+		sock = m_sock;
+	}
+	if (sock != INVALID_SOCKET)
+	{
+		disconnect(sock, "client closed");
+	}
+	while(true)
+	{
+		{
+			epicsGuard<epicsMutex> _lock(m_lock);
+			if (!m_reader_running)
+			{
+				break;
+			}
+		}
+		m_reader_done.wait(1.0);
+	}
+	osiSockRelease();
+}
+
+bool lvDCOMTcpClient::connected()
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	return m_sock != INVALID_SOCKET;
+}
+
+/// number of connections ever made, so a caller can tell that the server may have lost state it had set up
+unsigned long lvDCOMTcpClient::connects()
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	return m_connects;
+}
+
+/// connect if not already connected, and check the server speaks our protocol version
+void lvDCOMTcpClient::connect(double timeout)
+{
+	epicsGuard<epicsMutex> _clock(m_connect_lock);
+	if (connected())
+	{
+		return;
+	}
+	// the reader of the last connection owns its socket until it exits
+	while(true)
+	{
+		{
+			epicsGuard<epicsMutex> _lock(m_lock);
+			if (!m_reader_running)
+			{
+				break;
+			}
+		}
+		m_reader_done.wait(1.0);
+	}
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	if (aToIPAddr(m_address.c_str(), tcp_default_port, &addr) != 0)
+	{
+		throw lvDCOMTcpDisconnected("lvDCOMTcpClient: cannot resolve \"" + m_address + "\"");
+	}
+	SOCKET sock = epicsSocketCreate(AF_INET, SOCK_STREAM, 0);
+	if (sock == INVALID_SOCKET)
+	{
+		throw lvDCOMTcpDisconnected("lvDCOMTcpClient: cannot create socket");
+	}
+	if (::connect(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0)
+	{
+		epicsSocketDestroy(sock);
+		throw lvDCOMTcpDisconnected("lvDCOMTcpClient: cannot connect to \"" + m_address + "\"");
+	}
+	tcpNoDelay(sock);
+	{
+		epicsGuard<epicsMutex> _lock(m_lock);
+		m_sock = sock;
+		m_reader_running = true;
+		++m_connects;
+	}
+	if (epicsThreadCreate("lvDCOMTcp", epicsThreadPriorityHigh, epicsThreadGetStackSize(epicsThreadStackMedium),
+	        readerTask, this) == 0)
+	{
+		{
+			epicsGuard<epicsMutex> _lock(m_lock);
+			m_reader_running = false;
+		}
+		disconnect(sock, "epicsThreadCreate failure");
+		epicsSocketDestroy(sock);
+		throw lvDCOMTcpDisconnected("lvDCOMTcpClient: epicsThreadCreate failure");
+	}
+	TcpMessage msg;
+	msg.type = TcpHello;
+	msg.items.resize(1);
+	msg.items[0].value.kind = CaptureValue::Int32;
+	msg.items[0].value.ival = tcp_protocol_version;
+	try
+	{
+		request(msg, timeout);
+	}
+	catch(const std::exception& ex)
+	{
+		disconnect(sock, ex.what());
+		throw lvDCOMTcpDisconnected(ex.what());
+	}
+	if (msg.items.size() != 1 || msg.items[0].status != 0)
+	{
+		std::string reason = "lvDCOMTcpClient: \"" + m_address + "\" refused connection: " +
+		    (msg.items.size() == 1 ? msg.items[0].message : std::string("malformed reply"));
+		disconnect(sock, reason);
+		throw lvDCOMTcpDisconnected(reason);
+	}
+}
+
+/// mark the connection on \a sock as failed, fail the requests waiting on it and forget the values it sent. The
+/// socket is shut down here, but only closed by its reader thread so the handle cannot be reused while still in use
+void lvDCOMTcpClient::disconnect(SOCKET sock, const std::string& reason)
+{
+	epicsGuard<epicsMutex> _slock(m_send_lock);
+	epicsGuard<epicsMutex> _lock(m_lock);
+	if (sock == INVALID_SOCKET || m_sock != sock)
+	{
+		return;
+	}
+	m_sock = INVALID_SOCKET;
+	m_last_error = reason;
+	++m_failures;
+	for(std::map<epicsUInt32, Pending*>::iterator it = m_pending.begin(); it != m_pending.end(); ++it)
+	{
+		it->second->failed = true;
+		it->second->done.signal();
+	}
+	m_pending.clear();
+	m_cache.clear();
+	shutdown(sock, 2);
+}
+
+/// send a frame on \a sock, if it is still the current connection. A failure disconnects, which fails any request waiting for a reply
+void lvDCOMTcpClient::send(SOCKET sock, const std::string& frame)
+{
+	epicsGuard<epicsMutex> _slock(m_send_lock);
+	{
+		epicsGuard<epicsMutex> _lock(m_lock);
+		if (m_sock != sock || sock == INVALID_SOCKET)
+		{
+			return;
+		}
+	}
+	if (!tcpSend(sock, frame))
+	{
+		disconnect(sock, "send failed");
+	}
+}
+
+/// send \a msg and wait up to \a timeout seconds (for ever if 0.0) for its reply, which replaces \a msg
+void lvDCOMTcpClient::request(TcpMessage& msg, double timeout)
+{
+	connect(timeout);
+	Pending pending;
+	SOCKET sock;
+	epicsUInt32 id;
+	{
+		epicsGuard<epicsMutex> _lock(m_lock);
+		sock = m_sock;
+		if (sock == INVALID_SOCKET)
+		{
+			throw lvDCOMTcpDisconnected("lvDCOMTcpClient: not connected to \"" + m_address + "\": " + m_last_error);
+		}
+		id = m_next_id++;
+		if (m_next_id == 0)
+		{
+			m_next_id = 1;  // 0 is for notifications
+		}
+		msg.id = id;
+		m_pending[id] = &pending;
+		++m_requests;
+	}
+	std::string frame;
+	tcpEncode(msg, frame);
+	epicsTime start = epicsTime::getCurrent();
+	send(sock, frame);
+	bool replied = true;
+	if (timeout > 0.0)
+	{
+		replied = pending.done.wait(timeout);
+	}
+	else
+	{
+		pending.done.wait();
+	}
+	double rtt = epicsTime::getCurrent() - start;
+	epicsGuard<epicsMutex> _lock(m_lock);
+	m_pending.erase(id);
+	if (!replied)
+	{
+		++m_timeouts;
+		char buffer[64];
+		epicsSnprintf(buffer, sizeof(buffer), "%.3f", timeout);
+		throw lvDCOMTcpTimeout("lvDCOMTcpClient: no reply from \"" + m_address + "\" within " + buffer + " s");
+	}
+	if (pending.failed)
+	{
+		throw lvDCOMTcpDisconnected("lvDCOMTcpClient: lost connection to \"" + m_address + "\": " + m_last_error);
+	}
+	++m_replies;
+	m_rtt_total += rtt;
+	m_rtt_max = (rtt > m_rtt_max ? rtt : m_rtt_max);
+	if ( pending.reply.type != (msg.type | TcpReply) || pending.reply.items.size() != msg.items.size() )
+	{
+		throw std::runtime_error("lvDCOMTcpClient: malformed reply from \"" + m_address + "\"");
+	}
+	msg.items.swap(pending.reply.items);
+}
+
+/// Read the value of each control of \a items in one round trip, with the status and message of each item saying
+/// whether it was read. Subscribed controls whose value the server has already sent are not asked for again
+void lvDCOMTcpClient::get(std::vector<TcpItem>& items, double timeout)
+{
+	std::vector<size_t> remote;
+	{
+		epicsGuard<epicsMutex> _lock(m_lock);
+		for(size_t i = 0; i < items.size(); ++i)
+		{
+			std::map<control_key_t, CaptureValue>::const_iterator it = m_cache.find(control_key_t(items[i].vi, items[i].control));
+			if (m_subscribe && it != m_cache.end())
+			{
+				items[i].value = it->second;
+				items[i].status = 0;
+				++m_cache_hits;
+			}
+			else
+			{
+				remote.push_back(i);
+			}
+		}
+	}
+	if (remote.size() == 0)
+	{
+		return;
+	}
+	TcpMessage msg;
+	msg.type = TcpGet;
+	msg.items.reserve(remote.size());
+	for(size_t i = 0; i < remote.size(); ++i)
+	{
+		msg.items.push_back(TcpItem(items[remote[i]].vi, items[remote[i]].control, (m_subscribe ? TcpSubscribe : 0)));
+	}
+	request(msg, timeout);
+	for(size_t i = 0; i < remote.size(); ++i)
+	{
+		TcpItem& item = items[remote[i]];
+		item.value = msg.items[i].value;
+		item.status = msg.items[i].status;
+		item.message = msg.items[i].message;
+	}
+}
+
+/// write the value of each of \a items in order in one round trip, the status and message of each item say whether it was written
+void lvDCOMTcpClient::set(std::vector<TcpItem>& items, double timeout)
+{
+	TcpMessage msg;
+	msg.type = TcpSet;
+	msg.items = items;
+	request(msg, timeout);
+	for(size_t i = 0; i < items.size(); ++i)
+	{
+		items[i].status = msg.items[i].status;
+		items[i].message = msg.items[i].message;
+	}
+}
+
+/// run \a vi with \a names_values, the Array of its control names and values, \a results is the values afterwards
+void lvDCOMTcpClient::call(const std::string& vi, const CaptureValue& names_values, CaptureValue& results, double timeout)
+{
+	TcpMessage msg;
+	msg.type = TcpCall;
+	msg.items.push_back(TcpItem(vi, ""));
+	msg.items[0].value = names_values;
+	request(msg, timeout);
+	if (msg.items[0].status != 0)
+	{
+		throw std::runtime_error("lvDCOMTcpClient: call of \"" + vi + "\" failed: " + msg.items[0].message);
+	}
+	results = msg.items[0].value;
+}
+
+/// send a TcpUpdate to a stand in server, without waiting for anything back
+void lvDCOMTcpClient::update(const std::vector<TcpItem>& items)
+{
+	connect(0.0);
+	TcpMessage msg;
+	msg.type = TcpUpdate;
+	msg.items = items;
+	std::string frame;
+	tcpEncode(msg, frame);
+	SOCKET sock;
+	{
+		epicsGuard<epicsMutex> _lock(m_lock);
+		sock = m_sock;
+	}
+	send(sock, frame);
+}
+
+void lvDCOMTcpClient::readerTask(void* arg)
+{
+	static_cast<lvDCOMTcpClient*>(arg)->reader();
+}
+
+/// Hand each reply to the request waiting for it and keep #m_cache up to date, until the connection fails. The
+/// server sends the reply to a subscribing get before any notification for it, so the cache never goes back in time
+void lvDCOMTcpClient::reader()
+{
+	SOCKET sock;
+	{
+		epicsGuard<epicsMutex> _lock(m_lock);
+		sock = m_sock;
+	}
+	std::string body, reason("connection closed by server");
+	TcpMessage msg;
+	while(sock != INVALID_SOCKET && tcpReceive(sock, body))
+	{
+		if (!tcpDecode(body, msg))
+		{
+			reason = "corrupt message from server";
+			break;
+		}
+		epicsGuard<epicsMutex> _lock(m_lock);
+		if (msg.type == TcpNotify)
+		{
+			++m_notifies;
+		}
+		if ( m_subscribe && (msg.type == TcpNotify || msg.type == (TcpGet | TcpReply)) )
+		{
+			for(std::vector<TcpItem>::const_iterator it = msg.items.begin(); it != msg.items.end(); ++it)
+			{
+				if ( it->status == 0 && (msg.type == TcpNotify || (it->flags & TcpSubscribe) != 0) )
+				{
+					m_cache[control_key_t(it->vi, it->control)] = it->value;
+				}
+				else if (msg.type == TcpNotify)
+				{
+					m_cache.erase(control_key_t(it->vi, it->control));
+				}
+			}
+		}
+		std::map<epicsUInt32, Pending*>::iterator it = m_pending.find(msg.id);
+		if (msg.type != TcpNotify && it != m_pending.end())
+		{
+			it->second->reply.type = msg.type;
+			it->second->reply.id = msg.id;
+			it->second->reply.items.swap(msg.items);
+			it->second->done.signal();
+			m_pending.erase(it);
+		}
+	}
+	disconnect(sock, reason);
+	if (sock != INVALID_SOCKET)
+	{
+		epicsSocketDestroy(sock);
+	}
+	// signal with the lock held, so the destructor cannot see the reader has stopped and delete the event while it is signalled
+	epicsGuard<epicsMutex> _lock(m_lock);
+	m_reader_running = false;
+	m_reader_done.signal();
+}
+
+void lvDCOMTcpClient::report(FILE* fp, int details)
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	fprintf(fp, "TCP transport: \"%s\" %s, %lu connection(s), %lu request(s) (%lu timed out), round trip mean %.3f max %.3f ms\n",
+		m_address.c_str(), (m_sock != INVALID_SOCKET ? "connected" : "not connected"), m_connects, m_requests, m_timeouts,
+		(m_replies > 0 ? 1000.0 * m_rtt_total / m_replies : 0.0), 1000.0 * m_rtt_max);
+	fprintf(fp, "TCP transport: subscribe %s, %lu value(s) cached, %lu get(s) answered from cache, %lu notification(s)\n",
+		(m_subscribe ? "on" : "off"), static_cast<unsigned long>(m_cache.size()), m_cache_hits, m_notifies);
+	if (m_failures > 0)
+	{
+		fprintf(fp, "TCP transport: %lu connection failure(s), last: %s\n", m_failures, m_last_error.c_str());
+	}
+	if (details > 1)
+	{
+		for(std::map<control_key_t, CaptureValue>::const_iterator it = m_cache.begin(); it != m_cache.end(); ++it)
+		{
+			fprintf(fp, "  cached \"%s\" on \"%s\"\n", it->first.second.c_str(), it->first.first.c_str());
+		}
+	}
+}
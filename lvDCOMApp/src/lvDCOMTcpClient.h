@@ -0,0 +1,97 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMTcpClient.h header for #lvDCOMTcpClient class.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#ifndef LV_DCOM_TCP_CLIENT_H
+#define LV_DCOM_TCP_CLIENT_H
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <osiSock.h>
+
+#include "lvDCOMCapture.h"
+#include "lvDCOMTcpProtocol.h"
+
+/// the connection to the server has failed, or could not be made
+class lvDCOMTcpDisconnected : public std::runtime_error
+{
+public:
+	explicit lvDCOMTcpDisconnected(const std::string& message) : std::runtime_error(message) { }
+};
+
+/// no reply came within the deadline, the connection is still usable
+class lvDCOMTcpTimeout : public std::runtime_error
+{
+public:
+	explicit lvDCOMTcpTimeout(const std::string& message) : std::runtime_error(message) { }
+};
+
+/// Client side of the TCP transport (see lvDCOMTcpProtocol.h) used by #lvDCOMInterface instead of DCOM when the host
+/// is given as tcp://host:port. A single connection is made on first use, and made again on the next request after
+/// it fails. Any number of threads may make requests at once: each is sent straight away with its own id and a reader
+/// thread hands each reply to the thread waiting for it, so a slow request does not hold up the others. If
+/// \a subscribe is set, gets ask the server for changes to the controls read, and later gets of those controls are
+/// answered from the values it has sent without a round trip. Nothing here depends on Windows.
+class lvDCOMTcpClient
+{
+public:
+	lvDCOMTcpClient(const std::string& address, bool subscribe);
+	~lvDCOMTcpClient();
+	void get(std::vector<TcpItem>& items, double timeout);
+	void set(std::vector<TcpItem>& items, double timeout);
+	void call(const std::string& vi, const CaptureValue& names_values, CaptureValue& results, double timeout);
+	void update(const std::vector<TcpItem>& items);
+	void report(FILE* fp, int details);
+	const std::string& address() const { return m_address; }
+	bool connected();
+	unsigned long connects();
+
+private:
+	/// a request waiting for its reply
+	struct Pending
+	{
+		epicsEvent done;
+		TcpMessage reply;
+		bool failed;        ///< the connection failed before the reply came
+		Pending() : failed(false) { }
+	};
+	typedef std::pair<std::string, std::string> control_key_t;  ///< (vi, control)
+	std::string m_address;
+	bool m_subscribe;
+	SOCKET m_sock;            ///< INVALID_SOCKET when not connected
+	epicsUInt32 m_next_id;
+	std::map<epicsUInt32, Pending*> m_pending;
+	std::map<control_key_t, CaptureValue> m_cache;  ///< last value the server sent of each subscribed control
+	epicsEvent m_reader_done;  ///< signalled as the reader thread of a connection exits
+	bool m_reader_running;
+	epicsMutex m_lock;         ///< protects everything else
+	epicsMutex m_send_lock;    ///< held while a frame is sent, so frames do not interleave
+	epicsMutex m_connect_lock; ///< held while connecting, so only one thread tries
+	unsigned long m_connects, m_requests, m_replies, m_cache_hits, m_notifies, m_timeouts, m_failures;
+	double m_rtt_total, m_rtt_max;   ///< seconds from sending a request to its reply
+	std::string m_last_error;
+
+	void connect(double timeout);
+	void disconnect(SOCKET sock, const std::string& reason);
+	void request(TcpMessage& msg, double timeout);
+	void send(SOCKET sock, const std::string& frame);
+	static void readerTask(void* arg);
+	void reader();
+};
+
+#endif /* LV_DCOM_TCP_CLIENT_H */
@@ -0,0 +1,123 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMTcpProtocol.cpp Encoding of the messages of the TCP transport, see lvDCOMTcpProtocol.h
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <epicsTypes.h>
+#include <osiSock.h>
+
+#include "lvDCOMCapture.h"
+#include "lvDCOMTcpProtocol.h"
+
+/// \a msg as a complete frame, including its length, ready for tcpSend()
+void tcpEncode(const TcpMessage& msg, std::string& frame)
+{
+	frame.resize(4);  // length, filled in at the end
+	frame.push_back(static_cast<char>(msg.type));
+	capturePutU32(frame, msg.id);
+	capturePutU32(frame, static_cast<epicsUInt32>(msg.items.size()));
+	for(std::vector<TcpItem>::const_iterator it = msg.items.begin(); it != msg.items.end(); ++it)
+	{
+		capturePutString(frame, it->vi);
+		capturePutString(frame, it->control);
+		frame.push_back(static_cast<char>(it->flags));
+		capturePutU32(frame, static_cast<epicsUInt32>(it->status));
+		capturePutString(frame, it->message);
+		capturePutValue(frame, it->value);
+	}
+	std::string length;
+	capturePutU32(length, static_cast<epicsUInt32>(frame.size() - 4));
+	frame.replace(0, 4, length);
+}
+
+/// decode a frame \a body, as returned by tcpReceive(). Returns false if it is not a valid message
+bool tcpDecode(const std::string& body, TcpMessage& msg)
+{
+	CaptureParser parser(body);
+	msg.type = parser.getU8();
+	msg.id = parser.getU32();
+	epicsUInt32 n = parser.getU32();
+	// an item takes at least 18 bytes, so this guards against allocating for a corrupt count
+	if ( !parser.ok() || n > body.size() / 18 )
+	{
+		return false;
+	}
+	msg.items.resize(n);
+	for(epicsUInt32 i = 0; i < n && parser.ok(); ++i)
+	{
+		TcpItem& item = msg.items[i];
+		item.vi = parser.getString();
+		item.control = parser.getString();
+		item.flags = parser.getU8();
+		item.status = static_cast<epicsInt32>(parser.getU32());
+		item.message = parser.getString();
+		parser.getValue(item.value);
+	}
+	return parser.ok() && parser.atEnd();
+}
+
+/// send the whole of \a frame, returns false if the connection has failed
+bool tcpSend(SOCKET sock, const std::string& frame)
+{
+	size_t sent = 0;
+	while(sent < frame.size())
+	{
+		int n = send(sock, frame.data() + sent, static_cast<int>(frame.size() - sent), 0);
+		if (n <= 0)
+		{
+			return false;
+		}
+		sent += n;
+	}
+	return true;
+}
+
+static bool receiveAll(SOCKET sock, char* buffer, size_t len)
+{
+	size_t got = 0;
+	while(got < len)
+	{
+		int n = recv(sock, buffer + got, static_cast<int>(len - got), 0);
+		if (n <= 0)
+		{
+			return false;
+		}
+		got += n;
+	}
+	return true;
+}
+
+/// wait for the next frame and return what follows its length in \a body, returns false if the connection has
+/// closed or failed, or the stream is corrupt
+bool tcpReceive(SOCKET sock, std::string& body)
+{
+	unsigned char length[4];
+	if ( !receiveAll(sock, reinterpret_cast<char*>(length), sizeof(length)) )
+	{
+		return false;
+	}
+	epicsUInt32 n = length[0] | (length[1] << 8) | (length[2] << 16) | (static_cast<epicsUInt32>(length[3]) << 24);
+	if (n > tcp_max_frame)
+	{
+		return false;
+	}
+	body.resize(n);
+	return (n == 0 || receiveAll(sock, &(body[0]), n));
+}
+
+/// send small frames straight away, rather than waiting to see if there is more to go in the same packet
+void tcpNoDelay(SOCKET sock)
+{
+	int flag = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<char*>(&flag), sizeof(flag));
+}
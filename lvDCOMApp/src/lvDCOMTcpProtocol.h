@@ -0,0 +1,92 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMTcpProtocol.h Messages of the TCP transport used instead of DCOM by #lvDCOMTcpClient.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+///
+/// Every message is a frame, all integers little endian:
+///   uint32 length of what follows, uint8 #TcpMessageType, uint32 id, uint32 number of items, then for each item
+///   string vi, string control, uint8 flags (#TcpItemFlags), int32 status, string message, value
+/// with strings and values encoded as in a capture file (see lvDCOMCapture.cpp). A reply has the type of its request
+/// with #TcpReply set and the same id, so a client can have many requests outstanding on one connection and match
+/// the replies as they come. Items of a request are done in order, and a reply has an item for each with status 0,
+/// or non-zero and a message if that item failed.
+///
+///   TcpHello    first message on a connection, one item whose value is the Int32 #tcp_protocol_version
+///   TcpGet      read each control into the value of its reply item. With #TcpSubscribe the server also sends a
+///               TcpNotify whenever the control changes from then on, until the connection closes
+///   TcpSet      write each value to its control, with #TcpSignal as the "signalling" SetControlValue of the extint VI
+///   TcpCall     run item vi, whose value is an Array of the names and values arrays of a LabVIEW Call, the reply
+///               value is the values array afterwards
+///   TcpUpdate   (no reply) change a control as the VI itself would, or with an empty control set what the next TcpCall
+///               of vi returns. Only for a stand in server, so captured traffic can be replayed through the transport
+///   TcpNotify   (server to client, id 0) the new value of a subscribed control. A notify caused by a TcpSet or
+///               TcpUpdate is always sent before the reply to it, and after the reply to the TcpGet that subscribed.
+///               A notify item with a non-zero status means the control could not be read, so the client forgets
+///               its value and asks the server on the next get
+
+#ifndef LV_DCOM_TCP_PROTOCOL_H
+#define LV_DCOM_TCP_PROTOCOL_H
+
+#include <string>
+#include <vector>
+
+#include <epicsTypes.h>
+#include <osiSock.h>
+
+#include "lvDCOMCapture.h"
+
+static const epicsInt32 tcp_protocol_version = 1;
+static const unsigned short tcp_default_port = 5331;     ///< used if the address does not give one
+static const unsigned short broker_default_port = 5332;  ///< lvDCOMBroker listens here if not told otherwise
+static const epicsUInt32 tcp_max_frame = 256 * 1024 * 1024; ///< larger frames are taken as a corrupt stream
+
+enum TcpMessageType
+{
+	TcpHello = 1,
+	TcpGet = 2,
+	TcpSet = 3,
+	TcpCall = 4,
+	TcpUpdate = 5,
+	TcpNotify = 6,
+	TcpReply = 0x80   ///< or'ed with the request type
+};
+
+enum TcpItemFlags
+{
+	TcpSubscribe = 1,  ///< TcpGet: keep sending the value as it changes
+	TcpSignal = 2      ///< TcpSet: write as the extint VI would, so LabVIEW value change events fire
+};
+
+/// one control of a message
+struct TcpItem
+{
+	std::string vi;
+	std::string control;
+	epicsUInt8 flags;     ///< #TcpItemFlags
+	epicsInt32 status;    ///< 0 for success, in a reply
+	std::string message;  ///< why the item failed, in a reply
+	CaptureValue value;
+	TcpItem() : flags(0), status(0) { }
+	TcpItem(const std::string& vi_, const std::string& control_, epicsUInt8 flags_ = 0) : vi(vi_), control(control_), flags(flags_), status(0) { }
+};
+
+struct TcpMessage
+{
+	epicsUInt8 type;   ///< #TcpMessageType
+	epicsUInt32 id;
+	std::vector<TcpItem> items;
+	TcpMessage() : type(0), id(0) { }
+};
+
+void tcpEncode(const TcpMessage& msg, std::string& frame);
+bool tcpDecode(const std::string& body, TcpMessage& msg);
+bool tcpSend(SOCKET sock, const std::string& frame);
+bool tcpReceive(SOCKET sock, std::string& body);
+void tcpNoDelay(SOCKET sock);
+
+#endif /* LV_DCOM_TCP_PROTOCOL_H */
@@ -0,0 +1,146 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMTcpProtocolTest.cpp Unit tests of tcpEncode() and tcpDecode().
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#include <string>
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "lvDCOMCapture.h"
+#include "lvDCOMTcpProtocol.h"
+
+/// true if \a a and \a b have the same type, id and items
+static bool sameMessage(const TcpMessage& a, const TcpMessage& b)
+{
+	if (a.type != b.type || a.id != b.id || a.items.size() != b.items.size())
+	{
+		return false;
+	}
+	for(size_t i = 0; i < a.items.size(); ++i)
+	{
+		const TcpItem& x = a.items[i];
+		const TcpItem& y = b.items[i];
+		if (x.vi != y.vi || x.control != y.control || x.flags != y.flags || x.status != y.status || x.message != y.message || x.value != y.value)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/// encode \a msg, check the frame length, and decode it again into \a decoded
+static bool roundTrip(const TcpMessage& msg, TcpMessage& decoded, std::string& body)
+{
+	std::string frame;
+	tcpEncode(msg, frame);
+	if (frame.size() < 4)
+	{
+		return false;
+	}
+	epicsUInt32 length = static_cast<unsigned char>(frame[0]) | (static_cast<unsigned char>(frame[1]) << 8) |
+	    (static_cast<unsigned char>(frame[2]) << 16) | (static_cast<epicsUInt32>(static_cast<unsigned char>(frame[3])) << 24);
+	body = frame.substr(4);
+	return length == body.size() && tcpDecode(body, decoded);
+}
+
+/// a reply to a TcpGet with a value of every kind, and one item that failed
+static TcpMessage getReply()
+{
+	TcpMessage msg;
+	msg.type = TcpGet | TcpReply;
+	msg.id = 0x12345678;
+	TcpItem item("c:\\labview\\test.vi", "scalar", TcpSubscribe);
+	item.value.kind = CaptureValue::Float64;
+	item.value.dval = -1.5e300;
+	msg.items.push_back(item);
+	item.control = "text";
+	item.value = CaptureValue();
+	item.value.kind = CaptureValue::String;
+	item.value.sval = "caf\xc3\xa9 \"quoted\"\n";
+	msg.items.push_back(item);
+	item.control = "matrix";
+	item.value = CaptureValue();
+	item.value.kind = CaptureValue::Float64Array;
+	item.value.dims.push_back(2);
+	item.value.dims.push_back(3);
+	for(int i = 0; i < 6; ++i)
+	{
+		item.value.farray.push_back(i * 0.25);
+	}
+	msg.items.push_back(item);
+	item.control = "flags";
+	item.value = CaptureValue();
+	item.value.kind = CaptureValue::BooleanArray;
+	item.value.dims.push_back(3);
+	item.value.iarray.push_back(0);
+	item.value.iarray.push_back(-1);
+	item.value.iarray.push_back(-1);
+	msg.items.push_back(item);
+	item.control = "cluster";
+	item.value = CaptureValue();
+	item.value.kind = CaptureValue::Array;
+	item.value.dims.push_back(2);
+	CaptureValue element;
+	element.kind = CaptureValue::Int32;
+	element.ival = -7;
+	item.value.elements.push_back(element);
+	element = CaptureValue();
+	element.kind = CaptureValue::String;
+	element.sval = "seven";
+	item.value.elements.push_back(element);
+	msg.items.push_back(item);
+	TcpItem failed("c:\\labview\\test.vi", "missing");
+	failed.status = -2147352567;
+	failed.message = "control not found";
+	msg.items.push_back(failed);
+	return msg;
+}
+
+MAIN(lvDCOMTcpProtocolTest)
+{
+	testPlan(8);
+	TcpMessage decoded;
+	std::string body;
+
+	TcpMessage hello;
+	hello.type = TcpHello;
+	hello.id = 1;
+	hello.items.push_back(TcpItem());
+	hello.items[0].value.kind = CaptureValue::Int32;
+	hello.items[0].value.ival = tcp_protocol_version;
+	testOk1(roundTrip(hello, decoded, body) && sameMessage(hello, decoded));
+
+	TcpMessage notify;
+	notify.type = TcpNotify;
+	testOk1(roundTrip(notify, decoded, body) && sameMessage(notify, decoded) && decoded.items.size() == 0);
+
+	TcpMessage reply = getReply();
+	testOk1(roundTrip(reply, decoded, body) && sameMessage(reply, decoded));
+
+	testDiag("corrupt frames are rejected");
+	int accepted = 0;
+	for(size_t n = 0; n < body.size(); ++n)
+	{
+		accepted += tcpDecode(body.substr(0, n), decoded);
+	}
+	testOk(accepted == 0, "%d of %d truncated bodies decoded", accepted, static_cast<int>(body.size()));
+	testOk1(!tcpDecode(body + '\0', decoded));
+	std::string bad_count(body);
+	bad_count[5] = bad_count[6] = bad_count[7] = bad_count[8] = '\xff';
+	testOk1(!tcpDecode(bad_count, decoded));
+	testOk1(!tcpDecode(std::string(), decoded));
+
+	testDiag("decoding into a message that already has items replaces them");
+	TcpMessage reused = getReply();
+	testOk1(roundTrip(hello, reused, body) && sameMessage(hello, reused));
+
+	return testDone();
+}
@@ -0,0 +1,250 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMTcpServer.cpp Stand in for the LabVIEW side of the TCP transport, serving #lvDCOMSimBackend.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+///
+/// Usage: lvDCOMTcpServer [-p port] [-l latency]
+///
+///   -p port      port to listen on (default 5331)
+///   -l latency   each get, set and call takes this many extra seconds (default 0), to model a slow VI
+///
+/// Speaks the protocol of lvDCOMTcpProtocol.h, so an IOC whose lvDCOMConfigure host is tcp://host:port, or
+/// lvDCOMReplay -c host:port, can be run without LabVIEW or Windows. Controls have no value until set, or
+/// given one with a TcpUpdate. Requests from all connections are handled one at a time, which keeps the
+/// ordering of notifications and replies simple at the cost of one slow client holding up the others.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <utility>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+#include <epicsGuard.h>
+#include <epicsThread.h>
+#include <osiSock.h>
+
+#include "lvDCOMCapture.h"
+#include "lvDCOMSimBackend.h"
+#include "lvDCOMTcpProtocol.h"
+
+typedef std::pair<std::string, std::string> control_key_t;  ///< (vi, control)
+
+/// state shared by all connections, only used with #lock held
+struct TcpServer
+{
+	lvDCOMSimBackend backend;
+	double latency;
+	std::map<control_key_t, std::set<SOCKET> > subscribers;
+	epicsMutex lock;
+	TcpServer() : latency(0.0) { }
+};
+
+/// one client connection
+struct TcpConnection
+{
+	TcpServer* server;
+	SOCKET sock;
+	std::string peer;
+};
+
+/// send the new \a value of a control to every connection that has subscribed to it
+static void notify(TcpServer& server, const std::string& vi, const std::string& control, const CaptureValue& value)
+{
+	std::map<control_key_t, std::set<SOCKET> >::const_iterator it = server.subscribers.find(control_key_t(vi, control));
+	if (it == server.subscribers.end())
+	{
+		return;
+	}
+	TcpMessage msg;
+	msg.type = TcpNotify;
+	msg.items.push_back(TcpItem(vi, control));
+	msg.items[0].value = value;
+	std::string frame;
+	tcpEncode(msg, frame);
+	for(std::set<SOCKET>::const_iterator s = it->second.begin(); s != it->second.end(); ++s)
+	{
+		tcpSend(*s, frame);  // a failed connection is cleaned up by its own thread
+	}
+}
+
+/// do the request \a msg of connection \a sock, turning it into its reply. Returns false if there is no reply to send
+static bool handle(TcpServer& server, SOCKET sock, TcpMessage& msg)
+{
+	for(std::vector<TcpItem>::iterator it = msg.items.begin(); it != msg.items.end(); ++it)
+	{
+		TcpItem& item = *it;
+		item.status = 0;
+		try
+		{
+			switch(msg.type)
+			{
+				case TcpHello:
+					if (item.value.kind != CaptureValue::Int32 || item.value.ival != tcp_protocol_version)
+					{
+						throw std::runtime_error("unsupported protocol version");
+					}
+					break;
+				case TcpGet:
+					server.backend.getControlValue(item.vi, item.control, item.value, server.latency);
+					if ( (item.flags & TcpSubscribe) != 0 )
+					{
+						server.subscribers[control_key_t(item.vi, item.control)].insert(sock);
+					}
+					break;
+				case TcpSet:
+					server.backend.setControlValue(item.vi, item.control, item.value, server.latency);
+					notify(server, item.vi, item.control, item.value);
+					item.value = CaptureValue();  // no need to send it back
+					break;
+				case TcpCall:
+					server.backend.call(item.vi, item.value, server.latency);
+					break;
+				case TcpUpdate:
+					if (item.control.size() == 0)
+					{
+						server.backend.updateCall(item.vi, item.value);
+					}
+					else if (server.backend.update(item.vi, item.control, item.value))
+					{
+						notify(server, item.vi, item.control, item.value);
+					}
+					break;
+				default:
+					throw std::runtime_error("unknown request");
+			}
+		}
+		catch(const std::exception& ex)
+		{
+			item.status = -1;
+			item.message = ex.what();
+			item.value = CaptureValue();
+		}
+	}
+	msg.type |= TcpReply;
+	return msg.type != (TcpUpdate | TcpReply);
+}
+
+static void connectionTask(void* arg)
+{
+	TcpConnection* conn = static_cast<TcpConnection*>(arg);
+	TcpServer& server = *(conn->server);
+	std::string body, frame;
+	TcpMessage msg;
+	printf("lvDCOMTcpServer: connection from %s\n", conn->peer.c_str());
+	fflush(stdout);
+	while(tcpReceive(conn->sock, body) && tcpDecode(body, msg))
+	{
+		epicsGuard<epicsMutex> _lock(server.lock);
+		if (handle(server, conn->sock, msg))
+		{
+			tcpEncode(msg, frame);
+			if (!tcpSend(conn->sock, frame))
+			{
+				break;
+			}
+		}
+	}
+	{
+		epicsGuard<epicsMutex> _lock(server.lock);
+		for(std::map<control_key_t, std::set<SOCKET> >::iterator it = server.subscribers.begin(); it != server.subscribers.end(); ++it)
+		{
+			it->second.erase(conn->sock);
+		}
+	}
+	printf("lvDCOMTcpServer: %s disconnected\n", conn->peer.c_str());
+	epicsSocketDestroy(conn->sock);
+	delete conn;
+}
+
+static void usage()
+{
+	fprintf(stderr, "Usage: lvDCOMTcpServer [-p port] [-l latency]\n");
+	exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+	int port = tcp_default_port;
+	TcpServer server;
+	for(int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-p") && i + 1 < argc)
+		{
+			port = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "-l") && i + 1 < argc)
+		{
+			server.latency = atof(argv[++i]);
+		}
+		else
+		{
+			usage();
+		}
+	}
+	if (port <= 0 || port > 65535 || server.latency < 0.0)
+	{
+		usage();
+	}
+	if (!osiSockAttach())
+	{
+		fprintf(stderr, "lvDCOMTcpServer: osiSockAttach failed\n");
+		return 1;
+	}
+	SOCKET listener = epicsSocketCreate(AF_INET, SOCK_STREAM, 0);
+	if (listener == INVALID_SOCKET)
+	{
+		fprintf(stderr, "lvDCOMTcpServer: cannot create socket\n");
+		return 1;
+	}
+	epicsSocketEnableAddressReuseDuringTimeWaitState(listener);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(static_cast<unsigned short>(port));
+	if (bind(listener, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listener, 10) != 0)
+	{
+		fprintf(stderr, "lvDCOMTcpServer: cannot listen on port %d\n", port);
+		epicsSocketDestroy(listener);
+		return 1;
+	}
+	printf("lvDCOMTcpServer: listening on port %d\n", port);
+	fflush(stdout);
+	while(true)
+	{
+		struct sockaddr_in peer;
+		osiSocklen_t len = sizeof(peer);
+		SOCKET sock = epicsSocketAccept(listener, reinterpret_cast<struct sockaddr*>(&peer), &len);
+		if (sock == INVALID_SOCKET)
+		{
+			continue;
+		}
+		tcpNoDelay(sock);
+		TcpConnection* conn = new TcpConnection;
+		char name[64];
+		ipAddrToDottedIP(&peer, name, sizeof(name));
+		conn->server = &server;
+		conn->sock = sock;
+		conn->peer = name;
+		if (epicsThreadCreate("lvDCOMTcpServer", epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackMedium),
+		        connectionTask, conn) == 0)
+		{
+			fprintf(stderr, "lvDCOMTcpServer: epicsThreadCreate failure\n");
+			epicsSocketDestroy(sock);
+			delete conn;
+		}
+	}
+	return 0;
+}
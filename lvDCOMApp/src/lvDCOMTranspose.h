@@ -0,0 +1,74 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMTranspose.h Slicing and conversion of column major 2D SAFEARRAY data to the row major order used by EPICS.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#ifndef LV_DCOM_TRANSPOSE_H
+#define LV_DCOM_TRANSPOSE_H
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <string>
+
+/// Copy rows [\a row0, \a row0 + \a nr) and columns [\a col0, \a col0 + \a nc) of the column major matrix \a src, which 
+/// has \a src_rows rows (the layout of a LabVIEW 2D array in a SAFEARRAY), to \a dest in row major order.
+/// The copy is done a tile at a time so both the reads and the strided writes stay within a few cache lines, rather than
+/// the writes striding across the whole of \a dest for every column. The inner loop reads contiguous memory
+/// and has no dependencies between iterations, so the compiler can vectorise it.
+template <typename S, typename T>
+void transposeBlocked(const S* src, size_t src_rows, size_t row0, size_t nr, size_t col0, size_t nc, T* dest)
+{
+	static const size_t block = 32;  // 32x32 doubles is 8k, two tiles fit comfortably in L1
+	for(size_t jb = 0; jb < nc; jb += block)
+	{
+		size_t je = (jb + block < nc ? jb + block : nc);
+		for(size_t ib = 0; ib < nr; ib += block)
+		{
+			size_t ie = (ib + block < nr ? ib + block : nr);
+			for(size_t j = jb; j < je; ++j)
+			{
+				const S* column = src + (col0 + j) * src_rows + row0;
+				T* out = dest + j;
+				for(size_t i = ib; i < ie; ++i)
+				{
+					out[i * nc] = static_cast<T>(column[i]);
+				}
+			}
+		}
+	}
+}
+
+/// Parse a \<read\> rows or cols attribute, "first:last" (last may be omitted for the end of the array) or a single index,
+/// 0 based and inclusive, into a range of an array dimension of size \a n. An empty \a spec selects the whole dimension.
+inline void parseSlice(const std::string& spec, size_t n, size_t& first, size_t& count)
+{
+	first = 0;
+	count = n;
+	if (spec.size() == 0 || n == 0)
+	{
+		return;
+	}
+	size_t colon = spec.find(':');
+	long f = atol(spec.c_str());
+	long l = static_cast<long>(n) - 1;
+	if (colon == std::string::npos)
+	{
+		l = f;
+	}
+	else if (colon + 1 < spec.size())
+	{
+		l = atol(spec.c_str() + colon + 1);
+	}
+	f = (f < 0 ? 0 : f);
+	l = (l >= static_cast<long>(n) ? static_cast<long>(n) - 1 : l);
+	first = static_cast<size_t>(f);
+	count = (l >= f ? static_cast<size_t>(l - f + 1) : 0);
+}
+
+#endif /* LV_DCOM_TRANSPOSE_H */
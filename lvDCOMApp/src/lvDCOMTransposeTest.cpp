@@ -0,0 +1,76 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMTransposeTest.cpp Unit tests of transposeBlocked() and parseSlice().
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#include <vector>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "lvDCOMTranspose.h"
+
+/// true if parseSlice() of \a spec over \a n gives \a first and \a count
+static bool slice(const char* spec, size_t n, size_t first, size_t count)
+{
+	size_t f = 99, c = 99;
+	parseSlice(spec, n, f, c);
+	return (f == first && c == count);
+}
+
+/// Transpose rows [\a row0, \a row0 + \a nr) and columns [\a col0, \a col0 + \a nc) of a \a rows x \a cols column major
+/// matrix and return the number of elements that differ from a direct element by element copy
+static int compareTranspose(size_t rows, size_t cols, size_t row0, size_t nr, size_t col0, size_t nc)
+{
+	std::vector<int> src(rows * cols);
+	for(size_t k = 0; k < src.size(); ++k)
+	{
+		src[k] = static_cast<int>(k * 3 + 1);
+	}
+	std::vector<double> dest(nr * nc, -1.0);
+	transposeBlocked(&(src[0]), rows, row0, nr, col0, nc, &(dest[0]));
+	int wrong = 0;
+	for(size_t i = 0; i < nr; ++i)
+	{
+		for(size_t j = 0; j < nc; ++j)
+		{
+			wrong += (dest[i * nc + j] != static_cast<double>(src[(col0 + j) * rows + row0 + i]));
+		}
+	}
+	return wrong;
+}
+
+MAIN(lvDCOMTransposeTest)
+{
+	testPlan(14);
+
+	testDiag("parseSlice");
+	testOk1(slice("", 8, 0, 8));
+	testOk1(slice("2", 8, 2, 1));
+	testOk1(slice("2:", 8, 2, 6));
+	testOk1(slice("1:3", 8, 1, 3));
+	testOk1(slice("5:100", 8, 5, 3));
+	testOk1(slice("-3:2", 8, 0, 3));
+	testOk1(slice("3:1", 8, 3, 0));
+	testOk1(slice("9", 8, 9, 0));
+	testOk1(slice("1:3", 0, 0, 0));
+
+	testDiag("transposeBlocked");
+	int wrong = compareTranspose(3, 2, 0, 3, 0, 2);
+	testOk(wrong == 0, "3x2 whole: %d elements wrong", wrong);
+	wrong = compareTranspose(32, 32, 0, 32, 0, 32);
+	testOk(wrong == 0, "32x32 whole, one tile: %d elements wrong", wrong);
+	wrong = compareTranspose(70, 45, 0, 70, 0, 45);
+	testOk(wrong == 0, "70x45 whole, partial tiles: %d elements wrong", wrong);
+	wrong = compareTranspose(70, 45, 3, 60, 5, 37);
+	testOk(wrong == 0, "rows 3:62 cols 5:41 of 70x45: %d elements wrong", wrong);
+	wrong = compareTranspose(1, 100, 0, 1, 10, 80);
+	testOk(wrong == 0, "cols 10:89 of a single row: %d elements wrong", wrong);
+
+	return testDone();
+}
@@ -0,0 +1,249 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMVIStrings.cpp Implementation of #lvDCOMVIStrings class.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+
+#include "lvDCOMVIStrings.h"
+
+/// a tag of the ExportVIStrings() output
+struct VIStringsTag
+{
+	std::string name;   ///< as written, without the / of a closing tag
+	bool closing;
+	std::vector< std::pair<std::string,std::string> > attributes;
+	std::string attribute(const char* attr) const
+	{
+		for(size_t i = 0; i < attributes.size(); ++i)
+		{
+			if (attributes[i].first == attr)
+			{
+				return attributes[i].second;
+			}
+		}
+		return "";
+	}
+};
+
+/// replace the XML entities LabVIEW may use in names and text
+static std::string decodeEntities(const std::string& str)
+{
+	static const char* entities[][2] = { { "&lt;", "<" }, { "&gt;", ">" }, { "&quot;", "\"" }, { "&apos;", "'" }, { "&amp;", "&" } };
+	std::string res;
+	res.reserve(str.size());
+	for(size_t i = 0; i < str.size(); ++i)
+	{
+		size_t j = 0, nentities = sizeof(entities) / sizeof(entities[0]);
+		if (str[i] == '&')
+		{
+			for(j = 0; j < nentities && str.compare(i, strlen(entities[j][0]), entities[j][0]) != 0; ++j)
+			{
+			}
+		}
+		if (str[i] == '&' && j < nentities)
+		{
+			res += entities[j][1];
+			i += strlen(entities[j][0]) - 1;
+		}
+		else
+		{
+			res += str[i];
+		}
+	}
+	return res;
+}
+
+/// position of the quote closing a quoted attribute value that starts at \a pos. LabVIEW does not escape a " in
+/// a control name, so a closing quote is one followed by white space, /, > or the end of the tag
+static size_t closingQuote(const std::string& text, size_t pos)
+{
+	for(size_t i = pos; i < text.size(); ++i)
+	{
+		if ( text[i] == '"' && (i + 1 == text.size() || strchr(" \t\r\n/>", text[i + 1]) != NULL) )
+		{
+			return i;
+		}
+	}
+	return std::string::npos;
+}
+
+/// split the text between < and > into a tag name and attributes, which can be name="value" or name=value
+static void parseTag(const std::string& text, VIStringsTag& tag)
+{
+	static const char* space = " \t\r\n";
+	tag = VIStringsTag();
+	size_t pos = 0;
+	tag.closing = (text.size() > 0 && text[0] == '/');
+	pos = (tag.closing ? 1 : 0);
+	size_t end = text.find_first_of(" \t\r\n/", pos);
+	tag.name = text.substr(pos, end - pos);
+	pos = end;
+	while( pos < text.size() && (pos = text.find_first_not_of(space, pos)) != std::string::npos )
+	{
+		size_t eq = text.find('=', pos);
+		if (eq == std::string::npos)
+		{
+			break;
+		}
+		std::string attr = text.substr(pos, eq - pos);
+		attr.erase(attr.find_last_not_of(space) + 1);
+		pos = eq + 1;
+		std::string value;
+		if (pos < text.size() && text[pos] == '"')
+		{
+			end = closingQuote(text, pos + 1);
+			end = (end == std::string::npos ? text.size() : end);
+			value = text.substr(pos + 1, end - pos - 1);
+			pos = end + 1;
+		}
+		else
+		{
+			end = text.find_first_of(space, pos);
+			end = (end == std::string::npos ? text.size() : end);
+			value = text.substr(pos, end - pos);
+			pos = end;
+		}
+		tag.attributes.push_back(std::pair<std::string,std::string>(attr, decodeEntities(value)));
+	}
+}
+
+/// FNV-1a
+static epicsUInt32 hashText(const char* text, size_t n)
+{
+	epicsUInt32 h = 2166136261u;
+	for(size_t i = 0; i < n; ++i)
+	{
+		h = (h ^ static_cast<unsigned char>(text[i])) * 16777619u;
+	}
+	return h;
+}
+
+/// the whole of \a file_name, which would usually have been written by ExportVIStrings()
+std::string lvDCOMVIStrings::readFile(const std::string& file_name)
+{
+	std::fstream fs(file_name.c_str(), std::ios::in | std::ios::binary);
+	if (!fs.good())
+	{
+		throw std::runtime_error("lvDCOMVIStrings: cannot open " + file_name);
+	}
+	std::string text((std::istreambuf_iterator<char>(fs)), std::istreambuf_iterator<char>());
+	return text;
+}
+
+/// Collect the top level CONTROL tags, the first nested CONTROL gives the type of a "Type Definition", and
+/// STRING tags within a "Ring Text" or "Boolean Text" PART give the items.
+void lvDCOMVIStrings::parse(const std::string& text)
+{
+	m_controls.clear();
+	m_vi_name.clear();
+	VIStringsTag tag;
+	VIStringsControl control;
+	std::vector<std::string> parts;  ///< types of the PART tags we are within
+	std::string inner_type, str;
+	size_t control_start = 0;
+	int depth = 0;                   ///< of CONTROL tags
+	bool in_string = false;
+	size_t pos = 0;
+	while(pos < text.size())
+	{
+		size_t lt = text.find('<', pos);
+		if (lt == std::string::npos)
+		{
+			break;
+		}
+		if (in_string)
+		{
+			str.append(text, pos, lt - pos);
+		}
+		// <<...>> is a LabVIEW escape for a character in text, not a tag
+		if (text.compare(lt, 2, "<<") == 0)
+		{
+			size_t gt = text.find(">>", lt + 2);
+			pos = (gt == std::string::npos ? text.size() : gt + 2);
+			continue;
+		}
+		// find the end of the tag, a > inside a quoted attribute value does not count
+		size_t gt = lt + 1;
+		while(gt < text.size() && text[gt] != '>')
+		{
+			if ( text.compare(gt, 2, "=\"") == 0 && (gt = closingQuote(text, gt + 2)) == std::string::npos )
+			{
+				gt = text.size();
+				break;
+			}
+			++gt;
+		}
+		parseTag(text.substr(lt + 1, gt - lt - 1), tag);
+		pos = (gt < text.size() ? gt + 1 : text.size());
+		if (tag.name == "VI" && !tag.closing && m_vi_name.size() == 0)
+		{
+			m_vi_name = tag.attribute("name");
+		}
+		else if (tag.name == "CONTROL" && !tag.closing)
+		{
+			if (++depth == 1)
+			{
+				control = VIStringsControl();
+				control.name = tag.attribute("name");
+				control.type = tag.attribute("type");
+				inner_type.clear();
+				control_start = lt;
+			}
+			else if (inner_type.size() == 0)
+			{
+				inner_type = tag.attribute("type");
+			}
+		}
+		else if (tag.name == "CONTROL" && tag.closing && depth > 0)
+		{
+			if (--depth == 0)
+			{
+				if (control.type == "Type Definition" && inner_type.size() > 0)
+				{
+					control.type = inner_type;
+				}
+				control.signature = hashText(text.data() + control_start, pos - control_start);
+				if (control.name.size() > 0)
+				{
+					m_controls.push_back(control);
+				}
+			}
+		}
+		else if (depth == 0)
+		{
+			continue;
+		}
+		else if (tag.name == "PART" && !tag.closing)
+		{
+			parts.push_back(tag.attribute("type"));
+		}
+		else if (tag.name == "PART" && tag.closing && parts.size() > 0)
+		{
+			parts.pop_back();
+		}
+		else if (tag.name == "STRING" && !tag.closing && parts.size() > 0 && (parts.back() == "Ring Text" || parts.back() == "Boolean Text"))
+		{
+			in_string = true;
+			str.clear();
+		}
+		else if (tag.name == "STRING" && tag.closing && in_string)
+		{
+			in_string = false;
+			control.items.push_back(decodeEntities(str));
+		}
+	}
+}
@@ -0,0 +1,48 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMVIStrings.h header for #lvDCOMVIStrings class.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#ifndef LV_DCOM_VI_STRINGS_H
+#define LV_DCOM_VI_STRINGS_H
+
+#include <string>
+#include <vector>
+
+#include <epicsTypes.h>
+
+/// a front panel control (or indicator) found in the output of ExportVIStrings()
+struct VIStringsControl
+{
+	std::string name;                ///< label, which is the name GetControlValue() and SetControlValue() use
+	std::string type;                ///< LabVIEW type e.g. "Numeric", "Ring", "Array", a "Type Definition" is given as the type it defines
+	std::vector<std::string> items;  ///< ring, enum or boolean text, in order
+	epicsUInt32 signature;           ///< hash of everything exported for the control, so changes when the control is edited
+	VIStringsControl() : signature(0) { }
+};
+
+/// Reads the front panel controls from the file written by the LabVIEW ExportVIStrings() method. This output is
+/// tag based but not XML (attribute values may be unquoted and tags such as \<LF\> are never closed), so rather
+/// than fixing it up for an XML parser as fix_xml.sh does only the CONTROL, PART and STRING tags are
+/// followed and anything else is skipped. Control names are taken as written, so can contain any character.
+/// Does not need Windows.
+class lvDCOMVIStrings
+{
+public:
+	explicit lvDCOMVIStrings(const std::string& text) { parse(text); }
+	static std::string readFile(const std::string& file_name);
+	const std::vector<VIStringsControl>& controls() const { return m_controls; }
+	const std::string& viName() const { return m_vi_name; }
+
+private:
+	std::vector<VIStringsControl> m_controls;  ///< top level controls, in front panel order
+	std::string m_vi_name;
+	void parse(const std::string& text);
+};
+
+#endif /* LV_DCOM_VI_STRINGS_H */
@@ -0,0 +1,146 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMVIStringsTest.cpp Unit tests of #lvDCOMVIStrings.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+///
+/// Parses ExportVIStrings() output like exampleApp/src/controls.txt, and the parts of the format that are not XML:
+/// unquoted attribute values, names containing " and >, entities, <<...>> escapes and unclosed tags.
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "lvDCOMVIStrings.h"
+
+/// exampleApp/src/controls.txt shortened, with the button given Boolean Text
+static const char* example_text =
+	"<VI syntaxVersion=11 LVversion=10008000 revision=6 name=\"example.vi\">\n"
+	"<TITLE><NO_TITLE name=\"example.vi\"></TITLE>\n"
+	"<CONTENT>\n"
+	"\t<GROUPER>\n"
+	"\t\t<PARTS>\n"
+	"\t\t</PARTS></GROUPER>\n"
+	"\t<CONTROL ID=80 type=\"Numeric\" name=\"Some Control\">\n"
+	"\t\t<DESC></DESC>\n"
+	"\t\t<PARTS>\n"
+	"\t\t\t<PART ID=82 order=0 type=\"Caption\"><LABEL><STEXT>Some Control</STEXT></LABEL></PART>\n"
+	"\t\t</PARTS>\n"
+	"\t</CONTROL>\n"
+	"\t<CONTROL ID=81 type=\"String\" name=\"Some String\">\n"
+	"\t\t<PARTS>\n"
+	"\t\t\t<PART ID=11 order=0 type=\"Text\"><LABEL><STEXT></STEXT></LABEL></PART>\n"
+	"\t\t</PARTS>\n"
+	"\t\t<DEFAULT><SAME_AS_LABEL></DEFAULT>\n"
+	"\t</CONTROL>\n"
+	"\t<CONTROL ID=82 type=\"Array\" name=\"Some Array\">\n"
+	"\t\t<DEFAULT>\n"
+	"\t\t\t<ARRAY nElems=0>\n"
+	"\t\t\t</ARRAY>\n"
+	"\t\t</DEFAULT>\n"
+	"\t\t<CONTENT>\n"
+	"\t\t\t<CONTROL ID=80 type=\"Numeric\" name=\"Numeric\">\n"
+	"\t\t\t</CONTROL>\n"
+	"\t\t</CONTENT>\n"
+	"\t</CONTROL>\n"
+	"\t<CONTROL ID=79 type=\"Boolean\" name=\"Some Button\">\n"
+	"\t\t<PARTS>\n"
+	"\t\t\t<PART ID=20 order=0 type=\"Boolean Text\"><MLABEL><STRINGS><STRING>Off</STRING><STRING>On</STRING></STRINGS></MLABEL></PART>\n"
+	"\t\t</PARTS>\n"
+	"\t</CONTROL>\n"
+	"</CONTENT>\n"
+	"</VI>\n";
+
+/// a ring, a type definition, and names that need care
+static std::string awkwardText(const char* mode_desc)
+{
+	return std::string(
+	"<VI name=plain.vi>\n"
+	"<CONTENT>\n"
+	"<CONTROL ID=83 type=\"Ring\" name=\"Mode\">\n"
+	"<DESC>") + mode_desc + "</DESC>\n"
+	"<PARTS>\n"
+	"<PART ID=82 order=0 type=\"Caption\"><LABEL><STEXT>Mode<LF></STEXT></LABEL></PART>\n"
+	"<PART ID=3 order=0 type=\"Ring Text\"><MLABEL><STRINGS><STRING>Off</STRING><STRING>A &amp; B</STRING>"
+	"<STRING><<B>>bold</STRING></STRINGS></MLABEL></PART>\n"
+	"</PARTS>\n"
+	"</CONTROL>\n"
+	"<CONTROL ID=84 type=\"Type Definition\" name=\"Settings\">\n"
+	"<CONTENT><CONTROL ID=85 type=\"Cluster\" name=\"Settings\"></CONTROL></CONTENT>\n"
+	"</CONTROL>\n"
+	"<CONTROL ID=80 type=Numeric name=\"a>b\"c\">\n"
+	"</CONTROL>\n"
+	"<CONTROL ID=80 type=\"Numeric\" name=\"x &lt; y\">\n"
+	"</CONTROL>\n"
+	"<CONTROL ID=80 type=\"Numeric\" name=\"\">\n"
+	"</CONTROL>\n"
+	"</CONTENT>\n"
+	"</VI>\n";
+}
+
+MAIN(lvDCOMVIStringsTest)
+{
+	testPlan(16);
+
+	testDiag("exampleApp controls");
+	lvDCOMVIStrings example(example_text);
+	const std::vector<VIStringsControl>& controls = example.controls();
+	testOk(example.viName() == "example.vi", "VI name \"%s\"", example.viName().c_str());
+	testOk(controls.size() == 4, "%d top level controls", static_cast<int>(controls.size()));
+	if (controls.size() == 4)
+	{
+		testOk1(controls[0].name == "Some Control" && controls[0].type == "Numeric" && controls[0].items.size() == 0);
+		testOk1(controls[1].name == "Some String" && controls[1].type == "String");
+		testOk1(controls[2].name == "Some Array" && controls[2].type == "Array");
+		testOk1(controls[3].name == "Some Button" && controls[3].items.size() == 2 && controls[3].items[0] == "Off" && controls[3].items[1] == "On");
+	}
+	else
+	{
+		testSkip(4, "wrong number of controls");
+	}
+
+	testDiag("rings, type definitions and awkward names");
+	lvDCOMVIStrings awkward(awkwardText(""));
+	const std::vector<VIStringsControl>& acontrols = awkward.controls();
+	testOk(awkward.viName() == "plain.vi", "unquoted VI name \"%s\"", awkward.viName().c_str());
+	testOk(acontrols.size() == 4, "%d named top level controls", static_cast<int>(acontrols.size()));
+	if (acontrols.size() == 4)
+	{
+		testOk1(acontrols[0].name == "Mode" && acontrols[0].type == "Ring" && acontrols[0].items.size() == 3);
+		testOk(acontrols[0].items.size() == 3 && acontrols[0].items[1] == "A & B" && acontrols[0].items[2] == "bold",
+		    "ring items decoded and <<...>> skipped");
+		testOk(acontrols[1].name == "Settings" && acontrols[1].type == "Cluster", "type definition of a \"%s\"", acontrols[1].type.c_str());
+		testOk(acontrols[2].name == "a>b\"c" && acontrols[2].type == "Numeric", "name with \" and > read as \"%s\"", acontrols[2].name.c_str());
+		testOk(acontrols[3].name == "x < y", "name with an entity read as \"%s\"", acontrols[3].name.c_str());
+	}
+	else
+	{
+		testSkip(5, "wrong number of controls");
+	}
+
+	testDiag("signatures");
+	lvDCOMVIStrings again(awkwardText(""));
+	lvDCOMVIStrings edited(awkwardText("now documented"));
+	testOk1(again.controls().size() == 4 && again.controls()[0].signature == acontrols[0].signature && again.controls()[2].signature == acontrols[2].signature);
+	testOk1(edited.controls().size() == 4 && edited.controls()[0].signature != acontrols[0].signature &&
+	    edited.controls()[1].signature == acontrols[1].signature);
+
+	try
+	{
+		lvDCOMVIStrings::readFile("no such lvDCOMVIStringsTest file.txt");
+		testFail("readFile of a missing file");
+	}
+	catch(const std::runtime_error&)
+	{
+		testPass("readFile of a missing file throws");
+	}
+
+	return testDone();
+}
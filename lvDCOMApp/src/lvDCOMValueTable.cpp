@@ -0,0 +1,373 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMValueTable.cpp Memory mapped table of parameter values, see lvDCOMValueTable.h
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#include <string.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+#include <epicsAtomic.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+
+#include "lvDCOMShm.h"
+#include "lvDCOMValueTable.h"
+
+/// seconds a reader waits for the driver to finish changing a slot, or to initialise the file, before giving up
+static const double value_table_wait = 1.0;
+
+/// copy as much of \a s as fits into the fixed size field \a field, returning false if it did not all fit
+static bool putField(char* field, size_t size, const std::string& s)
+{
+	size_t n = (s.size() < size ? s.size() : size - 1);
+	memcpy(field, s.c_str(), n);
+	field[n] = '\0';
+	return n == s.size();
+}
+
+/// the string in the fixed size field \a field, which a torn read may have left unterminated
+static std::string getField(const char* field, size_t size)
+{
+	const char* end = static_cast<const char*>(memchr(field, '\0', size));
+	return std::string(field, (end != NULL ? end - field : size));
+}
+
+/// spin at first as the driver is usually just finishing, then yield for 10ms, then sleep a millisecond at a time.
+/// Returns false once \a start is more than value_table_wait ago
+static bool valueTableBackoff(int attempt, const epicsTime& start)
+{
+	if (attempt < 64)
+	{
+		return true;
+	}
+	double waited = epicsTime::getCurrent() - start;
+	if (waited > value_table_wait)
+	{
+		return false;
+	}
+	epicsThreadSleep(waited < 0.01 ? 0.0 : 0.001);
+	return true;
+}
+
+const char* valueTableTypeName(ValueTableType type)
+{
+	switch(type)
+	{
+		case ValueTableInt32:
+			return "int32";
+		case ValueTableFloat64:
+			return "float64";
+		case ValueTableString:
+			return "string";
+		case ValueTableUInt32Digital:
+			return "uint32digital";
+		case ValueTableFloat64Array:
+			return "float64array";
+		case ValueTableInt32Array:
+			return "int32array";
+		default:
+			return "none";
+	}
+}
+
+/// Map \a file_name with room for \a slots parameters, creating it if need be, and clear it for port \a port.
+/// The file is never truncated as readers may have it mapped, a file left by a driver with more parameters keeps its size
+lvDCOMValueTableWriter::lvDCOMValueTableWriter(const std::string& file_name, const std::string& port, size_t slots) :
+    m_file_name(file_name), m_region(NULL), m_slots(slots), m_updates(0), m_dropped(0)
+{
+	m_region = lvDCOMShmRegion::mapFile(file_name, sizeof(ValueTableHeader) + slots * sizeof(ValueTableSlot), true);
+	ValueTableHeader* h = reinterpret_cast<ValueTableHeader*>(m_region->base());
+	// the epoch is changed before anything else, and is after the magic and version, so a reader part way through a
+	// read sees it change and starts again
+	h->magic = 0;
+	epicsAtomicSetIntT(&(h->epoch), h->epoch + 1);
+	epicsAtomicWriteMemoryBarrier();
+	size_t keep = offsetof(ValueTableHeader, epoch) + sizeof(h->epoch);
+	memset(m_region->base() + keep, 0, m_region->size() - keep);
+	h->version = value_table_version;
+	h->slot_size = sizeof(ValueTableSlot);
+	h->slot_max = static_cast<epicsUInt32>(slots);
+	h->slot_offset = sizeof(ValueTableHeader);
+	h->updated = static_cast<epicsInt32>(static_cast<epicsTimeStamp>(epicsTime::getCurrent()).secPastEpoch);
+#ifdef _WIN32
+	h->writer_pid = GetCurrentProcessId();
+#else
+	h->writer_pid = getpid();
+#endif
+	putField(h->port, sizeof(h->port), port);
+	epicsAtomicWriteMemoryBarrier();
+	h->magic = value_table_magic;
+	epicsAtomicWriteMemoryBarrier();
+}
+
+lvDCOMValueTableWriter::~lvDCOMValueTableWriter()
+{
+	delete m_region;
+}
+
+/// write \a entry to slot \a slot. Returns false, and counts it in dropped(), if the table has no such slot
+bool lvDCOMValueTableWriter::publish(size_t slot, const ValueTableEntry& entry)
+{
+	if (slot >= m_slots)
+	{
+		++m_dropped;
+		return false;
+	}
+	ValueTableHeader* h = reinterpret_cast<ValueTableHeader*>(m_region->base());
+	ValueTableSlot* s = reinterpret_cast<ValueTableSlot*>(m_region->base() + h->slot_offset) + slot;
+	epicsInt32 seq = s->seq;
+	epicsAtomicSetIntT(&(s->seq), seq + 1);
+	epicsAtomicWriteMemoryBarrier();
+	s->type = entry.type;
+	s->status = entry.status;
+	s->alarm_status = entry.alarm_status;
+	s->alarm_severity = entry.alarm_severity;
+	s->flags = entry.flags & ValueTableUndefined;
+	s->sec = entry.stamp.secPastEpoch;
+	s->nsec = entry.stamp.nsec;
+	s->ival = entry.ival;
+	s->dval = entry.dval;
+	s->length = entry.length;
+	if (entry.type == ValueTableString)
+	{
+		s->length = entry.sval.size();
+		if (!putField(s->sval, sizeof(s->sval), entry.sval))
+		{
+			s->flags |= ValueTableTruncated;
+		}
+	}
+	if (s->name[0] == '\0')
+	{
+		putField(s->name, sizeof(s->name), entry.name);
+	}
+	++(s->updates);
+	epicsAtomicWriteMemoryBarrier();
+	epicsAtomicSetIntT(&(s->seq), seq + 2);
+	if (static_cast<size_t>(h->slot_count) <= slot)
+	{
+		epicsAtomicSetIntT(&(h->slot_count), static_cast<epicsInt32>(slot + 1));
+	}
+	epicsAtomicSetIntT(&(h->updated), static_cast<epicsInt32>(entry.stamp.secPastEpoch));
+	++(h->updates);
+	++m_updates;
+	return true;
+}
+
+/// map \a file_name read only, failing if it is not a value table
+lvDCOMValueTableReader::lvDCOMValueTableReader(const std::string& file_name) : m_file_name(file_name), m_region(NULL), m_epoch(0),
+    m_retries(0), m_remaps(0)
+{
+	remap();
+}
+
+lvDCOMValueTableReader::~lvDCOMValueTableReader()
+{
+	delete m_region;
+}
+
+const ValueTableHeader* lvDCOMValueTableReader::header() const
+{
+	return reinterpret_cast<const ValueTableHeader*>(m_region->base());
+}
+
+/// map the file again, waiting for a driver that is initialising it
+void lvDCOMValueTableReader::remap()
+{
+	epicsTime start = epicsTime::getCurrent();
+	for(int attempt = 0; ; ++attempt)
+	{
+		lvDCOMShmRegion* r = lvDCOMShmRegion::mapFile(m_file_name, 0, false);
+		const ValueTableHeader* h = reinterpret_cast<const ValueTableHeader*>(r->base());
+		if (r->size() >= sizeof(ValueTableHeader) && epicsAtomicGetIntT(reinterpret_cast<const epicsInt32*>(&(h->magic))) == static_cast<epicsInt32>(value_table_magic))
+		{
+			epicsAtomicReadMemoryBarrier();
+			if (h->version != value_table_version || h->slot_size < sizeof(ValueTableSlot) ||
+			    h->slot_offset + static_cast<epicsUInt64>(h->slot_max) * h->slot_size > r->size())
+			{
+				delete r;
+				throw std::runtime_error("lvDCOMValueTable: \"" + m_file_name + "\" is not a value table this reader understands");
+			}
+			if (m_region != NULL)
+			{
+				delete m_region;
+				++m_remaps;
+			}
+			m_region = r;
+			m_epoch = epicsAtomicGetIntT(&(h->epoch));
+			m_names.clear();
+			return;
+		}
+		delete r;
+		if (!valueTableBackoff(attempt, start))
+		{
+			throw std::runtime_error("lvDCOMValueTable: \"" + m_file_name + "\" has not been initialised by a driver");
+		}
+	}
+}
+
+/// map the file again if a driver has re-initialised it since it was mapped
+void lvDCOMValueTableReader::check()
+{
+	const ValueTableHeader* h = header();
+	if ( epicsAtomicGetIntT(reinterpret_cast<const epicsInt32*>(&(h->magic))) != static_cast<epicsInt32>(value_table_magic) ||
+	     epicsAtomicGetIntT(&(h->epoch)) != m_epoch )
+	{
+		remap();
+	}
+}
+
+/// copy slot \a slot under its seqlock, returning false if there is no such slot
+bool lvDCOMValueTableReader::copySlot(size_t slot, ValueTableSlot& copy)
+{
+	check();
+	epicsTime start = epicsTime::getCurrent();
+	for(int attempt = 0; ; ++attempt)
+	{
+		const ValueTableHeader* h = header();
+		if (slot >= h->slot_max)
+		{
+			return false;
+		}
+		const ValueTableSlot* s = reinterpret_cast<const ValueTableSlot*>(m_region->base() + h->slot_offset + slot * h->slot_size);
+		epicsInt32 seq = epicsAtomicGetIntT(&(s->seq));
+		if ( (seq & 1) == 0 )
+		{
+			epicsAtomicReadMemoryBarrier();
+			memcpy(&copy, s, sizeof(ValueTableSlot));
+			epicsAtomicReadMemoryBarrier();
+			if (epicsAtomicGetIntT(&(s->seq)) == seq && epicsAtomicGetIntT(&(h->epoch)) == m_epoch)
+			{
+				return true;
+			}
+			++m_retries;
+			if (epicsAtomicGetIntT(&(h->epoch)) != m_epoch)
+			{
+				check();
+				start = epicsTime::getCurrent();
+				attempt = 0;
+				continue;
+			}
+		}
+		if (!valueTableBackoff(attempt, start))
+		{
+			throw std::runtime_error("lvDCOMValueTable: a slot of \"" + m_file_name + "\" is being changed for too long, has the driver stopped?");
+		}
+	}
+}
+
+/// number of slots that may be in use
+size_t lvDCOMValueTableReader::size()
+{
+	check();
+	return static_cast<size_t>(epicsAtomicGetIntT(&(header()->slot_count)));
+}
+
+/// asyn port name of the driver writing the table
+std::string lvDCOMValueTableReader::port()
+{
+	check();
+	return getField(header()->port, sizeof(header()->port));
+}
+
+/// when the driver last changed any slot
+epicsTimeStamp lvDCOMValueTableReader::updated()
+{
+	check();
+	epicsTimeStamp stamp;
+	stamp.secPastEpoch = static_cast<epicsUInt32>(epicsAtomicGetIntT(&(header()->updated)));
+	stamp.nsec = 0;
+	return stamp;
+}
+
+/// read slot \a slot (asyn parameter index) into \a entry, returning false if it is not in use
+bool lvDCOMValueTableReader::read(size_t slot, ValueTableEntry& entry)
+{
+	ValueTableSlot copy;
+	if (!copySlot(slot, copy) || copy.type == ValueTableNone)
+	{
+		return false;
+	}
+	entry.name = getField(copy.name, sizeof(copy.name));
+	entry.type = static_cast<ValueTableType>(copy.type);
+	entry.status = copy.status;
+	entry.alarm_status = copy.alarm_status;
+	entry.alarm_severity = copy.alarm_severity;
+	entry.flags = copy.flags;
+	entry.stamp.secPastEpoch = copy.sec;
+	entry.stamp.nsec = copy.nsec;
+	entry.length = static_cast<size_t>(copy.length);
+	entry.updates = static_cast<unsigned long>(copy.updates);
+	entry.ival = copy.ival;
+	entry.dval = copy.dval;
+	if (entry.type == ValueTableString)
+	{
+		entry.sval = getField(copy.sval, sizeof(copy.sval));
+	}
+	else
+	{
+		entry.sval.clear();
+	}
+	return true;
+}
+
+/// read the parameter called \a name into \a entry, returning false if the table has no such parameter
+bool lvDCOMValueTableReader::read(const std::string& name, ValueTableEntry& entry)
+{
+	for(int pass = 0; pass < 2; ++pass)
+	{
+		check();
+		std::map<std::string, size_t>::const_iterator it = m_names.find(name);
+		if (it != m_names.end() && read(it->second, entry) && entry.name == name)
+		{
+			return true;
+		}
+		if (pass > 0)
+		{
+			break;
+		}
+		// not seen yet, or the table has been re-initialised, so look the names up again
+		m_names.clear();
+		size_t n = size();
+		ValueTableEntry e;
+		for(size_t i = 0; i < n; ++i)
+		{
+			if (read(i, e))
+			{
+				m_names[e.name] = i;
+			}
+		}
+	}
+	return false;
+}
+
+/// read every slot in use
+void lvDCOMValueTableReader::readAll(std::vector<ValueTableEntry>& entries)
+{
+	entries.clear();
+	size_t n = size();
+	ValueTableEntry e;
+	for(size_t i = 0; i < n; ++i)
+	{
+		if (read(i, e))
+		{
+			entries.push_back(e);
+		}
+	}
+}
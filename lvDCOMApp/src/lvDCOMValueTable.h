@@ -0,0 +1,173 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMValueTable.h header for #lvDCOMValueTableWriter and #lvDCOMValueTableReader classes.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+///
+/// A memory mapped file, named by the section value_table attribute, in which #lvDCOMDriver keeps the latest value,
+/// time and status of every parameter of its port. Other processes on the same machine map it read only with
+/// #lvDCOMValueTableReader and see values as soon as the driver has them, without Channel Access or a call to LabVIEW.
+/// The file has a fixed binary layout, version #value_table_version, with all fields in the byte order of the machine:
+///
+///   header      #ValueTableHeader, 256 bytes
+///   slots       #ValueTableHeader::slot_max #ValueTableSlot of #ValueTableHeader::slot_size bytes, slot i is asyn parameter i
+///
+/// The driver writes a slot under a seqlock: #ValueTableSlot::seq is odd while it is being changed, so a reader copies the
+/// slot and then checks seq is even and unchanged, trying again if not. Readers never block the driver. When the driver
+/// starts it increments #ValueTableHeader::epoch before clearing the file, so readers know to look their names up again.
+/// Only the length of array parameters is kept, with their status and time.
+
+#ifndef LV_DCOM_VALUE_TABLE_H
+#define LV_DCOM_VALUE_TABLE_H
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdexcept>
+
+#include <epicsTypes.h>
+#include <epicsTime.h>
+
+class lvDCOMShmRegion;
+
+static const epicsUInt32 value_table_magic = 0x5456564c;  ///< "LVVT"
+static const epicsUInt32 value_table_version = 1;
+
+/// type of a #ValueTableSlot, matching the asyn parameter type
+enum ValueTableType
+{
+	ValueTableNone = 0,          ///< slot not in use
+	ValueTableInt32 = 1,         ///< value in ival
+	ValueTableFloat64 = 2,       ///< value in dval
+	ValueTableString = 3,        ///< value in sval
+	ValueTableUInt32Digital = 4, ///< value in ival
+	ValueTableFloat64Array = 5,  ///< number of elements in length, no value
+	ValueTableInt32Array = 6     ///< number of elements in length, no value
+};
+
+/// #ValueTableSlot::flags
+enum ValueTableFlags
+{
+	ValueTableTruncated = 1,     ///< sval holds only the start of the string, length is its full length
+	ValueTableUndefined = 2      ///< the parameter has not had a value yet
+};
+
+struct ValueTableHeader
+{
+	epicsUInt32 magic;           ///< #value_table_magic once the file is initialised
+	epicsUInt32 version;
+	epicsInt32 epoch;            ///< changes each time a driver initialises the file
+	epicsUInt32 slot_size;       ///< bytes between slots
+	epicsUInt32 slot_max;
+	epicsInt32 slot_count;       ///< slots in use
+	epicsUInt64 slot_offset;
+	epicsInt32 updated;          ///< seconds past the EPICS epoch of the last change to any slot
+	epicsUInt32 writer_pid;
+	epicsUInt64 updates;         ///< number of slot changes since the file was initialised
+	char port[64];               ///< asyn port name of the driver
+	char pad[144];
+};
+
+struct ValueTableSlot
+{
+	epicsInt32 seq;              ///< seqlock, odd while the driver is changing the slot
+	epicsUInt32 type;            ///< #ValueTableType
+	epicsInt32 status;           ///< asynStatus of the parameter
+	epicsInt32 alarm_status;     ///< EPICS alarm status
+	epicsInt32 alarm_severity;   ///< EPICS alarm severity
+	epicsUInt32 flags;           ///< #ValueTableFlags
+	epicsUInt32 sec;             ///< time of the value, seconds past the EPICS epoch
+	epicsUInt32 nsec;
+	epicsUInt64 length;          ///< characters of a string, elements of an array
+	epicsUInt64 updates;         ///< number of times this slot has changed
+	epicsInt32 ival;
+	epicsInt32 pad0;
+	epicsFloat64 dval;
+	char name[128];              ///< asyn parameter name
+	char sval[320];
+};
+
+/// a copy of a #ValueTableSlot
+struct ValueTableEntry
+{
+	std::string name;
+	ValueTableType type;
+	int status;                  ///< asynStatus
+	int alarm_status;
+	int alarm_severity;
+	epicsUInt32 flags;
+	epicsTimeStamp stamp;
+	size_t length;
+	unsigned long updates;
+	epicsInt32 ival;
+	epicsFloat64 dval;
+	std::string sval;
+	ValueTableEntry() : type(ValueTableNone), status(0), alarm_status(0), alarm_severity(0), flags(0), length(0), updates(0), ival(0), dval(0.0)
+	{
+		stamp.secPastEpoch = stamp.nsec = 0;
+	}
+	bool undefined() const { return (flags & ValueTableUndefined) != 0; }
+};
+
+/// Creates (or re-initialises) a value table file and writes its slots. Only one thread may use it at once,
+/// #lvDCOMDriver calls it with the port lock held
+class lvDCOMValueTableWriter
+{
+public:
+	lvDCOMValueTableWriter(const std::string& file_name, const std::string& port, size_t slots);
+	~lvDCOMValueTableWriter();
+	bool publish(size_t slot, const ValueTableEntry& entry);
+	const std::string& fileName() const { return m_file_name; }
+	size_t slots() const { return m_slots; }
+	unsigned long updates() const { return m_updates; }
+	unsigned long dropped() const { return m_dropped; }
+
+private:
+	std::string m_file_name;
+	lvDCOMShmRegion* m_region;
+	size_t m_slots;
+	unsigned long m_updates;
+	unsigned long m_dropped;  ///< publish() calls for a slot beyond the end of the table
+};
+
+/// Reads a value table file written by an lvDCOM driver, see lvDCOMValueTable.h. An instance must only be used by one
+/// thread at a time, give each thread its own. Reads copy a slot at memory speed and never wait for the driver except
+/// for the moment it takes to change the slot.
+class lvDCOMValueTableReader
+{
+public:
+	explicit lvDCOMValueTableReader(const std::string& file_name);
+	~lvDCOMValueTableReader();
+	size_t size();
+	bool read(size_t slot, ValueTableEntry& entry);
+	bool read(const std::string& name, ValueTableEntry& entry);
+	void readAll(std::vector<ValueTableEntry>& entries);
+	std::string port();
+	epicsTimeStamp updated();
+	unsigned long retries() const { return m_retries; }
+	unsigned long remaps() const { return m_remaps; }
+
+private:
+	std::string m_file_name;
+	lvDCOMShmRegion* m_region;
+	epicsInt32 m_epoch;                  ///< of the file when #m_names was built
+	std::map<std::string, size_t> m_names;
+	unsigned long m_retries;             ///< seqlock reads that had to be tried again
+	unsigned long m_remaps;              ///< times the file was mapped again after the driver re-initialised it
+
+	const ValueTableHeader* header() const;
+	void check();
+	void remap();
+	bool copySlot(size_t slot, ValueTableSlot& copy);
+};
+
+/// a readable name for \a type
+extern const char* valueTableTypeName(ValueTableType type);
+
+#endif /* LV_DCOM_VALUE_TABLE_H */
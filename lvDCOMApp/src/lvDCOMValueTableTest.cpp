@@ -0,0 +1,157 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMValueTableTest.cpp Unit tests of #lvDCOMValueTableWriter and #lvDCOMValueTableReader.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+///
+/// Values written to a table file are read back by slot and by name, a slot past the end of the table is refused, a
+/// reader maps the file again when a new writer re-initialises it, and a reader copying slots while a thread keeps
+/// changing them never sees a slot with fields from two different writes.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <epicsTypes.h>
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "lvDCOMValueTable.h"
+
+static const char* table_file = "lvDCOMValueTableTest.tbl";
+static const char* text_file = "lvDCOMValueTableTest.txt";
+static const size_t table_slots = 8;
+
+static ValueTableEntry entry(const char* name, ValueTableType type, epicsInt32 ival, double dval, const std::string& sval)
+{
+	ValueTableEntry e;
+	e.name = name;
+	e.type = type;
+	e.ival = ival;
+	e.dval = dval;
+	e.sval = sval;
+	e.stamp.secPastEpoch = 1000 + ival;
+	e.stamp.nsec = 500;
+	return e;
+}
+
+/// keeps changing slot 0 so that its ival, dval, string and time all agree
+struct SlotChanger
+{
+	lvDCOMValueTableWriter* writer;
+	volatile bool stop;
+	int writes;
+	epicsEvent done;
+};
+
+static void changeTask(void* arg)
+{
+	SlotChanger& c = *static_cast<SlotChanger*>(arg);
+	char buffer[32];
+	for(c.writes = 1; !c.stop; ++c.writes)
+	{
+		sprintf(buffer, "%d", c.writes);
+		c.writer->publish(0, entry("changing", ValueTableString, c.writes, c.writes, buffer));
+	}
+	c.done.signal();
+}
+
+MAIN(lvDCOMValueTableTest)
+{
+	testPlan(18);
+	remove(table_file);
+
+	testDiag("write and read back");
+	lvDCOMValueTableWriter* writer = new lvDCOMValueTableWriter(table_file, "PORT1", table_slots);
+	testOk1(writer->publish(0, entry("int", ValueTableInt32, 7, 0.0, "")));
+	testOk1(writer->publish(2, entry("double", ValueTableFloat64, 0, 2.5, "")));
+	std::string long_text(500, 'y');
+	testOk1(writer->publish(3, entry("text", ValueTableString, 0, 0.0, long_text)));
+	testOk1(!writer->publish(table_slots, entry("beyond", ValueTableInt32, 1, 0.0, "")) && writer->dropped() == 1 && writer->updates() == 3);
+
+	lvDCOMValueTableReader reader(table_file);
+	ValueTableEntry e;
+	testOk(reader.size() == 4 && reader.port() == "PORT1", "%d slots in use by port \"%s\"", static_cast<int>(reader.size()), reader.port().c_str());
+	testOk1(reader.read(0, e) && e.name == "int" && e.type == ValueTableInt32 && e.ival == 7 && e.stamp.secPastEpoch == 1007 && e.stamp.nsec == 500);
+	testOk1(!reader.read(1, e));
+	testOk1(reader.read("double", e) && e.type == ValueTableFloat64 && e.dval == 2.5);
+	testOk1(reader.read("text", e) && (e.flags & ValueTableTruncated) != 0 && e.length == long_text.size() && e.sval == long_text.substr(0, e.sval.size()));
+	testOk1(!reader.read("beyond", e) && !reader.read(table_slots, e));
+
+	testDiag("a change to a slot");
+	writer->publish(0, entry("int", ValueTableInt32, 8, 0.0, ""));
+	testOk1(reader.read("int", e) && e.ival == 8 && e.updates == 2);
+	std::vector<ValueTableEntry> entries;
+	reader.readAll(entries);
+	testOk(entries.size() == 3, "readAll found %d entries", static_cast<int>(entries.size()));
+
+	testDiag("a new writer re-initialises the file");
+	delete writer;
+	writer = new lvDCOMValueTableWriter(table_file, "PORT2", table_slots);
+	writer->publish(1, entry("other", ValueTableUInt32Digital, 3, 0.0, ""));
+	testOk1(reader.port() == "PORT2" && reader.remaps() == 1);
+	testOk1(!reader.read("int", e) && !reader.read(0, e));
+	testOk1(reader.read("other", e) && e.type == ValueTableUInt32Digital && e.ival == 3);
+
+	testDiag("slots copied while they change");
+	SlotChanger changer;
+	changer.writer = writer;
+	changer.stop = false;
+	changer.writes = 0;
+	epicsThreadCreate("lvDCOMValueTableTest", epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackMedium), changeTask, &changer);
+	int torn = 0, reads = 0, missing = 0;
+	char buffer[32];
+	epicsTime start = epicsTime::getCurrent();
+	for(; epicsTime::getCurrent() - start < 0.5; ++reads)
+	{
+		if (!reader.read(0, e))
+		{
+			++missing;  // until the first write
+			continue;
+		}
+		sprintf(buffer, "%d", e.ival);
+		if ( e.ival != static_cast<epicsInt32>(e.dval) || e.sval != buffer ||
+		     e.stamp.secPastEpoch != static_cast<epicsUInt32>(1000 + e.ival) )
+		{
+			++torn;
+		}
+	}
+	changer.stop = true;
+	changer.done.wait();
+	testOk(torn == 0, "%d of %d reads during %d writes saw a torn slot", torn, reads - missing, changer.writes);
+	testOk1(reader.read(0, e) && e.ival == changer.writes - 1);
+	testDiag("%lu seqlock retries", reader.retries());
+
+	delete writer;
+
+	testDiag("a file that is not a value table");
+	FILE* f = fopen(text_file, "wb");
+	if (f != NULL)
+	{
+		fprintf(f, "not a value table\n");
+		fclose(f);
+	}
+	try
+	{
+		lvDCOMValueTableReader bad(text_file);
+		testFail("reader of a text file");
+	}
+	catch(const std::exception& ex)
+	{
+		testPass("reader of a text file throws");
+		testDiag("%s", ex.what());
+	}
+
+	remove(text_file);
+	remove(table_file);
+	return testDone();
+}
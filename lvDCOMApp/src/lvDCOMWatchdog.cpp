@@ -0,0 +1,228 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMWatchdog.cpp Implementation of #lvDCOMWatchdog class.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#include <stdio.h>
+
+#include <windows.h>
+#include <objbase.h>
+
+#include <atlbase.h>
+#include <atlconv.h>
+
+#include <string>
+#include <map>
+#include <iostream>
+
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsGuard.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <errlog.h>
+
+#include "lvDCOMWatchdog.h"
+
+/// how often (seconds) the watchdog thread checks for overrunning calls
+static const double WATCHDOG_INTERVAL = 0.1;
+
+lvDCOMWatchdog::lvDCOMWatchdog(const std::string& name) : m_name(name), m_next_id(0), m_overruns(0), m_calls_made(0), m_max_overrun(0.0),
+    m_thread_started(false), m_stopping(false)
+{
+}
+
+lvDCOMWatchdog::~lvDCOMWatchdog()
+{
+	bool started;
+	{
+		epicsGuard<epicsMutex> _lock(m_lock);
+		m_stopping = true;
+		started = m_thread_started;
+	}
+	if (started)
+	{
+		m_wake.signal();
+		m_exited.wait();
+	}
+}
+
+/// register a call about to be made on the current thread, returns an id to pass to finish(). A \a timeout of 0.0 or 
+/// less means no deadline, so there is nothing to watch
+int lvDCOMWatchdog::start(const std::string& what, double timeout)
+{
+	if (timeout <= 0.0)
+	{
+		return -1;
+	}
+	PendingCall pc;
+	pc.thread_id = GetCurrentThreadId();
+	pc.deadline = epicsTime::getCurrent() + timeout;
+	pc.what = what;
+	pc.cancelled = false;
+	epicsGuard<epicsMutex> _lock(m_lock);
+	int id = ++m_next_id;
+	++m_calls_made;
+	if (!m_thread_started && !m_stopping)
+	{
+		std::string thread_name = "lvDCOMWatchdog" + m_name;
+		if (epicsThreadCreate(thread_name.c_str(),
+			epicsThreadPriorityHigh,
+			epicsThreadGetStackSize(epicsThreadStackSmall),
+			(EPICSTHREADFUNC)watchdogTaskC, this) == 0)
+		{
+			// the call is still tracked, and we try again next time
+			errlogSevPrintf(errlogMajor, "lvDCOMWatchdog: epicsThreadCreate failure for \"%s\"\n", thread_name.c_str());
+		}
+		else
+		{
+			m_thread_started = true;
+		}
+	}
+	bool was_idle = m_calls.empty();
+	m_calls[id] = pc;
+	if (was_idle)
+	{
+		m_wake.signal();
+	}
+	return id;
+}
+
+/// returns true if the call overran and we tried to cancel it
+bool lvDCOMWatchdog::finish(int id)
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	std::map<int,PendingCall>::iterator it = m_calls.find(id);
+	if (it == m_calls.end())
+	{
+		return false;
+	}
+	bool cancelled = it->second.cancelled;
+	if (cancelled)
+	{
+		double overrun = epicsTime::getCurrent() - it->second.deadline;
+		if (overrun > m_max_overrun)
+		{
+			m_max_overrun = overrun;
+		}
+	}
+	m_calls.erase(it);
+	return cancelled;
+}
+
+void lvDCOMWatchdog::watchdogTaskC(void* arg)
+{
+	lvDCOMWatchdog* watchdog = static_cast<lvDCOMWatchdog*>(arg);
+	watchdog->watchdogTask();
+}
+
+void lvDCOMWatchdog::watchdogTask()
+{
+	while(true)
+	{
+		bool idle;
+		{
+			epicsGuard<epicsMutex> _lock(m_lock);
+			if (m_stopping)
+			{
+				break;
+			}
+			idle = m_calls.empty();
+		}
+		if (idle)
+		{
+			m_wake.wait();
+		}
+		else
+		{
+			checkCalls();
+			m_wake.wait(WATCHDOG_INTERVAL);
+		}
+	}
+	m_exited.signal();  // we may be destroyed as soon as we do this
+}
+
+unsigned long lvDCOMWatchdog::overruns() const
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	return m_overruns;
+}
+
+void lvDCOMWatchdog::checkCalls()
+{
+	epicsTime now = epicsTime::getCurrent();
+	epicsGuard<epicsMutex> _lock(m_lock);
+	for(std::map<int,PendingCall>::iterator it = m_calls.begin(); it != m_calls.end(); ++it)
+	{
+		PendingCall& pc = it->second;
+		if (pc.cancelled || now < pc.deadline)
+		{
+			continue;
+		}
+		pc.cancelled = true;
+		++m_overruns;
+		// the cancel is asynchronous, the blocked thread will see RPC_E_CALL_CANCELED returned from its call
+		HRESULT hr = CoCancelCall(pc.thread_id, 0);
+		errlogSevPrintf(errlogMinor, "lvDCOMWatchdog: %s: \"%s\" exceeded its deadline, cancel %s (0x%x)\n", m_name.c_str(), pc.what.c_str(),
+			(SUCCEEDED(hr) ? "requested" : "failed - call abandoned"), hr);
+	}
+}
+
+void lvDCOMWatchdog::report(FILE* fp, int details)
+{
+	epicsGuard<epicsMutex> _lock(m_lock);
+	fprintf(fp, "DCOM calls with deadline: %lu overrun: %lu (largest overrun %.3f s)\n", m_calls_made, m_overruns, m_max_overrun);
+	if (details > 0)
+	{
+		epicsTime now = epicsTime::getCurrent();
+		for(std::map<int,PendingCall>::const_iterator it = m_calls.begin(); it != m_calls.end(); ++it)
+		{
+			fprintf(fp, "DCOM call in progress: \"%s\" deadline in %.3f s%s\n", it->second.what.c_str(), it->second.deadline - now,
+				(it->second.cancelled ? " (cancelled)" : ""));
+		}
+	}
+}
+
+DCOMCallDeadline::DCOMCallDeadline(lvDCOMWatchdog& watchdog, const char* op, BSTR vi_name, BSTR control_name, double timeout) : m_watchdog(watchdog), m_id(-1), m_expired(false), m_cancel_enabled(false)
+{
+	if (timeout <= 0.0)
+	{
+		return;
+	}
+	// enable/disable are reference counted on a per thread basis, so nesting is allowed
+	m_cancel_enabled = SUCCEEDED(CoEnableCallCancellation(NULL));
+	std::string what(op);
+	if (control_name != NULL)
+	{
+		what += " \"" + std::string(CW2CT(control_name)) + "\"";
+	}
+	if (vi_name != NULL)
+	{
+		what += " on \"" + std::string(CW2CT(vi_name)) + "\"";
+	}
+	m_id = m_watchdog.start(what, timeout);
+}
+
+bool DCOMCallDeadline::finish()
+{
+	if (m_id != -1)
+	{
+		m_expired = m_watchdog.finish(m_id);
+		m_id = -1;
+	}
+	return m_expired;
+}
+
+DCOMCallDeadline::~DCOMCallDeadline()
+{
+	finish();
+	if (m_cancel_enabled)
+	{
+		CoDisableCallCancellation(NULL);
+	}
+}
@@ -0,0 +1,81 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file lvDCOMWatchdog.h header for #lvDCOMWatchdog class.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+
+#ifndef LV_DCOM_WATCHDOG_H
+#define LV_DCOM_WATCHDOG_H
+
+#include <stdio.h>
+
+#include <windows.h>
+
+#include <string>
+#include <map>
+
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsTime.h>
+
+/// Watches DCOM calls in progress and cancels (via CoCancelCall()) any that overrun their deadline.
+/// A call is registered with start() on the thread that is about to make it, and must be removed with finish()
+/// on the same thread when it returns. The calling thread must have enabled call cancellation (see #DCOMCallDeadline)
+/// The watchdog thread is only started by the first call with a deadline, and sleeps while no calls are in progress
+class lvDCOMWatchdog
+{
+public:
+	explicit lvDCOMWatchdog(const std::string& name);
+	~lvDCOMWatchdog();
+	int start(const std::string& what, double timeout);
+	bool finish(int id);
+	void report(FILE* fp, int details);
+	unsigned long overruns() const;
+
+private:
+	struct PendingCall
+	{
+		DWORD thread_id;      ///< windows thread id of caller, needed by CoCancelCall()
+		epicsTime deadline;
+		std::string what;     ///< description of call for diagnostics
+		bool cancelled;       ///< we have tried to cancel this call
+	};
+	std::string m_name;
+	std::map<int,PendingCall> m_calls;
+	mutable epicsMutex m_lock;
+	int m_next_id;
+	unsigned long m_overruns; ///< number of calls we have cancelled
+	unsigned long m_calls_made;  ///< number of calls with a deadline that we have watched
+	double m_max_overrun; ///< largest time (s) past a deadline that a call has been seen to be still running
+	bool m_thread_started; ///< watchdog thread has been started
+	bool m_stopping;      ///< asks the watchdog thread to exit
+	epicsEvent m_wake;    ///< wakes the watchdog thread when a call is started or we are stopping
+	epicsEvent m_exited;  ///< signalled by the watchdog thread as it exits
+
+	static void watchdogTaskC(void* arg);
+	void watchdogTask();
+	void checkCalls();
+};
+
+/// RAII helper to place a deadline on a single DCOM call made from the current thread. A \a timeout of 0.0 or less means no deadline.
+class DCOMCallDeadline
+{
+public:
+	DCOMCallDeadline(lvDCOMWatchdog& watchdog, const char* op, BSTR vi_name, BSTR control_name, double timeout);
+	~DCOMCallDeadline();
+	/// did the watchdog cancel our call
+	bool expired() const { return m_expired; }
+	/// check whether the call was cancelled, need to call this before the object goes out of scope
+	bool finish();
+private:
+	lvDCOMWatchdog& m_watchdog;
+	int m_id;
+	bool m_expired;
+	bool m_cancel_enabled;
+};
+
+#endif /* LV_DCOM_WATCHDOG_H */
@@ -0,0 +1,144 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file variantConvertTest.cpp Compare convertVariant() (variant_convert.h) with VariantChangeType() for results and speed.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+///
+/// Each scalar VARIANT type convertVariant() handles itself is converted to int and double both ways, and the
+/// results must agree apart from VT_BOOL true, which convertVariant() makes 1 rather than -1. Then the same
+/// values are converted repeatedly each way and the time per conversion is printed, so the speed up can be checked
+/// on the machine the IOC runs on (it is not a test result, as it depends on the machine). Only built on Windows,
+/// as it needs OLE Automation.
+
+#include <windows.h>
+#include <atlbase.h>
+#include <atlconv.h>
+
+#include <string>
+#include <vector>
+
+#include <epicsTime.h>
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "variant_convert.h"
+
+/// one VARIANT of each type convertVariant() handles directly, including values that overflow an int
+static std::vector<CComVariant> testValues()
+{
+	std::vector<CComVariant> values;
+	values.push_back(CComVariant(true));
+	values.push_back(CComVariant(false));
+	values.push_back(CComVariant(static_cast<char>(-5)));
+	values.push_back(CComVariant(static_cast<short>(-300)));
+	values.push_back(CComVariant(static_cast<long>(123456), VT_I4));
+	values.push_back(CComVariant(static_cast<int>(-42), VT_INT));
+	values.push_back(CComVariant(static_cast<LONGLONG>(-5000000000LL)));
+	values.push_back(CComVariant(static_cast<LONGLONG>(77)));
+	values.push_back(CComVariant(static_cast<BYTE>(200)));
+	values.push_back(CComVariant(static_cast<unsigned short>(60000)));
+	values.push_back(CComVariant(static_cast<unsigned long>(3000000000UL), VT_UI4));
+	values.push_back(CComVariant(static_cast<unsigned int>(17), VT_UINT));
+	values.push_back(CComVariant(static_cast<ULONGLONG>(12345678901ULL)));
+	values.push_back(CComVariant(-1.25f));
+	values.push_back(CComVariant(2.5));
+	values.push_back(CComVariant(3.5));
+	values.push_back(CComVariant(-2.5));
+	values.push_back(CComVariant(1.0e20));
+	return values;
+}
+
+/// convert \a v to \a value with VariantChangeType(), as convertVariant() did for every type before
+template <typename T>
+static bool changeType(const VARIANT& v, T& value)
+{
+	CComVariant vtmp;
+	if ( vtmp.ChangeType(CVarTypeInfo<T>::VT, &v) != S_OK )
+	{
+		return false;
+	}
+	value = vtmp.*(CVarTypeInfo<T>::pmField);
+	return true;
+}
+
+/// number of \a values that convertVariant() and changeType() disagree on when converting to \a T
+template <typename T>
+static int compareResults(const std::vector<CComVariant>& values)
+{
+	int mismatches = 0;
+	for(size_t i = 0; i < values.size(); ++i)
+	{
+		T a = 0, b = 0;
+		bool ok_a = convertVariant(values[i], a);
+		bool ok_b = changeType(values[i], b);
+		if (V_VT(&values[i]) == VT_BOOL && V_BOOL(&values[i]) != VARIANT_FALSE)
+		{
+			b = 1;  // the one intended difference
+		}
+		if (ok_a != ok_b || (ok_a && a != b))
+		{
+			testDiag("VARTYPE %d value %d: convertVariant %s %g, VariantChangeType %s %g", static_cast<int>(V_VT(&values[i])),
+			    static_cast<int>(i), (ok_a ? "ok" : "failed"), static_cast<double>(a), (ok_b ? "ok" : "failed"), static_cast<double>(b));
+			++mismatches;
+		}
+	}
+	return mismatches;
+}
+
+/// time \a repeat passes over \a values converting each to \a T with convertVariant() and with changeType(),
+/// and print nanoseconds per conversion
+template <typename T>
+static void timeConversions(const std::vector<CComVariant>& values, int repeat, const char* type_name)
+{
+	double sum = 0.0;
+	epicsTime start = epicsTime::getCurrent();
+	for(int r = 0; r < repeat; ++r)
+	{
+		for(size_t i = 0; i < values.size(); ++i)
+		{
+			T value = 0;
+			if (convertVariant(values[i], value))
+			{
+				sum += value;
+			}
+		}
+	}
+	double direct = epicsTime::getCurrent() - start;
+	start = epicsTime::getCurrent();
+	for(int r = 0; r < repeat; ++r)
+	{
+		for(size_t i = 0; i < values.size(); ++i)
+		{
+			T value = 0;
+			if (changeType(values[i], value))
+			{
+				sum += value;
+			}
+		}
+	}
+	double change_type = epicsTime::getCurrent() - start;
+	double n = static_cast<double>(repeat) * static_cast<double>(values.size());
+	testDiag("to %s: convertVariant %.1f ns, VariantChangeType %.1f ns per conversion, %.1f times as fast (checksum %g)", type_name,
+	    1.0e9 * direct / n, 1.0e9 * change_type / n, (direct > 0.0 ? change_type / direct : 0.0), sum);
+}
+
+MAIN(variantConvertTest)
+{
+	testPlan(2);
+	std::vector<CComVariant> values = testValues();
+	int mismatches = compareResults<int>(values);
+	testOk(mismatches == 0, "to int: %d results differ from VariantChangeType", mismatches);
+	mismatches = compareResults<double>(values);
+	testOk(mismatches == 0, "to double: %d results differ from VariantChangeType", mismatches);
+
+	testDiag("time per conversion, averaged over the values above");
+	const int repeat = 200000;
+	timeConversions<int>(values, repeat, "int");
+	timeConversions<double>(values, repeat, "double");
+
+	return testDone();
+}
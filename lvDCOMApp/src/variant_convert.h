@@ -0,0 +1,209 @@
+/*************************************************************************\
+* Copyright (c) 2013 Science and Technology Facilities Council (STFC), GB.
+* All rights reverved.
+* This file is distributed subject to a Software License Agreement found
+* in the file LICENSE.txt that is included with this distribution.
+\*************************************************************************/
+
+/// @file variant_convert.h Conversion of scalar VARIANT values to asyn parameter types.
+/// @author Freddie Akeroyd, STFC ISIS Facility, GB
+///
+/// The common numeric VARIANT types are converted directly via a single switch on the VARTYPE, with
+/// per destination type rules selected at compile time by #VariantTarget. Only types we do not
+/// handle here (currency, dates, decimals, strings etc.) go through VariantChangeType(), which
+/// is locale aware and may allocate. Conversion rules differ from VariantChangeType() only in
+/// that VT_BOOL true converts to 1 rather than -1. variantConvertTest checks this and times the two.
+///
+/// Rules for converting to an int (asyn Int32):
+///  - any integer source outside the range of a 32 bit signed int (e.g. a VT_UI4 above 2147483647) is an overflow error
+///  - floating point sources are rounded to nearest (ties to even, as VariantChangeType()) and range checked, NaN is an error
+///
+/// Rules for converting to a double (asyn Float64):
+///  - all integer and floating point sources are converted exactly (VT_I8/VT_UI8 may lose precision above 2^53)
+
+#ifndef VARIANT_CONVERT_H
+#define VARIANT_CONVERT_H
+
+#include <limits.h>
+#include <math.h>
+#include <float.h>
+
+/// what lvDCOM parameter type is most appropriate for a given VARTYPE
+enum VariantKind
+{
+	VariantKindUnknown = 0,  ///< not handled directly, but may be convertible via VariantChangeType()
+	VariantKindBoolean = 1,
+	VariantKindInt32 = 2,
+	VariantKindFloat64 = 3,
+	VariantKindString = 4
+};
+
+/// classify a scalar VARTYPE, used both to choose a parameter type for a control and for conversion dispatch
+inline VariantKind variantKind(VARTYPE vt)
+{
+	switch(vt)
+	{
+		case VT_BOOL:
+			return VariantKindBoolean;
+
+		case VT_BSTR:
+			return VariantKindString;
+
+		case VT_I1:
+		case VT_I2:
+		case VT_I4:
+		case VT_INT:
+		case VT_UI1:
+		case VT_UI2:
+		case VT_UI4:
+		case VT_UINT:
+			return VariantKindInt32;
+
+		case VT_I8:
+		case VT_UI8:
+		case VT_R4:
+		case VT_R8:
+			return VariantKindFloat64;
+
+		default:
+			return VariantKindUnknown;
+	}
+}
+
+/// round half to even, as used by VariantChangeType() for floating point to integer conversion
+inline double variantRound(double d)
+{
+	double r = floor(d + 0.5);
+	if ( (r - d) == 0.5 && fmod(r, 2.0) != 0.0 )
+	{
+		r -= 1.0;
+	}
+	return r;
+}
+
+/// conversion rules for each destination type, specialised below for the types we support
+template <typename T>
+struct VariantTarget;
+
+template <>
+struct VariantTarget<int>
+{
+	static bool fromInteger(LONGLONG i, int& value)
+	{
+		if (i < INT_MIN || i > INT_MAX)
+		{
+			return false;
+		}
+		value = static_cast<int>(i);
+		return true;
+	}
+	static bool fromUnsigned(ULONGLONG u, int& value)
+	{
+		if (u > static_cast<ULONGLONG>(INT_MAX))
+		{
+			return false;
+		}
+		value = static_cast<int>(u);
+		return true;
+	}
+	static bool fromReal(double d, int& value)
+	{
+		if (d != d) // NaN
+		{
+			return false;
+		}
+		double r = variantRound(d);
+		if (r < static_cast<double>(INT_MIN) || r > static_cast<double>(INT_MAX))
+		{
+			return false;
+		}
+		value = static_cast<int>(r);
+		return true;
+	}
+};
+
+template <>
+struct VariantTarget<double>
+{
+	static bool fromInteger(LONGLONG i, double& value)
+	{
+		value = static_cast<double>(i);
+		return true;
+	}
+	static bool fromUnsigned(ULONGLONG u, double& value)
+	{
+		value = static_cast<double>(u);
+		return true;
+	}
+	static bool fromReal(double d, double& value)
+	{
+		value = d;
+		return true;
+	}
+};
+
+/// convert a scalar VARIANT to \a value, returns false if the conversion is not possible (type mismatch or overflow).
+/// \a v must not be VT_BYREF
+template <typename T>
+inline bool convertVariant(const VARIANT& v, T& value)
+{
+	switch(V_VT(&v))
+	{
+		case VT_BOOL:
+			return VariantTarget<T>::fromInteger( (V_BOOL(&v) != VARIANT_FALSE ? 1 : 0), value );
+		case VT_I1:
+			return VariantTarget<T>::fromInteger(V_I1(&v), value);
+		case VT_I2:
+			return VariantTarget<T>::fromInteger(V_I2(&v), value);
+		case VT_I4:
+			return VariantTarget<T>::fromInteger(V_I4(&v), value);
+		case VT_INT:
+			return VariantTarget<T>::fromInteger(V_INT(&v), value);
+		case VT_I8:
+			return VariantTarget<T>::fromInteger(V_I8(&v), value);
+		case VT_UI1:
+			return VariantTarget<T>::fromUnsigned(V_UI1(&v), value);
+		case VT_UI2:
+			return VariantTarget<T>::fromUnsigned(V_UI2(&v), value);
+		case VT_UI4:
+			return VariantTarget<T>::fromUnsigned(V_UI4(&v), value);
+		case VT_UINT:
+			return VariantTarget<T>::fromUnsigned(V_UINT(&v), value);
+		case VT_UI8:
+			return VariantTarget<T>::fromUnsigned(V_UI8(&v), value);
+		case VT_R4:
+			return VariantTarget<T>::fromReal(V_R4(&v), value);
+		case VT_R8:
+			return VariantTarget<T>::fromReal(V_R8(&v), value);
+		default:
+			break;
+	}
+	// exotic type, let OLE Automation coerce it
+	CComVariant vtmp;
+	if ( vtmp.ChangeType(CVarTypeInfo<T>::VT, &v) != S_OK )
+	{
+		return false;
+	}
+	value = vtmp.*(CVarTypeInfo<T>::pmField);
+	return true;
+}
+
+/// convert a scalar VARIANT to a string, only non BSTR sources go through VariantChangeType()
+template <>
+inline bool convertVariant(const VARIANT& v, std::string& value)
+{
+	if (V_VT(&v) == VT_BSTR)
+	{
+		value = (V_BSTR(&v) != NULL ? static_cast<const char*>(CW2CT(V_BSTR(&v))) : "");
+		return true;
+	}
+	CComVariant vtmp;
+	if ( vtmp.ChangeType(VT_BSTR, &v) != S_OK )
+	{
+		return false;
+	}
+	value = CW2CT(vtmp.bstrVal);
+	return true;
+}
+
+#endif /* VARIANT_CONVERT_H */
@@ -27,6 +27,8 @@
 #include <sstream>
 
 #include "variant_utils.h"
+#include "variant_convert.h"
+#include "lvDCOMCapture.h"
 
 
 std::string COMexception::com_message(const std::string& message, HRESULT hr)
@@ -246,3 +248,248 @@ int makeVariantFromArray(VARIANT* v, const char* the_array, int n)
 
 template int makeVariantFromArray(VARIANT* v, const std::vector<float>& the_array);
 
+template <typename T>
+static void captureElements(const T* data, size_t n, std::vector<epicsInt32>& values)
+{
+	values.resize(n);
+	for(size_t i = 0; i < n; ++i)
+	{
+		values[i] = static_cast<epicsInt32>(data[i]);
+	}
+}
+
+template <typename T>
+static void captureElements(const T* data, size_t n, std::vector<epicsFloat64>& values)
+{
+	values.assign(data, data + n);
+}
+
+static void captureArray(SAFEARRAY* psa, CaptureValue& value)
+{
+	VARTYPE vt = VT_EMPTY;
+	void* data = NULL;
+	int ndims = SafeArrayGetDim(psa);
+	size_t n = 1;
+	if ( ndims <= 0 || FAILED(SafeArrayGetVartype(psa, &vt)) )
+	{
+		return;
+	}
+	// SAFEARRAY dimension 1 varies fastest, the capture file lists the slowest first as C does
+	value.dims.resize(ndims);
+	for(int i = 0; i < ndims; ++i)
+	{
+		long lbound = 0, ubound = -1;
+		SafeArrayGetLBound(psa, ndims - i, &lbound);
+		SafeArrayGetUBound(psa, ndims - i, &ubound);
+		value.dims[i] = static_cast<epicsUInt32>(ubound - lbound + 1);
+		n *= value.dims[i];
+	}
+	if ( FAILED(SafeArrayAccessData(psa, &data)) || data == NULL )
+	{
+		value.dims.clear();
+		return;
+	}
+	switch(vt)
+	{
+		case VT_R8:
+			value.kind = CaptureValue::Float64Array;
+			captureElements(static_cast<const double*>(data), n, value.farray);
+			break;
+		case VT_R4:
+			value.kind = CaptureValue::Float64Array;
+			captureElements(static_cast<const float*>(data), n, value.farray);
+			break;
+		case VT_I4:
+		case VT_INT:
+			value.kind = CaptureValue::Int32Array;
+			captureElements(static_cast<const long*>(data), n, value.iarray);
+			break;
+		case VT_I2:
+			value.kind = CaptureValue::Int32Array;
+			captureElements(static_cast<const short*>(data), n, value.iarray);
+			break;
+		case VT_BOOL:
+			value.kind = CaptureValue::BooleanArray;
+			captureElements(static_cast<const short*>(data), n, value.iarray);
+			break;
+		case VT_UI2:
+			value.kind = CaptureValue::Int32Array;
+			captureElements(static_cast<const unsigned short*>(data), n, value.iarray);
+			break;
+		case VT_I1:
+			value.kind = CaptureValue::Int32Array;
+			captureElements(static_cast<const signed char*>(data), n, value.iarray);
+			break;
+		case VT_UI1:
+			value.kind = CaptureValue::Int32Array;
+			captureElements(static_cast<const unsigned char*>(data), n, value.iarray);
+			break;
+		case VT_BSTR:
+			value.kind = CaptureValue::Array;
+			value.elements.resize(n);
+			for(size_t i = 0; i < n; ++i)
+			{
+				CComVariant v(static_cast<const BSTR*>(data)[i]);
+				variantToCapture(v, value.elements[i]);
+			}
+			break;
+		case VT_VARIANT:
+			value.kind = CaptureValue::Array;
+			value.elements.resize(n);
+			for(size_t i = 0; i < n; ++i)
+			{
+				variantToCapture(static_cast<const VARIANT*>(data)[i], value.elements[i]);
+			}
+			break;
+		default:
+			value.dims.clear();
+			break;
+	}
+	SafeArrayUnaccessData(psa);
+}
+
+/// Copy \a v into the portable form used by capture files, a type we cannot represent becomes CaptureValue::Empty
+void variantToCapture(const VARIANT& v, CaptureValue& value)
+{
+	value = CaptureValue();
+	if (V_VT(&v) & VT_BYREF)
+	{
+		CComVariant vtmp;
+		if ( SUCCEEDED(VariantCopyInd(&vtmp, &v)) )
+		{
+			variantToCapture(vtmp, value);
+		}
+		return;
+	}
+	if (V_VT(&v) & VT_ARRAY)
+	{
+		if (V_ARRAY(&v) != NULL)
+		{
+			captureArray(V_ARRAY(&v), value);
+		}
+		return;
+	}
+	int i = 0;
+	double d = 0.0;
+	switch(variantKind(V_VT(&v)))
+	{
+		case VariantKindBoolean:
+			value.kind = CaptureValue::Boolean;
+			convertVariant(v, i);
+			value.ival = i;
+			break;
+		case VariantKindInt32:
+			if ( convertVariant(v, i) )  // a large VT_UI4 does not fit
+			{
+				value.kind = CaptureValue::Int32;
+				value.ival = i;
+			}
+			else if ( convertVariant(v, d) )
+			{
+				value.kind = CaptureValue::Float64;
+				value.dval = d;
+			}
+			break;
+		case VariantKindString:
+			value.kind = CaptureValue::String;
+			value.sval = (V_BSTR(&v) != NULL ? static_cast<const char*>(CW2A(V_BSTR(&v), CP_UTF8)) : "");
+			break;
+		default:
+			if ( V_VT(&v) != VT_EMPTY && convertVariant(v, d) )
+			{
+				value.kind = CaptureValue::Float64;
+				value.dval = d;
+			}
+			break;
+	}
+}
+
+/// The reverse of variantToCapture(), set \a v (which must be empty or cleared) from \a value as LabVIEW would have given it
+void captureToVariant(const CaptureValue& value, VARIANT& v)
+{
+	VariantInit(&v);
+	VARTYPE vt = VT_EMPTY;
+	switch(value.kind)
+	{
+		case CaptureValue::Boolean:
+			V_VT(&v) = VT_BOOL;
+			V_BOOL(&v) = (value.ival != 0 ? VARIANT_TRUE : VARIANT_FALSE);
+			return;
+		case CaptureValue::Int32:
+			V_VT(&v) = VT_I4;
+			V_I4(&v) = value.ival;
+			return;
+		case CaptureValue::Float64:
+			V_VT(&v) = VT_R8;
+			V_R8(&v) = value.dval;
+			return;
+		case CaptureValue::String:
+			V_VT(&v) = VT_BSTR;
+			V_BSTR(&v) = SysAllocString(CA2W(value.sval.c_str(), CP_UTF8));
+			return;
+		case CaptureValue::Int32Array:
+			vt = VT_I4;
+			break;
+		case CaptureValue::BooleanArray:
+			vt = VT_BOOL;
+			break;
+		case CaptureValue::Float64Array:
+			vt = VT_R8;
+			break;
+		case CaptureValue::Array:
+			vt = VT_VARIANT;
+			break;
+		default:
+			return;
+	}
+	// dims are slowest varying first, SAFEARRAY dimension 1 varies fastest
+	size_t ndims = (value.dims.size() > 0 ? value.dims.size() : 1);
+	std::vector<SAFEARRAYBOUND> sab(ndims);
+	size_t n = 1;
+	for(size_t i = 0; i < ndims; ++i)
+	{
+		sab[i].lLbound = 0;
+		sab[i].cElements = (value.dims.size() > 0 ? value.dims[ndims - i - 1] : 0);
+		n *= sab[i].cElements;
+	}
+	SAFEARRAY* psa = SafeArrayCreate(vt, static_cast<UINT>(ndims), &(sab[0]));
+	void* data = NULL;
+	if ( psa == NULL || FAILED(SafeArrayAccessData(psa, &data)) )
+	{
+		if (psa != NULL)
+		{
+			SafeArrayDestroy(psa);
+		}
+		throw std::runtime_error("captureToVariant: cannot create SAFEARRAY");
+	}
+	switch(value.kind)
+	{
+		case CaptureValue::Int32Array:
+			for(size_t i = 0; i < n && i < value.iarray.size(); ++i)
+			{
+				static_cast<long*>(data)[i] = value.iarray[i];
+			}
+			break;
+		case CaptureValue::BooleanArray:
+			for(size_t i = 0; i < n && i < value.iarray.size(); ++i)
+			{
+				static_cast<VARIANT_BOOL*>(data)[i] = (value.iarray[i] != 0 ? VARIANT_TRUE : VARIANT_FALSE);
+			}
+			break;
+		case CaptureValue::Float64Array:
+			if (value.farray.size() > 0)
+			{
+				memcpy(data, &(value.farray[0]), (n < value.farray.size() ? n : value.farray.size()) * sizeof(double));
+			}
+			break;
+		default:
+			for(size_t i = 0; i < n && i < value.elements.size(); ++i)
+			{
+				captureToVariant(value.elements[i], static_cast<VARIANT*>(data)[i]);
+			}
+			break;
+	}
+	SafeArrayUnaccessData(psa);
+	V_VT(&v) = VT_ARRAY | vt;
+	V_ARRAY(&v) = psa;
+}
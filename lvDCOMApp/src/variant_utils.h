@@ -11,17 +11,35 @@
 #ifndef VARIANT_UTILS_H
 #define VARIANT_UTILS_H
 
+struct CaptureValue;
+
 /// create an C++ exception from a COM HRESULT.
 class COMexception : public std::runtime_error
 {
 public:
-	explicit COMexception(const std::string& what_arg) : std::runtime_error(what_arg) { }
-	explicit COMexception(const std::string& message, HRESULT hr) : std::runtime_error(com_message(message, hr)) { }
+	explicit COMexception(const std::string& what_arg) : std::runtime_error(what_arg), m_hr(E_FAIL) { }
+	explicit COMexception(const std::string& message, HRESULT hr) : std::runtime_error(com_message(message, hr)), m_hr(hr) { }
+	HRESULT hresult() const { return m_hr; }
 private:
+	HRESULT m_hr;  ///< E_FAIL if not created from a COM error
 	static std::string com_message(const std::string& message, HRESULT hr);
 };
 
-/// An STL exception describing a Win32 Structured Exception. 
+/// A DCOM call did not complete before its deadline and was cancelled by the #lvDCOMWatchdog
+class COMTimeoutException : public COMexception
+{
+public:
+	explicit COMTimeoutException(const std::string& what_arg) : COMexception(what_arg) { }
+};
+
+/// LabVIEW, or the VI being accessed, is known to be unavailable so the request was not attempted
+class COMDisconnectedException : public COMexception
+{
+public:
+	explicit COMDisconnectedException(const std::string& what_arg) : COMexception(what_arg) { }
+};
+
+/// An STL exception describing a Win32 Structured Exception.
 /// Code needs to be compiled with /EHa if you wish to use this via _set_se_translator().
 /// Note that _set_se_translator() needs to be called on a per thread basis
 class Win32StructuredException : public std::runtime_error
@@ -43,6 +61,9 @@ int accessArrayVariant(VARIANT* v, BSTR** values);
 
 int unaccessArrayVariant(VARIANT* v);
 
+void variantToCapture(const VARIANT& v, CaptureValue& value);
+void captureToVariant(const CaptureValue& value, VARIANT& v);
+
 int arrayVariantLength(VARIANT* v);
 int arrayVariantDimensions(VARIANT* v, int dims_array[], int& ndims);
 